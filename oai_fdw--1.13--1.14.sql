@@ -58,3 +58,608 @@ RETURNS text AS 'MODULE_PATHNAME', 'oai_fdw_version'
 LANGUAGE C VOLATILE STRICT;
   
 COMMENT ON FUNCTION oai_fdw_version() IS 'Shows current version of oai_fdw and its major libraries';
+
+/* on-disk response cache */
+CREATE FUNCTION oai_fdw_clear_cache(server text DEFAULT NULL)
+RETURNS bigint AS 'MODULE_PATHNAME', 'oai_fdw_clear_cache'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION oai_fdw_clear_cache(text) IS 'Removes cached OAI responses of a given FOREIGN SERVER, or of all servers if NULL';
+
+REVOKE EXECUTE ON FUNCTION oai_fdw_clear_cache(text) FROM PUBLIC;
+
+/* checkpoints of scans with resume_from_checkpoint */
+CREATE FUNCTION oai_fdw_clear_checkpoints(foreign_table regclass DEFAULT NULL)
+RETURNS bigint AS 'MODULE_PATHNAME', 'oai_fdw_clear_checkpoints'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION oai_fdw_clear_checkpoints(regclass) IS 'Removes the checkpoints of failed scans of a given FOREIGN TABLE, or of all foreign tables if NULL';
+
+REVOKE EXECUTE ON FUNCTION oai_fdw_clear_checkpoints(regclass) FROM PUBLIC;
+
+/* incremental harvests with OAI_Sync */
+CREATE TABLE oai_fdw_sync_state (
+  target_table regclass PRIMARY KEY,
+  foreign_table regclass NOT NULL,
+  response_date timestamptz,
+  last_datestamp timestamptz,
+  last_sync timestamptz,
+  records bigint
+);
+
+SELECT pg_catalog.pg_extension_config_dump('oai_fdw_sync_state', '');
+
+COMMENT ON TABLE oai_fdw_sync_state IS 'High-watermarks of the incremental harvests made with OAI_Sync';
+
+CREATE FUNCTION OAI_Sync(foreign_table regclass, target_table regclass, strategy text DEFAULT 'ListRecords', concurrency integer DEFAULT 4,
+                         deleted_mode text DEFAULT 'keep')
+RETURNS bigint AS 'MODULE_PATHNAME', 'oai_fdw_sync'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION OAI_Sync(regclass, regclass, text, integer, text) IS 'Harvests the records of an OAI FOREIGN TABLE changed since its last sync into a local table';
+
+/* new signature: OAI_HarvestTable with parallel_workers */
+DROP PROCEDURE OAI_HarvestTable(text,text,interval,timestamp,timestamp,boolean,boolean);
+
+CREATE PROCEDURE OAI_HarvestTable
+(oai_table text, 
+ target_table text, 
+ page_size interval, 
+ start_date timestamp, 
+ end_date timestamp DEFAULT CURRENT_TIMESTAMP, 
+ create_table boolean DEFAULT true,
+ exec_verbose boolean DEFAULT false,
+ parallel_workers integer DEFAULT 0,
+ target_records integer DEFAULT NULL,
+ min_page_size interval DEFAULT interval '1 hour',
+ max_page_size interval DEFAULT interval '1 year',
+ deleted_mode text DEFAULT 'keep')
+LANGUAGE plpgsql AS $$ 
+DECLARE 
+  rec record;
+  window_from timestamp;
+  window_until timestamp;
+  window_size interval;
+  list_size bigint;
+  fdw text;  
+  columns_list text; 
+  datestamp_column text;
+  identifier_column text;
+  content_column text;
+  status_column text;
+  foreign_table_name text;
+  total_inserts bigint := 0;
+  total_updates bigint := 0;
+  total_unchanged bigint := 0;
+  total_deleted bigint := 0;
+  target_table_exists boolean := false;  
+  inserted_records  bigint := 0;
+  updated_records  bigint := 0; 
+  unchanged_records bigint := 0;
+  deleted_records bigint := 0;
+  page_windows timestamp[] := '{}';
+  failed_pages integer := 0;
+  windows_done integer := 0;
+  windows_total integer;
+BEGIN
+  
+  IF oai_table !~~ '%.%' OR (oai_table !~~ '"%"."%"' AND oai_table ~~ '"%"') THEN
+    oai_table := CURRENT_SCHEMA || '.' || oai_table;
+  END IF;
+  
+  IF target_table !~~ '%.%' OR (target_table !~~ '"%"."%"' AND target_table ~~ '"%"') THEN
+    target_table := CURRENT_SCHEMA || '.' || target_table;
+  END IF;
+  
+  IF start_date > end_date THEN
+    RAISE EXCEPTION 'invalid time window. The end date [%] lies before the start date [%]',start_date,end_date;
+  END IF;
+
+  IF page_size <= interval '0' OR min_page_size <= interval '0' THEN
+    RAISE EXCEPTION 'invalid page size. The page_size [%] and min_page_size [%] must be positive',page_size,min_page_size;
+  END IF;
+
+  IF parallel_workers < 0 THEN
+    RAISE EXCEPTION 'invalid parallel_workers: %',parallel_workers;
+  END IF;
+
+  IF target_records < 1 THEN
+    RAISE EXCEPTION 'invalid target_records: %',target_records;
+  END IF;
+
+  IF target_records IS NOT NULL AND parallel_workers > 0 THEN
+    RAISE EXCEPTION 'target_records cannot be combined with parallel_workers'
+      USING HINT = 'The size of an adaptive page depends on the records found in the previous one.';
+  END IF;
+
+  IF min_page_size > max_page_size THEN
+    RAISE EXCEPTION 'invalid page size range. The min_page_size [%] is larger than the max_page_size [%]',min_page_size,max_page_size;
+  END IF;
+
+  IF deleted_mode IS NULL OR deleted_mode NOT IN ('keep','mark','delete') THEN
+    RAISE EXCEPTION 'invalid deleted_mode: %',deleted_mode
+      USING HINT = 'Supported modes are ''keep'', ''mark'' and ''delete''.';
+  END IF;
+  
+  target_table_exists := (SELECT EXISTS (SELECT 1 FROM pg_tables WHERE schemaname||'.'||tablename = target_table));
+  
+  SELECT   
+    srv.foreign_data_wrapper_name AS fdw, 
+    tb.foreign_table_name fdw_table_name,
+    node_datestamp.attname AS fdw_datestamp,
+    node_identifier.attname AS fdw_identifier,
+    array_to_string(array_agg(col.attname),', ') AS fdw_table_cols
+  INTO fdw, foreign_table_name, datestamp_column, identifier_column, columns_list
+  FROM information_schema._pg_foreign_tables tb
+  JOIN information_schema._pg_foreign_table_columns col ON col.relname = tb.foreign_table_name
+  JOIN information_schema._pg_foreign_servers srv ON srv.foreign_server_name = tb.foreign_server_name
+  LEFT JOIN (
+      SELECT nspname, relname, attname 
+      FROM information_schema._pg_foreign_table_columns
+      WHERE attfdwoptions <@ ARRAY['oai_node=datestamp']) node_datestamp ON 
+            node_datestamp.relname = tb.foreign_table_name AND node_datestamp.nspname = tb.foreign_table_schema
+  LEFT JOIN (
+     SELECT nspname, relname, attname 
+     FROM information_schema._pg_foreign_table_columns
+     WHERE attfdwoptions <@ ARRAY['oai_node=identifier']) node_identifier ON 
+           node_identifier.relname = tb.foreign_table_name AND node_identifier.nspname = tb.foreign_table_schema            
+  WHERE tb.foreign_table_schema || '.' || tb.foreign_table_name = oai_table AND
+        srv.foreign_data_wrapper_name = 'oai_fdw'
+  GROUP BY srv.foreign_data_wrapper_name, tb.foreign_table_name, node_datestamp.attname, node_identifier.attname ;
+
+  IF foreign_table_name IS NULL THEN
+    RAISE EXCEPTION 'foreign table "%" does not exist', oai_table;
+  END IF;
+  
+  IF columns_list IS NULL THEN
+    RAISE EXCEPTION 'foreign table "%" does not have any oai_node mapping', oai_table;
+  END IF; 
+    
+  IF datestamp_column IS NULL THEN 
+    RAISE EXCEPTION 'foreign table "%" has no datestamp column',oai_table;
+  END IF;           
+
+  SELECT attname INTO content_column
+  FROM information_schema._pg_foreign_table_columns
+  WHERE nspname || '.' || relname = oai_table AND
+        attfdwoptions <@ ARRAY['oai_node=content'];
+
+  SELECT attname INTO status_column
+  FROM information_schema._pg_foreign_table_columns
+  WHERE nspname || '.' || relname = oai_table AND
+        attfdwoptions <@ ARRAY['oai_node=status'];
+
+  /* deleted records are looked up by their identifier */
+  IF deleted_mode <> 'keep' AND (status_column IS NULL OR identifier_column IS NULL) THEN
+    RAISE EXCEPTION 'deleted_mode "%" requires an identifier and a status column in foreign table "%"',deleted_mode,oai_table;
+  END IF;
+                    
+  IF create_table = true THEN 
+  
+    IF NOT target_table_exists THEN
+    
+      EXECUTE format('CREATE TABLE %s AS SELECT %s FROM %s WITH NO DATA;', target_table, columns_list, oai_table);
+      
+      IF identifier_column IS NOT NULL THEN 
+        EXECUTE format('ALTER TABLE %s ADD PRIMARY KEY (%s);',target_table,identifier_column);      
+      ELSE
+        RAISE WARNING 'foreign table "%" has no identifier column. It is strongly recommended to map the OAI identifier to a column, as it can ensure that records are not duplicated',oai_table;              
+      END IF;    
+
+      /* hash of the content, so that unchanged records are not rewritten */
+      IF content_column IS NOT NULL THEN
+        EXECUTE format('ALTER TABLE %s ADD COLUMN oai_content_hash text;',target_table);
+      END IF;
+      RAISE INFO 'target table "%" created',target_table;  
+    END IF;
+    
+  END IF;
+  
+  IF parallel_workers > 0 THEN
+    /* background workers only see committed tables */
+    COMMIT;
+  END IF;
+
+  window_from := start_date;
+  window_size := page_size;
+
+  IF target_records IS NOT NULL THEN
+    window_size := LEAST(GREATEST(page_size, min_page_size), max_page_size);
+  END IF;
+
+  /* windows of fixed pages, reported in oai_fdw_progress */
+  IF target_records IS NULL THEN
+    SELECT count(*) INTO windows_total
+    FROM generate_series(start_date, end_date, page_size) AS w
+    WHERE w + page_size <= end_date;
+  END IF;
+
+  LOOP
+    IF target_records IS NULL THEN
+      /* fixed pages, the time window is cut into whole page_size intervals */
+      EXIT WHEN window_from + page_size > end_date;
+      window_until := window_from + page_size;
+    ELSE
+      EXIT WHEN window_from >= end_date;
+      window_until := LEAST(window_from + window_size, end_date);
+
+      /* pages the repository announces as too large are shrunk before being harvested */
+      IF window_size > min_page_size THEN
+        list_size := oai_fdw_complete_list_size(oai_table::regclass, window_from, window_until);
+        IF list_size > target_records THEN
+          window_size := GREATEST(window_size * (target_records::float8 / list_size), min_page_size);
+          RAISE DEBUG 'page [% - %] holds % records, shrinking page size to %',window_from,window_until,list_size,window_size;
+          CONTINUE;
+        END IF;
+      END IF;
+    END IF;
+
+    IF parallel_workers > 0 THEN
+      page_windows := page_windows || ARRAY[window_from, window_until];
+      window_from := window_until;
+      CONTINUE;
+    END IF;
+
+    PERFORM oai_fdw_progress_update(to_regclass(target_table), windows_done, windows_total, window_from, window_until);
+
+	  SELECT * INTO inserted_records, updated_records, unchanged_records, deleted_records
+	  FROM oai_fdw_harvest_page(oai_table::regclass, target_table::regclass, window_from, window_until, deleted_mode);
+	  total_inserts := total_inserts + inserted_records;
+	  total_updates := total_updates + updated_records;
+	  total_unchanged := total_unchanged + unchanged_records;
+	  total_deleted := total_deleted + deleted_records;
+    COMMIT;
+    windows_done := windows_done + 1;
+
+    IF exec_verbose THEN
+	    RAISE INFO 'page stored into "%": % records inserted, % updated and % unchanged% [% - %]',
+		            target_table, 
+					inserted_records,
+					updated_records,
+					unchanged_records,
+					CASE deleted_mode WHEN 'mark' THEN format('; %s marked as deleted',deleted_records)
+					                  WHEN 'delete' THEN format('; %s deleted',deleted_records) ELSE '' END,
+					to_char(window_from,'yyyy-mm-dd hh24:mi:ss'),to_char(window_until,'yyyy-mm-dd hh24:mi:ss');
+    END IF;
+
+    /* the next adaptive page is sized after the records found in this one, growing at most fourfold */
+    IF target_records IS NOT NULL THEN
+      window_size := LEAST(GREATEST(window_size * LEAST(target_records::float8 / GREATEST(inserted_records + updated_records + unchanged_records, 1), 4),
+                                    min_page_size),
+                           max_page_size);
+    END IF;
+
+    window_from := window_until;
+  END LOOP;
+
+  /* pages are claimed by the workers in order, each committed on its own */
+  IF cardinality(page_windows) > 0 THEN
+    PERFORM oai_fdw_progress_update(to_regclass(target_table), 0, cardinality(page_windows) / 2);
+
+    FOR rec IN
+      SELECT * FROM oai_fdw_harvest_pages(oai_table::regclass, target_table::regclass, page_windows, deleted_mode, parallel_workers)
+    LOOP
+      IF rec.error IS NOT NULL THEN
+        failed_pages := failed_pages + 1;
+        RAISE WARNING 'could not harvest page [% - %]: %',
+                      to_char(page_windows[rec.page * 2 - 1],'yyyy-mm-dd hh24:mi:ss'),
+                      to_char(page_windows[rec.page * 2],'yyyy-mm-dd hh24:mi:ss'),
+                      rec.error;
+        CONTINUE;
+      END IF;
+
+      total_inserts := total_inserts + rec.inserted;
+      total_updates := total_updates + rec.updated;
+      total_unchanged := total_unchanged + rec.unchanged;
+      total_deleted := total_deleted + rec.deleted;
+
+      IF exec_verbose THEN
+        RAISE INFO 'page stored into "%": % records inserted, % updated and % unchanged% [% - %]',
+                    target_table,
+                    rec.inserted,
+                    rec.updated,
+                    rec.unchanged,
+                    CASE deleted_mode WHEN 'mark' THEN format('; %s marked as deleted',rec.deleted)
+                                      WHEN 'delete' THEN format('; %s deleted',rec.deleted) ELSE '' END,
+                    to_char(page_windows[rec.page * 2 - 1],'yyyy-mm-dd hh24:mi:ss'),
+                    to_char(page_windows[rec.page * 2],'yyyy-mm-dd hh24:mi:ss');
+      END IF;
+    END LOOP;
+  END IF;
+
+  PERFORM oai_fdw_progress_end();
+
+  RAISE INFO 'OAI harvester complete ("%" -> "%"): % records inserted, % updated and % unchanged% [% - %]',
+              oai_table,target_table,total_inserts,total_updates,total_unchanged,
+              CASE deleted_mode WHEN 'mark' THEN format('; %s marked as deleted',total_deleted)
+                                WHEN 'delete' THEN format('; %s deleted',total_deleted) ELSE '' END,
+              to_char(start_date,'yyyy-mm-dd hh24:mi:ss'),to_char(end_date,'yyyy-mm-dd hh24:mi:ss');
+
+  IF failed_pages > 0 THEN
+    RAISE EXCEPTION '% of % pages could not be harvested',failed_pages,cardinality(page_windows) / 2
+      USING HINT = 'The other pages were committed. Harvest the time windows of the failed pages again.';
+  END IF;
+END; $$;
+
+COMMENT ON PROCEDURE OAI_HarvestTable(text,text,interval,timestamp,timestamp,boolean,boolean,integer,integer,interval,interval,text) IS 'Harvests an OAI foreign table and stores its records in a local table';
+
+/* one page (time window) of OAI_HarvestTable */
+CREATE FUNCTION oai_fdw_harvest_page(oai_table regclass, target_table regclass, window_from timestamp, window_until timestamp,
+                                     deleted_mode text DEFAULT 'keep',
+                                     OUT inserted bigint, OUT updated bigint, OUT unchanged bigint, OUT deleted bigint)
+LANGUAGE plpgsql AS $$
+DECLARE
+  columns_list text;
+  columns_list_excluded text;
+  datestamp_column text;
+  identifier_column text;
+  content_column text;
+  status_column text;
+  insert_columns text;
+  select_columns text;
+  excluded_columns text;
+  changed_filter text;
+  conflict_clause text := '';
+  deleted_filter text := '';
+  deleted_query text := 'SELECT WHERE false';
+  page_query text;
+BEGIN
+
+  IF deleted_mode IS NULL OR deleted_mode NOT IN ('keep','mark','delete') THEN
+    RAISE EXCEPTION 'invalid deleted_mode: %',deleted_mode
+      USING HINT = 'Supported modes are ''keep'', ''mark'' and ''delete''.';
+  END IF;
+
+  /* the query is built from the catalog only, so that it can run in background workers */
+  SELECT
+    string_agg(quote_ident(a.attname), ', ' ORDER BY a.attnum),
+    string_agg('EXCLUDED.' || quote_ident(a.attname), ', ' ORDER BY a.attnum),
+    min(quote_ident(a.attname)) FILTER (WHERE a.attfdwoptions <@ ARRAY['oai_node=datestamp']),
+    min(quote_ident(a.attname)) FILTER (WHERE a.attfdwoptions <@ ARRAY['oai_node=identifier']),
+    min(quote_ident(a.attname)) FILTER (WHERE a.attfdwoptions <@ ARRAY['oai_node=content']),
+    min(quote_ident(a.attname)) FILTER (WHERE a.attfdwoptions <@ ARRAY['oai_node=status'])
+  INTO columns_list, columns_list_excluded, datestamp_column, identifier_column, content_column, status_column
+  FROM pg_attribute a
+  JOIN pg_foreign_table ft ON ft.ftrelid = a.attrelid
+  WHERE a.attrelid = oai_table AND a.attnum > 0 AND NOT a.attisdropped;
+
+  IF columns_list IS NULL THEN
+    RAISE EXCEPTION 'relation "%" is not a foreign table', oai_table;
+  END IF;
+
+  IF datestamp_column IS NULL THEN
+    RAISE EXCEPTION 'foreign table "%" has no datestamp column',oai_table;
+  END IF;
+
+  IF deleted_mode <> 'keep' AND (status_column IS NULL OR identifier_column IS NULL) THEN
+    RAISE EXCEPTION 'deleted_mode "%" requires an identifier and a status column in foreign table "%"',deleted_mode,oai_table;
+  END IF;
+
+  insert_columns := columns_list;
+  select_columns := columns_list;
+  excluded_columns := columns_list_excluded;
+  changed_filter := format('(t.%1$s) IS DISTINCT FROM (EXCLUDED.%1$s)',datestamp_column);
+
+  /* hash of the content, so that unchanged records are not rewritten */
+  IF content_column IS NOT NULL AND EXISTS (
+    SELECT 1 FROM pg_attribute
+    WHERE attrelid = target_table AND
+          attname = 'oai_content_hash' AND NOT attisdropped) THEN
+    insert_columns := insert_columns || ', oai_content_hash';
+    select_columns := select_columns || format(', md5(%s::text)',content_column);
+    excluded_columns := excluded_columns || ', EXCLUDED.oai_content_hash';
+    changed_filter := format('(t.%1$s, t.oai_content_hash) IS DISTINCT FROM (EXCLUDED.%1$s, EXCLUDED.oai_content_hash)',datestamp_column);
+  END IF;
+
+  /* records with the same datestamp (and content hash) are left untouched */
+  IF identifier_column IS NOT NULL THEN
+    conflict_clause := format('ON CONFLICT (%1$s) DO UPDATE SET (%2$s) = (%3$s) WHERE %4$s',identifier_column, insert_columns, excluded_columns, changed_filter);
+  END IF;
+
+  /* 
+   * Deleted records are not stored, but flag or remove the rows of their
+   * identifiers in the target table, all of a page in a single statement.
+   */
+  IF deleted_mode <> 'keep' THEN
+    deleted_filter := format('WHERE s.%s IS NOT TRUE',status_column);
+  END IF;
+
+  IF deleted_mode = 'mark' THEN
+    deleted_query := format('UPDATE %1$s AS t SET (%2$s, %4$s) = (true, s.%4$s) FROM s WHERE s.%2$s AND t.%3$s = s.%3$s AND t.%2$s IS NOT TRUE RETURNING 1',
+                            target_table, status_column, identifier_column, datestamp_column);
+  ELSIF deleted_mode = 'delete' THEN
+    deleted_query := format('DELETE FROM %1$s AS t USING s WHERE s.%2$s AND t.%3$s = s.%3$s RETURNING 1',
+                            target_table, status_column, identifier_column);
+  END IF;
+
+  page_query := format('
+    WITH s AS (
+      SELECT %1$s FROM %2$s
+      WHERE %3$s >= %4$L AND %3$s < %5$L),
+    j AS (
+      INSERT INTO %6$s AS t (%7$s)
+      SELECT %8$s FROM s %10$s
+      %9$s
+      RETURNING xmax=0 AS inserted),
+    d AS (%11$s)
+    SELECT 
+      COUNT(*) FILTER (WHERE inserted) AS inserted, 
+      COUNT(*) FILTER (WHERE NOT inserted) AS updated,
+      (SELECT COUNT(*) FROM s %10$s) - COUNT(*) AS unchanged,
+      (SELECT COUNT(*) FROM d) AS deleted
+    FROM j', columns_list, oai_table, datestamp_column, window_from, window_until,
+             target_table, insert_columns, select_columns, conflict_clause,
+             deleted_filter, deleted_query);
+
+  RAISE DEBUG '%',page_query;
+
+  EXECUTE page_query INTO inserted, updated, unchanged, deleted;
+END; $$;
+
+COMMENT ON FUNCTION oai_fdw_harvest_page(regclass,regclass,timestamp,timestamp,text) IS 'Harvests the records of an OAI FOREIGN TABLE within a time window into a local table, as a page of OAI_HarvestTable';
+
+/* parallel OAI_HarvestTable */
+CREATE FUNCTION oai_fdw_harvest_pages(oai_table regclass, target_table regclass, windows timestamp[], deleted_mode text, parallel_workers integer)
+RETURNS TABLE (page integer, inserted bigint, updated bigint, unchanged bigint, deleted bigint, error text) AS 'MODULE_PATHNAME', 'oai_fdw_harvest_pages'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION oai_fdw_harvest_pages(regclass,regclass,timestamp[],text,integer) IS 'Runs oai_fdw_harvest_page for pairs of window bounds in background workers, each page in its own transaction';
+
+/* adaptive OAI_HarvestTable */
+CREATE FUNCTION oai_fdw_complete_list_size(foreign_table regclass, "from" timestamp DEFAULT NULL, "until" timestamp DEFAULT NULL)
+RETURNS bigint AS 'MODULE_PATHNAME', 'oai_fdw_complete_list_size'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION oai_fdw_complete_list_size(regclass, timestamp, timestamp) IS 'Number of records of an OAI FOREIGN TABLE within a time window, as announced by the repository';
+
+/* scheduled harvests, run by the oai_fdw scheduler background worker */
+CREATE TABLE oai_fdw_harvest_jobs (
+  job_id serial PRIMARY KEY,
+  foreign_table regclass NOT NULL,
+  target_table regclass NOT NULL UNIQUE,
+  run_interval interval NOT NULL CHECK (run_interval > interval '0'),
+  strategy text NOT NULL DEFAULT 'ListRecords' CHECK (strategy IN ('ListRecords', 'ListIdentifiers')),
+  deleted_mode text NOT NULL DEFAULT 'keep' CHECK (deleted_mode IN ('keep', 'mark', 'delete')),
+  enabled boolean NOT NULL DEFAULT true,
+  job_owner regrole NOT NULL DEFAULT current_user::regrole,
+  next_run timestamptz NOT NULL DEFAULT pg_catalog.now(),
+  failures integer NOT NULL DEFAULT 0
+);
+
+CREATE TABLE oai_fdw_harvest_runs (
+  run_id bigserial PRIMARY KEY,
+  job_id integer NOT NULL REFERENCES oai_fdw_harvest_jobs (job_id) ON DELETE CASCADE,
+  started timestamptz NOT NULL,
+  finished timestamptz NOT NULL,
+  duration interval NOT NULL,
+  records bigint,
+  error text
+);
+
+CREATE INDEX ON oai_fdw_harvest_runs (job_id, started);
+
+SELECT pg_catalog.pg_extension_config_dump('oai_fdw_harvest_jobs', '');
+SELECT pg_catalog.pg_extension_config_dump('oai_fdw_harvest_jobs_job_id_seq', '');
+SELECT pg_catalog.pg_extension_config_dump('oai_fdw_harvest_runs', '');
+SELECT pg_catalog.pg_extension_config_dump('oai_fdw_harvest_runs_run_id_seq', '');
+
+REVOKE ALL ON oai_fdw_harvest_jobs, oai_fdw_harvest_runs FROM PUBLIC;
+
+COMMENT ON TABLE oai_fdw_harvest_jobs IS 'Incremental harvests (OAI_Sync) run periodically by the oai_fdw scheduler';
+COMMENT ON TABLE oai_fdw_harvest_runs IS 'History of the harvests run by the oai_fdw scheduler';
+
+CREATE FUNCTION oai_fdw_harvest_backoff(failures integer, run_interval interval)
+RETURNS interval AS 'MODULE_PATHNAME', 'oai_fdw_harvest_backoff'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION oai_fdw_harvest_backoff(integer, interval) IS 'Time after which the oai_fdw scheduler retries a job that failed a given number of times in a row';
+
+/* cluster-wide request statistics per server */
+CREATE FUNCTION oai_fdw_stat_servers(
+  OUT dbid oid,
+  OUT serverid oid,
+  OUT server_name text,
+  OUT requests bigint,
+  OUT identify bigint,
+  OUT list_metadata_formats bigint,
+  OUT list_sets bigint,
+  OUT list_identifiers bigint,
+  OUT list_records bigint,
+  OUT get_record bigint,
+  OUT bytes_received bigint,
+  OUT http_1xx bigint,
+  OUT http_2xx bigint,
+  OUT http_3xx bigint,
+  OUT http_4xx bigint,
+  OUT http_5xx bigint,
+  OUT transport_errors bigint,
+  OUT retries bigint,
+  OUT backoff_time double precision,
+  OUT mean_time double precision,
+  OUT max_time double precision,
+  OUT p50_time double precision,
+  OUT p90_time double precision,
+  OUT p99_time double precision,
+  OUT last_error text,
+  OUT last_error_time timestamptz,
+  OUT stats_reset timestamptz)
+RETURNS SETOF record AS 'MODULE_PATHNAME', 'oai_fdw_stat_servers'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION oai_fdw_stat_servers() IS 'Request statistics of all OAI servers of the cluster, collected in shared memory';
+
+CREATE VIEW oai_fdw_stat_servers AS SELECT * FROM oai_fdw_stat_servers();
+
+COMMENT ON VIEW oai_fdw_stat_servers IS 'Request statistics of all OAI servers of the cluster, collected in shared memory';
+
+CREATE FUNCTION oai_fdw_stat_servers_reset(server_name text DEFAULT NULL)
+RETURNS void AS 'MODULE_PATHNAME', 'oai_fdw_stat_servers_reset'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION oai_fdw_stat_servers_reset(text) IS 'Discards the request statistics of a given SERVER, or of all servers if NULL';
+
+REVOKE ALL ON FUNCTION oai_fdw_stat_servers() FROM PUBLIC;
+REVOKE ALL ON oai_fdw_stat_servers FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION oai_fdw_stat_servers_reset(text) FROM PUBLIC;
+GRANT EXECUTE ON FUNCTION oai_fdw_stat_servers() TO pg_read_all_stats;
+GRANT SELECT ON oai_fdw_stat_servers TO pg_read_all_stats;
+
+/* progress of OAI scans and harvests */
+CREATE FUNCTION oai_fdw_progress(
+  OUT pid integer,
+  OUT datid oid,
+  OUT foreign_table regclass,
+  OUT pages_fetched bigint,
+  OUT records_fetched bigint,
+  OUT bytes_received bigint,
+  OUT complete_list_size bigint,
+  OUT scan_start timestamptz,
+  OUT target_table regclass,
+  OUT window_start timestamp,
+  OUT window_end timestamp,
+  OUT windows_done integer,
+  OUT windows_total integer,
+  OUT harvest_start timestamptz,
+  OUT estimated_time_remaining interval)
+RETURNS SETOF record AS 'MODULE_PATHNAME', 'oai_fdw_progress'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION oai_fdw_progress() IS 'Progress of the OAI scans and harvests running in all backends of the cluster';
+
+CREATE VIEW oai_fdw_progress AS SELECT * FROM oai_fdw_progress();
+
+COMMENT ON VIEW oai_fdw_progress IS 'Progress of the OAI scans and harvests running in all backends of the cluster';
+
+CREATE FUNCTION oai_fdw_progress_update(target_table regclass, windows_done integer, windows_total integer DEFAULT NULL,
+                                        window_start timestamp DEFAULT NULL, window_end timestamp DEFAULT NULL)
+RETURNS void AS 'MODULE_PATHNAME', 'oai_fdw_progress_update'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION oai_fdw_progress_update(regclass,integer,integer,timestamp,timestamp) IS 'Reports the windows completed by a harvest of this session in oai_fdw_progress';
+
+CREATE FUNCTION oai_fdw_progress_end()
+RETURNS void AS 'MODULE_PATHNAME', 'oai_fdw_progress_end'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION oai_fdw_progress_end() IS 'Removes the harvest of this session from oai_fdw_progress';
+
+REVOKE ALL ON FUNCTION oai_fdw_progress() FROM PUBLIC;
+REVOKE ALL ON oai_fdw_progress FROM PUBLIC;
+GRANT EXECUTE ON FUNCTION oai_fdw_progress() TO pg_read_all_stats;
+GRANT SELECT ON oai_fdw_progress TO pg_read_all_stats;
+
+/* micro-benchmark of the record extraction */
+CREATE FUNCTION oai_fdw_bench_parse(file text, iterations integer DEFAULT 100,
+  OUT records bigint,
+  OUT bytes bigint,
+  OUT parse_ns_per_record float8,
+  OUT extract_ns_per_record float8,
+  OUT ns_per_record float8,
+  OUT xml_allocations_per_record float8,
+  OUT palloc_bytes_per_record float8)
+RETURNS record AS 'MODULE_PATHNAME', 'oai_fdw_bench_parse'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION oai_fdw_bench_parse(text,integer) IS 'Parses an OAI response stored in a server file repeatedly and reports the cost per record';
+
+REVOKE EXECUTE ON FUNCTION oai_fdw_bench_parse(text,integer) FROM PUBLIC;
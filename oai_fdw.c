@@ -47,9 +47,11 @@
 #include <utils/array.h>
 #include <commands/explain.h>
 #include <libxml/tree.h>
+#include <libxml/xmlmemory.h>
 #include <catalog/pg_collation.h>
 #include <funcapi.h>
 #include "lib/stringinfo.h"
+#include "lib/ilist.h"
 #include <utils/lsyscache.h>
 #include "nodes/pg_list.h"
 #include "nodes/nodes.h"
@@ -62,7 +64,9 @@
 #endif
 #include "utils/datetime.h"
 #include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 #include "utils/formatting.h"
+#include "utils/varlena.h"
 #include "catalog/pg_operator.h"
 #include "utils/syscache.h"
 #include "catalog/pg_foreign_table.h"
@@ -71,8 +75,73 @@
 #include "catalog/pg_type.h"
 #include "access/reloptions.h"
 #include "catalog/pg_namespace.h"
+#include "common/pg_lzcompress.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "pgstat.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "storage/lock.h"
+#include "storage/lmgr.h"
+#include "executor/spi.h"
+#include "catalog/pg_index.h"
+#include "access/heapam.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "executor/executor.h"
+#include "storage/bufmgr.h"
+#include "utils/acl.h"
+#include "utils/portal.h"
+#include "utils/rls.h"
+#include "utils/snapmgr.h"
+#include "utils/resowner.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "tcop/tcopprot.h"
+
+#if PG_VERSION_NUM >= 120000
+#include "access/tableam.h"
+#endif
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#elif PG_VERSION_NUM >= 120000
+#include "utils/hashutils.h"
+#else
+#include "access/hash.h"
+#endif
+
+#if PG_VERSION_NUM >= 150000
+#include "common/pg_prng.h"
+#endif
+
+#if PG_VERSION_NUM >= 170000
+#include "utils/wait_event.h"
+#include "storage/procnumber.h"
+#else
+#include "storage/backendid.h"
+#endif
+
+#if PG_VERSION_NUM < 150000
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#endif
+
+#include <math.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <utime.h>
 
 #define OAI_FDW_VERSION "1.14-dev"
+#define OAI_FDW_NAME "oai_fdw"
 #define OAI_REQUEST_LISTRECORDS "ListRecords"
 #define OAI_REQUEST_LISTIDENTIFIERS "ListIdentifiers"
 #define OAI_REQUEST_IDENTIFY "Identify"
@@ -80,6 +149,11 @@
 #define OAI_REQUEST_LISTMETADATAFORMATS "ListMetadataFormats"
 #define OAI_REQUEST_LISTSETS "ListSets"
 
+/* verbs counted separately in oai_fdw_stat_servers, in the order of its columns */
+static const char *const OAIStatVerbs[] = {OAI_REQUEST_IDENTIFY, OAI_REQUEST_LISTMETADATAFORMATS,
+										   OAI_REQUEST_LISTSETS, OAI_REQUEST_LISTIDENTIFIERS,
+										   OAI_REQUEST_LISTRECORDS, OAI_REQUEST_GETRECORD};
+
 #define OAI_DEFAULT_REQUEST_TIMEOUT 0
 #define OAI_DEFAULT_CONNECT_TIMEOUT 300
 #define OAI_DEFAULT_MAX_RETRY 3
@@ -90,6 +164,103 @@
  */
 #define OAI_FDW_MAX_ERROR_BODY 512
 
+/*
+ * On-disk response cache.  Files live in a directory relative to the data
+ * directory and are named <database oid>_<server oid>_<key hash>.cache, so
+ * that entries of a single server can be invalidated by file name alone.
+ */
+#define OAI_CACHE_DIR "oai_fdw_cache"
+#define OAI_CACHE_FILE_SUFFIX ".cache"
+#define OAI_CACHE_MAGIC 0x4F414931 /* "OAI1" */
+#define OAI_CACHE_DEFAULT_MAX_SIZE 1048576 /* kB */
+#define OAI_METADATA_CACHE_DEFAULT_TTL 300	 /* seconds */
+#define OAI_LOG_MIN_REQUEST_DURATION_DISABLED -1
+
+/*
+ * Checkpoints of scans with resume_from_checkpoint. Each checkpoint
+ * consists of <database oid>_<table oid>_<request hash>.checkpoint, holding
+ * the last resumptionToken, and a .pages file with the pages retrieved so
+ * far.
+ */
+#define OAI_CHECKPOINT_DIR "oai_fdw_checkpoint"
+#define OAI_CHECKPOINT_FILE_SUFFIX ".checkpoint"
+#define OAI_CHECKPOINT_PAGES_SUFFIX ".pages"
+#define OAI_CHECKPOINT_MAGIC 0x4F414943 /* "OAIC" */
+#define OAI_CHECKPOINT_LOCK_CLASS 0x4F41 /* advisory lock class, distinct from pg_advisory_lock() */
+
+/* Bookkeeping table of OAI_Sync, in the schema of the extension */
+#define OAI_SYNC_STATE_TABLE "oai_fdw_sync_state"
+/* Optional target column with the md5 of the content, see OAI_HarvestTable */
+#define OAI_CONTENT_HASH_COLUMN "oai_content_hash"
+#define OAI_BULK_INSERT_BATCH_SIZE 1000 /* records per multi-insert, as COPY FROM */
+
+/* OAI_Sync with the ListIdentifiers strategy, see FetchOAIRecords */
+#define OAI_DELTA_BATCH_SIZE 1000			 /* records fetched with GetRecord per upsert */
+#define OAI_DEFAULT_GETRECORD_CONCURRENCY 4 /* concurrent GetRecord requests */
+#define OAI_ENGINE_MAX_EVENTS 16			 /* events handled per wait of the request engine */
+
+/* Pages of a parallel OAI_HarvestTable */
+#define OAI_HARVEST_PAGE_PENDING 0
+#define OAI_HARVEST_PAGE_DONE 1
+#define OAI_HARVEST_PAGE_FAILED 2
+#define OAI_HARVEST_ERROR_LEN 1024
+#define OAI_HARVEST_DEFAULT_MAX_WORKERS 4 /* background workers per harvest */
+
+/* Scheduled harvests, see oai_fdw_scheduler_main */
+#define OAI_HARVEST_JOBS_TABLE "oai_fdw_harvest_jobs"
+#define OAI_HARVEST_RUNS_TABLE "oai_fdw_harvest_runs"
+#define OAI_SCHEDULER_DEFAULT_NAPTIME 60 /* s */
+#define OAI_SCHEDULER_RESTART_TIME 60	 /* s, after the worker crashed */
+#define OAI_SCHEDULER_MAX_BACKOFF 16	 /* failed runs are retried after at most 2^16 minutes */
+
+/*
+ * Shared memory used to coordinate the request rate of all backends per
+ * foreign server. Only available if oai_fdw is loaded via
+ * shared_preload_libraries.
+ */
+#define OAI_SHMEM_NAME "oai_fdw"
+#define OAI_DEFAULT_MAX_SHARED_SERVERS 64
+#define OAI_RATE_LIMIT_POLL_INTERVAL 10 /* ms, used while waiting for a concurrency slot */
+#define OAI_STAT_LATENCY_SUB_BUCKETS 8	/* latency buckets per power of two (12.5% precision) */
+#define OAI_STAT_LATENCY_MAGNITUDES 20	/* powers of two covered, from 1 ms to about 17 minutes */
+#define OAI_STAT_LATENCY_BUCKETS (1 + OAI_STAT_LATENCY_MAGNITUDES * OAI_STAT_LATENCY_SUB_BUCKETS)
+#define OAI_STAT_STATUS_CLASSES 6		/* transport errors, 1xx, 2xx, 3xx, 4xx and 5xx */
+#define OAI_STAT_ERROR_LEN 256
+#define OAI_STAT_SERVERS_COLS 27
+#define OAI_PROGRESS_COLS 15
+#define OAI_BENCH_PARSE_COLS 7
+
+/* Progress slot of this backend, see oai_fdw_progress */
+#if PG_VERSION_NUM >= 170000
+#define OAI_MY_PROGRESS_SLOT MyProcNumber
+#else
+#define OAI_MY_PROGRESS_SLOT (MyBackendId - 1)
+#endif
+
+/* Backoff between retries of failed requests (ms) */
+#define OAI_RETRY_BASE_DELAY 1000
+#define OAI_RETRY_MAX_DELAY 60000
+#define OAI_RETRY_AFTER_MAX_DELAY 300000
+
+#if PG_VERSION_NUM >= 120000
+#define OAI_WAIT_EVENTS (WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH)
+#else
+#define OAI_WAIT_EVENTS (WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH)
+#endif
+
+/*
+ * Wait events shown in pg_stat_activity while waiting for a repository,
+ * registered as custom wait events on PostgreSQL 17 and later, see
+ * GetOAIWaitEvent. The order matches OAIWaitEventNames.
+ */
+typedef enum OAIWaitEvent
+{
+	OAI_WAIT_EVENT_CONNECT,	   /* Connecting to a repository, TLS handshake included */
+	OAI_WAIT_EVENT_RESPONSE,   /* Sending a request and receiving its response */
+	OAI_WAIT_EVENT_RATE_LIMIT, /* Waiting for the server-wide request limits */
+	OAI_WAIT_EVENT_BACKOFF	   /* Waiting before retrying a failed request */
+} OAIWaitEvent;
+
 #define OAI_USERMAPPING_OPTION_USER "user"
 #define OAI_USERMAPPING_OPTION_PASSWORD "password"
 #define OAI_USERMAPPING_OPTION_PROXY_USER "proxy_user"
@@ -109,6 +280,9 @@
 #define OAI_RESPONSE_ELEMENT_DELETED "deleted"
 #define OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN "resumptionToken"
 #define OAI_RESPONSE_ELEMENT_COMPLETELISTSIZE "completeListSize"
+#define OAI_RESPONSE_ATTRIBUTE_EXPIRATIONDATE "expirationDate"
+#define OAI_RESPONSE_ELEMENT_RESPONSEDATE "responseDate"
+#define OAI_ERROR_BAD_RESUMPTION_TOKEN "badResumptionToken"
 
 #define OAI_XML_ROOT_ELEMENT "OAI-PMH"
 #define OAI_NODE_URL "url"
@@ -118,6 +292,12 @@
 #define OAI_SERVER_OPTION_CONNECTRETRY "connect_retry"
 #define OAI_SERVER_OPTION_REQUEST_REDIRECT "request_redirect"
 #define OAI_SERVER_OPTION_REQUEST_MAX_REDIRECT "request_max_redirect"
+#define OAI_SERVER_OPTION_CACHE_TTL "cache_ttl"
+#define OAI_SERVER_OPTION_MAX_REQUESTS_PER_SECOND "max_requests_per_second"
+#define OAI_SERVER_OPTION_MAX_CONCURRENT_REQUESTS "max_concurrent_requests"
+#define OAI_TABLE_OPTION_RESUME_FROM_CHECKPOINT "resume_from_checkpoint"
+#define OAI_TABLE_OPTION_SERVERS "servers"
+#define OAI_TABLE_OPTION_MAX_CONCURRENT_SERVERS "max_concurrent_servers"
 #define OAI_NODE_IDENTIFIER "identifier"
 #define OAI_NODE_CONTENT "content"
 #define OAI_NODE_DATESTAMP "datestamp"
@@ -126,6 +306,7 @@
 #define OAI_NODE_FROM "from"
 #define OAI_NODE_UNTIL "until"
 #define OAI_NODE_STATUS "status"
+#define OAI_NODE_SERVER "server"
 #define OAI_NODE_COLUMN_OPTION "oai_node"
 #define OAI_ERROR_ID_DOES_NOT_EXIST "idDoesNotExist"
 #define OAI_ERROR_NO_RECORD_MATCH "noRecordsMatch"
@@ -135,6 +316,7 @@
 #define OAI_UNKNOWN_REQUEST 2
 #define IntToConst(x) makeConst(INT4OID, -1, InvalidOid, 4, Int32GetDatum((int32)(x)), false, true)
 #define OidToConst(x) makeConst(OIDOID, -1, InvalidOid, 4, ObjectIdGetDatum(x), false, true)
+#define Float8ToConst(x) makeConst(FLOAT8OID, -1, InvalidOid, 8, Float8GetDatum((float8)(x)), false, FLOAT8PASSBYVAL)
 
 /* list API has changed in v13 */
 #if PG_VERSION_NUM < 130000
@@ -157,6 +339,9 @@ typedef struct OAIFdwState
 	long maxretries;		 /* Max number of retries in case a request returns an error message. */
 	long connectTimeout;	 /* Connection timeout for OAI requests in seconds. */
 	long request_timeout;	 /* Timeout for the entire HTTP request (connect + transfer) */
+	long cacheTtl;			 /* Seconds a cached OAI response stays fresh (0 disables the cache). */
+	double maxRequestsPerSecond; /* Requests per second allowed for all backends together (0 = unlimited). */
+	int maxConcurrentRequests;	 /* Requests in flight allowed for all backends together (0 = unlimited). */
 	char *identifier;		 /* The unique identifier of an item in a repository. */
 	char *set;				 /* The set membership of the item for the purpose of selective harvesting. */
 	char *url;				 /* Concatenated URL with the OAI request. */
@@ -182,6 +367,41 @@ typedef struct OAIFdwState
 	char *password;
 	Cost startup_cost;
 	Cost total_cost;
+	Tuplestorestate *rescanstore; /* Tuples emitted so far, replayed on rescan. */
+	TupleTableSlot *rescanslot;	  /* Slot used to read tuples back from rescanstore. */
+	bool rescanreplay;			  /* Tuples are currently being replayed from rescanstore. */
+	bool eof;					  /* All pages of the result set have been retrieved. */
+	long httpRetries;			  /* Number of failed requests that were retried. */
+	double backoffTime;			  /* Time spent waiting between retries (ms). */
+	long httpRequests;			  /* Number of requests sent, retries included. */
+	int64 bytesReceived;		  /* Bytes received over the wire, headers included. */
+	int64 bytesDecompressed;	  /* Bytes of the response bodies after content decoding. */
+	double dnsTime;				  /* Time spent resolving host names (ms). */
+	double connectTime;			  /* Time spent on TCP and TLS handshakes (ms). */
+	double firstByteTime;		  /* Time from sending requests to their first response byte (ms). */
+	double transferTime;		  /* Time spent receiving the responses (ms). */
+	double parseTime;			  /* Time spent parsing responses into XML documents (ms). */
+	double extractTime;			  /* Time spent extracting records from XML documents (ms). */
+	int64 recordsSeen;			  /* Records read from the responses. */
+	int64 deletedSeen;			  /* Records among recordsSeen with status "deleted". */
+	int64 peakPageSize;			  /* Size of the largest response (bytes). */
+	int64 pagesLoaded;			  /* Pages loaded by the scan, see oai_fdw_progress. */
+	int64 completeListSize;		  /* completeListSize of the last resumptionToken, 0 if unknown. */
+	bool resumeFromCheckpoint;	  /* Failed scans can be resumed from a checkpoint. */
+	char *checkpointKey;		  /* Request the checkpoint belongs to, NULL until it is opened. */
+	uint64 checkpointHash;		  /* Hash of checkpointKey, part of the file name. */
+	int checkpointPages;		  /* Pages stored in the checkpoint. */
+	int checkpointPending;		  /* Stored pages that were not replayed yet. */
+	int64 checkpointOffset;		  /* Read/write position in the checkpoint pages file. */
+	int64 checkpointRows;		  /* Records stored in the checkpoint. */
+	int64 resumedRows;			  /* Records replayed from the checkpoint. */
+	TimestampTz tokenExpiration;  /* expirationDate of the current resumptionToken, 0 if unknown. */
+	char *responseDate;			  /* responseDate of the last OAI response. */
+	List *servers;				  /* Names of the foreign servers the scan reads from. */
+	bool federated;				  /* The records come from the servers of the "servers" option. */
+	bool pruned;				  /* The WHERE clause excludes all servers, nothing is requested. */
+	int maxConcurrentServers;	  /* Servers requested at the same time (0 = all). */
+	struct OAIFederation *federation; /* Requests of a federated scan, see LoadFederatedRecords. */
 
 	struct OAIfdwTable *oaiTable; /* All necessary information of the FOREIGN TABLE used in a SQL statement */
 } OAIFdwState;
@@ -194,6 +414,7 @@ typedef struct OAIRecord
 	char *metadataPrefix;
 	bool isDeleted;
 	ArrayType *setsArray;
+	char *server; /* Foreign server of a federated scan, NULL for the table's own server */
 } OAIRecord;
 
 typedef struct OAIMetadataFormat
@@ -209,6 +430,18 @@ typedef struct OAISet
 	char *setName;
 } OAISet;
 
+typedef struct OAISetCollector
+{
+	List *sets;		   /* Collected OAISet entries */
+	MemoryContext cxt; /* Context the entries are allocated in */
+} OAISetCollector;
+
+typedef struct OAISetTupleStore
+{
+	Tuplestorestate *tupstore; /* Result of a materialized SRF */
+	TupleDesc tupdesc;		   /* Descriptor of the result rows */
+} OAISetTupleStore;
+
 typedef struct OAIFdwIdentityNode
 {
 	char *name;
@@ -229,6 +462,301 @@ struct MemoryStruct
 	size_t size;
 };
 
+/*
+ * Header of a cached OAI response. It is followed by the cache key
+ * (keylen bytes) and the payload, which is pglz compressed unless
+ * compsize is -1.
+ */
+typedef struct OAICacheFileHeader
+{
+	uint32 magic;	 /* OAI_CACHE_MAGIC */
+	uint32 keylen;	 /* Length of the cache key stored after the header. */
+	int32 rawsize;	 /* Size of the uncompressed response. */
+	int32 compsize;	 /* Size of the compressed response, -1 if stored as is. */
+	int64 created;	 /* Time the response was retrieved (seconds since epoch). */
+} OAICacheFileHeader;
+
+/*
+ * Backend-local cache of Identify, ListSets and ListMetadataFormats
+ * responses. Entries are kept per server and user, as the user mapping
+ * may change what a repository returns.
+ */
+typedef struct OAIMetadataCacheKey
+{
+	Oid serverid;		 /* FOREIGN SERVER the request was sent to */
+	Oid userid;			 /* User the request was issued by */
+	uint32 requesthash;	 /* Hash of the request parameters */
+} OAIMetadataCacheKey;
+
+typedef struct OAIMetadataCacheEntry
+{
+	OAIMetadataCacheKey key; /* Hash key (must be first) */
+	char *request;			 /* Request parameters, guards against hash collisions */
+	char *body;				 /* Raw response */
+	size_t size;			 /* Size of the raw response */
+	char *etag;				 /* ETag response header, if any */
+	char *lastModified;		 /* Last-Modified response header, if any */
+	TimestampTz fetched;	 /* Time the response was retrieved or revalidated */
+} OAIMetadataCacheEntry;
+
+/*
+ * Shared rate limiting state of a foreign server: a token bucket refilled
+ * with max_requests_per_second tokens per second (holding at most one
+ * second worth of tokens) and the number of requests currently in flight.
+ */
+typedef struct OAIRateLimitKey
+{
+	Oid dbid;	  /* Database the FOREIGN SERVER belongs to */
+	Oid serverid; /* FOREIGN SERVER */
+} OAIRateLimitKey;
+
+typedef struct OAIRateLimitEntry
+{
+	OAIRateLimitKey key;	 /* Hash key (must be first) */
+	double tokens;			 /* Requests that may be started right away */
+	TimestampTz lastRefill;	 /* Last time tokens were added to the bucket */
+	int active;				 /* Requests in flight */
+} OAIRateLimitEntry;
+
+/*
+ * Request statistics of a foreign server, collected by all backends. The
+ * latencies are counted in buckets growing exponentially, each power of
+ * two split into OAI_STAT_LATENCY_SUB_BUCKETS linear ones (in the manner
+ * of HDR histograms), so that percentiles can be estimated within 12.5%.
+ */
+typedef struct OAIServerStatsEntry
+{
+	OAIRateLimitKey key;						/* Hash key (must be first) */
+	slock_t mutex;								/* Protects the counters below */
+	int64 requests[lengthof(OAIStatVerbs)];		/* Requests per verb */
+	int64 bytes;								/* Bytes received, headers included */
+	int64 status[OAI_STAT_STATUS_CLASSES];		/* Requests per HTTP status class */
+	int64 retries;								/* Failed requests that were retried */
+	double backoffTime;							/* Time spent waiting between retries (ms) */
+	double totalTime;							/* Sum of the request latencies (ms) */
+	double maxTime;								/* Highest request latency (ms) */
+	int64 latency[OAI_STAT_LATENCY_BUCKETS];	/* Latency histogram */
+	TimestampTz lastErrorTime;					/* Time of the last failed request */
+	char lastError[OAI_STAT_ERROR_LEN];			/* Error of the last failed request */
+	TimestampTz statsReset;						/* Time the counters started */
+} OAIServerStatsEntry;
+
+/*
+ * Progress of the scan and the harvest running in a backend, in the
+ * manner of pg_stat_progress_*. Each backend only writes its own slot.
+ */
+typedef struct OAIProgressSlot
+{
+	slock_t mutex;			   /* Protects the fields below */
+	int pid;				   /* Backend reporting progress, 0 if the slot is unused */
+	Oid dbid;				   /* Database of the backend */
+	Oid relid;				   /* Foreign table being scanned, InvalidOid if none */
+	TimestampTz scanStart;	   /* Time the scan started */
+	int64 pages;			   /* Pages loaded by the scan */
+	int64 records;			   /* Records read from these pages */
+	int64 bytes;			   /* Bytes received by the scan */
+	int64 completeListSize;	   /* completeListSize announced by the repository, 0 if unknown */
+	bool harvesting;		   /* A harvest is reported */
+	Oid targetid;			   /* Table harvested into, InvalidOid if unknown */
+	TimestampTz harvestStart;  /* Time the harvest started */
+	int32 windowsDone;		   /* Windows of the harvest completed */
+	int32 windowsTotal;		   /* Windows of the harvest, 0 if unknown */
+	Timestamp windowStart;	   /* Current time window, DT_NOBEGIN if none */
+	Timestamp windowEnd;
+} OAIProgressSlot;
+
+typedef struct OAISharedState
+{
+	LWLock *lock;	   /* Protects OAISharedServers and OAISharedStats */
+	int progressSlots; /* Number of entries of OAIProgress */
+} OAISharedState;
+
+/*
+ * Checkpoint of a scan. It is followed by the checkpoint key (keylen
+ * bytes) and the last resumptionToken (tokenlen bytes). The pages file
+ * holds a sequence of OAICheckpointPage headers, each followed by the
+ * page, which is pglz compressed unless compsize is -1.
+ */
+typedef struct OAICheckpointHeader
+{
+	uint32 magic;			/* OAI_CHECKPOINT_MAGIC */
+	uint32 keylen;			/* Length of the checkpoint key stored after the header. */
+	int32 tokenlen;			/* Length of the resumptionToken stored after the key. */
+	int32 pages;			/* Number of pages in the pages file. */
+	int64 rows;				/* Number of records in these pages. */
+	int64 offset;			/* Size of the pages file covered by the checkpoint. */
+	TimestampTz expiration; /* expirationDate of the resumptionToken, 0 if unknown. */
+	int64 created;			/* Time the checkpoint was written (seconds since epoch). */
+} OAICheckpointHeader;
+
+typedef struct OAICheckpointPage
+{
+	int32 rawsize;	/* Size of the uncompressed page. */
+	int32 compsize; /* Size of the compressed page, -1 if stored as is. */
+} OAICheckpointPage;
+
+typedef struct OAIBulkInsert
+{
+	Relation rel;			  /* Target table */
+	AttrNumber *attmap;		  /* Foreign table column of each target column */
+	AttrNumber hashattr;	  /* Target column with the content hash, if any */
+	AttrNumber contentattr;	  /* Foreign table column hashed into hashattr */
+	MemoryContext cxt;		  /* Context of the slots */
+	MemoryContext batchcxt;	  /* Reset after each multi-insert */
+	EState *estate;			  /* Needed to insert the index entries */
+	ResultRelInfo *rri;		  /* Indexes of the target table */
+	BulkInsertState bistate;  /* Buffer access strategy of the bulk insert */
+	CommandId cid;			  /* Command id of the inserted rows */
+	int options;			  /* Options of the multi-insert */
+	bool frozen;			  /* Rows are inserted frozen */
+#if PG_VERSION_NUM >= 120000
+	TupleTableSlot **slots;	  /* Buffered rows */
+#else
+	HeapTuple *tuples;		  /* Buffered rows */
+	TupleTableSlot *slot;	  /* Used to insert the index entries */
+#endif
+	int nbuffered;			  /* Number of buffered rows */
+	int64 inserted;			  /* Rows inserted so far */
+} OAIBulkInsert;
+
+typedef struct OAIHarvestPage
+{
+	Timestamp from;						/* Start of the time window */
+	Timestamp until;					/* End of the time window (exclusive) */
+	int status;							/* OAI_HARVEST_PAGE_* */
+	int64 inserted;						/* Records inserted by the page */
+	int64 updated;						/* Records updated by the page */
+	int64 unchanged;					/* Records left untouched by the page */
+	int64 deleted;						/* Rows of deleted records removed or flagged by the page */
+	char error[OAI_HARVEST_ERROR_LEN];	/* Error message of a failed page */
+} OAIHarvestPage;
+
+/*
+ * Queue of a parallel OAI_HarvestTable in dynamic shared memory. Each
+ * page is harvested with oai_fdw_harvest_page.
+ */
+typedef struct OAIHarvestQueue
+{
+	Oid database;			  /* Database the workers connect to */
+	Oid authenticated;		  /* User the workers connect as */
+	Oid user;				  /* User the pages are harvested as */
+	int sec_context;		  /* Security context of the harvest */
+	Oid foreigntableid;		  /* Foreign table harvested */
+	Oid targetid;			  /* Table the records are stored into */
+	char deleted_mode[8];	  /* deleted_mode of OAI_HarvestTable */
+	char function[2 * NAMEDATALEN + 32]; /* Qualified name of oai_fdw_harvest_page */
+	Size guc;				  /* Offset of the serialized GUC state of the harvest */
+	int npages;				  /* Number of pages */
+	pg_atomic_uint32 next;	  /* Next page to be claimed by a worker */
+	OAIHarvestPage pages[FLEXIBLE_ARRAY_MEMBER];
+} OAIHarvestQueue;
+
+/* Called by RunRequestEngine once a transfer finished, see AddEngineTransfer */
+typedef void (*OAITransferCallback)(CURL *curl, CURLcode res, void *arg);
+
+/* Transfer in progress in the request engine */
+typedef struct OAIEngineTransfer
+{
+	dlist_node node;				  /* Entry in OAIRequestEngine.transfers */
+	CURL *curl;						  /* Easy handle of the transfer */
+	OAITransferCallback callback;	  /* Called once the transfer finished */
+	void *arg;						  /* Argument of the callback */
+} OAIEngineTransfer;
+
+/*
+ * Request engine of the backend: all transfers share one cURL multi handle
+ * driven with curl_multi_socket_action, and the backend waits for their
+ * sockets and its latch with one WaitEventSet. See RunRequestEngine.
+ */
+typedef struct OAIRequestEngine
+{
+	CURLM *multi;					  /* Multi handle of all transfers */
+	dlist_head transfers;			  /* Transfers in progress */
+	WaitEventSet *events;			  /* Latch and sockets waited for, NULL if outdated */
+	curl_socket_t *sockets;			  /* Sockets cURL waits for */
+	int *socketEvents;				  /* WL_SOCKET_* events of each socket */
+	int nsockets;					  /* Sockets in use */
+	int maxsockets;					  /* Allocated entries of sockets and socketEvents */
+	TimestampTz deadline;			  /* When cURL wants to be called on timeout, 0 if never */
+} OAIRequestEngine;
+
+/* Outcome of a transfer, set by SetTransferResult */
+typedef struct OAITransferResult
+{
+	bool finished;					  /* The transfer finished */
+	CURLcode code;					  /* Result of the transfer */
+} OAITransferResult;
+
+/* GetRecord request of FetchOAIRecords, waiting to be sent */
+typedef struct OAIPendingRecord
+{
+	char *identifier;		  /* Record to be retrieved */
+	long attempt;			  /* Retries so far */
+	TimestampTz notBefore;	  /* Backoff of a retry, 0 if none */
+} OAIPendingRecord;
+
+/* GetRecord request of FetchOAIRecords or page request of a federated scan in progress */
+typedef struct OAITransfer
+{
+	CURL *curl;						  /* Easy handle, NULL if the transfer is free */
+	OAIPendingRecord *record;		  /* Record being retrieved */
+	char *request;					  /* Request parameters (POST fields) */
+	struct MemoryStruct body;		  /* Response body */
+	struct MemoryStruct header;		  /* Response headers */
+	struct curl_slist *headers;		  /* Request headers */
+	char errbuf[CURL_ERROR_SIZE];	  /* cURL error message */
+	bool holdsSlot;					  /* Took a concurrency slot of the server */
+	Oid serverid;					  /* Server the slot belongs to */
+	OAITransferResult result;		  /* Set once the transfer finished */
+} OAITransfer;
+
+/* Foreign server of a federated scan */
+typedef struct OAIEndpoint
+{
+	OAIFdwState *state;				  /* Requests to the server, with its own options */
+	OAITransfer transfer;			  /* Page request in progress, if any */
+	long attempt;					  /* Retries of the current page */
+	TimestampTz notBefore;			  /* Backoff of a retry, 0 if none */
+	bool done;						  /* All pages have been retrieved */
+} OAIEndpoint;
+
+/* Requests of a federated scan, kept in the memory context of the scan */
+typedef struct OAIFederation
+{
+	OAIEndpoint *endpoints;			  /* One per server */
+	int nendpoints;					  /* Number of servers */
+	int running;					  /* Transfers in progress */
+	int remaining;					  /* Servers with pages left */
+	int next;						  /* Server served first by the next round */
+} OAIFederation;
+
+/* Record of the target table of OAI_Sync, keyed by the hash of its identifier */
+typedef struct OAILocalRecord
+{
+	uint64 identifier;		  /* Hash of the identifier */
+	uint64 datestamp;		  /* Hash of the datestamp */
+} OAILocalRecord;
+
+/* Due row of oai_fdw_harvest_jobs */
+typedef struct OAIHarvestJob
+{
+	int32 jobid;			  /* job_id */
+	Oid foreigntableid;		  /* Foreign table harvested */
+	Oid targetid;			  /* Table the records are stored into */
+	Oid owner;				  /* Role the harvest runs as */
+	char *strategy;			  /* Strategy of OAI_Sync */
+	char *deleted_mode;		  /* deleted_mode of OAI_Sync */
+	int32 failures;			  /* Consecutive failed runs so far */
+	Interval *run_interval;	  /* Time between two successful runs */
+} OAIHarvestJob;
+
+typedef struct OAICacheFile
+{
+	char *name;	   /* File name within OAI_CACHE_DIR */
+	time_t mtime;  /* Last time the entry was written or served */
+	off_t size;	   /* File size in bytes */
+} OAICacheFile;
+
 typedef struct OAIfdwTable
 {
 	char *name;					/* FOREIGN TABLE name */
@@ -256,6 +784,9 @@ static struct OAIFdwOption valid_options[] =
 		{OAI_SERVER_OPTION_CONNECTRETRY, ForeignServerRelationId, false, false},
 		{OAI_SERVER_OPTION_REQUEST_REDIRECT, ForeignServerRelationId, false, false},
 		{OAI_SERVER_OPTION_REQUEST_MAX_REDIRECT, ForeignServerRelationId, false, false},
+		{OAI_SERVER_OPTION_CACHE_TTL, ForeignServerRelationId, false, false},
+		{OAI_SERVER_OPTION_MAX_REQUESTS_PER_SECOND, ForeignServerRelationId, false, false},
+		{OAI_SERVER_OPTION_MAX_CONCURRENT_REQUESTS, ForeignServerRelationId, false, false},
 
 		/* Foreign Table */
 		{OAI_NODE_IDENTIFIER, ForeignTableRelationId, false, false},
@@ -263,6 +794,9 @@ static struct OAIFdwOption valid_options[] =
 		{OAI_NODE_SETSPEC, ForeignTableRelationId, false, false},
 		{OAI_NODE_FROM, ForeignTableRelationId, false, false},
 		{OAI_NODE_UNTIL, ForeignTableRelationId, false, false},
+		{OAI_TABLE_OPTION_RESUME_FROM_CHECKPOINT, ForeignTableRelationId, false, false},
+		{OAI_TABLE_OPTION_SERVERS, ForeignTableRelationId, false, false},
+		{OAI_TABLE_OPTION_MAX_CONCURRENT_SERVERS, ForeignTableRelationId, false, false},
 
 		/* Column OPTIONS */
 		{OAI_NODE_COLUMN_OPTION, AttributeRelationId, true, false},
@@ -285,6 +819,15 @@ extern Datum oai_fdw_settings(PG_FUNCTION_ARGS);
 extern Datum oai_fdw_listMetadataFormats(PG_FUNCTION_ARGS);
 extern Datum oai_fdw_listSets(PG_FUNCTION_ARGS);
 extern Datum oai_fdw_identity(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_clear_cache(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_clear_checkpoints(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_sync(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_harvest_pages(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_complete_list_size(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_harvest_backoff(PG_FUNCTION_ARGS);
+extern Datum oai_fdw_bench_parse(PG_FUNCTION_ARGS);
+PGDLLEXPORT void oai_fdw_harvest_worker(Datum main_arg);
+PGDLLEXPORT void oai_fdw_scheduler_main(Datum main_arg);
 
 PG_FUNCTION_INFO_V1(oai_fdw_handler);
 PG_FUNCTION_INFO_V1(oai_fdw_validator);
@@ -293,6 +836,71 @@ PG_FUNCTION_INFO_V1(oai_fdw_settings);
 PG_FUNCTION_INFO_V1(oai_fdw_listMetadataFormats);
 PG_FUNCTION_INFO_V1(oai_fdw_listSets);
 PG_FUNCTION_INFO_V1(oai_fdw_identity);
+PG_FUNCTION_INFO_V1(oai_fdw_clear_cache);
+PG_FUNCTION_INFO_V1(oai_fdw_clear_checkpoints);
+PG_FUNCTION_INFO_V1(oai_fdw_sync);
+PG_FUNCTION_INFO_V1(oai_fdw_harvest_pages);
+PG_FUNCTION_INFO_V1(oai_fdw_complete_list_size);
+PG_FUNCTION_INFO_V1(oai_fdw_harvest_backoff);
+PG_FUNCTION_INFO_V1(oai_fdw_stat_servers);
+PG_FUNCTION_INFO_V1(oai_fdw_stat_servers_reset);
+PG_FUNCTION_INFO_V1(oai_fdw_progress);
+PG_FUNCTION_INFO_V1(oai_fdw_progress_update);
+PG_FUNCTION_INFO_V1(oai_fdw_progress_end);
+PG_FUNCTION_INFO_V1(oai_fdw_bench_parse);
+
+/* libxml2 allocator of the session while oai_fdw_bench_parse counts its allocations */
+static xmlMallocFunc BenchXmlMalloc = NULL;
+static xmlReallocFunc BenchXmlRealloc = NULL;
+static xmlStrdupFunc BenchXmlStrdup = NULL;
+static int64 BenchXmlAllocations = 0;
+
+/* GUC: maximum size of the on-disk response cache in kB (0 = unlimited) */
+static int OAICacheMaxSize = OAI_CACHE_DEFAULT_MAX_SIZE;
+
+/* GUC: seconds Identify, ListSets and ListMetadataFormats responses are reused (0 = disabled) */
+static int OAIMetadataCacheTtl = OAI_METADATA_CACHE_DEFAULT_TTL;
+
+/* GUC: requests taking at least this many ms are logged (-1 = disabled) */
+static int OAILogMinRequestDuration = OAI_LOG_MIN_REQUEST_DURATION_DISABLED;
+
+/* GUC: background workers a parallel OAI_HarvestTable may use (0 = disabled) */
+static int OAIMaxHarvestWorkers = OAI_HARVEST_DEFAULT_MAX_WORKERS;
+
+static HTAB *OAIMetadataCache = NULL;
+static MemoryContext OAIMetadataCacheContext = NULL;
+
+/* GUC: number of foreign servers the shared memory has room for */
+static int OAIMaxSharedServers = OAI_DEFAULT_MAX_SHARED_SERVERS;
+
+/* GUC: database the scheduler worker connects to (empty = no scheduler) */
+static char *OAISchedulerDatabase = NULL;
+
+/* GUC: seconds the scheduler worker sleeps between looking for due jobs */
+static int OAISchedulerNaptime = OAI_SCHEDULER_DEFAULT_NAPTIME;
+
+static volatile sig_atomic_t OAISchedulerGotSighup = false;
+
+static OAISharedState *OAIShared = NULL;
+static HTAB *OAISharedServers = NULL;
+static HTAB *OAISharedStats = NULL;
+static OAIProgressSlot *OAIProgress = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static const char *const OAIWaitEventNames[] = {"OAIConnect", "OAIResponse", "OAIRateLimit", "OAIBackoff"};
+static uint32 OAIWaitEventIds[lengthof(OAIWaitEventNames)];
+
+/* concurrency slots held by this backend, released on error or exit */
+static OAIRateLimitKey *OAIHeldSlot = NULL;
+static int OAIHeldSlots = 0;
+static int OAIHeldSlotsAllocated = 0;
+
+/* request engine of this backend, created on first use */
+static OAIRequestEngine *OAIEngine = NULL;
 
 static void OAIFdwGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
 static void OAIFdwGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
@@ -309,31 +917,139 @@ static List *OAIFdwImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid server
 
 static void appendTextArray(ArrayType **array, char *text_element);
 static int ExecuteOAIRequest(OAIFdwState *state);
+static bool BuildOAIRequest(OAIFdwState *state, CURL *curl, StringInfo buffer);
+static void SetOAIRequestOptions(OAIFdwState *state, CURL *curl, const char *postfields,
+								 struct MemoryStruct *chunk, struct MemoryStruct *chunk_header,
+								 char *errbuf, struct curl_slist **headers);
 static void CreateOAITuple(TupleTableSlot *slot, OAIFdwState *state, OAIRecord *oai);
 static OAIRecord *FetchNextOAIRecord(OAIFdwState **state);
 static void LoadOAIRecords(struct OAIFdwState **state);
+static void LoadFederatedRecords(OAIFdwState *state);
+static OAIFederation *BeginFederation(OAIFdwState *state);
+static void EndFederation(void *arg);
+static void StartFederatedRequests(OAIFdwState *state, OAIFederation *federation, long *wait_ms);
+static void EndFederatedRequest(OAIFdwState *state, OAIFederation *federation, OAIEndpoint *endpoint);
+static void AddFederatedPage(OAIFdwState *state, OAIFederation *federation, OAIEndpoint *endpoint);
+static void FederatedPageErrorCallback(void *arg);
+static void CollectFederatedCounters(OAIFdwState *state);
+static void ParseOAIRecords(struct OAIFdwState **state);
+static void ExtractOAIHeader(xmlDocPtr doc, xmlNodePtr header, OAIRecord *oai);
+static OAIRecord *ExtractOAIRecord(xmlDocPtr doc, xmlNodePtr node, const char *metadataPrefix);
+static void *CountingXmlMalloc(size_t size);
+static void *CountingXmlRealloc(void *ptr, size_t size);
+static char *CountingXmlStrdup(const char *str);
+static void CountOAITransfer(OAIFdwState *state, CURL *curl, CURLcode res, size_t size);
+static void CountOAIRetry(OAIFdwState *state, long delay);
+static void LogOAIRequest(OAIFdwState *state, CURL *curl, const char *request, xmlDocPtr doc, long attempts, double parse_ms);
+static char *RedactOAIRequest(const char *request);
+static OAIServerStatsEntry *LockServerStats(Oid serverid);
+static void UnlockServerStats(OAIServerStatsEntry *entry);
+static int GetLatencyBucket(double ms);
+static double GetLatencyPercentile(OAIServerStatsEntry *entry, double fraction);
+static int GetProgressSlotCount(void);
+static OAIProgressSlot *GetProgressSlot(void);
+static void ReportScanProgress(OAIFdwState *state);
+static void EndScanProgress(OAIFdwState *state);
+static void ReportHarvestProgress(Oid targetid, int done, int total, Timestamp window_start, Timestamp window_end);
+static void EndHarvestProgress(void);
+static bool IsHarvestInProgress(void);
+static void ClearProgress(void);
+static void ProgressXactCallback(XactEvent event, void *arg);
+static void ProgressExit(int code, Datum arg);
+static xmlDocPtr ReadOAIDocument(OAIFdwState *state, const char *buffer, size_t size);
+static void FetchOAIRecords(OAIFdwState *state, List *identifiers, int concurrency);
+static void EndTransfer(OAITransfer *transfer);
+static HTAB *LoadLocalRecords(const char *target_name, const char *identifier, const char *datestamp, Form_pg_attribute identifierattr, Form_pg_attribute datestampattr);
+static uint64 HashText(const char *value);
+static void InitRescanStore(ForeignScanState *node, OAIFdwState *state);
 static void deparseExpr(Expr *expr, OAIFdwState *state);
+static void PruneOAIServers(OAIFdwState *state, List *servers);
 static char *datumToString(Datum datum, Oid type);
 static char *GetOAINodeFromColumn(Oid foreigntableid, int16 attnum);
 static void deparseWhereClause(OAIFdwState *state, List *conditions);
 static void deparseSelectColumns(OAIFdwState *state, List *exprs);
 static void OAIRequestPlanner(OAIFdwState *state, RelOptInfo *baserel);
+static bool CheckOAIColumns(OAIFdwState *state, Relation rel);
 static char *deparseTimestamp(Datum datum);
 static int CheckURL(char *url);
 static OAIFdwState *GetServerInfo(const char *srvname);
 static List *GetMetadataFormats(OAIFdwState *state);
 static List *GetIdentity(OAIFdwState *state);
 static List *GetSets(OAIFdwState *state);
+static void ForEachOAISet(OAIFdwState *state, void (*callback)(OAISet *set, void *arg), void *arg);
+static void CollectOAISet(OAISet *set, void *arg);
+static void StoreOAISet(OAISet *set, void *arg);
+static Tuplestorestate *InitMaterializedResult(FunctionCallInfo fcinfo, TupleDesc *tupdesc);
 static void RaiseOAIException(xmlNodePtr error);
 static Datum CreateDatum(int pgtype, int pgtypmod, char *value);
 static void LoadOAIServerInfo(OAIFdwState *state);
 static void LoadOAITableInfo(OAIFdwState *state);
 static void LoadOAIUserMapping(OAIFdwState *state);
+static List *GetFederatedServers(OAIFdwState *state, const char *servers);
+static void CheckFederatedServerUsage(ForeignServer *server, Oid roleid);
 static void InitSession(OAIFdwState *state, RelOptInfo *baserel);
 static List *SerializePlanData(OAIFdwState *state);
 static struct OAIFdwState *DeserializePlanData(List *list);
 static Const *CStringToConst(const char *str);
 static char *ConstToCString(Const *constant);
+static char *GetCredentialsKey(OAIFdwState *state);
+static char *GetCacheKey(OAIFdwState *state, const char *request);
+static char *GetCacheFileName(OAIFdwState *state, const char *key);
+static char *ReadCachedResponse(OAIFdwState *state, const char *request, size_t *size);
+static void WriteCachedResponse(OAIFdwState *state, const char *request, const char *data, size_t size);
+static int CompareCacheFiles(const void *a, const void *b);
+static void EvictCachedResponses(void);
+static char *GetResponseHeader(const char *headers, const char *name);
+static bool IsMetadataRequest(const char *verb);
+static bool IsCacheableResponse(xmlDocPtr doc);
+static void InvalidateMetadataCache(Datum arg, int cacheid, uint32 hashvalue);
+static OAIMetadataCacheEntry *GetMetadataCacheEntry(OAIFdwState *state, const char *request, bool create);
+static void StoreMetadataCacheEntry(OAIFdwState *state, const char *request, const char *data, size_t size, const char *headers);
+static Size OAIShmemSize(void);
+#if PG_VERSION_NUM >= 150000
+static void OAIShmemRequest(void);
+#endif
+static void OAIShmemStartup(void);
+static void OAIShmemExit(int code, Datum arg);
+static void AcquireRequestSlot(OAIFdwState *state);
+static bool TryAcquireRequestSlot(OAIFdwState *state, long *wait_ms);
+static void ReleaseRequestSlot(Oid serverid);
+static CURLcode PerformOAIRequest(OAIFdwState *state, CURL *curl);
+static OAIRequestEngine *GetRequestEngine(void);
+static void AddEngineTransfer(CURL *curl, OAITransferCallback callback, void *arg);
+static void RemoveEngineTransfer(CURL *curl);
+static void RunRequestEngine(long timeout, uint32 wait_event);
+static void SetTransferResult(CURL *curl, CURLcode res, void *arg);
+static int EngineSocketCallback(CURL *curl, curl_socket_t socket, int what, void *userp, void *socketp);
+static int EngineTimerCallback(CURLM *multi, long timeout_ms, void *userp);
+static void EngineXactCallback(XactEvent event, void *arg);
+static uint32 GetOAIWaitEvent(OAIWaitEvent event);
+static bool IsTransientFailure(CURL *curl, CURLcode res, long response_code);
+static long GetRetryDelay(const char *headers, long attempt);
+static void WaitForRetry(long delay);
+static char *GetCheckpointKey(OAIFdwState *state);
+static char *GetCheckpointFileName(OAIFdwState *state, const char *suffix);
+static TimestampTz GetTokenExpiration(xmlNodePtr token);
+static int64 GetCompleteListSize(xmlNodePtr token);
+static void OpenCheckpoint(OAIFdwState *state);
+static int ReadCheckpointPage(OAIFdwState *state);
+static void WriteCheckpoint(OAIFdwState *state);
+static void RemoveCheckpoint(OAIFdwState *state);
+static void DiscardInvalidCheckpoint(OAIFdwState *state, xmlNodePtr error);
+static OAIFdwState *GetOAIForeignTableState(Oid foreigntableid);
+static bool HasDayGranularity(OAIFdwState *state);
+static bool HasUniqueIndex(Relation rel, AttrNumber attnum);
+static char *GetExtensionTable(const char *name, bool missing_ok);
+static Oid GetExtensionOwner(void);
+static List *GetDueHarvestJobs(void);
+static void RunHarvestJob(OAIHarvestJob *job);
+static Interval *HarvestBackoff(int32 failures, Interval *run_interval);
+static void OAISchedulerSighup(SIGNAL_ARGS);
+static bool CanBulkInsert(Relation target, TupleDesc source, AttrNumber *attmap);
+static OAIBulkInsert *BeginBulkInsert(Relation target, AttrNumber *attmap, AttrNumber hashattr, AttrNumber contentattr);
+static void BulkInsertRecord(OAIBulkInsert *bulk, TupleTableSlot *slot);
+static void FlushBulkInsert(OAIBulkInsert *bulk);
+static int64 EndBulkInsert(OAIBulkInsert *bulk);
 void _PG_init(void);
 
 void _PG_init(void)
@@ -352,6 +1068,231 @@ void _PG_init(void)
 				 errmsg("oai_fdw: could not initialise libcurl")));
 
 	xmlInitParser();
+
+	DefineCustomIntVariable("oai_fdw.cache_max_size",
+							"Maximum size of the oai_fdw on-disk response cache.",
+							"Least recently used responses are removed once the cache grows beyond "
+							"this size. Zero disables the limit.",
+							&OAICacheMaxSize,
+							OAI_CACHE_DEFAULT_MAX_SIZE,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oai_fdw.metadata_cache_ttl",
+							"Time Identify, ListSets and ListMetadataFormats responses are reused.",
+							"Responses are kept per session, server and user. Expired responses are "
+							"revalidated with conditional requests if the repository supports them. "
+							"Zero disables the cache.",
+							&OAIMetadataCacheTtl,
+							OAI_METADATA_CACHE_DEFAULT_TTL,
+							0,
+							INT_MAX / 1000,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oai_fdw.log_min_request_duration",
+							"Minimum duration of OAI requests to be logged.",
+							"Requests taking at least this long are logged with their timings. "
+							"Zero logs all requests, -1 disables the log.",
+							&OAILogMinRequestDuration,
+							OAI_LOG_MIN_REQUEST_DURATION_DISABLED,
+							-1,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oai_fdw.max_harvest_workers",
+							"Maximum number of background workers of a parallel OAI_HarvestTable.",
+							"Larger values of parallel_workers are reduced to this number. "
+							"Zero disables parallel harvests.",
+							&OAIMaxHarvestWorkers,
+							OAI_HARVEST_DEFAULT_MAX_WORKERS,
+							0,
+							MAX_BACKENDS,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	/*
+	 * Server-wide request limits need shared memory, which can only be
+	 * reserved while the postmaster loads shared_preload_libraries.
+	 */
+	if (process_shared_preload_libraries_in_progress)
+	{
+		DefineCustomIntVariable("oai_fdw.max_shared_servers",
+								"Maximum number of foreign servers whose request limits and statistics are tracked in shared memory.",
+								NULL,
+								&OAIMaxSharedServers,
+								OAI_DEFAULT_MAX_SHARED_SERVERS,
+								1,
+								INT_MAX / 2,
+								PGC_POSTMASTER,
+								0,
+								NULL,
+								NULL,
+								NULL);
+
+#if PG_VERSION_NUM >= 150000
+		prev_shmem_request_hook = shmem_request_hook;
+		shmem_request_hook = OAIShmemRequest;
+#else
+		RequestAddinShmemSpace(OAIShmemSize());
+		RequestNamedLWLockTranche(OAI_SHMEM_NAME, 1);
+#endif
+		prev_shmem_startup_hook = shmem_startup_hook;
+		shmem_startup_hook = OAIShmemStartup;
+
+		DefineCustomStringVariable("oai_fdw.scheduler_database",
+								   "Database in which the scheduler worker runs the jobs of oai_fdw_harvest_jobs.",
+								   "Empty to disable the scheduler.",
+								   &OAISchedulerDatabase,
+								   "",
+								   PGC_POSTMASTER,
+								   0,
+								   NULL,
+								   NULL,
+								   NULL);
+
+		DefineCustomIntVariable("oai_fdw.scheduler_naptime",
+								"Time the scheduler worker sleeps between looking for due harvest jobs.",
+								NULL,
+								&OAISchedulerNaptime,
+								OAI_SCHEDULER_DEFAULT_NAPTIME,
+								1,
+								INT_MAX / 1000,
+								PGC_SIGHUP,
+								GUC_UNIT_S,
+								NULL,
+								NULL,
+								NULL);
+
+		if (OAISchedulerDatabase && OAISchedulerDatabase[0] != '\0')
+		{
+			BackgroundWorker worker;
+
+			memset(&worker, 0, sizeof(worker));
+			worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+			worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+			worker.bgw_restart_time = OAI_SCHEDULER_RESTART_TIME;
+			snprintf(worker.bgw_library_name, BGW_MAXLEN, OAI_FDW_NAME);
+			snprintf(worker.bgw_function_name, BGW_MAXLEN, "oai_fdw_scheduler_main");
+			snprintf(worker.bgw_name, BGW_MAXLEN, "oai_fdw scheduler");
+			snprintf(worker.bgw_type, BGW_MAXLEN, "oai_fdw scheduler");
+			RegisterBackgroundWorker(&worker);
+		}
+	}
+
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("oai_fdw");
+#else
+	EmitWarningsOnPlaceholders("oai_fdw");
+#endif
+}
+
+/*
+ * OAIShmemSize
+ * ------------
+ * Size of the shared memory needed to track the request limits and the
+ * statistics of oai_fdw.max_shared_servers foreign servers, and the
+ * progress of each backend.
+ */
+static Size OAIShmemSize(void)
+{
+	Size size = MAXALIGN(sizeof(OAISharedState));
+
+	size = add_size(size, hash_estimate_size(OAIMaxSharedServers, sizeof(OAIRateLimitEntry)));
+	size = add_size(size, hash_estimate_size(OAIMaxSharedServers, sizeof(OAIServerStatsEntry)));
+	size = add_size(size, mul_size(GetProgressSlotCount(), sizeof(OAIProgressSlot)));
+
+	return size;
+}
+
+#if PG_VERSION_NUM >= 150000
+/*
+ * OAIShmemRequest
+ * ---------------
+ * shmem_request_hook: reserves the shared memory and the LWLock used to
+ * enforce server-wide request limits.
+ */
+static void OAIShmemRequest(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(OAIShmemSize());
+	RequestNamedLWLockTranche(OAI_SHMEM_NAME, 1);
+}
+#endif
+
+/*
+ * OAIShmemStartup
+ * ---------------
+ * shmem_startup_hook: creates (or attaches to) the shared state and the
+ * hash tables holding the request limits and statistics of each foreign
+ * server, and the progress slots of the backends.
+ */
+static void OAIShmemStartup(void)
+{
+	HASHCTL info;
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	OAIShared = ShmemInitStruct(OAI_SHMEM_NAME, sizeof(OAISharedState), &found);
+
+	if (!found)
+	{
+		OAIShared->lock = &(GetNamedLWLockTranche(OAI_SHMEM_NAME))->lock;
+		OAIShared->progressSlots = GetProgressSlotCount();
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(OAIRateLimitKey);
+	info.entrysize = sizeof(OAIRateLimitEntry);
+
+	OAISharedServers = ShmemInitHash("oai_fdw servers",
+									 OAIMaxSharedServers,
+									 OAIMaxSharedServers,
+									 &info,
+									 HASH_ELEM | HASH_BLOBS);
+
+	info.entrysize = sizeof(OAIServerStatsEntry);
+
+	OAISharedStats = ShmemInitHash("oai_fdw server statistics",
+								   OAIMaxSharedServers,
+								   OAIMaxSharedServers,
+								   &info,
+								   HASH_ELEM | HASH_BLOBS);
+
+	OAIProgress = ShmemInitStruct("oai_fdw progress",
+								  mul_size(OAIShared->progressSlots, sizeof(OAIProgressSlot)),
+								  &found);
+
+	if (!found)
+	{
+		memset(OAIProgress, 0, mul_size(OAIShared->progressSlots, sizeof(OAIProgressSlot)));
+
+		for (int i = 0; i < OAIShared->progressSlots; i++)
+			SpinLockInit(&OAIProgress[i].mutex);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
 }
 
 Datum oai_fdw_handler(PG_FUNCTION_ARGS)
@@ -480,6 +1421,27 @@ OAIFdwState *GetServerInfo(const char *srvname)
 
 				state->request_timeout = strtol(timeout_str, &tailpt, 0);
 			}
+			else if (strcmp(def->defname, OAI_SERVER_OPTION_CACHE_TTL) == 0)
+			{
+				char *tailpt;
+				char *ttl_str = defGetString(def);
+
+				state->cacheTtl = strtol(ttl_str, &tailpt, 0);
+			}
+			else if (strcmp(def->defname, OAI_SERVER_OPTION_MAX_REQUESTS_PER_SECOND) == 0)
+			{
+				char *tailpt;
+				char *rate_str = defGetString(def);
+
+				state->maxRequestsPerSecond = strtod(rate_str, &tailpt);
+			}
+			else if (strcmp(def->defname, OAI_SERVER_OPTION_MAX_CONCURRENT_REQUESTS) == 0)
+			{
+				char *tailpt;
+				char *concurrency_str = defGetString(def);
+
+				state->maxConcurrentRequests = (int)strtol(concurrency_str, &tailpt, 0);
+			}
 			else if (strcmp(def->defname, OAI_SERVER_OPTION_REQUEST_REDIRECT) == 0)
 			{
 				state->requestRedirect = defGetBoolean(def);
@@ -586,83 +1548,101 @@ Datum oai_fdw_identity(PG_FUNCTION_ARGS)
 		SRF_RETURN_DONE(funcctx);
 }
 
-Datum oai_fdw_listSets(PG_FUNCTION_ARGS)
+/*
+ * InitMaterializedResult
+ * ----------------------
+ * Prepares a set-returning function to return its rows in materialize
+ * mode: checks that the caller accepts it and creates the tuplestore
+ * (in the per-query memory context) the rows are written into.
+ *
+ * fcinfo  : function call info of the set-returning function
+ * tupdesc : set to the descriptor of the result rows
+ *
+ * returns the tuplestore holding the result set
+ */
+static Tuplestorestate *InitMaterializedResult(FunctionCallInfo fcinfo, TupleDesc *tupdesc)
 {
-
-	text *srvname_text = PG_GETARG_TEXT_P(0);
-	char *srvname = text_to_cstring(srvname_text);
-	OAIFdwState *state = GetServerInfo(srvname);
-
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
 	MemoryContext oldcontext;
-	FuncCallContext *funcctx;
-	AttInMetadata *attinmeta;
-	TupleDesc tupdesc;
-	int call_cntr;
-	int max_calls;
+	TupleDesc resultdesc;
 
-	if (SRF_IS_FIRSTCALL())
-	{
-		List *sets;
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
 
-		/*
-		 * Loading USER MAPPING (if any)
-		 */
-		LoadOAIUserMapping(state);
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
 
-		sets = GetSets(state);
-		funcctx->user_fctx = sets;
+	if (get_call_result_type(fcinfo, NULL, &resultdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("function returning record called in context that cannot accept type record")));
 
-		if (sets)
-			funcctx->max_calls = sets->length;
-		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-							errmsg("function returning record called in context that cannot accept type record")));
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
 
-		attinmeta = TupleDescGetAttInMetadata(tupdesc);
-		funcctx->attinmeta = attinmeta;
+	*tupdesc = CreateTupleDescCopy(resultdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random, false, work_mem);
 
-		MemoryContextSwitchTo(oldcontext);
-	}
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = *tupdesc;
 
-	funcctx = SRF_PERCALL_SETUP();
+	MemoryContextSwitchTo(oldcontext);
 
-	call_cntr = funcctx->call_cntr;
-	max_calls = funcctx->max_calls;
-	attinmeta = funcctx->attinmeta;
+	return tupstore;
+}
 
-	if (call_cntr < max_calls)
+/*
+ * StoreOAISet
+ * -----------
+ * ForEachOAISet callback that writes the set as a row into the
+ * tuplestore of OAI_ListSets.
+ */
+static void StoreOAISet(OAISet *set, void *arg)
+{
+	OAISetTupleStore *store = (OAISetTupleStore *)arg;
+	Datum *values = (Datum *)palloc0(sizeof(Datum) * store->tupdesc->natts);
+	bool *nulls = (bool *)palloc0(sizeof(bool) * store->tupdesc->natts);
+
+	for (int i = 0; i < store->tupdesc->natts; i++)
 	{
-		Datum values[23];
-		bool nulls[23];
-		HeapTuple tuple;
-		Datum result;
-		OAISet *set_node = (OAISet *)list_nth((List *)funcctx->user_fctx, call_cntr);
+		Form_pg_attribute att = TupleDescAttr(store->tupdesc, i);
 
-		memset(nulls, 0, sizeof(nulls));
+		if (strcmp(NameStr(att->attname), "setname") == 0 && set->setName)
+			values[i] = CreateDatum(att->atttypid, att->atttypmod, set->setName);
+		else if (strcmp(NameStr(att->attname), "setspec") == 0 && set->setSpec)
+			values[i] = CreateDatum(att->atttypid, att->atttypmod, set->setSpec);
+		else
+			nulls[i] = true;
+	}
 
-		for (size_t i = 0; i < funcctx->attinmeta->tupdesc->natts; i++)
-		{
-			Form_pg_attribute att = TupleDescAttr(funcctx->attinmeta->tupdesc, i);
+	tuplestore_putvalues(store->tupstore, store->tupdesc, values, nulls);
 
-			if (strcmp(NameStr(att->attname), "setname") == 0)
-				values[i] = CreateDatum(att->atttypid, att->atttypmod, set_node->setName);
-			else if (strcmp(NameStr(att->attname), "setspec") == 0)
-				values[i] = CreateDatum(att->atttypid, att->atttypmod, set_node->setSpec);
-			else
-				nulls[i] = true;
-		}
+	pfree(values);
+	pfree(nulls);
+}
 
-		elog(DEBUG2, "  %s: creating heap tuple", __func__);
+Datum oai_fdw_listSets(PG_FUNCTION_ARGS)
+{
+	text *srvname_text = PG_GETARG_TEXT_P(0);
+	char *srvname = text_to_cstring(srvname_text);
+	OAIFdwState *state = GetServerInfo(srvname);
+	OAISetTupleStore store;
 
-		tuple = heap_form_tuple(funcctx->attinmeta->tupdesc, values, nulls);
-		result = HeapTupleGetDatum(tuple);
+	store.tupstore = InitMaterializedResult(fcinfo, &store.tupdesc);
 
-		SRF_RETURN_NEXT(funcctx, result);
-	}
-	else
-		SRF_RETURN_DONE(funcctx);
+	/*
+	 * Loading USER MAPPING (if any)
+	 */
+	LoadOAIUserMapping(state);
+
+	/* rows are stored page by page while following the resumptionTokens */
+	ForEachOAISet(state, StoreOAISet, &store);
+
+	return (Datum)0;
 }
 
 Datum oai_fdw_listMetadataFormats(PG_FUNCTION_ARGS)
@@ -670,84 +1650,51 @@ Datum oai_fdw_listMetadataFormats(PG_FUNCTION_ARGS)
 	text *srvname_text = PG_GETARG_TEXT_P(0);
 	const char *srvname = text_to_cstring(srvname_text);
 	OAIFdwState *state = GetServerInfo(srvname);
-
-	FuncCallContext *funcctx;
-	int call_cntr;
-	int max_calls;
+	Tuplestorestate *tupstore;
 	TupleDesc tupdesc;
-	AttInMetadata *attinmeta;
-	MemoryContext oldcontext;
+	ListCell *cell;
+	List *formats;
 
-	/* stuff done only on the first call of the function */
-	if (SRF_IS_FIRSTCALL())
-	{
-		List *formats;
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	tupstore = InitMaterializedResult(fcinfo, &tupdesc);
 
-		/*
-		 * Loading USER MAPPING (if any)
-		 */
-		LoadOAIUserMapping(state);
+	/*
+	 * Loading USER MAPPING (if any)
+	 */
+	LoadOAIUserMapping(state);
 
-		formats = GetMetadataFormats(state);
-		funcctx->user_fctx = formats;
-
-		if (formats)
-			funcctx->max_calls = formats->length;
-
-		/* Build a tuple descriptor for our result type */
-		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-							errmsg("function returning record called in context that cannot accept type record")));
-
-		attinmeta = TupleDescGetAttInMetadata(tupdesc);
-		funcctx->attinmeta = attinmeta;
-
-		MemoryContextSwitchTo(oldcontext);
-	}
-
-	/* stuff done on every function call */
-	funcctx = SRF_PERCALL_SETUP();
-
-	call_cntr = funcctx->call_cntr;
-	max_calls = funcctx->max_calls;
-	attinmeta = funcctx->attinmeta;
+	/*
+	 * ListMetadataFormats has no flow control in OAI-PMH, so the whole
+	 * list always comes in a single response.
+	 */
+	formats = GetMetadataFormats(state);
 
-	/* do when there is more left to send */
-	if (call_cntr < max_calls)
+	foreach (cell, formats)
 	{
-		Datum values[23];
-		bool nulls[23];
-		HeapTuple tuple;
-		Datum result;
-		OAIMetadataFormat *format = (OAIMetadataFormat *)list_nth((List *)funcctx->user_fctx, call_cntr);
+		OAIMetadataFormat *format = (OAIMetadataFormat *)lfirst(cell);
+		Datum *values = (Datum *)palloc0(sizeof(Datum) * tupdesc->natts);
+		bool *nulls = (bool *)palloc0(sizeof(bool) * tupdesc->natts);
 
-		memset(nulls, 0, sizeof(nulls));
-
-		for (size_t i = 0; i < funcctx->attinmeta->tupdesc->natts; i++)
+		for (int i = 0; i < tupdesc->natts; i++)
 		{
-			Form_pg_attribute att = TupleDescAttr(funcctx->attinmeta->tupdesc, i);
+			Form_pg_attribute att = TupleDescAttr(tupdesc, i);
 
-			if (strcmp(NameStr(att->attname), "metadataprefix") == 0)
+			if (strcmp(NameStr(att->attname), "metadataprefix") == 0 && format->metadataPrefix)
 				values[i] = CreateDatum(att->atttypid, att->atttypmod, format->metadataPrefix);
-			else if (strcmp(NameStr(att->attname), "schema") == 0)
+			else if (strcmp(NameStr(att->attname), "schema") == 0 && format->schema)
 				values[i] = CreateDatum(att->atttypid, att->atttypmod, format->schema);
-			else if (strcmp(NameStr(att->attname), "metadatanamespace") == 0)
+			else if (strcmp(NameStr(att->attname), "metadatanamespace") == 0 && format->metadataNamespace)
 				values[i] = CreateDatum(att->atttypid, att->atttypmod, format->metadataNamespace);
 			else
 				nulls[i] = true;
 		}
 
-		elog(DEBUG2, "  %s: creating heap tuple", __func__);
-
-		tuple = heap_form_tuple(funcctx->attinmeta->tupdesc, values, nulls);
-		result = HeapTupleGetDatum(tuple);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
 
-		SRF_RETURN_NEXT(funcctx, result);
+		pfree(values);
+		pfree(nulls);
 	}
-	else /* do when there is no more left */
-		SRF_RETURN_DONE(funcctx);
+
+	return (Datum)0;
 }
 
 Datum oai_fdw_validator(PG_FUNCTION_ARGS)
@@ -756,6 +1703,8 @@ Datum oai_fdw_validator(PG_FUNCTION_ARGS)
 	Oid catalog = PG_GETARG_OID(1);
 	ListCell *cell;
 	struct OAIFdwOption *opt;
+	bool federated = false;
+	bool resume = false;
 
 	/* Initialize found state to not found */
 	for (opt = valid_options; opt->optname; opt++)
@@ -814,6 +1763,45 @@ Datum oai_fdw_validator(PG_FUNCTION_ARGS)
 								 errhint("expected values are positive integers (timeout in seconds)")));
 				}
 
+				if (strcmp(opt->optname, OAI_SERVER_OPTION_CACHE_TTL) == 0)
+				{
+					char *endptr;
+					char *ttl_str = defGetString(def);
+					long ttl_val = strtol(ttl_str, &endptr, 0);
+
+					if (ttl_str[0] == '\0' || *endptr != '\0' || ttl_val < 0 || ttl_val > INT_MAX)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+								 errmsg("invalid %s: %s", def->defname, ttl_str),
+								 errhint("expected values are positive integers (cache lifetime in seconds, 0 disables the cache)")));
+				}
+
+				if (strcmp(opt->optname, OAI_SERVER_OPTION_MAX_REQUESTS_PER_SECOND) == 0)
+				{
+					char *endptr;
+					char *rate_str = defGetString(def);
+					double rate_val = strtod(rate_str, &endptr);
+
+					if (rate_str[0] == '\0' || *endptr != '\0' || !(rate_val > 0) || isinf(rate_val))
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+								 errmsg("invalid %s: %s", def->defname, rate_str),
+								 errhint("expected values are positive numbers (requests per second, e.g. 0.5 or 10)")));
+				}
+
+				if (strcmp(opt->optname, OAI_SERVER_OPTION_MAX_CONCURRENT_REQUESTS) == 0)
+				{
+					char *endptr;
+					char *concurrency_str = defGetString(def);
+					long concurrency_val = strtol(concurrency_str, &endptr, 0);
+
+					if (concurrency_str[0] == '\0' || *endptr != '\0' || concurrency_val < 1 || concurrency_val > INT_MAX)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+								 errmsg("invalid %s: %s", def->defname, concurrency_str),
+								 errhint("expected values are positive integers (requests in flight)")));
+				}
+
 				if (strcmp(opt->optname, OAI_SERVER_OPTION_CONNECTRETRY) == 0)
 				{
 					char *endptr;
@@ -827,6 +1815,61 @@ Datum oai_fdw_validator(PG_FUNCTION_ARGS)
 								 errhint("expected values are positive integers (retry attempts in case of failure)")));
 				}
 
+				if (strcmp(opt->optname, OAI_TABLE_OPTION_RESUME_FROM_CHECKPOINT) == 0)
+					resume = defGetBoolean(def);
+
+				if (strcmp(opt->optname, OAI_TABLE_OPTION_SERVERS) == 0)
+				{
+					char *servers_str = pstrdup(defGetString(def));
+					List *servers;
+					ListCell *lc;
+
+					if (!SplitIdentifierString(servers_str, ',', &servers) || servers == NIL)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+								 errmsg("invalid %s: %s", def->defname, defGetString(def)),
+								 errhint("expected value is a comma-separated list of foreign server names")));
+
+					foreach (lc, servers)
+					{
+						ListCell *prev;
+
+						for (prev = list_head(servers); prev != lc; prev = list_next(servers, prev))
+							if (strcmp((char *)lfirst(prev), (char *)lfirst(lc)) == 0)
+								ereport(ERROR,
+										(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+										 errmsg("invalid %s: server \"%s\" is listed more than once",
+												def->defname, (char *)lfirst(lc))));
+					}
+
+					/*
+					 * Servers that do not exist yet are only reported by the
+					 * scan, which checks USAGE again.
+					 */
+					foreach (lc, servers)
+					{
+						ForeignServer *server = GetForeignServerByName((char *)lfirst(lc), true);
+
+						if (server)
+							CheckFederatedServerUsage(server, GetUserId());
+					}
+
+					federated = true;
+				}
+
+				if (strcmp(opt->optname, OAI_TABLE_OPTION_MAX_CONCURRENT_SERVERS) == 0)
+				{
+					char *endptr;
+					char *concurrency_str = defGetString(def);
+					long concurrency_val = strtol(concurrency_str, &endptr, 0);
+
+					if (concurrency_str[0] == '\0' || *endptr != '\0' || concurrency_val < 1 || concurrency_val > INT_MAX)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+								 errmsg("invalid %s: %s", def->defname, concurrency_str),
+								 errhint("expected values are positive integers (servers requested at the same time)")));
+				}
+
 				if (strcmp(opt->optname, OAI_NODE_COLUMN_OPTION) == 0)
 				{
 					if (strcmp(defGetString(def), OAI_NODE_IDENTIFIER) != 0 &&
@@ -834,7 +1877,8 @@ Datum oai_fdw_validator(PG_FUNCTION_ARGS)
 						strcmp(defGetString(def), OAI_NODE_SETSPEC) != 0 &&
 						strcmp(defGetString(def), OAI_NODE_DATESTAMP) != 0 &&
 						strcmp(defGetString(def), OAI_NODE_CONTENT) != 0 &&
-						strcmp(defGetString(def), OAI_NODE_STATUS) != 0)
+						strcmp(defGetString(def), OAI_NODE_STATUS) != 0 &&
+						strcmp(defGetString(def), OAI_NODE_SERVER) != 0)
 					{
 						ereport(ERROR,
 								(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
@@ -860,6 +1904,13 @@ Datum oai_fdw_validator(PG_FUNCTION_ARGS)
 					 errmsg("invalid oai_fdw option \"%s\"", def->defname)));
 	}
 
+	/* a checkpoint holds the resumptionToken of a single repository */
+	if (federated && resume)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+				 errmsg("option '%s' cannot be used with '%s'",
+						OAI_TABLE_OPTION_RESUME_FROM_CHECKPOINT, OAI_TABLE_OPTION_SERVERS)));
+
 	for (opt = valid_options; opt->optname; opt++)
 	{
 		/* Required option for this catalog type is missing? */
@@ -873,1750 +1924,8184 @@ Datum oai_fdw_validator(PG_FUNCTION_ARGS)
 }
 
 /*
- * Parses information from the OAI Identify request.
- * https://www.openarchives.org/OAI/openarchivesprotocol.html#Identify
+ * GetOAIForeignTableState
+ * -----------------------
+ * Creates the state of requests to the OAI repository of a foreign table
+ * outside of a scan, with the options of its server, table and user
+ * mapping loaded.
+ *
+ * foreigntableid : oid of an oai_fdw foreign table
+ *
+ * returns the new state
  */
-static List *GetIdentity(OAIFdwState *state)
+static OAIFdwState *GetOAIForeignTableState(Oid foreigntableid)
 {
-	int oaiExecuteResponse;
-	List *result = NIL;
-
-	elog(DEBUG2, "%s called", __func__);
+	OAIFdwState *state;
+	ForeignTable *foreign_table;
+	ForeignServer *server;
+	ForeignDataWrapper *fdw;
 
-	state->requestVerb = OAI_REQUEST_IDENTIFY;
+	if (get_rel_relkind(foreigntableid) != RELKIND_FOREIGN_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a foreign table", get_rel_name(foreigntableid))));
 
-	oaiExecuteResponse = ExecuteOAIRequest(state);
+	foreign_table = GetForeignTable(foreigntableid);
+	server = GetForeignServer(foreign_table->serverid);
+	fdw = GetForeignDataWrapper(server->fdwid);
 
-	if (!state->xmldoc)
-		elog(ERROR, "invalid %s response from '%s'", state->requestVerb, state->url);
+	if (strcmp(fdw->fdwname, OAI_FDW_NAME) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not an %s foreign table", get_rel_name(foreigntableid), OAI_FDW_NAME)));
 
-	if (oaiExecuteResponse == OAI_SUCCESS)
-	{
-		xmlNodePtr oai_root;
-		xmlNodePtr Identity;
-		xmlNodePtr xmlroot = xmlDocGetRootElement(state->xmldoc);
+	state = (OAIFdwState *)palloc0(sizeof(OAIFdwState));
+	state->foreign_table = foreign_table;
+	state->foreign_server = server;
+	state->foreigntableid = foreigntableid;
 
-		if (xmlroot == NULL)
-			elog(ERROR, "invalid root element for %s response", state->requestVerb);
+	LoadOAIServerInfo(state);
+	LoadOAITableInfo(state);
+	LoadOAIUserMapping(state);
 
-		for (oai_root = xmlroot->children; oai_root != NULL; oai_root = oai_root->next)
-		{
-			if (oai_root->type != XML_ELEMENT_NODE)
-				continue;
+	if (state->federated)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("foreign table \"%s\" reads from several servers", get_rel_name(foreigntableid)),
+				 errhint("Use a foreign table of each server listed in the option '%s'.", OAI_TABLE_OPTION_SERVERS)));
 
-			if (xmlStrcmp(oai_root->name, (xmlChar *)OAI_REQUEST_IDENTIFY) != 0)
-				continue;
+	return state;
+}
 
-			for (Identity = oai_root->children; Identity != NULL; Identity = Identity->next)
-			{
-				OAIFdwIdentityNode *node;
-				xmlChar *el;
+/*
+ * HasDayGranularity
+ * -----------------
+ * Checks whether the repository only supports datestamps with day
+ * granularity (YYYY-MM-DD), according to its Identify response.
+ *
+ * state : state of the OAI request, its verb is overwritten
+ *
+ * returns true if the repository has day granularity
+ */
+static bool HasDayGranularity(OAIFdwState *state)
+{
+	ListCell *cell;
+	List *identity = GetIdentity(state);
 
-				if (Identity->type != XML_ELEMENT_NODE)
-					continue;
+	foreach (cell, identity)
+	{
+		OAIFdwIdentityNode *node = (OAIFdwIdentityNode *)lfirst(cell);
 
-				node = (OAIFdwIdentityNode *)palloc0(sizeof(OAIFdwIdentityNode));
-				node->name = pstrdup((char *)Identity->name);
-				el = xmlNodeGetContent(Identity);
-				node->description = el ? pstrdup((char *)el) : NULL;
-				if (el)
-					xmlFree(el);
-				result = lappend(result, node);
-			}
-		}
+		if (strcmp(node->name, "granularity") == 0 && node->description &&
+			strcmp(node->description, "YYYY-MM-DD") == 0)
+			return true;
 	}
 
-	xmlFreeDoc(state->xmldoc);
-
-	elog(DEBUG2, "%s => finished", __func__);
-
-	return result;
+	return false;
 }
 
 /*
- * Parses information from the OAI ListSets request.
- * https://www.openarchives.org/OAI/openarchivesprotocol.html#ListSets
+ * oai_fdw_complete_list_size
+ * --------------------------
+ * Probes the number of records a foreign table returns within a time
+ * window with a ListIdentifiers request. Repositories announce the size
+ * of a result set split into several pages in the completeListSize
+ * attribute of the resumptionToken; a result set fitting into a single
+ * page is counted. Windows of repositories with day granularity are
+ * widened to whole days.
+ *
+ * foreign_table : oai_fdw foreign table
+ * from          : start of the window (inclusive), NULL for no limit
+ * until         : end of the window (inclusive), NULL for no limit
+ *
+ * returns the number of records, or NULL if the repository does not
+ * report it
  */
-static List *GetSets(OAIFdwState *state)
+Datum oai_fdw_complete_list_size(PG_FUNCTION_ARGS)
 {
-	int oaiExecuteResponse;
-	List *result = NIL;
+	OAIFdwState *state = GetOAIForeignTableState(PG_GETARG_OID(0));
+	xmlNodePtr xmlroot;
+	xmlNodePtr oaipmh;
+	xmlNodePtr node;
+	int64 size = 0;
+	bool isnull = false;
 
 	elog(DEBUG2, "%s called", __func__);
 
-	state->requestVerb = OAI_REQUEST_LISTSETS;
-
-	oaiExecuteResponse = ExecuteOAIRequest(state);
+	if (!PG_ARGISNULL(1))
+		state->from = deparseTimestamp(PG_GETARG_DATUM(1));
 
-	if (!state->xmldoc)
-		elog(ERROR, "invalid %s response from '%s'", state->requestVerb, state->url);
+	if (!PG_ARGISNULL(2))
+		state->until = deparseTimestamp(PG_GETARG_DATUM(2));
 
-	if (oaiExecuteResponse == OAI_SUCCESS)
+	/*
+	 * Repositories with day granularity reject datestamps with time, so the
+	 * window is widened to the whole days it touches.
+	 */
+	if ((state->from || state->until) && HasDayGranularity(state))
 	{
-		xmlNodePtr oai_root;
-		xmlNodePtr ListSets;
-		xmlNodePtr SetElement;
-		xmlNodePtr xmlroot = xmlDocGetRootElement(state->xmldoc);
+		if (state->from && strlen(state->from) > 10)
+			state->from[10] = '\0';
+		if (state->until && strlen(state->until) > 10)
+			state->until[10] = '\0';
+	}
 
-		if (xmlroot == NULL)
-			elog(ERROR, "invalid root element for %s response", state->requestVerb);
+	state->requestVerb = OAI_REQUEST_LISTIDENTIFIERS;
 
-		for (oai_root = xmlroot->children; oai_root != NULL; oai_root = oai_root->next)
+	if (ExecuteOAIRequest(state) != OAI_SUCCESS || !state->xmldoc)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not retrieve the list size from '%s'", state->url)));
+
+	xmlroot = xmlDocGetRootElement(state->xmldoc);
+
+	for (oaipmh = xmlroot ? xmlroot->children : NULL; oaipmh != NULL; oaipmh = oaipmh->next)
+	{
+		if (xmlStrcmp(oaipmh->name, (xmlChar *)"error") == 0)
 		{
-			if (oai_root->type != XML_ELEMENT_NODE)
-				continue;
+			xmlChar *code = xmlGetProp(oaipmh, (xmlChar *)"code");
+			bool empty = code && xmlStrcmp(code, (xmlChar *)OAI_ERROR_NO_RECORD_MATCH) == 0;
 
-			if (xmlStrcmp(oai_root->name, (xmlChar *)OAI_REQUEST_LISTSETS) != 0)
-				continue;
+			xmlFree(code);
 
-			for (ListSets = oai_root->children; ListSets != NULL; ListSets = ListSets->next)
-			{
-				OAISet *set = (OAISet *)palloc0(sizeof(OAISet));
+			/* an empty window is no error here */
+			if (!empty)
+				RaiseOAIException(oaipmh);
 
-				if (ListSets->type != XML_ELEMENT_NODE)
-					continue;
-				if (xmlStrcmp(ListSets->name, (xmlChar *)"set") != 0)
-					continue;
+			break;
+		}
 
-				for (SetElement = ListSets->children; SetElement != NULL; SetElement = SetElement->next)
-				{
-					if (SetElement->type != XML_ELEMENT_NODE)
-						continue;
+		if (xmlStrcmp(oaipmh->name, (xmlChar *)OAI_REQUEST_LISTIDENTIFIERS) != 0)
+			continue;
 
-					if (xmlStrcmp(SetElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETSPEC) == 0)
-					{
-						xmlChar *el = xmlNodeGetContent(SetElement);
-						set->setSpec = pstrdup((char *)el);
-						xmlFree(el);
-					}
-					else if (xmlStrcmp(SetElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETNAME) == 0)
-					{
-						xmlChar *el = xmlNodeGetContent(SetElement);
-						set->setName = pstrdup((char *)el);
-						xmlFree(el);
-					}
-				}
+		for (node = oaipmh->children; node != NULL; node = node->next)
+		{
+			if (xmlStrcmp(node->name, (xmlChar *)OAI_RESPONSE_ELEMENT_HEADER) == 0)
+				size++;
+			else if (xmlStrcmp(node->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN) == 0)
+			{
+				xmlChar *listsize = xmlGetProp(node, (xmlChar *)OAI_RESPONSE_ELEMENT_COMPLETELISTSIZE);
+				xmlChar *token = xmlNodeGetContent(node);
 
-				result = lappend(result, set);
+				if (listsize)
+					size = strtoll((char *)listsize, NULL, 10);
+				else if (token && *token)
+					isnull = true; /* more pages of unknown size */
+
+				xmlFree(listsize);
+				xmlFree(token);
+				break;
 			}
 		}
 	}
 
 	xmlFreeDoc(state->xmldoc);
+	state->xmldoc = NULL;
 
-	elog(DEBUG2, "%s => finished", __func__);
+	if (isnull)
+		PG_RETURN_NULL();
 
-	return result;
+	PG_RETURN_INT64(size);
 }
 
 /*
- * Parses information from the OAI ListMetadataFormats request.
- * https://www.openarchives.org/OAI/openarchivesprotocol.html#ListMetadataFormats
+ * CountingXmlMalloc, CountingXmlRealloc, CountingXmlStrdup
+ * --------------------------------------------------------
+ * libxml2 allocation functions counting the allocations of
+ * oai_fdw_bench_parse, passing them on to the allocator of the session.
  */
-static List *GetMetadataFormats(OAIFdwState *state)
+static void *CountingXmlMalloc(size_t size)
 {
+	BenchXmlAllocations++;
+	return BenchXmlMalloc(size);
+}
 
-	int oaiExecuteResponse;
-	List *result = NIL;
+static void *CountingXmlRealloc(void *ptr, size_t size)
+{
+	BenchXmlAllocations++;
+	return BenchXmlRealloc(ptr, size);
+}
 
-	elog(DEBUG2, "  %s called", __func__);
+static char *CountingXmlStrdup(const char *str)
+{
+	BenchXmlAllocations++;
+	return BenchXmlStrdup(str);
+}
 
-	state->requestVerb = OAI_REQUEST_LISTMETADATAFORMATS;
+/*
+ * oai_fdw_bench_parse
+ * -------------------
+ * Micro-benchmark of the record extraction: parses an OAI response stored
+ * in a file and converts its records into OAIRecords, like a scan does
+ * with every page, without any network involved. Parsing (libxml2) and
+ * extraction are timed separately.
+ *
+ * file       : ListRecords, ListIdentifiers or GetRecord response
+ * iterations : number of times the response is parsed
+ *
+ * returns the records of the response, the file size, the average
+ * nanoseconds per record, libxml2 allocations per record and bytes
+ * allocated from PostgreSQL memory contexts per record (PostgreSQL 13+)
+ */
+Datum oai_fdw_bench_parse(PG_FUNCTION_ARGS)
+{
+	char *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	int32 iterations = PG_GETARG_INT32(1);
+	Datum values[OAI_BENCH_PARSE_COLS];
+	bool nulls[OAI_BENCH_PARSE_COLS];
+	TupleDesc tupdesc;
+	MemoryContext context;
+	MemoryContext oldcontext;
+	struct stat st;
+	char *buffer;
+	int fd;
+	int64 records = 0;
+	double parse_ns = 0;
+	double extract_ns = 0;
+#if PG_VERSION_NUM >= 130000
+	double palloc_bytes = 0;
+#endif
+	xmlFreeFunc freeFunc;
+	xmlMallocFunc mallocFunc;
+	xmlReallocFunc reallocFunc;
+	xmlStrdupFunc strdupFunc;
 
-	oaiExecuteResponse = ExecuteOAIRequest(state);
+	elog(DEBUG2, "%s called: '%s'", __func__, path);
 
-	if (!state->xmldoc)
-		elog(ERROR, "invalid %s response from '%s'", state->requestVerb, state->url);
+	if (iterations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("iterations must be greater than zero")));
 
-	if (oaiExecuteResponse == OAI_SUCCESS)
-	{
-		xmlNodePtr oai_root;
-		xmlNodePtr ListMetadataFormats;
-		xmlNodePtr MetadataElement;
-		xmlNodePtr xmlroot = xmlDocGetRootElement(state->xmldoc);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("function returning record called in context that cannot accept type record")));
 
-		if (xmlroot == NULL)
-			elog(ERROR, "invalid root element for %s response", state->requestVerb);
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
 
-		for (oai_root = xmlroot->children; oai_root != NULL; oai_root = oai_root->next)
-		{
-			if (oai_root->type != XML_ELEMENT_NODE)
-				continue;
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
 
-			if (xmlStrcmp(oai_root->name, (xmlChar *)OAI_REQUEST_LISTMETADATAFORMATS) != 0)
-				continue;
+	if (fstat(fd, &st) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", path)));
 
-			for (ListMetadataFormats = oai_root->children; ListMetadataFormats != NULL; ListMetadataFormats = ListMetadataFormats->next)
-			{
-				OAIMetadataFormat *format = (OAIMetadataFormat *)palloc0(sizeof(OAIMetadataFormat));
+	buffer = palloc(st.st_size + 1);
 
-				if (ListMetadataFormats->type != XML_ELEMENT_NODE)
-					continue;
-				if (xmlStrcmp(ListMetadataFormats->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATAFORMAT) != 0)
-					continue;
+	if (read(fd, buffer, st.st_size) != st.st_size)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", path)));
 
-				for (MetadataElement = ListMetadataFormats->children; MetadataElement != NULL; MetadataElement = MetadataElement->next)
-				{
-					if (MetadataElement->type != XML_ELEMENT_NODE)
-						continue;
+	buffer[st.st_size] = '\0';
+	CloseTransientFile(fd);
 
-					if (xmlStrcmp(MetadataElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATAPREFIX) == 0)
-					{
-						xmlChar *el = xmlNodeGetContent(MetadataElement);
-						format->metadataPrefix = pstrdup((char *)el);
-						xmlFree(el);
-					}
-					else if (xmlStrcmp(MetadataElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SCHEMA) == 0)
-					{
-						xmlChar *el = xmlNodeGetContent(MetadataElement);
-						format->schema = pstrdup((char *)el);
-						xmlFree(el);
-					}
-					else if (xmlStrcmp(MetadataElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATANAMESPACE) == 0)
-					{
-						xmlChar *el = xmlNodeGetContent(MetadataElement);
-						format->metadataNamespace = pstrdup((char *)el);
-						xmlFree(el);
-					}
-				}
+	context = AllocSetContextCreate(CurrentMemoryContext,
+									"oai_fdw_bench_parse",
+									ALLOCSET_DEFAULT_SIZES);
 
-				result = lappend(result, format);
-			}
-		}
-	}
+	xmlMemGet(&freeFunc, &mallocFunc, &reallocFunc, &strdupFunc);
+	BenchXmlMalloc = mallocFunc;
+	BenchXmlRealloc = reallocFunc;
+	BenchXmlStrdup = strdupFunc;
+	BenchXmlAllocations = 0;
+	xmlMemSetup(freeFunc, CountingXmlMalloc, CountingXmlRealloc, CountingXmlStrdup);
 
-	xmlFreeDoc(state->xmldoc);
+	PG_TRY();
+	{
+		for (int i = 0; i < iterations; i++)
+		{
+			xmlDocPtr doc;
+			xmlNodePtr root;
+			xmlNodePtr verb;
+			xmlNodePtr node;
+			char *metadataPrefix = "";
+			instr_time start;
+			instr_time duration;
+#if PG_VERSION_NUM >= 130000
+			Size allocated = MemoryContextMemAllocated(context, true);
+#endif
 
-	elog(DEBUG2, "  %s => finished.", __func__);
+			CHECK_FOR_INTERRUPTS();
 
-	return result;
-}
+			oldcontext = MemoryContextSwitchTo(context);
+			records = 0;
 
-/**
- * Checks if a given URL is valid.
- */
-static int CheckURL(char *url)
-{
+			INSTR_TIME_SET_CURRENT(start);
+			doc = xmlReadMemory(buffer, st.st_size, NULL, NULL, XML_PARSE_NOBLANKS);
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, start);
+			parse_ns += INSTR_TIME_GET_DOUBLE(duration) * 1e9;
 
-	CURLUcode code;
-	CURLU *handler = curl_url();
+			root = doc ? xmlDocGetRootElement(doc) : NULL;
 
-	elog(DEBUG2, "%s called > '%s'", __func__, url);
+			if (!root)
+			{
+				if (doc)
+					xmlFreeDoc(doc);
 
-	code = curl_url_set(handler, CURLUPART_URL, url, 0);
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_XML_DOCUMENT),
+						 errmsg("invalid XML document in file \"%s\"", path)));
+			}
 
-	curl_url_cleanup(handler);
+			INSTR_TIME_SET_CURRENT(start);
 
-	elog(DEBUG2, "  %s handler return code: %u", __func__, code);
+			for (verb = root->children; verb != NULL; verb = verb->next)
+			{
+				if (xmlStrcmp(verb->name, (xmlChar *)"request") == 0)
+				{
+					xmlChar *prefix = xmlGetProp(verb, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATAPREFIX);
 
-	if (code != 0)
-	{
-		elog(DEBUG2, "%s: invalid URL (%u) > '%s'", __func__, code, url);
+					if (prefix)
+						metadataPrefix = pstrdup((char *)prefix);
+					xmlFree(prefix);
+				}
+				else if (xmlStrcmp(verb->name, (xmlChar *)OAI_REQUEST_LISTRECORDS) == 0 ||
+						 xmlStrcmp(verb->name, (xmlChar *)OAI_REQUEST_LISTIDENTIFIERS) == 0 ||
+						 xmlStrcmp(verb->name, (xmlChar *)OAI_REQUEST_GETRECORD) == 0)
+				{
+					for (node = verb->children; node != NULL; node = node->next)
+						if (ExtractOAIRecord(doc, node, metadataPrefix))
+							records++;
+				}
+			}
 
-		return code;
+			INSTR_TIME_SET_CURRENT(duration);
+			INSTR_TIME_SUBTRACT(duration, start);
+			extract_ns += INSTR_TIME_GET_DOUBLE(duration) * 1e9;
+
+#if PG_VERSION_NUM >= 130000
+			palloc_bytes += MemoryContextMemAllocated(context, true) - allocated;
+#endif
+			xmlFreeDoc(doc);
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(context);
+
+			if (records == 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_NO_DATA_FOUND),
+						 errmsg("no OAI records found in file \"%s\"", path)));
+		}
+	}
+	PG_CATCH();
+	{
+		xmlMemSetup(freeFunc, mallocFunc, reallocFunc, strdupFunc);
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
+
+	xmlMemSetup(freeFunc, mallocFunc, reallocFunc, strdupFunc);
+	MemoryContextDelete(context);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(records);
+	values[1] = Int64GetDatum((int64)st.st_size);
+	values[2] = Float8GetDatum(parse_ns / iterations / records);
+	values[3] = Float8GetDatum(extract_ns / iterations / records);
+	values[4] = Float8GetDatum((parse_ns + extract_ns) / iterations / records);
+	values[5] = Float8GetDatum((double)BenchXmlAllocations / iterations / records);
+#if PG_VERSION_NUM >= 130000
+	values[6] = Float8GetDatum(palloc_bytes / iterations / records);
+#else
+	nulls[6] = true;
+#endif
 
-	return OAI_SUCCESS;
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
 }
 
-static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
+/*
+ * HasUniqueIndex
+ * --------------
+ * Checks whether a column is covered by a unique index on its own, i.e.
+ * whether it can be used as ON CONFLICT target.
+ *
+ * rel    : the table
+ * attnum : attribute number of the column
+ *
+ * returns true if such an index exists
+ */
+static bool HasUniqueIndex(Relation rel, AttrNumber attnum)
 {
-	size_t realsize = size * nmemb;
-	struct MemoryStruct *mem = (struct MemoryStruct *)userp;
-	char *ptr = repalloc(mem->memory, mem->size + realsize + 1);
-
-	if (!ptr)
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-				 errmsg("out of memory (repalloc returned NULL)")));
+	List *indexes = RelationGetIndexList(rel);
+	ListCell *cell;
+	bool result = false;
 
-	mem->memory = ptr;
-	memcpy(&(mem->memory[mem->size]), contents, realsize);
-	mem->size += realsize;
-	mem->memory[mem->size] = 0;
+	foreach (cell, indexes)
+	{
+		HeapTuple tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(lfirst_oid(cell)));
+		Form_pg_index index;
 
-	return realsize;
-}
+		if (!HeapTupleIsValid(tuple))
+			continue;
 
-static size_t HeaderCallbackFunction(char *contents, size_t size, size_t nmemb, void *userp)
-{
-	size_t nbytes = size * nmemb;
-	struct MemoryStruct *mem = (struct MemoryStruct *)userp;
-	char *ptr;
-	char *line = palloc(nbytes + 1);
-	size_t linelen = nbytes;
+		index = (Form_pg_index)GETSTRUCT(tuple);
 
-	memcpy(line, contents, nbytes);
-	line[nbytes] = '\0';
+		result = index->indisunique &&
+				 index->indimmediate &&
+				 index->indnkeyatts == 1 &&
+				 index->indkey.values[0] == attnum &&
+				 heap_attisnull(tuple, Anum_pg_index_indexprs, NULL) &&
+				 heap_attisnull(tuple, Anum_pg_index_indpred, NULL);
 
-	while (linelen > 0 && (line[linelen - 1] == '\r' || line[linelen - 1] == '\n'))
-		line[--linelen] = '\0';
+		ReleaseSysCache(tuple);
 
-	if (pg_strncasecmp(line, "content-type:", 13) == 0 &&
-		pg_strncasecmp(line, "content-type: text/xml", 22) != 0 &&
-		pg_strncasecmp(line, "content-type: application/xml", 29) != 0)
-	{
-		elog(WARNING, "unsupported content-type: \"%s\"", line);
+		if (result)
+			break;
 	}
-	pfree(line);
 
-	ptr = repalloc(mem->memory, mem->size + nbytes + 1);
-	if (!ptr)
-		ereport(ERROR, (errcode(ERRCODE_FDW_OUT_OF_MEMORY),
-						errmsg("[%s] out of memory", __func__)));
-	mem->memory = ptr;
-	memcpy(&(mem->memory[mem->size]), contents, nbytes);
-	mem->size += nbytes;
-	mem->memory[mem->size] = 0;
-	return nbytes;
+	list_free(indexes);
+
+	return result;
 }
 
 /*
- * IsSensitiveHeader
+ * GetExtensionTable
  * -----------------
- * Returns the field-name of a sensitive HTTP header if `line` begins with
- * one, or NULL otherwise.  Comparison is case-insensitive (RFC 9110 §5.1).
+ * Qualified name of a bookkeeping table of oai_fdw, e.g. the one of
+ * OAI_Sync, which lives in the schema of the extension. Must be called
+ * within an SPI connection.
+ *
+ * name       : name of the table
+ * missing_ok : return NULL instead of raising an error if the extension
+ *              is not installed or does not have the table (yet)
+ *
+ * returns a palloc'd, quoted table name
  */
-static const char *
-IsSensitiveHeader(const char *line)
+static char *GetExtensionTable(const char *name, bool missing_ok)
 {
-	static const struct
+	Oid argtypes[1] = {TEXTOID};
+	Datum args[1];
+	bool isnull;
+	int ret;
+
+	args[0] = CStringGetTextDatum(name);
+
+	ret = SPI_execute_with_args("SELECT pg_catalog.quote_ident(n.nspname), c.oid IS NOT NULL "
+								"FROM pg_catalog.pg_extension e "
+								"JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+								"LEFT JOIN pg_catalog.pg_class c ON c.relnamespace = n.oid AND c.relname = $1 "
+								"WHERE e.extname = 'oai_fdw'",
+								1, argtypes, args, NULL, true, 1);
+
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "%s: could not look up extension \"oai_fdw\": %s", __func__, SPI_result_code_string(ret));
+
+	if (SPI_processed != 1)
 	{
-		const char *name;
-		size_t len;
-	} sensitive_headers[] = {
-		{"Authorization:", sizeof("Authorization:") - 1},
-		{"Proxy-Authorization:", sizeof("Proxy-Authorization:") - 1},
-		{NULL, 0}};
+		if (missing_ok)
+			return NULL;
 
-	for (int i = 0; sensitive_headers[i].name != NULL; i++)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("extension \"oai_fdw\" is not installed in this database")));
+	}
+
+	if (!DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull)))
 	{
-		if (strncasecmp(line, sensitive_headers[i].name,
-						sensitive_headers[i].len) == 0)
-			return sensitive_headers[i].name;
+		if (missing_ok)
+			return NULL;
+
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("table \"%s\" of extension \"oai_fdw\" does not exist", name),
+				 errhint("Update the extension with ALTER EXTENSION oai_fdw UPDATE.")));
 	}
 
-	return NULL;
+	return psprintf("%s.%s", SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1), name);
 }
 
 /*
- * CURLDebugCallback
+ * GetExtensionOwner
  * -----------------
- * Custom libcurl debug callback. Routes all verbose output through
- * PostgreSQL's elog() at DEBUG3 level rather than writing directly to
- * stderr, and redacts Authorization headers so credentials are never
- * written to server logs.
+ * Owner of the extension oai_fdw, and thereby of its bookkeeping tables,
+ * which are not granted to anyone. Functions available to every user
+ * access these tables as this role, after checking the privileges of the
+ * caller on the objects involved. Must be called within an SPI connection.
  *
- * handle  : the curl handle (unused)
- * type    : category of the debug data
- * data    : pointer to the debug data (NOT null-terminated)
- * size    : number of bytes in data
- * userptr : user-supplied pointer (unused)
+ * returns the OID of the owner
  */
-static int
-CURLDebugCallback(CURL *handle, curl_infotype type, char *data, size_t size, void *userptr)
+static Oid GetExtensionOwner(void)
 {
-	const char *prefix;
-	StringInfoData buf;
+	bool isnull;
+	int ret;
 
-	switch (type)
-	{
-	case CURLINFO_TEXT:
-		prefix = "* ";
-		break;
-	case CURLINFO_HEADER_IN:
-		prefix = "< ";
-		break;
-	case CURLINFO_HEADER_OUT:
-		prefix = "> ";
-		break;
-	default:
-		return 0; /* skip raw data blobs (bodies, SSL frames) */
-	}
+	ret = SPI_execute("SELECT e.extowner FROM pg_catalog.pg_extension e WHERE e.extname = 'oai_fdw'", true, 1);
 
-	/*
-	 * curl's data pointer is NOT null-terminated, so copy it into a palloc'd
-	 * buffer before using any string functions on it.
-	 */
-	initStringInfo(&buf);
-	appendBinaryStringInfo(&buf, data, (int)size);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "%s: could not look up extension \"oai_fdw\": %s", __func__, SPI_result_code_string(ret));
 
-	if (type == CURLINFO_HEADER_OUT)
-	{
-		/*
-		 * CURLINFO_HEADER_OUT delivers the entire outgoing request header
-		 * block (request line + all headers) as one multi-line chunk per
-		 * invocation.  Split it line-by-line so each sensitive header can be
-		 * redacted individually.
-		 */
-		char *pos = buf.data;
+	if (SPI_processed != 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("extension \"oai_fdw\" is not installed in this database")));
 
-		while (*pos != '\0')
-		{
-			char *eol = pos + strcspn(pos, "\r\n");
-			char saved = *eol;
-			const char *match;
+	return DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+}
 
-			*eol = '\0'; /* temporarily terminate the line */
+/*
+ * CanBulkInsert
+ * -------------
+ * Checks whether the records of a sync can be written straight into the
+ * heap of the target table with BeginBulkInsert. This bypasses the
+ * executor, so it is only done for plain tables without triggers, CHECK
+ * constraints, row level security and generated columns, if the current
+ * user may insert into the whole table, and if every column is either
+ * fed by a column of the same type of the foreign table or has no
+ * default value.
+ *
+ * target : the target table
+ * source : tuple descriptor of the foreign table
+ * attmap : for each attribute of the target, the attribute number of the
+ *          foreign table column that feeds it, or InvalidAttrNumber
+ *
+ * returns true if the bulk path can be used
+ */
+static bool CanBulkInsert(Relation target, TupleDesc source, AttrNumber *attmap)
+{
+	TupleDesc tupdesc = RelationGetDescr(target);
 
-			if (*pos != '\0') /* skip blank lines */
-			{
-				match = IsSensitiveHeader(pos);
-				if (match)
-					elog(DEBUG3, "[curl] > %s [REDACTED]", match);
-				else
-					elog(DEBUG3, "[curl] > %s", pos);
-			}
+	if (target->rd_rel->relkind != RELKIND_RELATION || target->trigdesc)
+		return false;
 
-			*eol = saved;
-			pos = eol;
-			while (*pos == '\r' || *pos == '\n')
-				pos++;
-		}
-	}
-	else
+	if (tupdesc->constr && tupdesc->constr->num_check > 0)
+		return false;
+
+	if (check_enable_rls(RelationGetRelid(target), InvalidOid, true) == RLS_ENABLED)
+		return false;
+
+	if (pg_class_aclcheck(RelationGetRelid(target), GetUserId(), ACL_INSERT) != ACLCHECK_OK)
+		return false;
+
+	for (int i = 0; i < tupdesc->natts; i++)
 	{
-		const char *match;
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
 
-		/* Strip trailing CRLF for cleaner log output. */
-		while (buf.len > 0 &&
-			   (buf.data[buf.len - 1] == '\n' || buf.data[buf.len - 1] == '\r'))
-			buf.data[--buf.len] = '\0';
+		if (att->attisdropped)
+			continue;
 
-		/*
-		 * Redact sensitive response headers.  Informational text lines
-		 * (CURLINFO_TEXT) are logged as-is — they never contain raw
-		 * credential values.
-		 */
-		match = (type == CURLINFO_HEADER_IN) ? IsSensitiveHeader(buf.data) : NULL;
-		if (match)
-			elog(DEBUG3, "[curl] %s%s [REDACTED]", prefix, match);
+#if PG_VERSION_NUM >= 120000
+		if (att->attgenerated)
+			return false;
+#endif
+
+		if (attmap[i] == InvalidAttrNumber)
+		{
+			if (att->atthasdef || att->attidentity)
+				return false;
+		}
 		else
-			elog(DEBUG3, "[curl] %s%s", prefix, buf.data);
+		{
+			Form_pg_attribute srcatt = TupleDescAttr(source, attmap[i] - 1);
+
+			/* the SQL path would apply an assignment cast */
+			if (srcatt->atttypid != att->atttypid ||
+				(att->atttypmod != -1 && srcatt->atttypmod != att->atttypmod))
+				return false;
+		}
 	}
 
-	pfree(buf.data);
-	return 0;
+	return true;
 }
 
 /*
- * CURLProgressCallback
- * --------------------
- * Progress callback function for cURL requests. This allows us to
- * check for interruptions to immediatelly cancel the request.
+ * BeginBulkInsert
+ * ---------------
+ * Prepares a batched insert into the heap of the target table, in the
+ * manner of COPY FROM. If the table was created or truncated in the
+ * current subtransaction the records are inserted frozen, and on servers
+ * prior to PostgreSQL 13 running with wal_level minimal no WAL is
+ * written for them.
+ *
+ * target      : the target table, which passed CanBulkInsert
+ * attmap      : see CanBulkInsert
+ * hashattr    : target column filled with the md5 of the content, or
+ *               InvalidAttrNumber
+ * contentattr : foreign table column with the content
  *
- * dltotal: Total bytes to download
- * dlnow: Bytes downloaded so far
- * ultotal: Total bytes to upload
- * ulnow: Bytes uploaded so far
+ * returns the bulk insert state
  */
-static int CURLProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+static OAIBulkInsert *BeginBulkInsert(Relation target, AttrNumber *attmap, AttrNumber hashattr, AttrNumber contentattr)
 {
-	CHECK_FOR_INTERRUPTS();
+	OAIBulkInsert *bulk = (OAIBulkInsert *)palloc0(sizeof(OAIBulkInsert));
+	SubTransactionId subid = GetCurrentSubTransactionId();
+	bool newRelfile = target->rd_createSubid == subid;
 
-	return 0;
-}
+	/* same test as CopyFrom: only a relfile of this very subtransaction */
+#if PG_VERSION_NUM >= 160000
+	newRelfile |= target->rd_newRelfilelocatorSubid == subid;
+#else
+	newRelfile |= target->rd_newRelfilenodeSubid == subid;
+#endif
 
-/**
- * Executes the HTTP request to the OAI repository using the
- * libcurl library.
- */
-static int ExecuteOAIRequest(OAIFdwState *state)
-{
+	bulk->rel = target;
+	bulk->cxt = CurrentMemoryContext;
+	bulk->attmap = attmap;
+	bulk->hashattr = hashattr;
+	bulk->contentattr = contentattr;
+	bulk->cid = GetCurrentCommandId(true);
+	bulk->bistate = GetBulkInsertState();
+	bulk->batchcxt = AllocSetContextCreate(CurrentMemoryContext,
+										   "oai_fdw_bulk_insert",
+										   ALLOCSET_DEFAULT_SIZES);
 
-	CURL *curl;
-	CURLcode res;
-	StringInfoData url_buffer;
-	StringInfoData user_agent;
-	char errbuf[CURL_ERROR_SIZE];
-	struct MemoryStruct chunk;
-	struct MemoryStruct chunk_header;
-	long maxretries = OAI_DEFAULT_MAX_RETRY;
-	long connectTimeout = OAI_DEFAULT_CONNECT_TIMEOUT;
-	long request_timeout = OAI_DEFAULT_REQUEST_TIMEOUT;
-
-	struct curl_slist *headers = NULL;
-
-	if (state->maxretries)
-		maxretries = state->maxretries;
+	/*
+	 * Rows written frozen would be visible to snapshots taken before the
+	 * table was created, so this is only done if there are none.
+	 */
+	if (newRelfile && ThereAreNoPriorRegisteredSnapshots() && ThereAreNoReadyPortals())
+	{
+#if PG_VERSION_NUM >= 120000
+		bulk->options |= TABLE_INSERT_FROZEN;
+#else
+		bulk->options |= HEAP_INSERT_FROZEN;
+#endif
+		bulk->frozen = true;
+	}
 
-	if (state->connectTimeout)
-		connectTimeout = state->connectTimeout;
+#if PG_VERSION_NUM < 130000
+	if (newRelfile && !XLogIsNeeded())
+#if PG_VERSION_NUM >= 120000
+		bulk->options |= TABLE_INSERT_SKIP_WAL;
+#else
+		bulk->options |= HEAP_INSERT_SKIP_WAL;
+#endif
+#endif
 
-	if (state->request_timeout)
-		request_timeout = state->request_timeout;
+	bulk->estate = CreateExecutorState();
+	bulk->estate->es_output_cid = bulk->cid;
+	bulk->rri = makeNode(ResultRelInfo);
+	InitResultRelInfo(bulk->rri, target, 0, NULL, 0);
+	ExecOpenIndices(bulk->rri, false);
 
-	chunk.memory = palloc(1);
-	chunk.size = 0; /* no data at this point */
-	chunk_header.memory = palloc(1);
-	chunk_header.size = 0; /* no data at this point */
+#if PG_VERSION_NUM < 140000
+	bulk->estate->es_result_relation_info = bulk->rri;
+#endif
 
-	initStringInfo(&url_buffer);
+#if PG_VERSION_NUM >= 120000
+	bulk->slots = (TupleTableSlot **)palloc0(OAI_BULK_INSERT_BATCH_SIZE * sizeof(TupleTableSlot *));
+#else
+	bulk->tuples = (HeapTuple *)palloc0(OAI_BULK_INSERT_BATCH_SIZE * sizeof(HeapTuple));
+	bulk->slot = MakeSingleTupleTableSlot(RelationGetDescr(target));
+#endif
 
-	elog(DEBUG2, "%s called: base url > '%s' ", __func__, state->url);
+	elog(DEBUG1, "%s: bulk insert into \"%s\"%s", __func__, RelationGetRelationName(target),
+		 bulk->frozen ? " (frozen)" : "");
 
-	curl = curl_easy_init();
+	return bulk;
+}
 
-	if (!curl)
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-				 errmsg("%s: failed to initialize curl", __func__)));
+/*
+ * FlushBulkInsert
+ * ---------------
+ * Writes the buffered records into the heap with a single multi-insert
+ * and inserts their index entries.
+ *
+ * bulk : bulk insert state
+ */
+static void FlushBulkInsert(OAIBulkInsert *bulk)
+{
+	if (bulk->nbuffered == 0)
+		return;
 
-	appendStringInfo(&url_buffer, "verb=%s", state->requestVerb);
+#if PG_VERSION_NUM >= 120000
+	table_multi_insert(bulk->rel, bulk->slots, bulk->nbuffered, bulk->cid, bulk->options, bulk->bistate);
+#else
+	heap_multi_insert(bulk->rel, bulk->tuples, bulk->nbuffered, bulk->cid, bulk->options, bulk->bistate);
+#endif
 
-	if (strcmp(state->requestVerb, OAI_REQUEST_LISTRECORDS) == 0)
+	for (int i = 0; i < bulk->nbuffered; i++)
 	{
-		if (state->set)
-		{
-			char *encoded_set = curl_easy_escape(curl, state->set, 0);
-			elog(DEBUG2, "  %s (%s): appending 'set' > %s", __func__, state->requestVerb, state->set);
-			appendStringInfo(&url_buffer, "&set=%s", encoded_set);
-			curl_free(encoded_set);
-		}
-
-		if (state->from)
+		if (bulk->rri->ri_NumIndices > 0)
 		{
-			char *encoded_from = curl_easy_escape(curl, state->from, 0);
-			elog(DEBUG2, "  %s (%s): appending 'from' > %s", __func__, state->requestVerb, state->from);
-			appendStringInfo(&url_buffer, "&from=%s", encoded_from);
-			curl_free(encoded_from);
+			List *recheck;
+
+			ResetPerTupleExprContext(bulk->estate);
+#if PG_VERSION_NUM >= 160000
+			recheck = ExecInsertIndexTuples(bulk->rri, bulk->slots[i], bulk->estate, false, false, NULL, NIL, false);
+#elif PG_VERSION_NUM >= 140000
+			recheck = ExecInsertIndexTuples(bulk->rri, bulk->slots[i], bulk->estate, false, false, NULL, NIL);
+#elif PG_VERSION_NUM >= 120000
+			recheck = ExecInsertIndexTuples(bulk->slots[i], bulk->estate, false, NULL, NIL);
+#else
+			ExecStoreTuple(bulk->tuples[i], bulk->slot, InvalidBuffer, false);
+			recheck = ExecInsertIndexTuples(bulk->slot, &(bulk->tuples[i]->t_self), bulk->estate, false, NULL, NIL);
+#endif
+			list_free(recheck);
 		}
 
-		if (state->until)
-		{
-			char *encoded_until = curl_easy_escape(curl, state->until, 0);
-			elog(DEBUG2, "  %s (%s): appending 'until' > %s", __func__, state->requestVerb, state->until);
-			appendStringInfo(&url_buffer, "&until=%s", encoded_until);
-			curl_free(encoded_until);
-		}
+#if PG_VERSION_NUM >= 120000
+		ExecClearTuple(bulk->slots[i]);
+#endif
+	}
 
-		if (state->metadataPrefix)
-		{
-			char *encoded_metadataPrefix = curl_easy_escape(curl, state->metadataPrefix, 0);
-			elog(DEBUG2, "  %s (%s): appending 'metadataPrefix' > %s", __func__, state->requestVerb, state->metadataPrefix);
-			appendStringInfo(&url_buffer, "&metadataPrefix=%s", encoded_metadataPrefix);
-			curl_free(encoded_metadataPrefix);
-		}
+	bulk->inserted += bulk->nbuffered;
+	bulk->nbuffered = 0;
 
-		if (state->resumptionToken)
-		{
-			char *encoded_token;
+	MemoryContextReset(bulk->batchcxt);
+}
 
-			elog(DEBUG2, "  %s (%s): appending 'resumptionToken' > %s", __func__, state->requestVerb, state->resumptionToken);
-			resetStringInfo(&url_buffer);
+/*
+ * BulkInsertRecord
+ * ----------------
+ * Buffers a record of the foreign table for the next multi-insert. The
+ * record is copied, so the slot can be reused afterwards.
+ *
+ * bulk : bulk insert state
+ * slot : record in the layout of the foreign table
+ */
+static void BulkInsertRecord(OAIBulkInsert *bulk, TupleTableSlot *slot)
+{
+	TupleDesc tupdesc = RelationGetDescr(bulk->rel);
+	MemoryContext oldcxt;
+	Datum *values;
+	bool *nulls;
 
-			/* URL-encode the resumption token to handle special characters like & */
-			encoded_token = curl_easy_escape(curl, state->resumptionToken, 0);
-			if (encoded_token)
-			{
-				elog(DEBUG2, "  %s (%s): encoded resumptionToken > %s", __func__, state->requestVerb, encoded_token);
-				appendStringInfo(&url_buffer, "verb=%s&resumptionToken=%s", state->requestVerb, encoded_token);
-				curl_free(encoded_token);
-			}
-			else
-			{
-				/* Fallback to unencoded if encoding fails */
-				elog(DEBUG2, "  %s (%s): encoding failed, using raw token", __func__, state->requestVerb);
-				appendStringInfo(&url_buffer, "verb=%s&resumptionToken=%s", state->requestVerb, state->resumptionToken);
-			}
-		}
-	}
-	else if (strcmp(state->requestVerb, OAI_REQUEST_GETRECORD) == 0)
+#if PG_VERSION_NUM >= 120000
+	/* slots are kept for the whole sync, the batch context is reset */
+	if (!bulk->slots[bulk->nbuffered])
 	{
+		oldcxt = MemoryContextSwitchTo(bulk->cxt);
+		bulk->slots[bulk->nbuffered] = table_slot_create(bulk->rel, NULL);
+		MemoryContextSwitchTo(oldcxt);
+	}
+#endif
 
-		if (state->identifier)
-		{
-			char *encoded_identifier = curl_easy_escape(curl, state->identifier, 0);
-			elog(DEBUG2, "  %s (%s): appending 'identifier' > %s", __func__, state->requestVerb, state->identifier);
-			appendStringInfo(&url_buffer, "&identifier=%s", encoded_identifier);
-			curl_free(encoded_identifier);
-		}
+	oldcxt = MemoryContextSwitchTo(bulk->batchcxt);
 
-		if (state->metadataPrefix)
-		{
-			elog(DEBUG2, "  %s (%s): appending 'metadataPrefix' > %s", __func__, state->requestVerb, state->metadataPrefix);
-			appendStringInfo(&url_buffer, "&metadataPrefix=%s", state->metadataPrefix);
-		}
-	}
-	else if (strcmp(state->requestVerb, OAI_REQUEST_LISTIDENTIFIERS) == 0)
+#if PG_VERSION_NUM >= 120000
+	values = bulk->slots[bulk->nbuffered]->tts_values;
+	nulls = bulk->slots[bulk->nbuffered]->tts_isnull;
+#else
+	values = (Datum *)palloc(tupdesc->natts * sizeof(Datum));
+	nulls = (bool *)palloc(tupdesc->natts * sizeof(bool));
+#endif
+
+	for (int i = 0; i < tupdesc->natts; i++)
 	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
 
-		if (state->set)
+		if (i == bulk->hashattr - 1 && !slot->tts_isnull[bulk->contentattr - 1])
 		{
-			char *encoded_set = curl_easy_escape(curl, state->set, 0);
-			elog(DEBUG2, "  %s (%s): appending 'set' > %s", __func__, state->requestVerb, state->set);
-			appendStringInfo(&url_buffer, "&set=%s", encoded_set);
-			curl_free(encoded_set);
+			/* xml is binary compatible with text */
+			values[i] = DirectFunctionCall1(md5_text, slot->tts_values[bulk->contentattr - 1]);
+			nulls[i] = false;
 		}
-
-		if (state->from)
+		else if (bulk->attmap[i] == InvalidAttrNumber || att->attisdropped)
 		{
-			char *encoded_from = curl_easy_escape(curl, state->from, 0);
-			elog(DEBUG2, "  %s (%s): appending 'from' > %s", __func__, state->requestVerb, state->from);
-			appendStringInfo(&url_buffer, "&from=%s", encoded_from);
-			curl_free(encoded_from);
+			values[i] = (Datum)0;
+			nulls[i] = true;
 		}
-
-		if (state->until)
+		else
 		{
-			char *encoded_until = curl_easy_escape(curl, state->until, 0);
-			elog(DEBUG2, "  %s (%s): appending 'until' > %s", __func__, state->requestVerb, state->until);
-			appendStringInfo(&url_buffer, "&until=%s", encoded_until);
-			curl_free(encoded_until);
+			values[i] = slot->tts_values[bulk->attmap[i] - 1];
+			nulls[i] = slot->tts_isnull[bulk->attmap[i] - 1];
 		}
 
-		if (state->metadataPrefix)
-		{
-			char *encoded_metadataPrefix = curl_easy_escape(curl, state->metadataPrefix, 0);
-			elog(DEBUG2, "  %s (%s): appending 'metadataPrefix' > %s", __func__, state->requestVerb, state->metadataPrefix);
-			appendStringInfo(&url_buffer, "&metadataPrefix=%s", encoded_metadataPrefix);
-			curl_free(encoded_metadataPrefix);
-		}
+		/* the only constraint besides indexes CanBulkInsert lets through */
+		if (nulls[i] && att->attnotnull)
+			ereport(ERROR,
+					(errcode(ERRCODE_NOT_NULL_VIOLATION),
+					 errmsg("null value in column \"%s\" of relation \"%s\" violates not-null constraint",
+							NameStr(att->attname), RelationGetRelationName(bulk->rel))));
+	}
 
-		if (state->resumptionToken)
-		{
-			char *encoded_token;
+#if PG_VERSION_NUM >= 120000
+	ExecStoreVirtualTuple(bulk->slots[bulk->nbuffered]);
+	ExecMaterializeSlot(bulk->slots[bulk->nbuffered]);
+#else
+	bulk->tuples[bulk->nbuffered] = heap_form_tuple(tupdesc, values, nulls);
+#endif
 
-			elog(DEBUG2, "  %s (%s): appending 'resumptionToken' > %s", __func__, state->requestVerb, state->resumptionToken);
-			resetStringInfo(&url_buffer);
+	MemoryContextSwitchTo(oldcxt);
 
-			/* URL-encode the resumption token to handle special characters like & */
-			encoded_token = curl_easy_escape(curl, state->resumptionToken, 0);
-			if (encoded_token)
-			{
-				elog(DEBUG2, "  %s (%s): encoded resumptionToken > %s", __func__, state->requestVerb, encoded_token);
-				appendStringInfo(&url_buffer, "verb=%s&resumptionToken=%s", state->requestVerb, encoded_token);
-				curl_free(encoded_token);
-			}
-			else
-			{
-				/* Fallback to unencoded if encoding fails */
-				elog(DEBUG2, "  %s (%s): encoding failed, using raw token", __func__, state->requestVerb);
-				appendStringInfo(&url_buffer, "verb=%s&resumptionToken=%s", state->requestVerb, state->resumptionToken);
-			}
-		}
-	}
-	else
-	{
-		if (strcmp(state->requestVerb, OAI_REQUEST_LISTMETADATAFORMATS) != 0 &&
-			strcmp(state->requestVerb, OAI_REQUEST_LISTSETS) != 0 &&
-			strcmp(state->requestVerb, OAI_REQUEST_IDENTIFY) != 0)
-			return OAI_UNKNOWN_REQUEST;
-	}
+	if (++bulk->nbuffered == OAI_BULK_INSERT_BATCH_SIZE)
+		FlushBulkInsert(bulk);
+}
 
-	elog(DEBUG1, "GET \"%s?%s\"", state->url, url_buffer.data);
+/*
+ * EndBulkInsert
+ * -------------
+ * Writes the remaining buffered records and releases the bulk insert
+ * state.
+ *
+ * bulk : bulk insert state
+ *
+ * returns the number of records inserted
+ */
+static int64 EndBulkInsert(OAIBulkInsert *bulk)
+{
+	int64 inserted;
 
-	if (curl)
-	{
-		errbuf[0] = 0;
+	FlushBulkInsert(bulk);
 
-		curl_easy_setopt(curl, CURLOPT_URL, state->url);
+	ExecCloseIndices(bulk->rri);
+	FreeExecutorState(bulk->estate);
+	FreeBulkInsertState(bulk->bistate);
 
-#if ((LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR < 85) || LIBCURL_VERSION_MAJOR < 7)
-		curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
+#if PG_VERSION_NUM >= 120000
+	for (int i = 0; i < OAI_BULK_INSERT_BATCH_SIZE && bulk->slots[i]; i++)
+		ExecDropSingleTupleTableSlot(bulk->slots[i]);
+
+	table_finish_bulk_insert(bulk->rel, bulk->options);
 #else
-		curl_easy_setopt(curl, CURLOPT_PROTOCOLS_STR, "http,https");
+	ExecDropSingleTupleTableSlot(bulk->slot);
+
+	if (bulk->options & HEAP_INSERT_SKIP_WAL)
+		heap_sync(bulk->rel);
 #endif
 
-		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+	MemoryContextDelete(bulk->batchcxt);
 
-		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connectTimeout);
-		curl_easy_setopt(curl, CURLOPT_TIMEOUT, request_timeout);
+	inserted = bulk->inserted;
+	pfree(bulk);
 
-		elog(DEBUG2, "  %s (%s): timeout > %ld", __func__, state->requestVerb, connectTimeout);
-		elog(DEBUG2, "  %s (%s): max retry > %ld", __func__, state->requestVerb, maxretries);
+	return inserted;
+}
 
-		/* Proxy support: added in version 1.1.0 */
-		if (state->proxy)
-		{
+/*
+ * oai_fdw_sync
+ * ------------
+ * Incrementally harvests an OAI foreign table into a local table. The
+ * responseDate of the first page of each run is kept in the bookkeeping
+ * table oai_fdw_sync_state, and the next run of the same pair of tables
+ * only requests records changed since then (from = watermark). The rows of
+ * each page are written with a single INSERT ... SELECT FROM unnest() of
+ * the page, and upserted if the target has a unique index on the column
+ * mapped to the OAI identifier. Existing records whose datestamp, and
+ * content hash if the target has an oai_content_hash column, did not
+ * change are left untouched.
+ *
+ * With the ListIdentifiers strategy, meant for repositories whose `from`
+ * filter cannot be trusted, all headers are listed instead and compared
+ * with the identifiers and datestamps of the target table; only new and
+ * changed records are then retrieved, with concurrent GetRecord requests.
+ *
+ * Deleted records are stored like any other record, unless deleted_mode
+ * is mark or delete: they then flag or remove the rows of their
+ * identifiers, in the same statement as the other records of the page.
+ *
+ * foreign_table : the OAI foreign table
+ * target_table  : the local table
+ * strategy      : ListRecords or ListIdentifiers
+ * concurrency   : GetRecord requests in progress at a time (ListIdentifiers)
+ * deleted_mode  : keep, mark or delete, see OAI_HarvestTable
+ *
+ * returns the number of records inserted or updated
+ */
+Datum oai_fdw_sync(PG_FUNCTION_ARGS)
+{
+	Oid foreigntableid = PG_GETARG_OID(0);
+	Oid targetid = PG_GETARG_OID(1);
+	char *strategy = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	int concurrency = PG_GETARG_INT32(3);
+	char *deleted_mode = text_to_cstring(PG_GETARG_TEXT_PP(4));
+	OAIFdwState *state;
+	Relation rel;
+	Relation target;
+	TupleDesc tupdesc;
+	TupleTableSlot *slot;
+	MemoryContext pagecxt;
+	MemoryContext oldcxt;
+	StringInfoData columns;
+	StringInfoData values;
+	StringInfoData excluded;
+	StringInfoData sql;
+	char *target_name;
+	char *identifier = NULL;
+	char *datestamp = NULL;
+	char *content = NULL;
+	char *status = NULL;
+	char *sync_state_table;
+	char *response_date = NULL;
+	char *last_datestamp = NULL;
+	AttrNumber *attmap;
+	AttrNumber hashattr;
+	AttrNumber contentattr = InvalidAttrNumber;
+	AttrNumber identifierattr = InvalidAttrNumber;
+	AttrNumber datestampattr = InvalidAttrNumber;
+	List *changed = NIL;
+	ListCell *next = NULL;
+	int batches = 0;
+	int batchesdone = 0;
+	bool delta;
+	OAIBulkInsert *bulk = NULL;
+	Oid arraytype;
+	Oid argtypes[5];
+	Datum args[5];
+	char argnulls[5];
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	SPIPlanPtr plan = NULL;
+	TimestampTz watermark = 0;
+	TimestampTz started = GetCurrentTimestamp();
+	int64 inserted = 0;
+	int64 updated = 0;
+	int64 unchanged = 0;
+	int64 deleted = 0;
+	bool keepDeleted;
+	bool hasContent;
+	AclResult aclresult;
+	Oid extowner;
+	Oid save_userid;
+	int save_sec_context;
+	int ret;
 
-			elog(DEBUG2, "%s (%s): proxy URL > '%s'", __func__, state->requestVerb, state->proxy);
+	elog(DEBUG2, "%s called", __func__);
 
-			curl_easy_setopt(curl, CURLOPT_PROXY, state->proxy);
+	if (pg_strcasecmp(strategy, OAI_REQUEST_LISTIDENTIFIERS) == 0)
+		delta = true;
+	else if (pg_strcasecmp(strategy, OAI_REQUEST_LISTRECORDS) == 0)
+		delta = false;
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid strategy: '%s'", strategy),
+				 errhint("Supported strategies are '%s' and '%s'.", OAI_REQUEST_LISTRECORDS, OAI_REQUEST_LISTIDENTIFIERS)));
 
-			if (strcmp(state->proxyType, OAI_SERVER_OPTION_HTTP_PROXY) == 0)
-			{
-				elog(DEBUG2, "%s (%s): proxy protocol > 'HTTP'", __func__, state->requestVerb);
-				curl_easy_setopt(curl, CURLOPT_PROXYTYPE, CURLPROXY_HTTP);
-			}
-			if (state->proxyUser)
-			{
-				elog(DEBUG2, "%s (%s): entering proxy user ('%s').", __func__, state->requestVerb, state->proxyUser);
-				curl_easy_setopt(curl, CURLOPT_PROXYUSERNAME, state->proxyUser);
-			}
-			if (state->proxyPassword)
-			{
-				elog(DEBUG2, "%s (%s): entering proxy user's password.", __func__, state->requestVerb);
-				curl_easy_setopt(curl, CURLOPT_PROXYPASSWORD, state->proxyPassword);
-			}
-		}
+	if (concurrency < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid concurrency: %d", concurrency),
+				 errhint("At least one request must be allowed.")));
 
-		if (state->requestRedirect == true)
-		{
+	if (strcmp(deleted_mode, "keep") != 0 && strcmp(deleted_mode, "mark") != 0 && strcmp(deleted_mode, "delete") != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid deleted_mode: %s", deleted_mode),
+				 errhint("Supported modes are 'keep', 'mark' and 'delete'.")));
 
-			elog(DEBUG2, "  %s (%s): setting request redirect: %d", __func__, state->requestVerb, state->requestRedirect);
-			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	keepDeleted = strcmp(deleted_mode, "keep") == 0;
 
-			if (state->requestMaxRedirect)
-			{
-				elog(DEBUG2, "  %s (%s): setting maxredirs: %ld", __func__, state->requestVerb, state->requestMaxRedirect);
-				curl_easy_setopt(curl, CURLOPT_MAXREDIRS, state->requestMaxRedirect);
-			}
-		}
+	state = GetOAIForeignTableState(foreigntableid);
 
-		/* Set the progress callback function */
-		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-		curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CURLProgressCallback);
+	/* the records are not read through the executor, which would check this */
+	aclresult = pg_class_aclcheck(foreigntableid, GetUserId(), ACL_SELECT);
 
-		/*
-		 * Enable libcurl verbose output, but route it exclusively through
-		 * CURLDebugCallback instead of stderr. The callback emits at DEBUG3
-		 * (gated by log_min_messages) and redacts Authorization headers so
-		 * credentials are never written to server logs.
-		 */
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, CURLDebugCallback);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, NULL);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, OBJECT_FOREIGN_TABLE, get_rel_name(foreigntableid));
+
+	if (get_rel_relkind(targetid) != RELKIND_RELATION &&
+		get_rel_relkind(targetid) != RELKIND_PARTITIONED_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a table", get_rel_name(targetid))));
+
+	/*
+	 * The watermark of the target is written as the owner of the extension,
+	 * so the caller must be allowed to write into the target table itself.
+	 */
+	aclresult = pg_class_aclcheck(targetid, GetUserId(), ACL_INSERT);
+
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, OBJECT_TABLE, get_rel_name(targetid));
+
+	/* concurrent syncs of a target would overwrite each other's watermark */
+	LockRelationOid(targetid, ShareUpdateExclusiveLock);
+
+	target_name = quote_qualified_identifier(get_namespace_name(get_rel_namespace(targetid)),
+											 get_rel_name(targetid));
+
+#if PG_VERSION_NUM < 130000
+	rel = heap_open(foreigntableid, AccessShareLock);
+	target = heap_open(targetid, NoLock);
+#else
+	rel = table_open(foreigntableid, AccessShareLock);
+	target = table_open(targetid, NoLock);
+#endif
+
+	tupdesc = RelationGetDescr(rel);
+	hasContent = CheckOAIColumns(state, rel);
+
+	/*
+	 * Only columns mapped to an OAI node that also exist in the target table
+	 * (by name) are stored.
+	 */
+	initStringInfo(&columns);
+	initStringInfo(&values);
+	initStringInfo(&excluded);
+
+	attmap = (AttrNumber *)palloc0(RelationGetDescr(target)->natts * sizeof(AttrNumber));
+
+	for (int i = 0; i < state->numcols; i++)
+	{
+		OAIfdwColumn *col = state->oaiTable->cols[i];
+		AttrNumber attnum;
+		const char *colname;
+
+		if (!col->oai_node || TupleDescAttr(tupdesc, i)->attisdropped)
+			continue;
+
+		attnum = get_attnum(targetid, col->name);
 
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, url_buffer.data);
-		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallbackFunction);
-		curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&chunk_header);
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-		curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+		if (attnum == InvalidAttrNumber)
+			continue;
 
-		if (state->user && state->password)
+		colname = quote_identifier(col->name);
+
+		appendStringInfo(&columns, "%s%s", columns.len > 0 ? ", " : "", colname);
+		appendStringInfo(&values, "%sr.%s", values.len > 0 ? ", " : "", colname);
+		appendStringInfo(&excluded, "%sEXCLUDED.%s", excluded.len > 0 ? ", " : "", colname);
+		attmap[attnum - 1] = i + 1;
+
+		if (strcmp(col->oai_node, OAI_NODE_IDENTIFIER) == 0 && HasUniqueIndex(target, attnum))
+		{
+			identifier = pstrdup(colname);
+			identifierattr = i + 1;
+		}
+		else if (strcmp(col->oai_node, OAI_NODE_DATESTAMP) == 0)
 		{
-			curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-			curl_easy_setopt(curl, CURLOPT_USERNAME, state->user);
-			curl_easy_setopt(curl, CURLOPT_PASSWORD, state->password);
+			datestamp = pstrdup(colname);
+			datestampattr = i + 1;
 		}
-		else if (state->user && !state->password)
+		else if (strcmp(col->oai_node, OAI_NODE_CONTENT) == 0)
 		{
-			curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-			curl_easy_setopt(curl, CURLOPT_USERNAME, state->user);
+			content = pstrdup(colname);
+			contentattr = i + 1;
 		}
+		else if (strcmp(col->oai_node, OAI_NODE_STATUS) == 0)
+			status = pstrdup(colname);
+	}
 
-		initStringInfo(&user_agent);
-		appendStringInfo(&user_agent, "PostgreSQL/%s oai_fdw/%s libxml2/%s %s", PG_VERSION, OAI_FDW_VERSION, LIBXML_DOTTED_VERSION, curl_version());
-		curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.data);
+	/* the content hash spares comparing the XML of existing records */
+	hashattr = get_attnum(targetid, OAI_CONTENT_HASH_COLUMN);
 
-		headers = curl_slist_append(headers, "Accept: application/xml");
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	if (hashattr != InvalidAttrNumber &&
+		(!content || TupleDescAttr(RelationGetDescr(target), hashattr - 1)->atttypid != TEXTOID))
+		hashattr = InvalidAttrNumber;
 
-		elog(DEBUG2, "  %s (%s): performing cURL request ... ", __func__, state->requestVerb);
+	if (hashattr != InvalidAttrNumber)
+	{
+		appendStringInfo(&columns, ", %s", OAI_CONTENT_HASH_COLUMN);
+		appendStringInfo(&values, ", pg_catalog.md5(r.%s::pg_catalog.text)", content);
+		appendStringInfo(&excluded, ", EXCLUDED.%s", OAI_CONTENT_HASH_COLUMN);
+	}
 
-		res = curl_easy_perform(curl);
+	if (columns.len == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("target table \"%s\" has no columns in common with foreign table \"%s\"",
+						get_rel_name(targetid), get_rel_name(foreigntableid)),
+				 errhint("Columns are matched by name, only columns with an oai_node are stored.")));
 
-		for (long i = 1; res != CURLE_OK && i <= maxretries; i++)
-		{
-			elog(WARNING, "request to '%s' failed (%ld/%ld)",
-				 state->foreign_server->servername, i, maxretries);
+	if (delta && (!identifier || !datestamp))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("strategy '%s' requires an identifier and a datestamp column in \"%s\"",
+						OAI_REQUEST_LISTIDENTIFIERS, get_rel_name(targetid)),
+				 errhint("Map the OAI identifier and datestamp to columns of both tables, and create a unique index on the identifier column of the target table.")));
 
-			/* discard any partial data from the failed attempt */
-			chunk.size = 0;
-			chunk.memory[0] = '\0';
-			chunk_header.size = 0;
-			chunk_header.memory[0] = '\0';
+	if (!keepDeleted && (!identifier || !status))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("deleted_mode '%s' requires an identifier and a status column in \"%s\"",
+						deleted_mode, get_rel_name(targetid)),
+				 errhint("Map the OAI identifier and status to columns of both tables, and create a unique index on the identifier column of the target table.")));
 
-			res = curl_easy_perform(curl);
-		}
+	/*
+	 * Comparing headers only pays off if records carry content, and not for
+	 * initial loads, which would retrieve every record with GetRecord.
+	 */
+	if (delta && (!hasContent || RelationGetNumberOfBlocks(target) == 0))
+	{
+		elog(DEBUG1, "%s: harvesting \"%s\" with %s", __func__, get_rel_name(foreigntableid), OAI_REQUEST_LISTRECORDS);
+		delta = false;
+	}
 
-		if (res != CURLE_OK)
-		{
-			long response_code = 0;
-			bool has_body = (chunk.size > 0 && chunk.memory);
-			StringInfoData display_body;
+	if (!identifier)
+		ereport(WARNING,
+				(errmsg("records harvested from \"%s\" may be duplicated in \"%s\"",
+						get_rel_name(foreigntableid), get_rel_name(targetid)),
+				 errhint("Create a unique index on the target column mapped to the OAI identifier, so that changed records are updated.")));
 
-			initStringInfo(&display_body);
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "%s: SPI_connect failed", __func__);
 
-			if (has_body)
-			{
-				/*
-				 * Truncate the error body before logging or including in
-				 * error messages.  Endpoints may return large HTML pages on
-				 * errors (e.g. from misconfigured proxies), which would
-				 * flood server logs.
-				 */
-				if (chunk.size > OAI_FDW_MAX_ERROR_BODY)
-				{
-					appendBinaryStringInfo(&display_body, chunk.memory, OAI_FDW_MAX_ERROR_BODY);
-					appendStringInfoString(&display_body, "... (truncated)");
-				}
-				else
-				{
-					appendStringInfoString(&display_body, chunk.memory);
-				}
-				elog(DEBUG1, "%s: error response body: %s", __func__, display_body.data);
-			}
-			else
-			{
-				elog(DEBUG1, "%s: no response body available for HTTP error %ld", __func__, response_code);
-			}
-			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+	sync_state_table = GetExtensionTable(OAI_SYNC_STATE_TABLE, false);
+	extowner = GetExtensionOwner();
 
-			if (chunk.memory)
-				pfree(chunk.memory);
-			if (chunk_header.memory)
-				pfree(chunk_header.memory);
-			curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
+	/* watermark of the previous run */
+	initStringInfo(&sql);
+	appendStringInfo(&sql,
+					 "SELECT response_date FROM %s "
+					 "WHERE target_table OPERATOR(pg_catalog.=) $1 AND foreign_table OPERATOR(pg_catalog.=) $2",
+					 sync_state_table);
 
-			ereport(ERROR,
-					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-					 errmsg("OAI request failed: HTTP %ld", response_code),
-					 errhint("Check your request parameters and try again."),
-					 errdetail("URL: \"%s\"", url_buffer.data)));
-		}
-		else
-		{
-			long response_code;
-			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-			state->xmldoc = xmlReadMemory(chunk.memory, chunk.size, NULL, NULL, XML_PARSE_NOBLANKS);
+	argtypes[0] = REGCLASSOID;
+	argtypes[1] = REGCLASSOID;
+	args[0] = ObjectIdGetDatum(targetid);
+	args[1] = ObjectIdGetDatum(foreigntableid);
 
-			elog(DEBUG1, "HTTP %ld, %ld bytes", response_code, chunk.size);
+	/* oai_fdw_sync_state is not granted to anyone, see GetExtensionOwner */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(extowner, save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
 
-			elog(DEBUG2, "  %s (%s): http response code = %ld", __func__, state->requestVerb, response_code);
-			elog(DEBUG2, "  %s (%s): http response size = %ld", __func__, state->requestVerb, chunk.size);
-			elog(DEBUG2, "  %s (%s): http response header = \n%s", __func__, state->requestVerb, chunk_header.memory);
-		}
+	ret = SPI_execute_with_args(sql.data, 2, argtypes, args, NULL, true, 1);
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "%s: could not read \"%s\": %s", __func__, sync_state_table, SPI_result_code_string(ret));
+
+	if (SPI_processed == 1)
+	{
+		bool isnull;
+		Datum datum = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+
+		if (!isnull)
+			watermark = DatumGetTimestampTz(datum);
 	}
 
-	if (chunk.memory)
-		pfree(chunk.memory);
-	if (chunk_header.memory)
-		pfree(chunk_header.memory);
-	curl_slist_free_all(headers);
-	curl_easy_cleanup(curl);
+	/* the watermark is not used by the ListIdentifiers strategy */
+	if (watermark != 0 && !delta)
+	{
+		state->from = deparseTimestamp(TimestampTzGetDatum(watermark));
 
-	return OAI_SUCCESS;
-}
+		/* repositories with day granularity reject datestamps with time */
+		if (HasDayGranularity(state))
+			state->from[10] = '\0';
 
-/**
- * This function validates the oai_nodes in the OPTION clause of each column
- * and its data types. Additionally it chooses which OAI Request will be
- * executed bases on the oai_nodes set in the foreign table (ListRecords or
- * ListIdentifiers).
- *
- * ListRecords:     https://www.openarchives.org/OAI/openarchivesprotocol.html#ListRecords
- * ListIdentifiers: https://www.openarchives.org/OAI/openarchivesprotocol.html#ListIdentifiers
- */
-static void OAIRequestPlanner(OAIFdwState *state, RelOptInfo *baserel)
-{
-	List *conditions = baserel->baserestrictinfo;
-	bool hasContentForeignColumn = false;
-	TupleDesc tupdesc;
+		elog(DEBUG1, "%s: harvesting \"%s\" from %s", __func__, get_rel_name(foreigntableid), state->from);
+	}
 
-#if PG_VERSION_NUM < 130000
-	Relation rel = heap_open(state->foreign_table->relid, NoLock);
+	state->requestVerb = hasContent ? OAI_REQUEST_LISTRECORDS : OAI_REQUEST_LISTIDENTIFIERS;
+
+	/*
+	 * Records are written straight into the heap only into tables without
+	 * a unique identifier. Even an empty target must otherwise go through
+	 * INSERT ... ON CONFLICT, as repositories may return an identifier
+	 * more than once in a harvest (e.g. on a later page after an update).
+	 */
+	if (!identifier && CanBulkInsert(target, tupdesc, attmap))
+		bulk = BeginBulkInsert(target, attmap, hashattr, contentattr);
+
+	resetStringInfo(&sql);
+	appendStringInfo(&sql,
+					 "WITH j AS ("
+					 "INSERT INTO %s AS t (%s) SELECT %s FROM pg_catalog.unnest($1) AS r",
+					 target_name, columns.data, values.data);
+
+	/* deleted records are not stored, but flag or remove the rows of their identifiers */
+	if (!keepDeleted)
+		appendStringInfo(&sql, " WHERE r.%s IS NOT TRUE", status);
+
+	if (identifier)
+		appendStringInfo(&sql, " ON CONFLICT (%s) DO UPDATE SET (%s) = ROW(%s)",
+						 identifier, columns.data, excluded.data);
+
+	/* records with the same datestamp (and content hash) are left untouched */
+	if (identifier && datestamp && hashattr != InvalidAttrNumber)
+		appendStringInfo(&sql, " WHERE (t.%1$s, t.%2$s) IS DISTINCT FROM (EXCLUDED.%1$s, EXCLUDED.%2$s)",
+						 datestamp, OAI_CONTENT_HASH_COLUMN);
+	else if (identifier && datestamp)
+		appendStringInfo(&sql, " WHERE t.%1$s IS DISTINCT FROM EXCLUDED.%1$s", datestamp);
+
+	appendStringInfoString(&sql, " RETURNING xmax = 0 AS inserted)");
+
+	if (strcmp(deleted_mode, "mark") == 0 && datestamp)
+		appendStringInfo(&sql,
+						 ", d AS (UPDATE %1$s AS t SET (%2$s, %4$s) = (true, r.%4$s) FROM pg_catalog.unnest($1) AS r "
+						 "WHERE r.%2$s AND t.%3$s = r.%3$s AND t.%2$s IS NOT TRUE RETURNING 1)",
+						 target_name, status, identifier, datestamp);
+	else if (strcmp(deleted_mode, "mark") == 0)
+		appendStringInfo(&sql,
+						 ", d AS (UPDATE %1$s AS t SET %2$s = true FROM pg_catalog.unnest($1) AS r "
+						 "WHERE r.%2$s AND t.%3$s = r.%3$s AND t.%2$s IS NOT TRUE RETURNING 1)",
+						 target_name, status, identifier);
+	else if (strcmp(deleted_mode, "delete") == 0)
+		appendStringInfo(&sql,
+						 ", d AS (DELETE FROM %1$s AS t USING pg_catalog.unnest($1) AS r "
+						 "WHERE r.%2$s AND t.%3$s = r.%3$s RETURNING 1)",
+						 target_name, status, identifier);
+	else
+		appendStringInfoString(&sql, ", d AS (SELECT WHERE false)");
+
+	appendStringInfoString(&sql,
+						   " SELECT pg_catalog.count(*) FILTER (WHERE inserted), "
+						   "pg_catalog.count(*) FILTER (WHERE NOT inserted), "
+						   "(SELECT pg_catalog.count(*) FROM d) FROM j");
+
+	if (!bulk)
+	{
+		elog(DEBUG2, "%s: %s", __func__, sql.data);
+
+		arraytype = get_array_type(tupdesc->tdtypeid);
+
+		if (!OidIsValid(arraytype))
+			elog(ERROR, "%s: could not find array type for \"%s\"", __func__, get_rel_name(foreigntableid));
+
+		get_typlenbyvalalign(tupdesc->tdtypeid, &typlen, &typbyval, &typalign);
+
+		plan = SPI_prepare(sql.data, 1, &arraytype);
+
+		if (!plan)
+			elog(ERROR, "%s: SPI_prepare failed: %s", __func__, SPI_result_code_string(SPI_result));
+	}
+
+	/* GetRecord responses are not worth a checkpoint */
+	if (delta)
+		state->resumeFromCheckpoint = false;
+
+	if (state->resumeFromCheckpoint)
+		OpenCheckpoint(state);
+
+#if PG_VERSION_NUM < 120000
+	slot = MakeSingleTupleTableSlot(tupdesc);
 #else
-	Relation rel = table_open(state->foreign_table->relid, NoLock);
+	slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsVirtual);
 #endif
 
-	char *relname = NameStr(rel->rd_rel->relname);
-	elog(DEBUG2, "%s called.", __func__);
-
-	tupdesc = rel->rd_att;
+	pagecxt = AllocSetContextCreate(CurrentMemoryContext,
+									"oai_fdw_sync_page",
+									ALLOCSET_DEFAULT_SIZES);
 
-	/* The default request type is OAI_REQUEST_LISTRECORDS.
-	 * This can be altered depending on the columns used
-	 * in the WHERE and SELECT clauses */
-	state->requestVerb = OAI_REQUEST_LISTRECORDS;
-	state->numcols = rel->rd_att->natts;
-	state->foreigntableid = state->foreign_table->relid;
+	ReportHarvestProgress(targetid, 0, 0, DT_NOBEGIN, DT_NOBEGIN);
 
-	for (int i = 0; i < rel->rd_att->natts; i++)
+	if (delta)
 	{
-		List *options = GetForeignColumnOptions(state->foreign_table->relid, i + 1);
-		ListCell *lc;
-		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		Form_pg_attribute idattr = TupleDescAttr(tupdesc, identifierattr - 1);
+		Form_pg_attribute dsattr = TupleDescAttr(tupdesc, datestampattr - 1);
+		HTAB *local = LoadLocalRecords(target_name, identifier, datestamp, idattr, dsattr);
+		Oid idoutput;
+		Oid dsoutput;
+		bool isvarlena;
+		int64 listed = 0;
 
-		foreach (lc, options)
+		getTypeOutputInfo(idattr->atttypid, &idoutput, &isvarlena);
+		getTypeOutputInfo(dsattr->atttypid, &dsoutput, &isvarlena);
+
+		state->requestVerb = OAI_REQUEST_LISTIDENTIFIERS;
+
+		/*
+		 * The headers are converted like the records they belong to, so that
+		 * they compare equal to the values stored in the target table.
+		 */
+		do
 		{
-			DefElem *def = (DefElem *)lfirst(lc);
+			char *token;
+			ListCell *cell;
 
-			if (strcmp(def->defname, OAI_NODE_COLUMN_OPTION) == 0)
+			CHECK_FOR_INTERRUPTS();
+
+			oldcxt = MemoryContextSwitchTo(pagecxt);
+
+			LoadOAIRecords(&state);
+
+			foreach (cell, state->records)
 			{
-				char *option_value = defGetString(def);
-				char *attname = NameStr(attr->attname);
-				state->numfdwcols++;
+				OAIRecord *record = (OAIRecord *)lfirst(cell);
+				OAILocalRecord *entry = NULL;
+				uint64 key;
 
-				if (strcmp(option_value, OAI_NODE_STATUS) == 0)
-				{
-					if (attr->atttypid != BOOLOID)
-						ereport(ERROR,
-								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-								 errmsg("invalid data type for '%s.%s': %d",
-										relname, attname, attr->atttypid),
-								 errhint("OAI %s must be of type 'boolean'.",
-										 OAI_NODE_STATUS)));
-				}
-				else if (strcmp(option_value, OAI_NODE_IDENTIFIER) == 0 || strcmp(option_value, OAI_NODE_METADATAPREFIX) == 0)
-				{
-					if (attr->atttypid != TEXTOID &&
-						attr->atttypid != VARCHAROID)
-						ereport(ERROR,
-								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-								 errmsg("invalid data type for '%s.%s': %d",
-										relname, attname, attr->atttypid),
-								 errhint("OAI %s must be of type 'text' or 'varchar'.",
-										 option_value)));
-				}
-				else if (strcmp(option_value, OAI_NODE_CONTENT) == 0)
-				{
-					hasContentForeignColumn = true;
+				ExecClearTuple(slot);
+				CreateOAITuple(slot, state, record);
+				listed++;
 
-					if (attr->atttypid != TEXTOID &&
-						attr->atttypid != VARCHAROID &&
-						attr->atttypid != XMLOID)
-						ereport(ERROR,
-								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-								 errmsg("invalid data type for '%s.%s': %d",
-										relname, attname, attr->atttypid),
-								 errhint("OAI %s expects one of the following types: 'xml', 'text' or 'varchar'.",
-										 OAI_NODE_CONTENT)));
-				}
-				else if (strcmp(option_value, OAI_NODE_SETSPEC) == 0)
-				{
-					if (attr->atttypid != TEXTARRAYOID &&
-						attr->atttypid != VARCHARARRAYOID)
-						ereport(ERROR,
-								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-								 errmsg("invalid data type for '%s.%s': %d",
-										relname, attname, attr->atttypid),
-								 errhint("OAI %s expects one of the following types: 'text[]', 'varchar[]'.",
-										 OAI_NODE_SETSPEC)));
-				}
-				else if (strcmp(option_value, OAI_NODE_DATESTAMP) == 0)
+				if (!slot->tts_isnull[identifierattr - 1])
 				{
-					if (attr->atttypid != TIMESTAMPOID)
-						ereport(ERROR,
-								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-								 errmsg("invalid data type for '%s.%s': %d",
-										relname, attname, attr->atttypid),
-								 errhint("OAI %s expects a 'timestamp'.",
-										 OAI_NODE_DATESTAMP)));
+					key = HashText(OidOutputFunctionCall(idoutput, slot->tts_values[identifierattr - 1]));
+					entry = (OAILocalRecord *)hash_search(local, &key, HASH_FIND, NULL);
 				}
-			}
-		}
-	}
 
-	/* If the foreign table has no "oai_attribute = 'content'" there is no need
-	 * to retrieve the document itself. The ListIdentifiers request lists the
-	 * whole OAI header */
-	if (!hasContentForeignColumn)
-	{
-		state->requestVerb = OAI_REQUEST_LISTIDENTIFIERS;
-		elog(DEBUG2, "  %s: the foreign table '%s' has no 'content' OAI node. Request type set to '%s'",
-			 __func__, relname, OAI_REQUEST_LISTIDENTIFIERS);
-	}
+				/* with deleted_mode delete, rows of deleted records are removed whatever their datestamp */
+				if (entry && !(record->isDeleted && strcmp(deleted_mode, "delete") == 0) &&
+					!slot->tts_isnull[datestampattr - 1] &&
+					entry->datestamp == HashText(OidOutputFunctionCall(dsoutput, slot->tts_values[datestampattr - 1])))
+					continue;
 
-	if (state->numfdwcols != 0)
-		deparseSelectColumns(state, baserel->reltarget->exprs);
+				/* deleted records without a row have nothing to flag or remove */
+				if (!entry && record->isDeleted && !keepDeleted)
+					continue;
 
-	deparseWhereClause(state, conditions);
+				MemoryContextSwitchTo(oldcxt);
+				changed = lappend(changed, pstrdup(record->identifier));
+				MemoryContextSwitchTo(pagecxt);
+			}
 
-#if PG_VERSION_NUM < 130000
-	heap_close(rel, NoLock);
-#else
-	table_close(rel, NoLock);
-#endif
+			MemoryContextSwitchTo(oldcxt);
 
-	elog(DEBUG2, "%s => finished.", __func__);
-}
+			if (!response_date && state->responseDate)
+				response_date = pstrdup(state->responseDate);
 
-static TupleTableSlot *OAIFdwExecForeignUpdate(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
-{
-	ereport(
-		ERROR, (
-				   errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				   errmsg("Operation not supported."),
-				   errhint("The OAI Foreign Data Wrapper does not support UPDATE queries.")));
-	return NULL;
-}
+			token = state->resumptionToken ? pstrdup(state->resumptionToken) : NULL;
+			MemoryContextReset(pagecxt);
+			state->resumptionToken = token;
+			state->responseDate = NULL;
 
-static TupleTableSlot *OAIFdwExecForeignInsert(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
-{
-	ereport(
-		ERROR, (
-				   errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				   errmsg("Operation not supported."),
-				   errhint("The OAI Foreign Data Wrapper does not support INSERT queries.")));
+		} while (state->resumptionToken);
 
-	return NULL;
-}
+		hash_destroy(local);
 
-static TupleTableSlot *OAIFdwExecForeignDelete(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
-{
-	ereport(
-		ERROR, (
-				   errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				   errmsg("Operation not supported."),
-				   errhint("The OAI Foreign Data Wrapper does not support DELETE queries.")));
+		elog(DEBUG1, "%s: " INT64_FORMAT " records listed, %d new or changed", __func__, listed, list_length(changed));
 
-	return NULL;
-}
+		unchanged = listed - list_length(changed);
+		next = list_head(changed);
 
-static char *GetOAINodeFromColumn(Oid foreigntableid, int16 attnum)
-{
+		if (!next)
+			goto done;
 
-	List *options;
-	TupleDesc tupdesc;
-	char *optionValue = NULL;
+		/* the GetRecord batches are the windows of the harvest */
+		EndScanProgress(state);
+		batches = (list_length(changed) + OAI_DELTA_BATCH_SIZE - 1) / OAI_DELTA_BATCH_SIZE;
+		ReportHarvestProgress(targetid, 0, batches, DT_NOBEGIN, DT_NOBEGIN);
+	}
 
-#if PG_VERSION_NUM < 130000
-	Relation rel = heap_open(foreigntableid, NoLock);
-#else
-	Relation rel = table_open(foreigntableid, NoLock);
-#endif
+	do
+	{
+		Datum *rows;
+		Datum array = (Datum)0;
+		int nrows = 0;
+		int ndeleted = 0;
+		char *token;
+		ListCell *cell;
 
-	elog(DEBUG2, "  %s called", __func__);
-	tupdesc = rel->rd_att;
+		CHECK_FOR_INTERRUPTS();
 
-	for (int i = 0; i < rel->rd_att->natts; i++)
-	{
-		ListCell *lc;
-		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-		options = GetForeignColumnOptions(foreigntableid, i + 1);
+		oldcxt = MemoryContextSwitchTo(pagecxt);
 
-		if (attr->attnum == attnum)
+		if (delta)
 		{
-			foreach (lc, options)
-			{
-				DefElem *def = (DefElem *)lfirst(lc);
+			List *batch = NIL;
 
-				if (strcmp(def->defname, OAI_NODE_COLUMN_OPTION) == 0)
-				{
-					optionValue = defGetString(def);
-					break;
-				}
-			}
+			for (; next && list_length(batch) < OAI_DELTA_BATCH_SIZE; next = list_next(changed, next))
+				batch = lappend(batch, lfirst(next));
+
+			FetchOAIRecords(state, batch, concurrency);
 		}
-	}
+		else
+			LoadOAIRecords(&state);
+
+		rows = (Datum *)palloc(Max(list_length(state->records), 1) * sizeof(Datum));
+
+		foreach (cell, state->records)
+		{
+			OAIRecord *record = (OAIRecord *)lfirst(cell);
+			HeapTuple tuple;
+
+			ExecClearTuple(slot);
+			CreateOAITuple(slot, state, record);
+
+			if (record->isDeleted && !keepDeleted)
+				ndeleted++;
+
+			if (bulk)
+			{
+				BulkInsertRecord(bulk, slot);
+				nrows++;
+			}
+			else
+			{
+				tuple = heap_form_tuple(tupdesc, slot->tts_values, slot->tts_isnull);
+				rows[nrows++] = heap_copy_tuple_as_datum(tuple, tupdesc);
+			}
+
+			if (record->datestamp && (!last_datestamp || strcmp(record->datestamp, last_datestamp) > 0))
+				last_datestamp = MemoryContextStrdup(oldcxt, record->datestamp);
+		}
+
+		if (nrows > 0 && !bulk)
+			array = PointerGetDatum(construct_array(rows, nrows, tupdesc->tdtypeid, typlen, typbyval, typalign));
+
+		MemoryContextSwitchTo(oldcxt);
+
+		if (nrows > 0 && !bulk)
+		{
+			bool isnull;
+			int64 pageinserted;
+			int64 pageupdated;
+			int64 pagedeleted;
+
+			ret = SPI_execute_plan(plan, &array, NULL, false, 1);
+
+			if (ret != SPI_OK_SELECT || SPI_processed != 1)
+				elog(ERROR, "%s: could not store records in \"%s\": %s", __func__, target_name, SPI_result_code_string(ret));
+
+			pageinserted = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+			pageupdated = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+			pagedeleted = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &isnull));
+
+			/* rows skipped by ON CONFLICT ... WHERE are not returned */
+			inserted += pageinserted;
+			updated += pageupdated;
+			unchanged += nrows - ndeleted - pageinserted - pageupdated;
+			deleted += pagedeleted;
+
+			SPI_freetuptable(SPI_tuptable);
+		}
+
+		/* the watermark is the time the repository answered the first page */
+		if (!response_date && state->responseDate)
+			response_date = pstrdup(state->responseDate);
+
+		elog(DEBUG1, "%s: page stored into \"%s\": %d records", __func__, get_rel_name(targetid), nrows);
+
+		if (delta)
+			ReportHarvestProgress(targetid, ++batchesdone, batches, DT_NOBEGIN, DT_NOBEGIN);
+
+		token = state->resumptionToken ? pstrdup(state->resumptionToken) : NULL;
+		MemoryContextReset(pagecxt);
+		state->resumptionToken = token;
+		state->responseDate = NULL;
+
+	} while (delta ? next != NULL : state->resumptionToken != NULL);
+
+done:
+	if (bulk)
+		inserted = EndBulkInsert(bulk);
+
+	if (state->checkpointKey)
+		RemoveCheckpoint(state);
+
+	EndScanProgress(state);
+	EndHarvestProgress();
+
+	/* new watermark */
+	resetStringInfo(&sql);
+	appendStringInfo(&sql,
+					 "INSERT INTO %1$s AS s (target_table, foreign_table, response_date, last_datestamp, last_sync, records) "
+					 "VALUES ($1, $2, $3, $4, pg_catalog.now(), $5) "
+					 "ON CONFLICT (target_table) DO UPDATE SET "
+					 "foreign_table = EXCLUDED.foreign_table, "
+					 "response_date = EXCLUDED.response_date, "
+					 "last_datestamp = COALESCE(EXCLUDED.last_datestamp, s.last_datestamp), "
+					 "last_sync = EXCLUDED.last_sync, "
+					 "records = EXCLUDED.records",
+					 sync_state_table);
+
+	argtypes[2] = TIMESTAMPTZOID;
+	argtypes[3] = TIMESTAMPTZOID;
+	argtypes[4] = INT8OID;
+	memset(argnulls, ' ', sizeof(argnulls));
+
+	if (response_date)
+		args[2] = DirectFunctionCall3(timestamptz_in,
+									  CStringGetDatum(response_date),
+									  ObjectIdGetDatum(InvalidOid),
+									  Int32GetDatum(-1));
+	else
+		args[2] = TimestampTzGetDatum(started);
+
+	if (last_datestamp)
+		args[3] = DirectFunctionCall3(timestamptz_in,
+									  CStringGetDatum(last_datestamp),
+									  ObjectIdGetDatum(InvalidOid),
+									  Int32GetDatum(-1));
+	else
+		argnulls[3] = 'n';
+
+	args[4] = Int64GetDatum(inserted + updated);
+
+	SetUserIdAndSecContext(extowner, save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	ret = SPI_execute_with_args(sql.data, 5, argtypes, args, argnulls, false, 0);
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "%s: could not update \"%s\": %s", __func__, sync_state_table, SPI_result_code_string(ret));
+
+	ExecDropSingleTupleTableSlot(slot);
+	MemoryContextDelete(pagecxt);
+
+	SPI_finish();
 
 #if PG_VERSION_NUM < 130000
+	heap_close(target, NoLock);
 	heap_close(rel, NoLock);
 #else
+	table_close(target, NoLock);
 	table_close(rel, NoLock);
 #endif
 
-	return optionValue;
+	ereport(INFO,
+			(errmsg("OAI sync complete (\"%s\" -> \"%s\"): " INT64_FORMAT " records inserted, " INT64_FORMAT " updated and " INT64_FORMAT " unchanged%s",
+					get_rel_name(foreigntableid), get_rel_name(targetid), inserted, updated, unchanged,
+					keepDeleted ? "" : psprintf("; " INT64_FORMAT " %s", deleted,
+												strcmp(deleted_mode, "mark") == 0 ? "marked as deleted" : "deleted"))));
+
+	PG_RETURN_INT64(inserted + updated);
+}
+
+/*
+ * oai_fdw_harvest_pages
+ * ---------------------
+ * Harvests the pages (time windows) of OAI_HarvestTable in dynamic
+ * background workers. The windows are put into a queue in dynamic shared
+ * memory, from which each worker claims the next page and harvests it with
+ * oai_fdw_harvest_page, in a transaction of its own, as the current user.
+ * The number of inserted, updated, unchanged and deleted records of each
+ * page is kept in the queue. A page that fails does not stop the worker,
+ * its error message is returned instead.
+ *
+ * oai_table        : the OAI foreign table
+ * target_table     : the local table
+ * windows          : start and end of each page, one after the other
+ * deleted_mode     : see OAI_HarvestTable
+ * parallel_workers : number of background workers, at most
+ *                    oai_fdw.max_harvest_workers
+ *
+ * returns a row for each page
+ */
+Datum oai_fdw_harvest_pages(PG_FUNCTION_ARGS)
+{
+	Oid foreigntableid = PG_GETARG_OID(0);
+	Oid targetid = PG_GETARG_OID(1);
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(2);
+	char *deleted_mode = text_to_cstring(PG_GETARG_TEXT_PP(3));
+	int nworkers = PG_GETARG_INT32(4);
+	Oid funcnamespace;
+	Datum *elems;
+	bool *nulls;
+	int nelems;
+	int npages;
+	Size size;
+	Size gucsize;
+	dsm_segment *seg;
+	OAIHarvestQueue *queue;
+	BackgroundWorkerHandle **handles;
+	int nlaunched = 0;
+	bool nested = IsHarvestInProgress();
+	Tuplestorestate *tupstore;
+	TupleDesc tupdesc;
+
+	elog(DEBUG2, "%s called", __func__);
+
+	if (nworkers < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid parallel_workers: %d", nworkers),
+				 errhint("At least one background worker is required.")));
+
+	if (OAIMaxHarvestWorkers == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("parallel harvests are disabled"),
+				 errhint("Set oai_fdw.max_harvest_workers to allow background workers.")));
+
+	if (strcmp(deleted_mode, "keep") != 0 && strcmp(deleted_mode, "mark") != 0 && strcmp(deleted_mode, "delete") != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid deleted_mode: %s", deleted_mode),
+				 errhint("Supported modes are 'keep', 'mark' and 'delete'.")));
+
+	deconstruct_array(array, TIMESTAMPOID, sizeof(Timestamp), FLOAT8PASSBYVAL, 'd', &elems, &nulls, &nelems);
+
+	if (nelems % 2 != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("windows must consist of pairs of start and end timestamps")));
+
+	tupstore = InitMaterializedResult(fcinfo, &tupdesc);
+	npages = nelems / 2;
+
+	if (npages == 0)
+		PG_RETURN_NULL();
+
+	for (int i = 0; i < nelems; i++)
+	{
+		if (nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("page windows must not be null")));
+	}
+
+	size = MAXALIGN(offsetof(OAIHarvestQueue, pages) + npages * sizeof(OAIHarvestPage));
+	gucsize = EstimateGUCStateSpace();
+
+	seg = dsm_create(size + gucsize, 0);
+	queue = (OAIHarvestQueue *)dsm_segment_address(seg);
+	memset(queue, 0, size);
+	queue->guc = size;
+	queue->database = MyDatabaseId;
+	queue->authenticated = GetAuthenticatedUserId();
+	GetUserIdAndSecContext(&queue->user, &queue->sec_context);
+	queue->foreigntableid = foreigntableid;
+	queue->targetid = targetid;
+	strlcpy(queue->deleted_mode, deleted_mode, sizeof(queue->deleted_mode));
+	queue->npages = npages;
+	pg_atomic_init_u32(&queue->next, 0);
+
+	/* the workers harvest with the TimeZone, DateStyle and oai_fdw.* settings of this session */
+	SerializeGUCState(gucsize, (char *)queue + queue->guc);
+
+	/* oai_fdw_harvest_page lives next to this function, in the schema of the extension */
+	funcnamespace = get_func_namespace(fcinfo->flinfo->fn_oid);
+	snprintf(queue->function, sizeof(queue->function), "%s.oai_fdw_harvest_page",
+			 quote_identifier(get_namespace_name(funcnamespace)));
+
+	for (int i = 0; i < npages; i++)
+	{
+		queue->pages[i].from = DatumGetTimestamp(elems[2 * i]);
+		queue->pages[i].until = DatumGetTimestamp(elems[2 * i + 1]);
+	}
+
+	if (nworkers > OAIMaxHarvestWorkers)
+		elog(DEBUG1, "%s: %d background workers requested, using oai_fdw.max_harvest_workers = %d",
+			 __func__, nworkers, OAIMaxHarvestWorkers);
+
+	nworkers = Min(nworkers, OAIMaxHarvestWorkers);
+	nworkers = Min(nworkers, npages);
+	handles = (BackgroundWorkerHandle **)palloc0(nworkers * sizeof(BackgroundWorkerHandle *));
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		BackgroundWorker worker;
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, OAI_FDW_NAME);
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "oai_fdw_harvest_worker");
+		snprintf(worker.bgw_name, BGW_MAXLEN, "oai_fdw harvest worker %d", i + 1);
+		snprintf(worker.bgw_type, BGW_MAXLEN, "oai_fdw harvest worker");
+		worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		worker.bgw_notify_pid = MyProcPid;
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[nlaunched]))
+			break;
+
+		nlaunched++;
+	}
+
+	if (nlaunched == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+				 errmsg("could not register background workers for the harvest"),
+				 errhint("You may need to increase max_worker_processes.")));
+
+	if (nlaunched < nworkers)
+		ereport(NOTICE,
+				(errmsg("only %d of %d background workers could be registered", nlaunched, nworkers)));
+
+	/*
+	 * Workers notify this backend when they exit. If the harvest is
+	 * cancelled, the workers are stopped, but the pages they committed are
+	 * kept.
+	 */
+	PG_TRY();
+	{
+		for (;;)
+		{
+			int running = 0;
+			int done = 0;
+
+			for (int i = 0; i < nlaunched; i++)
+			{
+				pid_t pid;
+
+				if (GetBackgroundWorkerPid(handles[i], &pid) != BGWH_STOPPED)
+					running++;
+			}
+
+			pg_read_barrier();
+
+			for (int i = 0; i < npages; i++)
+				if (queue->pages[i].status != OAI_HARVEST_PAGE_PENDING)
+					done++;
+
+			/* the pages are the windows of the harvest, each scanned by a worker */
+			ReportHarvestProgress(InvalidOid, done, npages, DT_NOBEGIN, DT_NOBEGIN);
+
+			if (running == 0)
+				break;
+
+			(void)WaitLatch(MyLatch, OAI_WAIT_EVENTS, 1000L, PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		for (int i = 0; i < nlaunched; i++)
+			TerminateBackgroundWorker(handles[i]);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pg_read_barrier();
+
+	for (int i = 0; i < npages; i++)
+	{
+		OAIHarvestPage *page = &queue->pages[i];
+		Datum values[6];
+		bool isnull[6] = {false, false, false, false, false, false};
+
+		values[0] = Int32GetDatum(i + 1);
+		values[1] = Int64GetDatum(page->inserted);
+		values[2] = Int64GetDatum(page->updated);
+		values[3] = Int64GetDatum(page->unchanged);
+		values[4] = Int64GetDatum(page->deleted);
+
+		if (page->status == OAI_HARVEST_PAGE_DONE)
+			isnull[5] = true;
+		else if (page->status == OAI_HARVEST_PAGE_FAILED)
+			values[5] = CStringGetTextDatum(page->error);
+		else
+			values[5] = CStringGetTextDatum("background worker exited before harvesting the page");
+
+		if (!isnull[5])
+			isnull[1] = isnull[2] = isnull[3] = isnull[4] = true;
+
+		tuplestore_putvalues(tupstore, tupdesc, values, isnull);
+	}
+
+	dsm_detach(seg);
+
+	/* a harvest reported by the caller, e.g. OAI_HarvestTable, is ended by it */
+	if (!nested)
+		EndHarvestProgress();
+
+	PG_RETURN_NULL();
+}
+
+/*
+ * oai_fdw_harvest_worker
+ * ----------------------
+ * Entry point of the background workers of oai_fdw_harvest_pages.
+ * Claims pages from the queue until it is empty, each one harvested and
+ * committed in a transaction of its own. Like parallel query workers, it
+ * connects as the authenticated user of the session that started the
+ * harvest, which may log in, and then acts as its current user, which
+ * might be a role without LOGIN the session switched to with SET ROLE.
+ * It also restores the settings of that session, e.g. DateStyle, which
+ * formats the windows in the page query, TimeZone, which converts the
+ * datestamps stored into timestamptz columns, and the oai_fdw.* options.
+ *
+ * main_arg : handle of the dynamic shared memory segment of the queue
+ */
+void oai_fdw_harvest_worker(Datum main_arg)
+{
+	dsm_segment *seg;
+	OAIHarvestQueue *queue;
+	char *query;
+	uint32 next;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "oai_fdw harvest worker");
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+
+	if (!seg)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+
+	dsm_pin_mapping(seg);
+	queue = (OAIHarvestQueue *)dsm_segment_address(seg);
+
+	BackgroundWorkerInitializeConnectionByOid(queue->database, queue->authenticated, 0);
+
+	/* check hooks of some settings, e.g. role, look up the catalogs */
+	StartTransactionCommand();
+	RestoreGUCState((char *)queue + queue->guc);
+	CommitTransactionCommand();
+
+	/* aborted transactions restore this user */
+	SetUserIdAndSecContext(queue->user, queue->sec_context);
+
+	query = psprintf("SELECT * FROM %s($1, $2, $3, $4, $5)", queue->function);
+
+	while ((next = pg_atomic_fetch_add_u32(&queue->next, 1)) < (uint32)queue->npages)
+	{
+		OAIHarvestPage *page = &queue->pages[next];
+		MemoryContext oldcxt = CurrentMemoryContext;
+
+		CHECK_FOR_INTERRUPTS();
+
+		elog(DEBUG1, "%s: harvesting page %u of %d", __func__, next + 1, queue->npages);
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+		pgstat_report_activity(STATE_RUNNING, query);
+
+		PG_TRY();
+		{
+			Oid argtypes[5] = {REGCLASSOID, REGCLASSOID, TIMESTAMPOID, TIMESTAMPOID, TEXTOID};
+			Datum args[5];
+			bool isnull;
+			int ret;
+
+			args[0] = ObjectIdGetDatum(queue->foreigntableid);
+			args[1] = ObjectIdGetDatum(queue->targetid);
+			args[2] = TimestampGetDatum(page->from);
+			args[3] = TimestampGetDatum(page->until);
+			args[4] = CStringGetTextDatum(queue->deleted_mode);
+
+			SPI_connect();
+			PushActiveSnapshot(GetTransactionSnapshot());
+
+			ret = SPI_execute_with_args(query, 5, argtypes, args, NULL, false, 0);
+
+			if (ret != SPI_OK_SELECT || SPI_processed != 1)
+				elog(ERROR, "%s: unexpected result of page query: %s", __func__, SPI_result_code_string(ret));
+
+			page->inserted = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+			page->updated = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+			page->unchanged = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &isnull));
+			page->deleted = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 4, &isnull));
+
+			SPI_finish();
+			PopActiveSnapshot();
+			CommitTransactionCommand();
+
+			pg_write_barrier();
+			page->status = OAI_HARVEST_PAGE_DONE;
+		}
+		PG_CATCH();
+		{
+			ErrorData *edata;
+
+			MemoryContextSwitchTo(oldcxt);
+			edata = CopyErrorData();
+			FlushErrorState();
+			AbortCurrentTransaction();
+
+			strlcpy(page->error, edata->message, sizeof(page->error));
+			FreeErrorData(edata);
+
+			pg_write_barrier();
+			page->status = OAI_HARVEST_PAGE_FAILED;
+		}
+		PG_END_TRY();
+
+		pgstat_report_activity(STATE_IDLE, NULL);
+	}
+
+	dsm_detach(seg);
+	proc_exit(0);
+}
+
+/*
+ * OAISchedulerSighup
+ * ------------------
+ * SIGHUP handler of the scheduler worker. The configuration is reloaded
+ * in its main loop.
+ */
+static void OAISchedulerSighup(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	OAISchedulerGotSighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * oai_fdw_scheduler_main
+ * ----------------------
+ * Entry point of the scheduler background worker, registered in _PG_init
+ * if oai_fdw.scheduler_database is set. Every oai_fdw.scheduler_naptime
+ * seconds it looks for enabled jobs in oai_fdw_harvest_jobs whose next_run
+ * has passed and runs them one after the other with OAI_Sync, so that the
+ * harvests of a server never compete with each other. Requests still go
+ * through the server-wide request limits of the foreign servers.
+ *
+ * main_arg : unused
+ */
+void oai_fdw_scheduler_main(Datum main_arg)
+{
+	MemoryContext roundcxt;
+
+	pqsignal(SIGHUP, OAISchedulerSighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(OAISchedulerDatabase, NULL, 0);
+
+	ereport(LOG,
+			(errmsg("oai_fdw scheduler started in database \"%s\"", OAISchedulerDatabase)));
+
+	roundcxt = AllocSetContextCreate(TopMemoryContext,
+									 "oai_fdw scheduler",
+									 ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		List *jobs;
+		ListCell *cell;
+		int rc;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (OAISchedulerGotSighup)
+		{
+			OAISchedulerGotSighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		MemoryContextSwitchTo(roundcxt);
+
+		jobs = GetDueHarvestJobs();
+
+		foreach (cell, jobs)
+		{
+			CHECK_FOR_INTERRUPTS();
+			RunHarvestJob((OAIHarvestJob *)lfirst(cell));
+		}
+
+		MemoryContextSwitchTo(TopMemoryContext);
+		MemoryContextReset(roundcxt);
+
+		rc = WaitLatch(MyLatch, OAI_WAIT_EVENTS, OAISchedulerNaptime * 1000L, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+
+#if PG_VERSION_NUM < 120000
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+#else
+		(void)rc;
+#endif
+	}
+}
+
+/*
+ * GetDueHarvestJobs
+ * -----------------
+ * Reads the enabled jobs of oai_fdw_harvest_jobs that are due, in the
+ * order they became due. Jobs whose tables or owner no longer exist are
+ * skipped. Nothing is returned if the extension is not installed in the
+ * database of the scheduler, or was not updated yet.
+ *
+ * returns a list of OAIHarvestJob, allocated in the current memory context
+ */
+static List *GetDueHarvestJobs(void)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+	List *jobs = NIL;
+	char *jobs_table;
+	int ret;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "oai_fdw scheduler: looking for due harvest jobs");
+
+	jobs_table = GetExtensionTable(OAI_HARVEST_JOBS_TABLE, true);
+
+	if (jobs_table)
+	{
+		char *sql = psprintf("SELECT j.job_id, j.foreign_table, j.target_table, j.job_owner, j.strategy, "
+							 "j.failures, j.run_interval, j.deleted_mode "
+							 "FROM %s j "
+							 "WHERE j.enabled AND j.next_run <= pg_catalog.now() "
+							 "AND EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = j.foreign_table) "
+							 "AND EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = j.target_table) "
+							 "AND EXISTS (SELECT 1 FROM pg_catalog.pg_roles r WHERE r.oid = j.job_owner) "
+							 "ORDER BY j.next_run, j.job_id",
+							 jobs_table);
+
+		ret = SPI_execute(sql, true, 0);
+
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "%s: could not read \"%s\": %s", __func__, jobs_table, SPI_result_code_string(ret));
+
+		for (uint64 i = 0; i < SPI_processed; i++)
+		{
+			HeapTuple tuple = SPI_tuptable->vals[i];
+			TupleDesc tupdesc = SPI_tuptable->tupdesc;
+			OAIHarvestJob *job;
+			bool isnull;
+
+			MemoryContextSwitchTo(oldcxt);
+
+			job = (OAIHarvestJob *)palloc0(sizeof(OAIHarvestJob));
+			job->jobid = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+			job->foreigntableid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+			job->targetid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+			job->owner = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+			job->strategy = SPI_getvalue(tuple, tupdesc, 5);
+			job->failures = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 6, &isnull));
+			job->run_interval = (Interval *)palloc(sizeof(Interval));
+			memcpy(job->run_interval, DatumGetIntervalP(SPI_getbinval(tuple, tupdesc, 7, &isnull)), sizeof(Interval));
+			job->deleted_mode = SPI_getvalue(tuple, tupdesc, 8);
+			jobs = lappend(jobs, job);
+		}
+	}
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	elog(DEBUG1, "%s: %d harvest jobs due", __func__, list_length(jobs));
+
+	return jobs;
+}
+
+/*
+ * RunHarvestJob
+ * -------------
+ * Runs OAI_Sync for a job as its owner, in a transaction of its own, and
+ * records the run in oai_fdw_harvest_runs. The owner gets the restricted
+ * environment of VACUUM and REFRESH MATERIALIZED VIEW, so that code of
+ * other roles it might trigger cannot act as the scheduler, and setting
+ * changes made by such code are undone. A successful job is due again
+ * run_interval after it started, a failed one after HarvestBackoff.
+ *
+ * job : the due job
+ */
+static void RunHarvestJob(OAIHarvestJob *job)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+	TimestampTz started;
+	TimestampTz finished;
+	int64 records = 0;
+	char *error = NULL;
+	char *jobs_table;
+	char *runs_table;
+	char *sql;
+	Oid save_userid;
+	int save_sec_context;
+	int save_nestlevel;
+	Oid argtypes[6] = {INT4OID, TIMESTAMPTZOID, TIMESTAMPTZOID, INT8OID, TEXTOID, INTERVALOID};
+	Datum args[6];
+	char argnulls[6] = {' ', ' ', ' ', ' ', ' ', ' '};
+	int ret;
+
+	elog(DEBUG1, "%s: running harvest job %d", __func__, job->jobid);
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "oai_fdw scheduler: running harvest job");
+
+	started = GetCurrentTimestamp();
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+
+	PG_TRY();
+	{
+		SetUserIdAndSecContext(job->owner,
+							   save_sec_context | SECURITY_LOCAL_USERID_CHANGE | SECURITY_RESTRICTED_OPERATION);
+		save_nestlevel = NewGUCNestLevel();
+#if PG_VERSION_NUM >= 170000
+		RestrictSearchPath();
+#endif
+
+		records = DatumGetInt64(DirectFunctionCall5(oai_fdw_sync,
+													ObjectIdGetDatum(job->foreigntableid),
+													ObjectIdGetDatum(job->targetid),
+													CStringGetTextDatum(job->strategy),
+													Int32GetDatum(OAI_DEFAULT_GETRECORD_CONCURRENCY),
+													CStringGetTextDatum(job->deleted_mode)));
+
+		AtEOXact_GUC(false, save_nestlevel);
+		SetUserIdAndSecContext(save_userid, save_sec_context);
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData *edata;
+
+		/* aborting the transaction also restores the user and the settings */
+		MemoryContextSwitchTo(oldcxt);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		error = edata->message;
+
+		ereport(LOG,
+				(errmsg("oai_fdw harvest job %d failed: %s", job->jobid, error)));
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldcxt);
+
+	finished = GetCurrentTimestamp();
+
+	/* history and next run */
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	jobs_table = GetExtensionTable(OAI_HARVEST_JOBS_TABLE, false);
+	runs_table = GetExtensionTable(OAI_HARVEST_RUNS_TABLE, false);
+
+	/* the job might have been deleted in the meantime */
+	sql = psprintf("WITH j AS ("
+				   "UPDATE %1$s SET "
+				   "failures = CASE WHEN $5 IS NULL THEN 0 ELSE failures + 1 END, "
+				   "next_run = CASE WHEN $5 IS NULL THEN $2 + run_interval ELSE $3 + $6 END "
+				   "WHERE job_id = $1 RETURNING job_id) "
+				   "INSERT INTO %2$s (job_id, started, finished, duration, records, error) "
+				   "SELECT j.job_id, $2, $3, $3 - $2, $4, $5 FROM j",
+				   jobs_table, runs_table);
+
+	args[0] = Int32GetDatum(job->jobid);
+	args[1] = TimestampTzGetDatum(started);
+	args[2] = TimestampTzGetDatum(finished);
+	args[3] = Int64GetDatum(records);
+	args[5] = IntervalPGetDatum(HarvestBackoff(job->failures + 1, job->run_interval));
+
+	if (error)
+	{
+		args[4] = CStringGetTextDatum(error);
+		argnulls[3] = 'n';
+	}
+	else
+		argnulls[4] = 'n';
+
+	ret = SPI_execute_with_args(sql, 6, argtypes, args, argnulls, false, 0);
+
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "%s: could not update \"%s\": %s", __func__, runs_table, SPI_result_code_string(ret));
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * HarvestBackoff
+ * --------------
+ * Time after which a failed harvest job is retried. It doubles with each
+ * consecutive failure, starting at one minute, and is capped at the
+ * run_interval of the job, so that a repository that is down is not
+ * hammered with harvests.
+ *
+ * failures     : consecutive failed runs, including the last one
+ * run_interval : run_interval of the job
+ *
+ * returns a palloc'd interval
+ */
+static Interval *HarvestBackoff(int32 failures, Interval *run_interval)
+{
+	Interval *backoff = (Interval *)palloc0(sizeof(Interval));
+
+	backoff->time = USECS_PER_MINUTE << Min(Max(failures - 1, 0), OAI_SCHEDULER_MAX_BACKOFF);
+
+	return DatumGetIntervalP(DirectFunctionCall2(interval_smaller,
+												 IntervalPGetDatum(backoff),
+												 IntervalPGetDatum(run_interval)));
+}
+
+/*
+ * oai_fdw_harvest_backoff
+ * -----------------------
+ * SQL interface of HarvestBackoff, telling when a failing job is retried.
+ *
+ * failures     : consecutive failed runs, including the last one
+ * run_interval : run_interval of the job
+ *
+ * returns the backoff interval
+ */
+Datum oai_fdw_harvest_backoff(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INTERVAL_P(HarvestBackoff(PG_GETARG_INT32(0), PG_GETARG_INTERVAL_P(1)));
+}
+
+/*
+ * Parses information from the OAI Identify request.
+ * https://www.openarchives.org/OAI/openarchivesprotocol.html#Identify
+ */
+static List *GetIdentity(OAIFdwState *state)
+{
+	int oaiExecuteResponse;
+	List *result = NIL;
+
+	elog(DEBUG2, "%s called", __func__);
+
+	state->requestVerb = OAI_REQUEST_IDENTIFY;
+
+	oaiExecuteResponse = ExecuteOAIRequest(state);
+
+	if (!state->xmldoc)
+		elog(ERROR, "invalid %s response from '%s'", state->requestVerb, state->url);
+
+	if (oaiExecuteResponse == OAI_SUCCESS)
+	{
+		xmlNodePtr oai_root;
+		xmlNodePtr Identity;
+		xmlNodePtr xmlroot = xmlDocGetRootElement(state->xmldoc);
+
+		if (xmlroot == NULL)
+			elog(ERROR, "invalid root element for %s response", state->requestVerb);
+
+		for (oai_root = xmlroot->children; oai_root != NULL; oai_root = oai_root->next)
+		{
+			if (oai_root->type != XML_ELEMENT_NODE)
+				continue;
+
+			if (xmlStrcmp(oai_root->name, (xmlChar *)OAI_REQUEST_IDENTIFY) != 0)
+				continue;
+
+			for (Identity = oai_root->children; Identity != NULL; Identity = Identity->next)
+			{
+				OAIFdwIdentityNode *node;
+				xmlChar *el;
+
+				if (Identity->type != XML_ELEMENT_NODE)
+					continue;
+
+				node = (OAIFdwIdentityNode *)palloc0(sizeof(OAIFdwIdentityNode));
+				node->name = pstrdup((char *)Identity->name);
+				el = xmlNodeGetContent(Identity);
+				node->description = el ? pstrdup((char *)el) : NULL;
+				if (el)
+					xmlFree(el);
+				result = lappend(result, node);
+			}
+		}
+	}
+
+	xmlFreeDoc(state->xmldoc);
+
+	elog(DEBUG2, "%s => finished", __func__);
+
+	return result;
+}
+
+/*
+ * ForEachOAISet
+ * -------------
+ * Issues OAI ListSets requests and calls `callback` for every set found,
+ * following resumptionTokens until the repository reports the end of the
+ * list. Only one page (DOM) is kept in memory at a time: everything
+ * allocated while processing a page - including the OAISet handed to the
+ * callback - is released before the next page is requested, so callbacks
+ * must copy whatever they want to keep.
+ * https://www.openarchives.org/OAI/openarchivesprotocol.html#ListSets
+ *
+ * state    : the OAI request state
+ * callback : function called for every set
+ * arg      : passed through to the callback
+ */
+static void ForEachOAISet(OAIFdwState *state, void (*callback)(OAISet *set, void *arg), void *arg)
+{
+	MemoryContext pagecxt;
+	MemoryContext oldcxt;
+	char *token = NULL;
+	int pages = 0;
+
+	elog(DEBUG2, "%s called", __func__);
+
+	pagecxt = AllocSetContextCreate(CurrentMemoryContext,
+									"oai_fdw ListSets page",
+									ALLOCSET_DEFAULT_SIZES);
+
+	state->requestVerb = OAI_REQUEST_LISTSETS;
+	state->resumptionToken = NULL;
+
+	do
+	{
+		int oaiExecuteResponse;
+		char *next = NULL;
+
+		CHECK_FOR_INTERRUPTS();
+
+		oldcxt = MemoryContextSwitchTo(pagecxt);
+
+		oaiExecuteResponse = ExecuteOAIRequest(state);
+
+		if (!state->xmldoc)
+			elog(ERROR, "invalid %s response from '%s'", state->requestVerb, state->url);
+
+		if (oaiExecuteResponse == OAI_SUCCESS)
+		{
+			xmlNodePtr oai_root;
+			xmlNodePtr ListSets;
+			xmlNodePtr SetElement;
+			xmlNodePtr xmlroot = xmlDocGetRootElement(state->xmldoc);
+
+			if (xmlroot == NULL)
+				elog(ERROR, "invalid root element for %s response", state->requestVerb);
+
+			for (oai_root = xmlroot->children; oai_root != NULL; oai_root = oai_root->next)
+			{
+				if (oai_root->type != XML_ELEMENT_NODE)
+					continue;
+
+				if (xmlStrcmp(oai_root->name, (xmlChar *)OAI_REQUEST_LISTSETS) != 0)
+					continue;
+
+				for (ListSets = oai_root->children; ListSets != NULL; ListSets = ListSets->next)
+				{
+					OAISet *set;
+
+					if (ListSets->type != XML_ELEMENT_NODE)
+						continue;
+
+					if (xmlStrcmp(ListSets->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN) == 0)
+					{
+						xmlChar *el = xmlNodeGetContent(ListSets);
+
+						/* an empty resumptionToken marks the last page */
+						if (el && *el)
+							next = MemoryContextStrdup(oldcxt, (char *)el);
+						if (el)
+							xmlFree(el);
+
+						continue;
+					}
+
+					if (xmlStrcmp(ListSets->name, (xmlChar *)"set") != 0)
+						continue;
+
+					set = (OAISet *)palloc0(sizeof(OAISet));
+
+					for (SetElement = ListSets->children; SetElement != NULL; SetElement = SetElement->next)
+					{
+						if (SetElement->type != XML_ELEMENT_NODE)
+							continue;
+
+						if (xmlStrcmp(SetElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETSPEC) == 0)
+						{
+							xmlChar *el = xmlNodeGetContent(SetElement);
+							set->setSpec = pstrdup((char *)el);
+							xmlFree(el);
+						}
+						else if (xmlStrcmp(SetElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETNAME) == 0)
+						{
+							xmlChar *el = xmlNodeGetContent(SetElement);
+							set->setName = pstrdup((char *)el);
+							xmlFree(el);
+						}
+					}
+
+					callback(set, arg);
+				}
+			}
+		}
+
+		xmlFreeDoc(state->xmldoc);
+		state->xmldoc = NULL;
+
+		MemoryContextSwitchTo(oldcxt);
+		MemoryContextReset(pagecxt);
+
+		pages++;
+
+		if (next && token && strcmp(next, token) == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_ERROR),
+					 errmsg("OAI repository '%s' returned the same %s resumptionToken twice", state->url, state->requestVerb),
+					 errdetail("resumptionToken: \"%s\"", token)));
+
+		if (token)
+			pfree(token);
+
+		token = next;
+		state->resumptionToken = token;
+
+	} while (token);
+
+	MemoryContextDelete(pagecxt);
+
+	elog(DEBUG2, "%s => finished (%d pages)", __func__, pages);
+}
+
+/*
+ * CollectOAISet
+ * -------------
+ * ForEachOAISet callback that copies the set into the list pointed at
+ * by `arg`, allocated in the context the list was started in.
+ */
+static void CollectOAISet(OAISet *set, void *arg)
+{
+	OAISetCollector *collector = (OAISetCollector *)arg;
+	MemoryContext oldcxt = MemoryContextSwitchTo(collector->cxt);
+	OAISet *copy = (OAISet *)palloc0(sizeof(OAISet));
+
+	copy->setSpec = set->setSpec ? pstrdup(set->setSpec) : NULL;
+	copy->setName = set->setName ? pstrdup(set->setName) : NULL;
+	collector->sets = lappend(collector->sets, copy);
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Retrieves all sets of an OAI repository as a list of OAISet.
+ */
+static List *GetSets(OAIFdwState *state)
+{
+	OAISetCollector collector;
+
+	collector.sets = NIL;
+	collector.cxt = CurrentMemoryContext;
+
+	ForEachOAISet(state, CollectOAISet, &collector);
+
+	return collector.sets;
+}
+
+/*
+ * Parses information from the OAI ListMetadataFormats request.
+ * https://www.openarchives.org/OAI/openarchivesprotocol.html#ListMetadataFormats
+ */
+static List *GetMetadataFormats(OAIFdwState *state)
+{
+
+	int oaiExecuteResponse;
+	List *result = NIL;
+
+	elog(DEBUG2, "  %s called", __func__);
+
+	state->requestVerb = OAI_REQUEST_LISTMETADATAFORMATS;
+
+	oaiExecuteResponse = ExecuteOAIRequest(state);
+
+	if (!state->xmldoc)
+		elog(ERROR, "invalid %s response from '%s'", state->requestVerb, state->url);
+
+	if (oaiExecuteResponse == OAI_SUCCESS)
+	{
+		xmlNodePtr oai_root;
+		xmlNodePtr ListMetadataFormats;
+		xmlNodePtr MetadataElement;
+		xmlNodePtr xmlroot = xmlDocGetRootElement(state->xmldoc);
+
+		if (xmlroot == NULL)
+			elog(ERROR, "invalid root element for %s response", state->requestVerb);
+
+		for (oai_root = xmlroot->children; oai_root != NULL; oai_root = oai_root->next)
+		{
+			if (oai_root->type != XML_ELEMENT_NODE)
+				continue;
+
+			if (xmlStrcmp(oai_root->name, (xmlChar *)OAI_REQUEST_LISTMETADATAFORMATS) != 0)
+				continue;
+
+			for (ListMetadataFormats = oai_root->children; ListMetadataFormats != NULL; ListMetadataFormats = ListMetadataFormats->next)
+			{
+				OAIMetadataFormat *format = (OAIMetadataFormat *)palloc0(sizeof(OAIMetadataFormat));
+
+				if (ListMetadataFormats->type != XML_ELEMENT_NODE)
+					continue;
+				if (xmlStrcmp(ListMetadataFormats->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATAFORMAT) != 0)
+					continue;
+
+				for (MetadataElement = ListMetadataFormats->children; MetadataElement != NULL; MetadataElement = MetadataElement->next)
+				{
+					if (MetadataElement->type != XML_ELEMENT_NODE)
+						continue;
+
+					if (xmlStrcmp(MetadataElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATAPREFIX) == 0)
+					{
+						xmlChar *el = xmlNodeGetContent(MetadataElement);
+						format->metadataPrefix = pstrdup((char *)el);
+						xmlFree(el);
+					}
+					else if (xmlStrcmp(MetadataElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SCHEMA) == 0)
+					{
+						xmlChar *el = xmlNodeGetContent(MetadataElement);
+						format->schema = pstrdup((char *)el);
+						xmlFree(el);
+					}
+					else if (xmlStrcmp(MetadataElement->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATANAMESPACE) == 0)
+					{
+						xmlChar *el = xmlNodeGetContent(MetadataElement);
+						format->metadataNamespace = pstrdup((char *)el);
+						xmlFree(el);
+					}
+				}
+
+				result = lappend(result, format);
+			}
+		}
+	}
+
+	xmlFreeDoc(state->xmldoc);
+
+	elog(DEBUG2, "  %s => finished.", __func__);
+
+	return result;
+}
+
+/**
+ * Checks if a given URL is valid.
+ */
+static int CheckURL(char *url)
+{
+
+	CURLUcode code;
+	CURLU *handler = curl_url();
+
+	elog(DEBUG2, "%s called > '%s'", __func__, url);
+
+	code = curl_url_set(handler, CURLUPART_URL, url, 0);
+
+	curl_url_cleanup(handler);
+
+	elog(DEBUG2, "  %s handler return code: %u", __func__, code);
+
+	if (code != 0)
+	{
+		elog(DEBUG2, "%s: invalid URL (%u) > '%s'", __func__, code, url);
+
+		return code;
+	}
+
+	return OAI_SUCCESS;
+}
+
+static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	size_t realsize = size * nmemb;
+	struct MemoryStruct *mem = (struct MemoryStruct *)userp;
+	char *ptr = repalloc(mem->memory, mem->size + realsize + 1);
+
+	if (!ptr)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+				 errmsg("out of memory (repalloc returned NULL)")));
+
+	mem->memory = ptr;
+	memcpy(&(mem->memory[mem->size]), contents, realsize);
+	mem->size += realsize;
+	mem->memory[mem->size] = 0;
+
+	return realsize;
+}
+
+static size_t HeaderCallbackFunction(char *contents, size_t size, size_t nmemb, void *userp)
+{
+	size_t nbytes = size * nmemb;
+	struct MemoryStruct *mem = (struct MemoryStruct *)userp;
+	char *ptr;
+	char *line = palloc(nbytes + 1);
+	size_t linelen = nbytes;
+
+	memcpy(line, contents, nbytes);
+	line[nbytes] = '\0';
+
+	while (linelen > 0 && (line[linelen - 1] == '\r' || line[linelen - 1] == '\n'))
+		line[--linelen] = '\0';
+
+	if (pg_strncasecmp(line, "content-type:", 13) == 0 &&
+		pg_strncasecmp(line, "content-type: text/xml", 22) != 0 &&
+		pg_strncasecmp(line, "content-type: application/xml", 29) != 0)
+	{
+		elog(WARNING, "unsupported content-type: \"%s\"", line);
+	}
+	pfree(line);
+
+	ptr = repalloc(mem->memory, mem->size + nbytes + 1);
+	if (!ptr)
+		ereport(ERROR, (errcode(ERRCODE_FDW_OUT_OF_MEMORY),
+						errmsg("[%s] out of memory", __func__)));
+	mem->memory = ptr;
+	memcpy(&(mem->memory[mem->size]), contents, nbytes);
+	mem->size += nbytes;
+	mem->memory[mem->size] = 0;
+	return nbytes;
+}
+
+/*
+ * IsSensitiveHeader
+ * -----------------
+ * Returns the field-name of a sensitive HTTP header if `line` begins with
+ * one, or NULL otherwise.  Comparison is case-insensitive (RFC 9110 §5.1).
+ */
+static const char *
+IsSensitiveHeader(const char *line)
+{
+	static const struct
+	{
+		const char *name;
+		size_t len;
+	} sensitive_headers[] = {
+		{"Authorization:", sizeof("Authorization:") - 1},
+		{"Proxy-Authorization:", sizeof("Proxy-Authorization:") - 1},
+		{NULL, 0}};
+
+	for (int i = 0; sensitive_headers[i].name != NULL; i++)
+	{
+		if (strncasecmp(line, sensitive_headers[i].name,
+						sensitive_headers[i].len) == 0)
+			return sensitive_headers[i].name;
+	}
+
+	return NULL;
+}
+
+/*
+ * CURLDebugCallback
+ * -----------------
+ * Custom libcurl debug callback. Routes all verbose output through
+ * PostgreSQL's elog() at DEBUG3 level rather than writing directly to
+ * stderr, and redacts Authorization headers so credentials are never
+ * written to server logs.
+ *
+ * handle  : the curl handle (unused)
+ * type    : category of the debug data
+ * data    : pointer to the debug data (NOT null-terminated)
+ * size    : number of bytes in data
+ * userptr : user-supplied pointer (unused)
+ */
+static int
+CURLDebugCallback(CURL *handle, curl_infotype type, char *data, size_t size, void *userptr)
+{
+	const char *prefix;
+	StringInfoData buf;
+
+	switch (type)
+	{
+	case CURLINFO_TEXT:
+		prefix = "* ";
+		break;
+	case CURLINFO_HEADER_IN:
+		prefix = "< ";
+		break;
+	case CURLINFO_HEADER_OUT:
+		prefix = "> ";
+		break;
+	default:
+		return 0; /* skip raw data blobs (bodies, SSL frames) */
+	}
+
+	/*
+	 * curl's data pointer is NOT null-terminated, so copy it into a palloc'd
+	 * buffer before using any string functions on it.
+	 */
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, data, (int)size);
+
+	if (type == CURLINFO_HEADER_OUT)
+	{
+		/*
+		 * CURLINFO_HEADER_OUT delivers the entire outgoing request header
+		 * block (request line + all headers) as one multi-line chunk per
+		 * invocation.  Split it line-by-line so each sensitive header can be
+		 * redacted individually.
+		 */
+		char *pos = buf.data;
+
+		while (*pos != '\0')
+		{
+			char *eol = pos + strcspn(pos, "\r\n");
+			char saved = *eol;
+			const char *match;
+
+			*eol = '\0'; /* temporarily terminate the line */
+
+			if (*pos != '\0') /* skip blank lines */
+			{
+				match = IsSensitiveHeader(pos);
+				if (match)
+					elog(DEBUG3, "[curl] > %s [REDACTED]", match);
+				else
+					elog(DEBUG3, "[curl] > %s", pos);
+			}
+
+			*eol = saved;
+			pos = eol;
+			while (*pos == '\r' || *pos == '\n')
+				pos++;
+		}
+	}
+	else
+	{
+		const char *match;
+
+		/* Strip trailing CRLF for cleaner log output. */
+		while (buf.len > 0 &&
+			   (buf.data[buf.len - 1] == '\n' || buf.data[buf.len - 1] == '\r'))
+			buf.data[--buf.len] = '\0';
+
+		/*
+		 * Redact sensitive response headers.  Informational text lines
+		 * (CURLINFO_TEXT) are logged as-is — they never contain raw
+		 * credential values.
+		 */
+		match = (type == CURLINFO_HEADER_IN) ? IsSensitiveHeader(buf.data) : NULL;
+		if (match)
+			elog(DEBUG3, "[curl] %s%s [REDACTED]", prefix, match);
+		else
+			elog(DEBUG3, "[curl] %s%s", prefix, buf.data);
+	}
+
+	pfree(buf.data);
+	return 0;
+}
+
+/*
+ * GetCredentialsKey
+ * -----------------
+ * Identifies the credentials an OAI request is sent with: the local role
+ * and the user and password of its USER MAPPING. Any role can map the
+ * same remote user with a password of its own, so the remote user alone
+ * does not prove that a response was retrieved with valid credentials.
+ * Keys are stored on disk, the password therefore only enters as hash.
+ *
+ * state : the OAI request state
+ *
+ * returns a palloc'd key
+ */
+static char *GetCredentialsKey(OAIFdwState *state)
+{
+	uint64 password = 0;
+
+	if (state->password)
+		password = DatumGetUInt64(hash_any_extended((const unsigned char *)state->password,
+													strlen(state->password), 0));
+
+	return psprintf("%u:%s:%016llx", GetUserId(), state->user ? state->user : "",
+					(unsigned long long)password);
+}
+
+/*
+ * GetCacheKey
+ * -----------
+ * Builds the key of a cached OAI response out of the repository URL, the
+ * request sent by ExecuteOAIRequest (verb, arguments and resumptionToken)
+ * and the credentials it was sent with, so that responses retrieved with
+ * different credentials are never shared.
+ *
+ * state   : the OAI request state
+ * request : request parameters as sent to the repository
+ *
+ * returns a palloc'd cache key
+ */
+static char *GetCacheKey(OAIFdwState *state, const char *request)
+{
+	StringInfoData key;
+
+	initStringInfo(&key);
+	appendStringInfo(&key, "%s?%s\n%s", state->url, request, GetCredentialsKey(state));
+
+	return key.data;
+}
+
+/*
+ * GetCacheFileName
+ * ----------------
+ * Path of the cache file for a given cache key, relative to the data
+ * directory.
+ *
+ * state : the OAI request state
+ * key   : cache key created by GetCacheKey
+ *
+ * returns a palloc'd file path
+ */
+static char *GetCacheFileName(OAIFdwState *state, const char *key)
+{
+	uint64 hash = DatumGetUInt64(hash_any_extended((const unsigned char *)key, strlen(key), 0));
+
+	return psprintf("%s/%u_%u_%016llx%s",
+					OAI_CACHE_DIR,
+					MyDatabaseId,
+					state->foreign_server->serverid,
+					(unsigned long long)hash,
+					OAI_CACHE_FILE_SUFFIX);
+}
+
+/*
+ * ReadCachedResponse
+ * ------------------
+ * Looks up a response in the on-disk cache. Entries older than the
+ * server's cache_ttl, as well as entries that cannot be read, are treated
+ * as cache misses. Serving an entry refreshes its modification time, which
+ * is what EvictCachedResponses uses to find the least recently used ones.
+ *
+ * state   : the OAI request state
+ * request : request parameters as sent to the repository
+ * size    : set to the size of the returned response
+ *
+ * returns the palloc'd (null-terminated) response or NULL if not cached
+ */
+static char *ReadCachedResponse(OAIFdwState *state, const char *request, size_t *size)
+{
+	char *key = GetCacheKey(state, request);
+	char *path = GetCacheFileName(state, key);
+	char *result = NULL;
+	char *buffer = NULL;
+	OAICacheFileHeader hdr;
+	bool ok;
+	int fd;
+
+	elog(DEBUG2, "%s called: '%s'", __func__, path);
+
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+
+	if (fd < 0)
+	{
+		if (errno != ENOENT)
+			ereport(DEBUG1,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\": %m", path)));
+		pfree(key);
+		pfree(path);
+		return NULL;
+	}
+
+	ok = read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		 hdr.magic == OAI_CACHE_MAGIC &&
+		 hdr.keylen == strlen(key) &&
+		 hdr.rawsize >= 0 &&
+		 hdr.compsize >= -1;
+
+	if (ok && (int64)time(NULL) - hdr.created > state->cacheTtl)
+	{
+		elog(DEBUG2, "  %s: cached response expired", __func__);
+		ok = false;
+	}
+
+	if (ok)
+	{
+		/* guard against hash collisions */
+		buffer = palloc(hdr.keylen);
+		ok = read(fd, buffer, hdr.keylen) == hdr.keylen &&
+			 memcmp(buffer, key, hdr.keylen) == 0;
+		pfree(buffer);
+	}
+
+	if (ok)
+	{
+		result = palloc(hdr.rawsize + 1);
+
+		if (hdr.compsize == -1)
+			ok = read(fd, result, hdr.rawsize) == hdr.rawsize;
+		else
+		{
+			buffer = palloc(hdr.compsize);
+			ok = read(fd, buffer, hdr.compsize) == hdr.compsize &&
+#if PG_VERSION_NUM >= 120000
+				 pglz_decompress(buffer, hdr.compsize, result, hdr.rawsize, true) == hdr.rawsize;
+#else
+				 pglz_decompress(buffer, hdr.compsize, result, hdr.rawsize) == hdr.rawsize;
+#endif
+			pfree(buffer);
+		}
+	}
+
+	CloseTransientFile(fd);
+
+	if (ok)
+	{
+		result[hdr.rawsize] = '\0';
+		*size = hdr.rawsize;
+
+		/* mark the entry as recently used */
+		if (utime(path, NULL) != 0)
+			elog(DEBUG2, "  %s: could not update modification time of \"%s\": %m", __func__, path);
+	}
+	else if (result)
+	{
+		pfree(result);
+		result = NULL;
+	}
+
+	pfree(key);
+	pfree(path);
+
+	return result;
+}
+
+/*
+ * WriteCachedResponse
+ * -------------------
+ * Stores a response in the on-disk cache. The response is pglz compressed
+ * whenever that saves space, written into a temporary file and renamed, so
+ * that concurrent readers never see a partially written entry. Failures
+ * are reported as warnings - the cache is merely an optimisation and must
+ * never make a query fail.
+ *
+ * state   : the OAI request state
+ * request : request parameters as sent to the repository
+ * data    : response body
+ * size    : size of the response body
+ */
+static void WriteCachedResponse(OAIFdwState *state, const char *request, const char *data, size_t size)
+{
+	char *key;
+	char *path;
+	char *tmppath;
+	char *compressed;
+	OAICacheFileHeader hdr;
+	bool ok;
+	int fd;
+
+	if (size == 0 || size > PG_INT32_MAX / 2)
+		return;
+
+	if (MakePGDirectory(OAI_CACHE_DIR) < 0 && errno != EEXIST)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", OAI_CACHE_DIR)));
+		return;
+	}
+
+	key = GetCacheKey(state, request);
+	path = GetCacheFileName(state, key);
+	tmppath = psprintf("%s.%d.tmp", path, MyProcPid);
+
+	elog(DEBUG2, "%s called: '%s'", __func__, path);
+
+	compressed = palloc(PGLZ_MAX_OUTPUT(size));
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = OAI_CACHE_MAGIC;
+	hdr.keylen = strlen(key);
+	hdr.rawsize = (int32)size;
+	hdr.compsize = pglz_compress(data, (int32)size, compressed, PGLZ_strategy_default);
+	hdr.created = (int64)time(NULL);
+
+	fd = OpenTransientFile(tmppath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+
+	if (fd < 0)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", tmppath)));
+		ok = false;
+	}
+	else
+	{
+		ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+			 write(fd, key, hdr.keylen) == hdr.keylen;
+
+		if (ok && hdr.compsize == -1)
+			ok = write(fd, data, size) == size;
+		else if (ok)
+			ok = write(fd, compressed, hdr.compsize) == hdr.compsize;
+
+		if (!ok)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not write file \"%s\": %m", tmppath)));
+
+		if (CloseTransientFile(fd) != 0 && ok)
+		{
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not close file \"%s\": %m", tmppath)));
+			ok = false;
+		}
+
+		if (ok && rename(tmppath, path) != 0)
+		{
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not rename file \"%s\" to \"%s\": %m", tmppath, path)));
+			ok = false;
+		}
+
+		if (!ok)
+			unlink(tmppath);
+	}
+
+	if (ok)
+		elog(DEBUG2, "  %s: stored %ld bytes (%d on disk)", __func__, size,
+			 hdr.compsize == -1 ? hdr.rawsize : hdr.compsize);
+
+	pfree(compressed);
+	pfree(tmppath);
+	pfree(path);
+	pfree(key);
+
+	if (ok)
+		EvictCachedResponses();
+}
+
+/*
+ * CompareCacheFiles
+ * -----------------
+ * qsort comparator ordering cache files from the least to the most
+ * recently used.
+ */
+static int CompareCacheFiles(const void *a, const void *b)
+{
+	const OAICacheFile *fa = (const OAICacheFile *)a;
+	const OAICacheFile *fb = (const OAICacheFile *)b;
+
+	if (fa->mtime < fb->mtime)
+		return -1;
+	if (fa->mtime > fb->mtime)
+		return 1;
+	return 0;
+}
+
+/*
+ * EvictCachedResponses
+ * --------------------
+ * Removes the least recently used cache files until the cache fits into
+ * oai_fdw.cache_max_size. The cache is shared by all databases of the
+ * cluster, hence the limit applies to the whole directory.
+ */
+static void EvictCachedResponses(void)
+{
+	DIR *dir;
+	struct dirent *de;
+	OAICacheFile *files;
+	int nfiles = 0;
+	int maxfiles = 64;
+	int64 total = 0;
+	int64 limit;
+	size_t suffixlen = strlen(OAI_CACHE_FILE_SUFFIX);
+
+	if (OAICacheMaxSize <= 0)
+		return;
+
+	limit = (int64)OAICacheMaxSize * 1024;
+
+	dir = AllocateDir(OAI_CACHE_DIR);
+
+	if (dir == NULL)
+		return;
+
+	files = (OAICacheFile *)palloc(maxfiles * sizeof(OAICacheFile));
+
+	while ((de = ReadDirExtended(dir, OAI_CACHE_DIR, LOG)) != NULL)
+	{
+		struct stat st;
+		size_t len = strlen(de->d_name);
+		char *path;
+
+		if (len <= suffixlen || strcmp(de->d_name + len - suffixlen, OAI_CACHE_FILE_SUFFIX) != 0)
+			continue;
+
+		path = psprintf("%s/%s", OAI_CACHE_DIR, de->d_name);
+
+		if (stat(path, &st) != 0)
+		{
+			pfree(path);
+			continue;
+		}
+
+		if (nfiles >= maxfiles)
+		{
+			maxfiles *= 2;
+			files = (OAICacheFile *)repalloc(files, maxfiles * sizeof(OAICacheFile));
+		}
+
+		files[nfiles].name = path;
+		files[nfiles].mtime = st.st_mtime;
+		files[nfiles].size = st.st_size;
+		total += st.st_size;
+		nfiles++;
+	}
+
+	FreeDir(dir);
+
+	if (total > limit)
+	{
+		qsort(files, nfiles, sizeof(OAICacheFile), CompareCacheFiles);
+
+		for (int i = 0; i < nfiles && total > limit; i++)
+		{
+			if (unlink(files[i].name) == 0 || errno == ENOENT)
+			{
+				elog(DEBUG2, "  %s: evicted \"%s\"", __func__, files[i].name);
+				total -= files[i].size;
+			}
+		}
+	}
+
+	for (int i = 0; i < nfiles; i++)
+		pfree(files[i].name);
+
+	pfree(files);
+}
+
+/*
+ * oai_fdw_clear_cache
+ * -------------------
+ * Removes cached OAI responses from disk, either of a single FOREIGN
+ * SERVER of the current database or - if called with NULL - of all
+ * servers of the cluster.
+ *
+ * returns the number of removed cache entries
+ */
+Datum oai_fdw_clear_cache(PG_FUNCTION_ARGS)
+{
+	char *prefix = NULL;
+	int64 removed = 0;
+	size_t suffixlen = strlen(OAI_CACHE_FILE_SUFFIX);
+	DIR *dir;
+	struct dirent *de;
+
+	if (!PG_ARGISNULL(0))
+	{
+		char *srvname = text_to_cstring(PG_GETARG_TEXT_PP(0));
+		ForeignServer *server = GetForeignServerByName(srvname, false);
+
+		prefix = psprintf("%u_%u_", MyDatabaseId, server->serverid);
+	}
+
+	dir = AllocateDir(OAI_CACHE_DIR);
+
+	if (dir == NULL)
+	{
+		if (errno == ENOENT)
+			PG_RETURN_INT64(0);
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open directory \"%s\": %m", OAI_CACHE_DIR)));
+	}
+
+	while ((de = ReadDir(dir, OAI_CACHE_DIR)) != NULL)
+	{
+		size_t len = strlen(de->d_name);
+		char *path;
+
+		if (len <= suffixlen || strcmp(de->d_name + len - suffixlen, OAI_CACHE_FILE_SUFFIX) != 0)
+			continue;
+
+		if (prefix && strncmp(de->d_name, prefix, strlen(prefix)) != 0)
+			continue;
+
+		path = psprintf("%s/%s", OAI_CACHE_DIR, de->d_name);
+
+		if (unlink(path) == 0)
+			removed++;
+		else if (errno != ENOENT)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+
+		pfree(path);
+	}
+
+	FreeDir(dir);
+
+	elog(DEBUG1, "%s: %ld cached responses removed", __func__, (long)removed);
+
+	PG_RETURN_INT64(removed);
+}
+
+/*
+ * GetCheckpointKey
+ * ----------------
+ * Identifies the harvest a checkpoint belongs to: repository, request
+ * arguments of the first page and credentials (see GetCredentialsKey). A
+ * checkpoint is only resumed by a scan issuing exactly the same request
+ * with the same credentials.
+ *
+ * state : the OAI request state
+ *
+ * returns a palloc'd checkpoint key
+ */
+static char *GetCheckpointKey(OAIFdwState *state)
+{
+	StringInfoData key;
+
+	initStringInfo(&key);
+	appendStringInfo(&key, "%s?verb=%s&identifier=%s&set=%s&from=%s&until=%s&metadataPrefix=%s\n%s",
+					 state->url,
+					 state->requestVerb,
+					 state->identifier ? state->identifier : "",
+					 state->set ? state->set : "",
+					 state->from ? state->from : "",
+					 state->until ? state->until : "",
+					 state->metadataPrefix ? state->metadataPrefix : "",
+					 GetCredentialsKey(state));
+
+	return key.data;
+}
+
+/*
+ * GetCheckpointFileName
+ * ---------------------
+ * Path of a checkpoint file, relative to the data directory.
+ *
+ * state  : the OAI request state
+ * suffix : OAI_CHECKPOINT_FILE_SUFFIX or OAI_CHECKPOINT_PAGES_SUFFIX
+ *
+ * returns a palloc'd file path
+ */
+static char *GetCheckpointFileName(OAIFdwState *state, const char *suffix)
+{
+	return psprintf("%s/%u_%u_%016llx%s",
+					OAI_CHECKPOINT_DIR,
+					MyDatabaseId,
+					state->foreigntableid,
+					(unsigned long long)state->checkpointHash,
+					suffix);
+}
+
+/*
+ * GetTokenExpiration
+ * ------------------
+ * Parses the expirationDate attribute of a resumptionToken element, which
+ * is given in UTC with either day or seconds granularity.
+ *
+ * token : the resumptionToken element
+ *
+ * returns the expiration time or 0 if the repository did not send any
+ */
+static TimestampTz GetTokenExpiration(xmlNodePtr token)
+{
+	xmlChar *value = xmlGetProp(token, (xmlChar *)OAI_RESPONSE_ATTRIBUTE_EXPIRATIONDATE);
+	Timestamp result = 0;
+
+	if (value)
+	{
+		struct pg_tm tm;
+
+		memset(&tm, 0, sizeof(tm));
+
+		if (sscanf((char *)value, "%d-%d-%dT%d:%d:%d",
+				   &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+				   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 3 ||
+			tm2timestamp(&tm, 0, NULL, &result) != 0)
+			result = 0;
+
+		xmlFree(value);
+	}
+
+	return (TimestampTz)result;
+}
+
+/*
+ * GetCompleteListSize
+ * -------------------
+ * Parses the completeListSize attribute of a resumptionToken element.
+ *
+ * token : the resumptionToken element
+ *
+ * returns the size of the complete list or 0 if the repository did not
+ * send it
+ */
+static int64 GetCompleteListSize(xmlNodePtr token)
+{
+	xmlChar *value = xmlGetProp(token, (xmlChar *)OAI_RESPONSE_ELEMENT_COMPLETELISTSIZE);
+	int64 result = 0;
+
+	if (value)
+	{
+		result = Max(strtoll((char *)value, NULL, 10), 0);
+		xmlFree(value);
+	}
+
+	return result;
+}
+
+/*
+ * OpenCheckpoint
+ * --------------
+ * Looks up the checkpoint of a scan with resume_from_checkpoint enabled,
+ * before its first page is requested. If a checkpoint of the same request
+ * exists and its resumptionToken has not expired, the pages stored in it
+ * are replayed by ReadCheckpointPage before the harvest continues with the
+ * repository. Only one scan at a time may use a checkpoint - concurrent
+ * scans of the same request run without one.
+ *
+ * state : the OAI request state
+ */
+static void OpenCheckpoint(OAIFdwState *state)
+{
+	char *key = GetCheckpointKey(state);
+	char *path;
+	char *pagespath;
+	char *buffer = NULL;
+	OAICheckpointHeader hdr;
+	LOCKTAG tag;
+	LockAcquireResult lockresult;
+	struct stat st;
+	bool ok;
+	int fd;
+
+	state->checkpointHash = DatumGetUInt64(hash_any_extended((const unsigned char *)key, strlen(key), 0));
+	state->checkpointPages = 0;
+	state->checkpointPending = 0;
+	state->checkpointOffset = 0;
+	state->checkpointRows = 0;
+
+	SET_LOCKTAG_ADVISORY(tag, MyDatabaseId, state->foreigntableid, (uint32)state->checkpointHash, OAI_CHECKPOINT_LOCK_CLASS);
+
+	lockresult = LockAcquire(&tag, ExclusiveLock, false, true);
+
+	/* another scan of this backend, e.g. in a self join */
+	if (lockresult == LOCKACQUIRE_ALREADY_HELD)
+	{
+		LockRelease(&tag, ExclusiveLock, false);
+
+		ereport(NOTICE,
+				(errmsg("checkpoint of foreign table \"%s\" is in use by another scan",
+						get_rel_name(state->foreigntableid)),
+				 errdetail("The scan runs without checkpoint.")));
+		state->resumeFromCheckpoint = false;
+		pfree(key);
+		return;
+	}
+
+	if (lockresult != LOCKACQUIRE_OK)
+	{
+		ereport(NOTICE,
+				(errmsg("checkpoint of foreign table \"%s\" is in use by another session",
+						get_rel_name(state->foreigntableid)),
+				 errdetail("The scan runs without checkpoint.")));
+		state->resumeFromCheckpoint = false;
+		pfree(key);
+		return;
+	}
+
+	state->checkpointKey = key;
+
+	path = GetCheckpointFileName(state, OAI_CHECKPOINT_FILE_SUFFIX);
+	pagespath = GetCheckpointFileName(state, OAI_CHECKPOINT_PAGES_SUFFIX);
+
+	elog(DEBUG2, "%s called: '%s'", __func__, path);
+
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+
+	if (fd < 0)
+	{
+		if (errno != ENOENT)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\": %m", path)));
+		pfree(path);
+		pfree(pagespath);
+		return;
+	}
+
+	ok = read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		 hdr.magic == OAI_CHECKPOINT_MAGIC &&
+		 hdr.keylen == strlen(key) &&
+		 hdr.tokenlen > 0 &&
+		 hdr.pages > 0 &&
+		 hdr.offset > 0;
+
+	if (ok)
+	{
+		/* guard against hash collisions */
+		buffer = palloc(hdr.keylen);
+		ok = read(fd, buffer, hdr.keylen) == hdr.keylen &&
+			 memcmp(buffer, key, hdr.keylen) == 0;
+		pfree(buffer);
+	}
+
+	if (ok)
+	{
+		buffer = palloc(hdr.tokenlen + 1);
+		ok = read(fd, buffer, hdr.tokenlen) == hdr.tokenlen;
+		buffer[hdr.tokenlen] = '\0';
+	}
+
+	CloseTransientFile(fd);
+
+	/* the pages file must hold all pages the checkpoint refers to */
+	if (ok)
+		ok = stat(pagespath, &st) == 0 && st.st_size >= hdr.offset;
+
+	if (ok && hdr.expiration != 0 && hdr.expiration <= GetCurrentTimestamp())
+	{
+		ereport(NOTICE,
+				(errmsg("checkpoint of foreign table \"%s\" expired at %s",
+						get_rel_name(state->foreigntableid), timestamptz_to_str(hdr.expiration)),
+				 errdetail("The resumptionToken is no longer valid, the harvest starts from the beginning.")));
+		ok = false;
+	}
+
+	if (ok)
+	{
+		ereport(NOTICE,
+				(errmsg("resuming harvest of foreign table \"%s\" from checkpoint",
+						get_rel_name(state->foreigntableid)),
+				 errdetail("%ld records in %d pages are read from the checkpoint.",
+						   (long)hdr.rows, hdr.pages)));
+
+		elog(DEBUG1, "%s: resumptionToken > %s", __func__, buffer);
+
+		state->checkpointPages = hdr.pages;
+		state->checkpointPending = hdr.pages;
+		state->checkpointRows = hdr.rows;
+		pfree(buffer);
+	}
+	else
+		RemoveCheckpoint(state);
+
+	pfree(path);
+	pfree(pagespath);
+}
+
+/*
+ * ReadCheckpointPage
+ * ------------------
+ * Replays the next page stored in the checkpoint instead of requesting it
+ * from the repository. The page is parsed into state->xmldoc just like a
+ * response of ExecuteOAIRequest.
+ *
+ * state : the OAI request state
+ *
+ * returns OAI_SUCCESS
+ */
+static int ReadCheckpointPage(OAIFdwState *state)
+{
+	char *path = GetCheckpointFileName(state, OAI_CHECKPOINT_PAGES_SUFFIX);
+	char *data = NULL;
+	OAICheckpointPage page;
+	bool ok;
+	int fd;
+
+	elog(DEBUG2, "%s called: page %d/%d", __func__,
+		 state->checkpointPages - state->checkpointPending + 1, state->checkpointPages);
+
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+
+	ok = lseek(fd, (off_t)state->checkpointOffset, SEEK_SET) == (off_t)state->checkpointOffset &&
+		 read(fd, &page, sizeof(page)) == sizeof(page) &&
+		 page.rawsize > 0 &&
+		 page.compsize >= -1;
+
+	if (ok)
+	{
+		data = palloc(page.rawsize);
+
+		if (page.compsize == -1)
+			ok = read(fd, data, page.rawsize) == page.rawsize;
+		else
+		{
+			char *buffer = palloc(page.compsize);
+
+			ok = read(fd, buffer, page.compsize) == page.compsize &&
+#if PG_VERSION_NUM >= 120000
+				 pglz_decompress(buffer, page.compsize, data, page.rawsize, true) == page.rawsize;
+#else
+				 pglz_decompress(buffer, page.compsize, data, page.rawsize) == page.rawsize;
+#endif
+			pfree(buffer);
+		}
+	}
+
+	CloseTransientFile(fd);
+
+	if (!ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("checkpoint of foreign table \"%s\" is corrupted",
+						get_rel_name(state->foreigntableid)),
+				 errhint("Remove it with oai_fdw_clear_checkpoints('%s') and run the query again.",
+						 get_rel_name(state->foreigntableid))));
+
+	state->xmldoc = ReadOAIDocument(state, data, page.rawsize);
+	state->checkpointOffset += sizeof(page) + (page.compsize == -1 ? page.rawsize : page.compsize);
+	state->checkpointPending--;
+
+	pfree(data);
+	pfree(path);
+
+	return OAI_SUCCESS;
+}
+
+/*
+ * WriteCheckpoint
+ * ---------------
+ * Appends the page that was just retrieved from the repository to the
+ * checkpoint and records its resumptionToken, so that a failed scan can
+ * continue with the next page. The checkpoint file is replaced atomically,
+ * a partially appended page is therefore never referenced. Failures are
+ * reported as warnings - the scan itself is not affected.
+ *
+ * state : the OAI request state, holding the parsed page
+ */
+static void WriteCheckpoint(OAIFdwState *state)
+{
+	char *path;
+	char *pagespath;
+	char *tmppath;
+	char *compressed;
+	xmlChar *data = NULL;
+	int size = 0;
+	OAICheckpointPage page;
+	OAICheckpointHeader hdr;
+	bool ok;
+	int fd;
+
+	xmlDocDumpMemory(state->xmldoc, &data, &size);
+
+	if (!data || size <= 0 || size > PG_INT32_MAX / 2)
+	{
+		if (data)
+			xmlFree(data);
+		return;
+	}
+
+	if (MakePGDirectory(OAI_CHECKPOINT_DIR) < 0 && errno != EEXIST)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", OAI_CHECKPOINT_DIR)));
+		xmlFree(data);
+		return;
+	}
+
+	path = GetCheckpointFileName(state, OAI_CHECKPOINT_FILE_SUFFIX);
+	pagespath = GetCheckpointFileName(state, OAI_CHECKPOINT_PAGES_SUFFIX);
+	tmppath = psprintf("%s.%d.tmp", path, MyProcPid);
+
+	elog(DEBUG2, "%s called: '%s'", __func__, path);
+
+	compressed = palloc(PGLZ_MAX_OUTPUT(size));
+	page.rawsize = size;
+	page.compsize = pglz_compress((char *)data, size, compressed, PGLZ_strategy_default);
+
+	fd = OpenTransientFile(pagespath, O_WRONLY | O_CREAT | PG_BINARY);
+
+	if (fd < 0)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", pagespath)));
+		ok = false;
+	}
+	else
+	{
+		off_t end = (off_t)state->checkpointOffset + sizeof(page) +
+					(page.compsize == -1 ? page.rawsize : page.compsize);
+
+		/* pages after the recorded offset were never referenced */
+		ok = lseek(fd, (off_t)state->checkpointOffset, SEEK_SET) == (off_t)state->checkpointOffset &&
+			 write(fd, &page, sizeof(page)) == sizeof(page);
+
+		if (ok && page.compsize == -1)
+			ok = write(fd, data, size) == size;
+		else if (ok)
+			ok = write(fd, compressed, page.compsize) == page.compsize;
+
+		if (ok)
+			ok = ftruncate(fd, end) == 0;
+
+		if (!ok)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not write file \"%s\": %m", pagespath)));
+
+		if (CloseTransientFile(fd) != 0 && ok)
+		{
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not close file \"%s\": %m", pagespath)));
+			ok = false;
+		}
+
+		if (ok)
+		{
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.magic = OAI_CHECKPOINT_MAGIC;
+			hdr.keylen = strlen(state->checkpointKey);
+			hdr.tokenlen = strlen(state->resumptionToken);
+			hdr.pages = state->checkpointPages + 1;
+			hdr.rows = state->checkpointRows + state->pagesize;
+			hdr.offset = (int64)end;
+			hdr.expiration = state->tokenExpiration;
+			hdr.created = (int64)time(NULL);
+
+			fd = OpenTransientFile(tmppath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+
+			if (fd < 0)
+			{
+				ereport(WARNING,
+						(errcode_for_file_access(),
+						 errmsg("could not create file \"%s\": %m", tmppath)));
+				ok = false;
+			}
+			else
+			{
+				ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+					 write(fd, state->checkpointKey, hdr.keylen) == hdr.keylen &&
+					 write(fd, state->resumptionToken, hdr.tokenlen) == hdr.tokenlen;
+
+				if (!ok)
+					ereport(WARNING,
+							(errcode_for_file_access(),
+							 errmsg("could not write file \"%s\": %m", tmppath)));
+
+				if (CloseTransientFile(fd) != 0 && ok)
+				{
+					ereport(WARNING,
+							(errcode_for_file_access(),
+							 errmsg("could not close file \"%s\": %m", tmppath)));
+					ok = false;
+				}
+
+				if (ok && rename(tmppath, path) != 0)
+				{
+					ereport(WARNING,
+							(errcode_for_file_access(),
+							 errmsg("could not rename file \"%s\" to \"%s\": %m", tmppath, path)));
+					ok = false;
+				}
+
+				if (!ok)
+					unlink(tmppath);
+			}
+
+			if (ok)
+			{
+				state->checkpointPages = hdr.pages;
+				state->checkpointRows = hdr.rows;
+				state->checkpointOffset = hdr.offset;
+
+				elog(DEBUG2, "  %s: page %d stored (%ld records)", __func__, hdr.pages, (long)hdr.rows);
+			}
+		}
+	}
+
+	xmlFree(data);
+	pfree(compressed);
+	pfree(tmppath);
+	pfree(pagespath);
+	pfree(path);
+}
+
+/*
+ * RemoveCheckpoint
+ * ----------------
+ * Removes the checkpoint of a scan, e.g. after it retrieved all pages or
+ * if it cannot be resumed.
+ *
+ * state : the OAI request state
+ */
+static void RemoveCheckpoint(OAIFdwState *state)
+{
+	char *path = GetCheckpointFileName(state, OAI_CHECKPOINT_FILE_SUFFIX);
+	char *pagespath = GetCheckpointFileName(state, OAI_CHECKPOINT_PAGES_SUFFIX);
+
+	elog(DEBUG2, "%s called: '%s'", __func__, path);
+
+	/* the checkpoint file goes first, so that no stale pages are referenced */
+	if (unlink(path) != 0 && errno != ENOENT)
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", path)));
+
+	if (unlink(pagespath) != 0 && errno != ENOENT)
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", pagespath)));
+
+	state->checkpointPages = 0;
+	state->checkpointPending = 0;
+	state->checkpointOffset = 0;
+	state->checkpointRows = 0;
+
+	pfree(path);
+	pfree(pagespath);
+}
+
+/*
+ * DiscardInvalidCheckpoint
+ * ------------------------
+ * Removes the checkpoint of a scan if the repository rejects its
+ * resumptionToken, as resuming it again would fail the same way.
+ *
+ * state : the OAI request state
+ * error : error element of the OAI response
+ */
+static void DiscardInvalidCheckpoint(OAIFdwState *state, xmlNodePtr error)
+{
+	xmlChar *code = xmlGetProp(error, (xmlChar *)"code");
+
+	if (code && xmlStrcmp(code, (xmlChar *)OAI_ERROR_BAD_RESUMPTION_TOKEN) == 0)
+	{
+		ereport(NOTICE,
+				(errmsg("checkpoint of foreign table \"%s\" discarded",
+						get_rel_name(state->foreigntableid)),
+				 errdetail("The repository no longer accepts its resumptionToken.")));
+		RemoveCheckpoint(state);
+	}
+
+	if (code)
+		xmlFree(code);
+}
+
+/*
+ * oai_fdw_clear_checkpoints
+ * -------------------------
+ * Removes the checkpoints of failed scans, either of a single FOREIGN
+ * TABLE of the current database or - if called with NULL - of all foreign
+ * tables of the cluster.
+ *
+ * returns the number of removed checkpoints
+ */
+Datum oai_fdw_clear_checkpoints(PG_FUNCTION_ARGS)
+{
+	char *prefix = NULL;
+	int64 removed = 0;
+	size_t suffixlen = strlen(OAI_CHECKPOINT_FILE_SUFFIX);
+	size_t pagessuffixlen = strlen(OAI_CHECKPOINT_PAGES_SUFFIX);
+	DIR *dir;
+	struct dirent *de;
+
+	if (!PG_ARGISNULL(0))
+		prefix = psprintf("%u_%u_", MyDatabaseId, PG_GETARG_OID(0));
+
+	dir = AllocateDir(OAI_CHECKPOINT_DIR);
+
+	if (dir == NULL)
+	{
+		if (errno == ENOENT)
+			PG_RETURN_INT64(0);
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open directory \"%s\": %m", OAI_CHECKPOINT_DIR)));
+	}
+
+	while ((de = ReadDir(dir, OAI_CHECKPOINT_DIR)) != NULL)
+	{
+		size_t len = strlen(de->d_name);
+		bool checkpoint = len > suffixlen && strcmp(de->d_name + len - suffixlen, OAI_CHECKPOINT_FILE_SUFFIX) == 0;
+		bool pages = len > pagessuffixlen && strcmp(de->d_name + len - pagessuffixlen, OAI_CHECKPOINT_PAGES_SUFFIX) == 0;
+		char *path;
+
+		if (!checkpoint && !pages)
+			continue;
+
+		if (prefix && strncmp(de->d_name, prefix, strlen(prefix)) != 0)
+			continue;
+
+		path = psprintf("%s/%s", OAI_CHECKPOINT_DIR, de->d_name);
+
+		if (unlink(path) == 0)
+		{
+			if (checkpoint)
+				removed++;
+		}
+		else if (errno != ENOENT)
+			ereport(WARNING,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+
+		pfree(path);
+	}
+
+	FreeDir(dir);
+
+	elog(DEBUG1, "%s: %ld checkpoints removed", __func__, (long)removed);
+
+	PG_RETURN_INT64(removed);
+}
+
+/*
+ * oai_fdw_stat_servers
+ * --------------------
+ * Returns the request statistics of all foreign servers of the cluster
+ * kept in shared memory. Server names can only be resolved for servers
+ * of the current database.
+ */
+Datum oai_fdw_stat_servers(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc tupdesc;
+	HASH_SEQ_STATUS status;
+	OAIServerStatsEntry *entry;
+	List *entries = NIL;
+	ListCell *cell;
+
+	if (!OAIShared || !OAISharedStats)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("oai_fdw must be loaded via shared_preload_libraries to collect server statistics")));
+
+	tupstore = InitMaterializedResult(fcinfo, &tupdesc);
+
+	if (tupdesc->natts != OAI_STAT_SERVERS_COLS)
+		elog(ERROR, "%s: incorrect number of output arguments", __func__);
+
+	/* the entries are copied first, looking up server names may fail */
+	LWLockAcquire(OAIShared->lock, LW_SHARED);
+
+	hash_seq_init(&status, OAISharedStats);
+
+	while ((entry = (OAIServerStatsEntry *)hash_seq_search(&status)) != NULL)
+	{
+		OAIServerStatsEntry *copy = (OAIServerStatsEntry *)palloc(sizeof(OAIServerStatsEntry));
+
+		SpinLockAcquire(&entry->mutex);
+		memcpy(copy, entry, sizeof(OAIServerStatsEntry));
+		SpinLockRelease(&entry->mutex);
+
+		entries = lappend(entries, copy);
+	}
+
+	LWLockRelease(OAIShared->lock);
+
+	foreach (cell, entries)
+	{
+		OAIServerStatsEntry *stats = (OAIServerStatsEntry *)lfirst(cell);
+		ForeignServer *server = NULL;
+		Datum values[OAI_STAT_SERVERS_COLS];
+		bool nulls[OAI_STAT_SERVERS_COLS];
+		int64 requests = 0;
+		int col = 0;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		if (stats->key.dbid == MyDatabaseId &&
+			SearchSysCacheExists1(FOREIGNSERVEROID, ObjectIdGetDatum(stats->key.serverid)))
+			server = GetForeignServer(stats->key.serverid);
+
+		values[col++] = ObjectIdGetDatum(stats->key.dbid);
+		values[col++] = ObjectIdGetDatum(stats->key.serverid);
+
+		if (server)
+			values[col++] = CStringGetTextDatum(server->servername);
+		else
+			nulls[col++] = true;
+
+		for (int i = 0; i < lengthof(OAIStatVerbs); i++)
+			requests += stats->requests[i];
+
+		values[col++] = Int64GetDatum(requests);
+
+		for (int i = 0; i < lengthof(OAIStatVerbs); i++)
+			values[col++] = Int64GetDatum(stats->requests[i]);
+
+		values[col++] = Int64GetDatum(stats->bytes);
+
+		/* 1xx to 5xx, then transport errors */
+		for (int i = 1; i < OAI_STAT_STATUS_CLASSES; i++)
+			values[col++] = Int64GetDatum(stats->status[i]);
+
+		values[col++] = Int64GetDatum(stats->status[0]);
+		values[col++] = Int64GetDatum(stats->retries);
+		values[col++] = Float8GetDatum(stats->backoffTime);
+
+		if (requests > 0)
+		{
+			values[col++] = Float8GetDatum(stats->totalTime / requests);
+			values[col++] = Float8GetDatum(stats->maxTime);
+			values[col++] = Float8GetDatum(GetLatencyPercentile(stats, 0.5));
+			values[col++] = Float8GetDatum(GetLatencyPercentile(stats, 0.9));
+			values[col++] = Float8GetDatum(GetLatencyPercentile(stats, 0.99));
+		}
+		else
+		{
+			for (int i = 0; i < 5; i++)
+				nulls[col++] = true;
+		}
+
+		if (stats->lastErrorTime != 0)
+		{
+			values[col++] = CStringGetTextDatum(stats->lastError);
+			values[col++] = TimestampTzGetDatum(stats->lastErrorTime);
+		}
+		else
+		{
+			nulls[col++] = true;
+			nulls[col++] = true;
+		}
+
+		values[col++] = TimestampTzGetDatum(stats->statsReset);
+
+		Assert(col == OAI_STAT_SERVERS_COLS);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum)0;
+}
+
+/*
+ * oai_fdw_stat_servers_reset
+ * --------------------------
+ * Discards the request statistics of a FOREIGN SERVER of the current
+ * database or - if called with NULL - of all foreign servers of the
+ * cluster.
+ */
+Datum oai_fdw_stat_servers_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	OAIServerStatsEntry *entry;
+
+	if (!OAIShared || !OAISharedStats)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("oai_fdw must be loaded via shared_preload_libraries to collect server statistics")));
+
+	if (!PG_ARGISNULL(0))
+	{
+		ForeignServer *server = GetForeignServerByName(text_to_cstring(PG_GETARG_TEXT_PP(0)), false);
+		OAIRateLimitKey key;
+
+		memset(&key, 0, sizeof(key));
+		key.dbid = MyDatabaseId;
+		key.serverid = server->serverid;
+
+		LWLockAcquire(OAIShared->lock, LW_EXCLUSIVE);
+		hash_search(OAISharedStats, &key, HASH_REMOVE, NULL);
+		LWLockRelease(OAIShared->lock);
+
+		PG_RETURN_VOID();
+	}
+
+	LWLockAcquire(OAIShared->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, OAISharedStats);
+
+	while ((entry = (OAIServerStatsEntry *)hash_seq_search(&status)) != NULL)
+		hash_search(OAISharedStats, &entry->key, HASH_REMOVE, NULL);
+
+	LWLockRelease(OAIShared->lock);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * oai_fdw_progress
+ * ----------------
+ * Returns the progress of the scans and harvests running in all backends
+ * of the cluster. The time remaining is extrapolated from the time spent
+ * on the windows completed so far or, if the number of windows is not
+ * known, from the records of the scan and the completeListSize announced
+ * by the repository.
+ */
+Datum oai_fdw_progress(PG_FUNCTION_ARGS)
+{
+	Tuplestorestate *tupstore;
+	TupleDesc tupdesc;
+	TimestampTz now = GetCurrentTimestamp();
+
+	if (!OAIShared || !OAIProgress)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("oai_fdw must be loaded via shared_preload_libraries to report progress")));
+
+	tupstore = InitMaterializedResult(fcinfo, &tupdesc);
+
+	if (tupdesc->natts != OAI_PROGRESS_COLS)
+		elog(ERROR, "%s: incorrect number of output arguments", __func__);
+
+	for (int i = 0; i < OAIShared->progressSlots; i++)
+	{
+		OAIProgressSlot progress;
+		Datum values[OAI_PROGRESS_COLS];
+		bool nulls[OAI_PROGRESS_COLS];
+		double remaining = -1;
+		int col = 0;
+
+		SpinLockAcquire(&OAIProgress[i].mutex);
+		memcpy(&progress, &OAIProgress[i], sizeof(OAIProgressSlot));
+		SpinLockRelease(&OAIProgress[i].mutex);
+
+		if (progress.pid == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[col++] = Int32GetDatum(progress.pid);
+		values[col++] = ObjectIdGetDatum(progress.dbid);
+
+		if (OidIsValid(progress.relid))
+		{
+			values[col++] = ObjectIdGetDatum(progress.relid);
+			values[col++] = Int64GetDatum(progress.pages);
+			values[col++] = Int64GetDatum(progress.records);
+			values[col++] = Int64GetDatum(progress.bytes);
+
+			if (progress.completeListSize > 0)
+				values[col++] = Int64GetDatum(progress.completeListSize);
+			else
+				nulls[col++] = true;
+
+			values[col++] = TimestampTzGetDatum(progress.scanStart);
+
+			if (progress.completeListSize > progress.records && progress.records > 0)
+				remaining = (double)(now - progress.scanStart) *
+							(progress.completeListSize - progress.records) / progress.records;
+		}
+		else
+		{
+			for (int j = 0; j < 6; j++)
+				nulls[col++] = true;
+		}
+
+		if (progress.harvesting)
+		{
+			if (OidIsValid(progress.targetid))
+				values[col++] = ObjectIdGetDatum(progress.targetid);
+			else
+				nulls[col++] = true;
+
+			if (!TIMESTAMP_NOT_FINITE(progress.windowStart) && !TIMESTAMP_NOT_FINITE(progress.windowEnd))
+			{
+				values[col++] = TimestampGetDatum(progress.windowStart);
+				values[col++] = TimestampGetDatum(progress.windowEnd);
+			}
+			else
+			{
+				nulls[col++] = true;
+				nulls[col++] = true;
+			}
+
+			values[col++] = Int32GetDatum(progress.windowsDone);
+
+			if (progress.windowsTotal > 0)
+				values[col++] = Int32GetDatum(progress.windowsTotal);
+			else
+				nulls[col++] = true;
+
+			values[col++] = TimestampTzGetDatum(progress.harvestStart);
+
+			if (progress.windowsTotal > 0 && progress.windowsDone > 0)
+				remaining = (double)(now - progress.harvestStart) *
+							(progress.windowsTotal - progress.windowsDone) / progress.windowsDone;
+		}
+		else
+		{
+			for (int j = 0; j < 6; j++)
+				nulls[col++] = true;
+		}
+
+		if (remaining >= 0)
+		{
+			Interval *interval = (Interval *)palloc0(sizeof(Interval));
+
+			interval->time = (TimeOffset)remaining;
+			values[col++] = IntervalPGetDatum(interval);
+		}
+		else
+			nulls[col++] = true;
+
+		Assert(col == OAI_PROGRESS_COLS);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum)0;
+}
+
+/*
+ * oai_fdw_progress_update
+ * -----------------------
+ * Reports the progress of a harvest run in SQL, e.g. OAI_HarvestTable.
+ * Does nothing if oai_fdw is not loaded via shared_preload_libraries, so
+ * that harvests do not depend on it.
+ */
+Datum oai_fdw_progress_update(PG_FUNCTION_ARGS)
+{
+	Timestamp window_start = DT_NOBEGIN;
+	Timestamp window_end = DT_NOBEGIN;
+
+	if (PG_ARGISNULL(1))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("windows_done cannot be NULL")));
+
+	if (!PG_ARGISNULL(3) && !PG_ARGISNULL(4))
+	{
+		window_start = PG_GETARG_TIMESTAMP(3);
+		window_end = PG_GETARG_TIMESTAMP(4);
+	}
+
+	ReportHarvestProgress(PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0),
+						  PG_GETARG_INT32(1),
+						  PG_ARGISNULL(2) ? 0 : Max(PG_GETARG_INT32(2), 0),
+						  window_start,
+						  window_end);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * oai_fdw_progress_end
+ * --------------------
+ * Ends the harvest reported with oai_fdw_progress_update.
+ */
+Datum oai_fdw_progress_end(PG_FUNCTION_ARGS)
+{
+	EndHarvestProgress();
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * GetResponseHeader
+ * -----------------
+ * Extracts the value of an HTTP response header from the headers collected
+ * by HeaderCallbackFunction. If the request was redirected the headers of
+ * all responses are available, so the last occurrence wins.
+ *
+ * headers : response headers, one per line
+ * name    : header field name (case-insensitive, without colon)
+ *
+ * returns a palloc'd copy of the header value or NULL if not found
+ */
+static char *GetResponseHeader(const char *headers, const char *name)
+{
+	size_t namelen = strlen(name);
+	const char *line = headers;
+	char *result = NULL;
+
+	while (line && *line)
+	{
+		const char *eol = line + strcspn(line, "\r\n");
+
+		if (pg_strncasecmp(line, name, namelen) == 0 && line[namelen] == ':')
+		{
+			const char *value = line + namelen + 1;
+			const char *end = eol;
+
+			while (value < end && (*value == ' ' || *value == '\t'))
+				value++;
+			while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+				end--;
+
+			if (result)
+				pfree(result);
+
+			result = pnstrdup(value, end - value);
+		}
+
+		line = eol;
+		while (*line == '\r' || *line == '\n')
+			line++;
+	}
+
+	return result;
+}
+
+/*
+ * IsMetadataRequest
+ * -----------------
+ * Identify, ListSets and ListMetadataFormats describe the repository itself
+ * rather than its records. They change rarely and are therefore kept in the
+ * backend-local metadata cache.
+ */
+static bool IsMetadataRequest(const char *verb)
+{
+	return strcmp(verb, OAI_REQUEST_IDENTIFY) == 0 ||
+		   strcmp(verb, OAI_REQUEST_LISTSETS) == 0 ||
+		   strcmp(verb, OAI_REQUEST_LISTMETADATAFORMATS) == 0;
+}
+
+/*
+ * IsCacheableResponse
+ * -------------------
+ * Only well-formed responses without an OAI <error> are worth caching:
+ * errors such as badResumptionToken or a repository briefly returning
+ * noRecordsMatch would otherwise be replayed until the entry expires.
+ *
+ * doc : the parsed OAI response, or NULL
+ *
+ * returns true if the response may be cached
+ */
+static bool IsCacheableResponse(xmlDocPtr doc)
+{
+	xmlNodePtr root = doc ? xmlDocGetRootElement(doc) : NULL;
+	xmlNodePtr node;
+
+	if (!root)
+		return false;
+
+	for (node = root->children; node != NULL; node = node->next)
+	{
+		if (node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, (xmlChar *)"error") == 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * InvalidateMetadataCache
+ * -----------------------
+ * Syscache callback for pg_foreign_server and pg_user_mapping. Changing a
+ * server removes its cached responses; as user mappings cannot be matched
+ * to cache entries through their hash value, changing any of them flushes
+ * the whole cache.
+ */
+static void InvalidateMetadataCache(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS status;
+	OAIMetadataCacheEntry *entry;
+
+	if (!OAIMetadataCache)
+		return;
+
+	hash_seq_init(&status, OAIMetadataCache);
+
+	while ((entry = (OAIMetadataCacheEntry *)hash_seq_search(&status)) != NULL)
+	{
+		if (cacheid == FOREIGNSERVEROID && hashvalue != 0 &&
+			GetSysCacheHashValue1(FOREIGNSERVEROID, ObjectIdGetDatum(entry->key.serverid)) != hashvalue)
+			continue;
+
+		if (entry->request)
+			pfree(entry->request);
+		if (entry->body)
+			pfree(entry->body);
+		if (entry->etag)
+			pfree(entry->etag);
+		if (entry->lastModified)
+			pfree(entry->lastModified);
+
+		hash_search(OAIMetadataCache, &entry->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * GetMetadataCacheEntry
+ * ---------------------
+ * Looks up the cached response of a metadata request issued by the
+ * current user against the server of the given state, creating the cache
+ * on first use.
+ *
+ * state   : the OAI request state
+ * request : request parameters as sent to the repository
+ * create  : create an empty entry if none is found
+ *
+ * returns the cache entry or NULL
+ */
+static OAIMetadataCacheEntry *GetMetadataCacheEntry(OAIFdwState *state, const char *request, bool create)
+{
+	OAIMetadataCacheKey key;
+	OAIMetadataCacheEntry *entry;
+	bool found;
+
+	if (!OAIMetadataCache)
+	{
+		HASHCTL ctl;
+
+		OAIMetadataCacheContext = AllocSetContextCreate(CacheMemoryContext,
+														"oai_fdw metadata cache",
+														ALLOCSET_SMALL_SIZES);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(OAIMetadataCacheKey);
+		ctl.entrysize = sizeof(OAIMetadataCacheEntry);
+		ctl.hcxt = OAIMetadataCacheContext;
+
+		OAIMetadataCache = hash_create("oai_fdw metadata cache", 16, &ctl,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		CacheRegisterSyscacheCallback(FOREIGNSERVEROID, InvalidateMetadataCache, (Datum)0);
+		CacheRegisterSyscacheCallback(USERMAPPINGOID, InvalidateMetadataCache, (Datum)0);
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.serverid = state->foreign_server->serverid;
+	key.userid = GetUserId();
+	key.requesthash = DatumGetUInt32(hash_any((const unsigned char *)request, strlen(request)));
+
+	entry = (OAIMetadataCacheEntry *)hash_search(OAIMetadataCache, &key, create ? HASH_ENTER : HASH_FIND, &found);
+
+	if (!entry)
+		return NULL;
+
+	if (found && strcmp(entry->request, request) != 0)
+	{
+		/* hash collision: the slot now belongs to the new request */
+		if (!create)
+			return NULL;
+
+		pfree(entry->request);
+		if (entry->body)
+			pfree(entry->body);
+		if (entry->etag)
+			pfree(entry->etag);
+		if (entry->lastModified)
+			pfree(entry->lastModified);
+
+		found = false;
+	}
+
+	if (!found)
+	{
+		entry->request = MemoryContextStrdup(OAIMetadataCacheContext, request);
+		entry->body = NULL;
+		entry->size = 0;
+		entry->etag = NULL;
+		entry->lastModified = NULL;
+		entry->fetched = 0;
+	}
+
+	return entry;
+}
+
+/*
+ * StoreMetadataCacheEntry
+ * -----------------------
+ * Keeps the response of a metadata request together with its validators
+ * (ETag and Last-Modified), so that it can be served while fresh and
+ * revalidated with a conditional request once it has expired.
+ *
+ * state   : the OAI request state
+ * request : request parameters as sent to the repository
+ * data    : response body
+ * size    : size of the response body
+ * headers : response headers collected by HeaderCallbackFunction
+ */
+static void StoreMetadataCacheEntry(OAIFdwState *state, const char *request, const char *data, size_t size, const char *headers)
+{
+	OAIMetadataCacheEntry *entry = GetMetadataCacheEntry(state, request, true);
+	char *etag = GetResponseHeader(headers, "ETag");
+	char *lastModified = GetResponseHeader(headers, "Last-Modified");
+
+	if (entry->body)
+		pfree(entry->body);
+	if (entry->etag)
+		pfree(entry->etag);
+	if (entry->lastModified)
+		pfree(entry->lastModified);
+
+	entry->body = MemoryContextAlloc(OAIMetadataCacheContext, size + 1);
+	memcpy(entry->body, data, size);
+	entry->body[size] = '\0';
+	entry->size = size;
+	entry->etag = etag ? MemoryContextStrdup(OAIMetadataCacheContext, etag) : NULL;
+	entry->lastModified = lastModified ? MemoryContextStrdup(OAIMetadataCacheContext, lastModified) : NULL;
+	entry->fetched = GetCurrentTimestamp();
+
+	elog(DEBUG2, "  %s: cached %s response (%ld bytes, etag: %s, last-modified: %s)", __func__,
+		 state->requestVerb, size, etag ? etag : "none", lastModified ? lastModified : "none");
+
+	if (etag)
+		pfree(etag);
+	if (lastModified)
+		pfree(lastModified);
+}
+
+/*
+ * OAIShmemExit
+ * ------------
+ * Releases the concurrency slots of a backend that exits in the middle of
+ * a request (e.g. FATAL errors, which do not unwind through PG_CATCH).
+ */
+static void OAIShmemExit(int code, Datum arg)
+{
+	while (OAIHeldSlots > 0 && OAIShared)
+		ReleaseRequestSlot(OAIHeldSlot[OAIHeldSlots - 1].serverid);
+}
+
+/*
+ * AcquireRequestSlot
+ * ------------------
+ * Waits until the server-wide limits max_requests_per_second and
+ * max_concurrent_requests allow this backend to send a request to the
+ * foreign server of `state`. The limits are shared by all backends of
+ * the cluster through shared memory; while waiting the backend sleeps on
+ * its latch, so the wait can be cancelled like any other query.
+ *
+ * state : the OAI request state
+ */
+static void AcquireRequestSlot(OAIFdwState *state)
+{
+	long wait_ms;
+
+	while (!TryAcquireRequestSlot(state, &wait_ms))
+	{
+		elog(DEBUG2, "  %s: request limit of server '%s' reached, waiting %ld ms", __func__,
+			 state->foreign_server->servername, wait_ms);
+
+		(void)WaitLatch(MyLatch, OAI_WAIT_EVENTS, Max(wait_ms, 1), GetOAIWaitEvent(OAI_WAIT_EVENT_RATE_LIMIT));
+		ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * TryAcquireRequestSlot
+ * ---------------------
+ * Takes a request token and, if max_concurrent_requests is set, a
+ * concurrency slot of the foreign server of `state` without waiting.
+ * A backend may hold several slots at once, also of different servers,
+ * e.g. for the concurrent transfers of FetchOAIRecords or of a federated
+ * scan; each one is given back with ReleaseRequestSlot.
+ *
+ * state   : the OAI request state
+ * wait_ms : set to the time after which a request may be allowed, if it
+ *           is not allowed now
+ *
+ * returns true if the request may be sent
+ */
+static bool TryAcquireRequestSlot(OAIFdwState *state, long *wait_ms)
+{
+	static bool warned = false;
+	static bool exit_registered = false;
+	double rate = state->maxRequestsPerSecond;
+	int concurrency = state->maxConcurrentRequests;
+	OAIRateLimitKey key;
+	OAIRateLimitEntry *entry;
+	TimestampTz now;
+	bool found;
+
+	*wait_ms = 0;
+
+	if (rate <= 0 && concurrency <= 0)
+		return true;
+
+	if (!OAIShared || !OAISharedServers)
+	{
+		if (!warned)
+			ereport(WARNING,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("request limits of server '%s' are not enforced", state->foreign_server->servername),
+					 errhint("Add oai_fdw to shared_preload_libraries to enable \"%s\" and \"%s\".",
+							 OAI_SERVER_OPTION_MAX_REQUESTS_PER_SECOND,
+							 OAI_SERVER_OPTION_MAX_CONCURRENT_REQUESTS)));
+		warned = true;
+		return true;
+	}
+
+	if (!exit_registered)
+	{
+		before_shmem_exit(OAIShmemExit, (Datum)0);
+		exit_registered = true;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.serverid = state->foreign_server->serverid;
+
+	/* room for the key of the slot, allocated before taking the lock */
+	if (OAIHeldSlots == OAIHeldSlotsAllocated)
+	{
+		int size = Max(OAIHeldSlotsAllocated * 2, OAI_DEFAULT_GETRECORD_CONCURRENCY);
+
+		if (OAIHeldSlot)
+			OAIHeldSlot = (OAIRateLimitKey *)repalloc(OAIHeldSlot, size * sizeof(OAIRateLimitKey));
+		else
+			OAIHeldSlot = (OAIRateLimitKey *)MemoryContextAlloc(TopMemoryContext, size * sizeof(OAIRateLimitKey));
+
+		OAIHeldSlotsAllocated = size;
+	}
+
+	now = GetCurrentTimestamp();
+
+	LWLockAcquire(OAIShared->lock, LW_EXCLUSIVE);
+
+	entry = (OAIRateLimitEntry *)hash_search(OAISharedServers, &key, HASH_ENTER_NULL, &found);
+
+	if (!entry)
+	{
+		LWLockRelease(OAIShared->lock);
+
+		if (!warned)
+			ereport(WARNING,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("request limits of server '%s' are not enforced", state->foreign_server->servername),
+					 errhint("Increase oai_fdw.max_shared_servers.")));
+		warned = true;
+		return true;
+	}
+
+	if (!found)
+	{
+		entry->tokens = Max(rate, 1.0);
+		entry->lastRefill = now;
+		entry->active = 0;
+	}
+
+	if (rate > 0)
+	{
+		/* refill the bucket, holding at most one second worth of requests */
+		double elapsed = (double)(now - entry->lastRefill) / USECS_PER_SEC;
+
+		entry->tokens = Min(Max(rate, 1.0), entry->tokens + elapsed * rate);
+	}
+	entry->lastRefill = now;
+
+	if ((rate <= 0 || entry->tokens >= 1.0) &&
+		(concurrency <= 0 || entry->active < concurrency))
+	{
+		if (rate > 0)
+			entry->tokens -= 1.0;
+
+		entry->active++;
+		OAIHeldSlot[OAIHeldSlots++] = key;
+
+		LWLockRelease(OAIShared->lock);
+		return true;
+	}
+
+	if (rate > 0 && entry->tokens < 1.0)
+		*wait_ms = (long)ceil((1.0 - entry->tokens) * 1000.0 / rate);
+	else
+		*wait_ms = OAI_RATE_LIMIT_POLL_INTERVAL;
+
+	LWLockRelease(OAIShared->lock);
+
+	return false;
+}
+
+/*
+ * ReleaseRequestSlot
+ * ------------------
+ * Gives back a concurrency slot of a foreign server taken by
+ * AcquireRequestSlot or TryAcquireRequestSlot, if this backend holds one.
+ *
+ * serverid : oid of the foreign server
+ */
+static void ReleaseRequestSlot(Oid serverid)
+{
+	OAIRateLimitEntry *entry;
+	int i = OAIHeldSlots - 1;
+
+	if (!OAIShared)
+		return;
+
+	while (i >= 0 && OAIHeldSlot[i].serverid != serverid)
+		i--;
+
+	if (i < 0)
+		return;
+
+	LWLockAcquire(OAIShared->lock, LW_EXCLUSIVE);
+
+	entry = (OAIRateLimitEntry *)hash_search(OAISharedServers, &OAIHeldSlot[i], HASH_FIND, NULL);
+
+	if (entry && entry->active > 0)
+		entry->active--;
+
+	LWLockRelease(OAIShared->lock);
+
+	OAIHeldSlot[i] = OAIHeldSlot[--OAIHeldSlots];
+}
+
+/*
+ * GetRequestEngine
+ * ----------------
+ * Returns the request engine of this backend, creating it on first use.
+ * The engine lives as long as the backend, so that the connections cURL
+ * keeps in the cache of its multi handle are reused by later requests.
+ */
+static OAIRequestEngine *GetRequestEngine(void)
+{
+	OAIRequestEngine *engine;
+
+	if (OAIEngine)
+		return OAIEngine;
+
+	engine = (OAIRequestEngine *)MemoryContextAllocZero(TopMemoryContext, sizeof(OAIRequestEngine));
+	engine->multi = curl_multi_init();
+
+	if (!engine->multi)
+	{
+		pfree(engine);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("%s: failed to initialize curl", __func__)));
+	}
+
+	dlist_init(&engine->transfers);
+
+	curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, EngineSocketCallback);
+	curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, engine);
+	curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, EngineTimerCallback);
+	curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, engine);
+
+	RegisterXactCallback(EngineXactCallback, NULL);
+
+	OAIEngine = engine;
+
+	return engine;
+}
+
+/*
+ * AddEngineTransfer
+ * -----------------
+ * Hands a prepared cURL request over to the request engine. The transfer
+ * proceeds whenever RunRequestEngine is called, also by other requests of
+ * the backend, and `callback` is called once it finished. The callback
+ * may run while another request waits for the engine, so it must only
+ * record the outcome of the transfer, e.g. with SetTransferResult, and
+ * must not raise errors.
+ *
+ * curl     : prepared cURL handle
+ * callback : called with the result of the transfer
+ * arg      : argument of the callback
+ */
+static void AddEngineTransfer(CURL *curl, OAITransferCallback callback, void *arg)
+{
+	OAIRequestEngine *engine = GetRequestEngine();
+	OAIEngineTransfer *transfer;
+
+	transfer = (OAIEngineTransfer *)MemoryContextAllocZero(TopMemoryContext, sizeof(OAIEngineTransfer));
+	transfer->curl = curl;
+	transfer->callback = callback;
+	transfer->arg = arg;
+
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+
+	if (curl_multi_add_handle(engine->multi, curl) != CURLM_OK)
+	{
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+		pfree(transfer);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("%s: failed to start the transfer", __func__)));
+	}
+
+	dlist_push_tail(&engine->transfers, &transfer->node);
+}
+
+/*
+ * RemoveEngineTransfer
+ * --------------------
+ * Cancels a transfer of the request engine, so that the cURL handle can
+ * be freed or reused. Its callback is not called. Does nothing if the
+ * transfer already finished or was never started.
+ *
+ * curl : cURL handle of the transfer
+ */
+static void RemoveEngineTransfer(CURL *curl)
+{
+	OAIEngineTransfer *transfer = NULL;
+
+	if (!curl || !OAIEngine)
+		return;
+
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&transfer);
+
+	if (!transfer)
+		return;
+
+	curl_multi_remove_handle(OAIEngine->multi, curl);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+
+	dlist_delete(&transfer->node);
+	pfree(transfer);
+}
+
+/*
+ * RunRequestEngine
+ * ----------------
+ * Waits once for the latch of the backend and the sockets of all transfers
+ * of the request engine, for at most `timeout` ms or until cURL wants to be
+ * called on timeout, e.g. to give up a connection attempt. The transfers
+ * whose sockets are ready proceed, and the callbacks of the finished ones
+ * are called. Interrupts are checked afterwards, so that a cancel request
+ * ends the wait at once. The callers call it in a loop until the
+ * transfers they wait for finished, releasing them with
+ * RemoveEngineTransfer on error.
+ *
+ * timeout    : maximum time to wait in ms, -1 to wait for the transfers
+ * wait_event : wait event reported in pg_stat_activity
+ */
+static void RunRequestEngine(long timeout, uint32 wait_event)
+{
+	OAIRequestEngine *engine = GetRequestEngine();
+	WaitEvent occurred[OAI_ENGINE_MAX_EVENTS];
+	CURLMsg *msg;
+	int nevents;
+	int running;
+	int queued;
+
+	if (engine->deadline != 0)
+	{
+		long remaining = 0;
+		TimestampTz now = GetCurrentTimestamp();
+
+		if (engine->deadline > now)
+			remaining = (long)((engine->deadline - now + 999) / 1000);
+
+		timeout = timeout < 0 ? remaining : Min(timeout, remaining);
+	}
+
+	/* the sockets changed since the last wait */
+	if (!engine->events)
+	{
+		engine->events = CreateWaitEventSet(
+#if PG_VERSION_NUM >= 170000
+			NULL,
+#else
+			TopMemoryContext,
+#endif
+			engine->nsockets + 2);
+
+		AddWaitEventToSet(engine->events, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+
+		if (IsUnderPostmaster)
+#if PG_VERSION_NUM >= 120000
+			AddWaitEventToSet(engine->events, WL_EXIT_ON_PM_DEATH, PGINVALID_SOCKET, NULL, NULL);
+#else
+			AddWaitEventToSet(engine->events, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+#endif
+
+		for (int i = 0; i < engine->nsockets; i++)
+			AddWaitEventToSet(engine->events, engine->socketEvents[i], engine->sockets[i], NULL, NULL);
+	}
+
+	nevents = WaitEventSetWait(engine->events, timeout, occurred, lengthof(occurred), wait_event);
+
+	for (int i = 0; i < nevents; i++)
+	{
+		int mask = 0;
+
+		if (occurred[i].events & WL_LATCH_SET)
+			ResetLatch(MyLatch);
+
+#if PG_VERSION_NUM < 120000
+		if (occurred[i].events & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+#endif
+
+		if (occurred[i].events & WL_SOCKET_READABLE)
+			mask |= CURL_CSELECT_IN;
+		if (occurred[i].events & WL_SOCKET_WRITEABLE)
+			mask |= CURL_CSELECT_OUT;
+
+		if (mask != 0)
+			curl_multi_socket_action(engine->multi, occurred[i].fd, mask, &running);
+	}
+
+	if (engine->deadline != 0 && engine->deadline <= GetCurrentTimestamp())
+	{
+		engine->deadline = 0;
+		curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	}
+
+	while ((msg = curl_multi_info_read(engine->multi, &queued)) != NULL)
+	{
+		OAIEngineTransfer *transfer = NULL;
+		CURL *curl = msg->easy_handle;
+		CURLcode res = msg->data.result;
+
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&transfer);
+
+		/* msg must not be used once its handle has been removed */
+		curl_multi_remove_handle(engine->multi, curl);
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+
+		if (!transfer)
+			continue;
+
+		dlist_delete(&transfer->node);
+		transfer->callback(curl, res, transfer->arg);
+		pfree(transfer);
+	}
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * SetTransferResult
+ * -----------------
+ * Callback of the request engine storing the outcome of a transfer.
+ *
+ * arg : the OAITransferResult of the transfer
+ */
+static void SetTransferResult(CURL *curl, CURLcode res, void *arg)
+{
+	OAITransferResult *result = (OAITransferResult *)arg;
+
+	result->finished = true;
+	result->code = res;
+}
+
+/*
+ * EngineSocketCallback
+ * --------------------
+ * Socket callback of the request engine. Keeps track of the sockets cURL
+ * wants to be waited for, and in which direction; the WaitEventSet is
+ * rebuilt by the next RunRequestEngine.
+ *
+ * socket : socket whose state changed
+ * what   : CURL_POLL_IN, CURL_POLL_OUT, CURL_POLL_INOUT or CURL_POLL_REMOVE
+ * userp  : the request engine
+ */
+static int EngineSocketCallback(CURL *curl, curl_socket_t socket, int what, void *userp, void *socketp)
+{
+	OAIRequestEngine *engine = (OAIRequestEngine *)userp;
+	int i;
+
+	for (i = 0; i < engine->nsockets; i++)
+		if (engine->sockets[i] == socket)
+			break;
+
+	if (engine->events)
+	{
+		FreeWaitEventSet(engine->events);
+		engine->events = NULL;
+	}
+
+	if (what == CURL_POLL_REMOVE)
+	{
+		if (i < engine->nsockets)
+		{
+			engine->nsockets--;
+			engine->sockets[i] = engine->sockets[engine->nsockets];
+			engine->socketEvents[i] = engine->socketEvents[engine->nsockets];
+		}
+
+		return 0;
+	}
+
+	if (i == engine->maxsockets)
+	{
+		int size = Max(engine->maxsockets * 2, OAI_DEFAULT_GETRECORD_CONCURRENCY);
+
+		/* no error may be raised within cURL */
+		curl_socket_t *sockets = (curl_socket_t *)MemoryContextAllocExtended(TopMemoryContext, size * sizeof(curl_socket_t), MCXT_ALLOC_NO_OOM);
+		int *events = (int *)MemoryContextAllocExtended(TopMemoryContext, size * sizeof(int), MCXT_ALLOC_NO_OOM);
+
+		if (!sockets || !events)
+		{
+			if (sockets)
+				pfree(sockets);
+			if (events)
+				pfree(events);
+			return -1;
+		}
+
+		if (engine->maxsockets > 0)
+		{
+			memcpy(sockets, engine->sockets, engine->nsockets * sizeof(curl_socket_t));
+			memcpy(events, engine->socketEvents, engine->nsockets * sizeof(int));
+			pfree(engine->sockets);
+			pfree(engine->socketEvents);
+		}
+
+		engine->sockets = sockets;
+		engine->socketEvents = events;
+		engine->maxsockets = size;
+	}
+
+	if (i == engine->nsockets)
+		engine->nsockets++;
+
+	engine->sockets[i] = socket;
+	engine->socketEvents[i] = 0;
+
+	if (what & CURL_POLL_IN)
+		engine->socketEvents[i] |= WL_SOCKET_READABLE;
+	if (what & CURL_POLL_OUT)
+		engine->socketEvents[i] |= WL_SOCKET_WRITEABLE;
+
+	return 0;
+}
+
+/*
+ * EngineTimerCallback
+ * -------------------
+ * Timer callback of the request engine: cURL wants to be called on
+ * timeout after `timeout_ms`, or never if it is -1.
+ *
+ * userp : the request engine
+ */
+static int EngineTimerCallback(CURLM *multi, long timeout_ms, void *userp)
+{
+	OAIRequestEngine *engine = (OAIRequestEngine *)userp;
+
+	if (timeout_ms < 0)
+		engine->deadline = 0;
+	else
+		engine->deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
+
+	return 0;
+}
+
+/*
+ * EngineXactCallback
+ * ------------------
+ * Removes the transfers still in the request engine when a transaction is
+ * aborted, e.g. those of a federated scan whose memory context is only
+ * freed afterwards, so that cURL does not write into memory that is about
+ * to be freed. The cURL handles are freed by their owners.
+ */
+static void EngineXactCallback(XactEvent event, void *arg)
+{
+	dlist_mutable_iter iter;
+
+	if (!OAIEngine || (event != XACT_EVENT_ABORT && event != XACT_EVENT_PARALLEL_ABORT))
+		return;
+
+	dlist_foreach_modify(iter, &OAIEngine->transfers)
+	{
+		OAIEngineTransfer *transfer = dlist_container(OAIEngineTransfer, node, iter.cur);
+
+		RemoveEngineTransfer(transfer->curl);
+	}
+}
+
+/*
+ * PerformOAIRequest
+ * -----------------
+ * Performs a prepared cURL request within the server-wide request limits.
+ * Instead of blocking in curl_easy_perform, the transfer is handed over to
+ * the request engine and the backend sleeps on its latch and the sockets
+ * of all transfers, so that pg_stat_activity shows what the backend waits
+ * for, cancel requests are served at once and the transfers of other
+ * scans, e.g. of a federated scan, proceed meanwhile. The concurrency
+ * slot is released however the transfer ends, including errors and
+ * cancellation.
+ *
+ * state : the OAI request state
+ * curl  : prepared cURL handle
+ *
+ * returns the result of the transfer
+ */
+static CURLcode PerformOAIRequest(OAIFdwState *state, CURL *curl)
+{
+	OAITransferResult result;
+
+	AcquireRequestSlot(state);
+
+	result.finished = false;
+	result.code = CURLE_FAILED_INIT;
+
+	PG_TRY();
+	{
+		AddEngineTransfer(curl, SetTransferResult, &result);
+
+		while (!result.finished)
+		{
+			curl_off_t connected = 0;
+
+			/* the pre-transfer time is set once the connection is established */
+			curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &connected);
+
+			RunRequestEngine(-1, GetOAIWaitEvent(connected > 0 ? OAI_WAIT_EVENT_RESPONSE : OAI_WAIT_EVENT_CONNECT));
+		}
+	}
+	PG_CATCH();
+	{
+		RemoveEngineTransfer(curl);
+		ReleaseRequestSlot(state->foreign_server->serverid);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	ReleaseRequestSlot(state->foreign_server->serverid);
+
+	return result.code;
+}
+
+/*
+ * GetOAIWaitEvent
+ * ---------------
+ * Wait event reported in pg_stat_activity while waiting for a repository.
+ * On PostgreSQL 17 and later the events are registered under their own
+ * names on first use, older versions report them all as "Extension".
+ *
+ * event : what the backend waits for
+ */
+static uint32 GetOAIWaitEvent(OAIWaitEvent event)
+{
+#if PG_VERSION_NUM >= 170000
+	if (OAIWaitEventIds[event] == 0)
+		OAIWaitEventIds[event] = WaitEventExtensionNew(OAIWaitEventNames[event]);
+
+	return OAIWaitEventIds[event];
+#else
+	return PG_WAIT_EXTENSION;
+#endif
+}
+
+/*
+ * CountOAITransfer
+ * ----------------
+ * Adds the size and timings of a finished cURL transfer to the counters
+ * shown by EXPLAIN ANALYZE and to the statistics of its foreign server
+ * in shared memory. cURL reports the timings of a transfer cumulatively
+ * from its start, in microseconds.
+ *
+ * state : the OAI request state
+ * curl  : cURL handle of the transfer
+ * res   : result of the transfer
+ * size  : size of the response body after content decoding
+ */
+static void CountOAITransfer(OAIFdwState *state, CURL *curl, CURLcode res, size_t size)
+{
+	OAIServerStatsEntry *entry;
+	TimestampTz now = GetCurrentTimestamp();
+	long response_code = 0;
+	double ms;
+	curl_off_t download = 0;
+	curl_off_t namelookup = 0;
+	curl_off_t pretransfer = 0;
+	curl_off_t starttransfer = 0;
+	curl_off_t total = 0;
+	long header = 0;
+
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &download);
+	curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header);
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+	curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+	state->httpRequests++;
+	state->bytesReceived += download + header;
+	state->bytesDecompressed += size;
+	state->peakPageSize = Max(state->peakPageSize, (int64)size);
+
+	/* a transfer that failed early has no later timings */
+	state->dnsTime += namelookup / 1000.0;
+
+	if (pretransfer >= namelookup)
+		state->connectTime += (pretransfer - namelookup) / 1000.0;
+	if (starttransfer >= pretransfer)
+		state->firstByteTime += (starttransfer - pretransfer) / 1000.0;
+	if (total >= starttransfer && starttransfer > 0)
+		state->transferTime += (total - starttransfer) / 1000.0;
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+	ms = total / 1000.0;
+
+	entry = LockServerStats(state->foreign_server->serverid);
+
+	if (!entry)
+		return;
+
+	for (int i = 0; i < lengthof(OAIStatVerbs); i++)
+		if (strcmp(state->requestVerb, OAIStatVerbs[i]) == 0)
+			entry->requests[i]++;
+
+	entry->bytes += download + header;
+	entry->status[res == CURLE_OK && response_code >= 100 && response_code < 600 ? response_code / 100 : 0]++;
+	entry->totalTime += ms;
+	entry->maxTime = Max(entry->maxTime, ms);
+	entry->latency[GetLatencyBucket(ms)]++;
+
+	if (res != CURLE_OK || response_code >= 400)
+	{
+		if (res != CURLE_OK)
+			strlcpy(entry->lastError, curl_easy_strerror(res), OAI_STAT_ERROR_LEN);
+		else
+			snprintf(entry->lastError, OAI_STAT_ERROR_LEN, "HTTP %ld", response_code);
+
+		entry->lastErrorTime = now;
+	}
+
+	UnlockServerStats(entry);
+}
+
+/*
+ * CountOAIRetry
+ * -------------
+ * Counts a failed request that is retried after `delay` ms, for EXPLAIN
+ * ANALYZE and in the statistics of its foreign server.
+ *
+ * state : the OAI request state
+ * delay : time waited before the retry (ms)
+ */
+static void CountOAIRetry(OAIFdwState *state, long delay)
+{
+	OAIServerStatsEntry *entry;
+
+	state->httpRetries++;
+	state->backoffTime += delay;
+
+	entry = LockServerStats(state->foreign_server->serverid);
+
+	if (!entry)
+		return;
+
+	entry->retries++;
+	entry->backoffTime += delay;
+
+	UnlockServerStats(entry);
+}
+
+/*
+ * LogOAIRequest
+ * -------------
+ * Logs a request that took at least oai_fdw.log_min_request_duration,
+ * with the timings of its last attempt as reported by cURL, in a single
+ * line of key=value pairs. The resumptionToken is replaced by its hash.
+ *
+ * state    : the OAI request state
+ * curl     : cURL handle of the request
+ * request  : request parameters
+ * doc      : the parsed response, NULL if the request failed
+ * attempts : number of attempts, retries included
+ * parse_ms : time spent parsing the response
+ */
+static void LogOAIRequest(OAIFdwState *state, CURL *curl, const char *request, xmlDocPtr doc, long attempts, double parse_ms)
+{
+	curl_off_t namelookup = 0;
+	curl_off_t connect = 0;
+	curl_off_t appconnect = 0;
+	curl_off_t pretransfer = 0;
+	curl_off_t starttransfer = 0;
+	curl_off_t total = 0;
+	curl_off_t bytes = 0;
+	long response_code = 0;
+	int records = 0;
+
+	if (OAILogMinRequestDuration < 0)
+		return;
+
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+	if (total / 1000.0 + parse_ms < OAILogMinRequestDuration)
+		return;
+
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+	curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+	/* records, headers, sets or metadata formats of the response */
+	if (doc && xmlDocGetRootElement(doc))
+	{
+		for (xmlNodePtr verb = xmlDocGetRootElement(doc)->children; verb != NULL; verb = verb->next)
+		{
+			if (verb->type != XML_ELEMENT_NODE || xmlStrcmp(verb->name, (xmlChar *)state->requestVerb) != 0)
+				continue;
+
+			for (xmlNodePtr item = verb->children; item != NULL; item = item->next)
+				if (item->type == XML_ELEMENT_NODE &&
+					xmlStrcmp(item->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN) != 0)
+					records++;
+		}
+	}
+
+	/*
+	 * Connections reused from a previous request have no DNS, connect and
+	 * TLS times; the times of a phase that did not happen stay zero.
+	 */
+	ereport(LOG,
+			(errmsg("oai_fdw request: server=%s verb=%s request=\"%s\" status=%ld bytes=%lld records=%d attempts=%ld "
+					"duration=%.3f ms dns=%.3f ms connect=%.3f ms tls=%.3f ms ttfb=%.3f ms transfer=%.3f ms parse=%.3f ms",
+					state->foreign_server->servername, state->requestVerb, RedactOAIRequest(request),
+					response_code, (long long)bytes, records, attempts,
+					total / 1000.0 + parse_ms,
+					namelookup / 1000.0,
+					connect > namelookup ? (connect - namelookup) / 1000.0 : 0,
+					appconnect > connect ? (appconnect - connect) / 1000.0 : 0,
+					starttransfer > pretransfer ? (starttransfer - pretransfer) / 1000.0 : 0,
+					total > starttransfer && starttransfer > 0 ? (total - starttransfer) / 1000.0 : 0,
+					parse_ms),
+			 errhidestmt(true)));
+}
+
+/*
+ * RedactOAIRequest
+ * ----------------
+ * Replaces the resumptionToken of request parameters by its hash, so that
+ * logged requests can be told apart without exposing tokens that may be
+ * valid for a while.
+ *
+ * request : request parameters
+ *
+ * returns a palloc'd copy of the request
+ */
+static char *RedactOAIRequest(const char *request)
+{
+	const char *token = strstr(request, "resumptionToken=");
+	StringInfoData buf;
+	size_t len;
+
+	if (!token)
+		return pstrdup(request);
+
+	token += strlen("resumptionToken=");
+	len = strcspn(token, "&");
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, request, token - request);
+	appendStringInfo(&buf, "#%016llx", (unsigned long long)DatumGetUInt64(hash_any_extended((const unsigned char *)token, len, 0)));
+	appendStringInfoString(&buf, token + len);
+
+	return buf.data;
+}
+
+/*
+ * LockServerStats
+ * ---------------
+ * Looks up the statistics of a foreign server of the current database
+ * in shared memory, creating them if necessary, and locks them for an
+ * update: the shared lock keeps oai_fdw_stat_servers_reset from removing
+ * the entry, its spinlock protects the counters from concurrent updates,
+ * so nothing that can fail may happen until UnlockServerStats.
+ *
+ * serverid : the FOREIGN SERVER
+ *
+ * returns the locked entry, or NULL if oai_fdw is not loaded via
+ * shared_preload_libraries or oai_fdw.max_shared_servers is exhausted
+ */
+static OAIServerStatsEntry *LockServerStats(Oid serverid)
+{
+	static bool warned = false;
+	OAIRateLimitKey key;
+	OAIServerStatsEntry *entry;
+	bool found;
+
+	if (!OAIShared || !OAISharedStats)
+		return NULL;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.serverid = serverid;
+
+	LWLockAcquire(OAIShared->lock, LW_SHARED);
+
+	entry = (OAIServerStatsEntry *)hash_search(OAISharedStats, &key, HASH_FIND, NULL);
+
+	if (!entry)
+	{
+		/* new servers are rare, the lock is kept exclusive for the update */
+		LWLockRelease(OAIShared->lock);
+		LWLockAcquire(OAIShared->lock, LW_EXCLUSIVE);
+
+		entry = (OAIServerStatsEntry *)hash_search(OAISharedStats, &key, HASH_ENTER_NULL, &found);
+
+		if (entry && !found)
+		{
+			memset((char *)entry + sizeof(OAIRateLimitKey), 0, sizeof(OAIServerStatsEntry) - sizeof(OAIRateLimitKey));
+			SpinLockInit(&entry->mutex);
+			entry->statsReset = GetCurrentTimestamp();
+		}
+	}
+
+	if (!entry)
+	{
+		LWLockRelease(OAIShared->lock);
+
+		if (!warned)
+			ereport(WARNING,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("statistics of server '%s' are not collected", GetForeignServer(serverid)->servername),
+					 errhint("Increase oai_fdw.max_shared_servers.")));
+		warned = true;
+		return NULL;
+	}
+
+	SpinLockAcquire(&entry->mutex);
+
+	return entry;
+}
+
+/*
+ * UnlockServerStats
+ * -----------------
+ * Releases the locks taken by LockServerStats.
+ *
+ * entry : the locked entry
+ */
+static void UnlockServerStats(OAIServerStatsEntry *entry)
+{
+	SpinLockRelease(&entry->mutex);
+	LWLockRelease(OAIShared->lock);
+}
+
+/*
+ * GetLatencyBucket
+ * ----------------
+ * Bucket of the latency histogram of OAIServerStatsEntry a request
+ * latency falls into. Bucket 0 holds everything below 1 ms, the last one
+ * everything beyond the range of the histogram.
+ *
+ * ms : latency of the request
+ */
+static int GetLatencyBucket(double ms)
+{
+	int magnitude;
+	int sub;
+	double lower;
+
+	if (ms < 1.0)
+		return 0;
+
+	magnitude = Min((int)floor(log2(ms)), OAI_STAT_LATENCY_MAGNITUDES - 1);
+	lower = ldexp(1.0, magnitude);
+	sub = Min((int)((ms - lower) / lower * OAI_STAT_LATENCY_SUB_BUCKETS), OAI_STAT_LATENCY_SUB_BUCKETS - 1);
+
+	return 1 + magnitude * OAI_STAT_LATENCY_SUB_BUCKETS + sub;
+}
+
+/*
+ * GetLatencyPercentile
+ * --------------------
+ * Estimates a percentile of the request latencies of a server as the
+ * upper bound of the histogram bucket it falls into, but no more than
+ * the highest latency seen.
+ *
+ * entry    : copy of the statistics of the server
+ * fraction : the percentile, e.g. 0.99
+ *
+ * returns the latency in ms
+ */
+static double GetLatencyPercentile(OAIServerStatsEntry *entry, double fraction)
+{
+	int64 total = 0;
+	int64 rank;
+	int64 seen = 0;
+
+	for (int i = 0; i < OAI_STAT_LATENCY_BUCKETS; i++)
+		total += entry->latency[i];
+
+	rank = Max((int64)ceil(fraction * total), 1);
+
+	for (int i = 0; i < OAI_STAT_LATENCY_BUCKETS; i++)
+	{
+		seen += entry->latency[i];
+
+		if (seen >= rank)
+		{
+			double upper = 1.0;
+
+			if (i > 0)
+				upper = ldexp(1.0 + (double)((i - 1) % OAI_STAT_LATENCY_SUB_BUCKETS + 1) / OAI_STAT_LATENCY_SUB_BUCKETS,
+							  (i - 1) / OAI_STAT_LATENCY_SUB_BUCKETS);
+
+			return Min(upper, entry->maxTime);
+		}
+	}
+
+	return entry->maxTime;
+}
+
+/*
+ * GetProgressSlotCount
+ * --------------------
+ * Number of backends that may report progress, one slot each.
+ * MaxBackends is only known after shared_preload_libraries were loaded
+ * in releases without shmem_request_hook, so it is computed the same way
+ * from its settings there.
+ */
+static int GetProgressSlotCount(void)
+{
+#if PG_VERSION_NUM >= 150000
+	return MaxBackends;
+#else
+	return MaxConnections + autovacuum_max_workers + 1 + max_worker_processes + max_wal_senders;
+#endif
+}
+
+/*
+ * GetProgressSlot
+ * ---------------
+ * Looks up the progress slot of this backend, registering the callbacks
+ * that clear it if the transaction is aborted or the backend exits.
+ *
+ * returns the slot, or NULL if oai_fdw is not loaded via
+ * shared_preload_libraries
+ */
+static OAIProgressSlot *GetProgressSlot(void)
+{
+	static bool callbacks_registered = false;
+	int slot = OAI_MY_PROGRESS_SLOT;
+
+	if (!OAIShared || !OAIProgress || slot < 0 || slot >= OAIShared->progressSlots)
+		return NULL;
+
+	if (!callbacks_registered)
+	{
+		RegisterXactCallback(ProgressXactCallback, NULL);
+		before_shmem_exit(ProgressExit, (Datum)0);
+		callbacks_registered = true;
+	}
+
+	return &OAIProgress[slot];
+}
+
+/*
+ * ReportScanProgress
+ * ------------------
+ * Publishes the progress of a scan in the progress slot of this backend
+ * once a page has been loaded. A scan of another foreign table takes
+ * over the slot, e.g. in a join of two foreign tables.
+ *
+ * state : the scan state
+ */
+static void ReportScanProgress(OAIFdwState *state)
+{
+	OAIProgressSlot *slot = GetProgressSlot();
+
+	if (!slot)
+		return;
+
+	SpinLockAcquire(&slot->mutex);
+
+	if (slot->relid != state->foreigntableid)
+	{
+		slot->relid = state->foreigntableid;
+		slot->scanStart = GetCurrentTimestamp();
+	}
+
+	slot->pid = MyProcPid;
+	slot->dbid = MyDatabaseId;
+	slot->pages = state->pagesLoaded;
+	slot->records = state->recordsSeen;
+	slot->bytes = state->bytesReceived;
+	slot->completeListSize = state->completeListSize;
+
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * EndScanProgress
+ * ---------------
+ * Removes a finished scan from the progress slot of this backend, unless
+ * another scan took it over in the meantime.
+ *
+ * state : the scan state
+ */
+static void EndScanProgress(OAIFdwState *state)
+{
+	OAIProgressSlot *slot = GetProgressSlot();
+
+	if (!slot || slot->relid != state->foreigntableid)
+		return;
+
+	SpinLockAcquire(&slot->mutex);
+
+	slot->relid = InvalidOid;
+	slot->pages = 0;
+	slot->records = 0;
+	slot->bytes = 0;
+	slot->completeListSize = 0;
+
+	if (!slot->harvesting)
+		slot->pid = 0;
+
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * ReportHarvestProgress
+ * ---------------------
+ * Publishes the progress of a harvest split into windows (time windows
+ * of OAI_HarvestTable, GetRecord batches of OAI_Sync) in the progress slot
+ * of this backend. The scans of the windows are reported on their own.
+ *
+ * targetid     : table the records are stored into, InvalidOid to keep
+ *                the one reported before
+ * done         : windows completed
+ * total        : windows of the harvest, 0 if unknown
+ * window_start : start of the current time window, DT_NOBEGIN if none
+ * window_end   : end of the current time window, DT_NOBEGIN if none
+ */
+static void ReportHarvestProgress(Oid targetid, int done, int total, Timestamp window_start, Timestamp window_end)
+{
+	OAIProgressSlot *slot = GetProgressSlot();
+
+	if (!slot)
+		return;
+
+	SpinLockAcquire(&slot->mutex);
+
+	if (!slot->harvesting)
+	{
+		slot->harvesting = true;
+		slot->harvestStart = GetCurrentTimestamp();
+		slot->targetid = InvalidOid;
+	}
+
+	if (OidIsValid(targetid))
+		slot->targetid = targetid;
+
+	slot->pid = MyProcPid;
+	slot->dbid = MyDatabaseId;
+	slot->windowsDone = done;
+	slot->windowsTotal = total;
+	slot->windowStart = window_start;
+	slot->windowEnd = window_end;
+
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * EndHarvestProgress
+ * ------------------
+ * Removes a finished harvest from the progress slot of this backend.
+ */
+static void EndHarvestProgress(void)
+{
+	OAIProgressSlot *slot = GetProgressSlot();
+
+	if (!slot || !slot->harvesting)
+		return;
+
+	SpinLockAcquire(&slot->mutex);
+
+	slot->harvesting = false;
+	slot->targetid = InvalidOid;
+	slot->windowsDone = 0;
+	slot->windowsTotal = 0;
+
+	if (!OidIsValid(slot->relid))
+		slot->pid = 0;
+
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * IsHarvestInProgress
+ * -------------------
+ * Checks whether this backend reports the progress of a harvest, e.g.
+ * of the OAI_HarvestTable call running oai_fdw_harvest_pages. The slot is
+ * only written by this backend, so it is read without its lock.
+ */
+static bool IsHarvestInProgress(void)
+{
+	OAIProgressSlot *slot = GetProgressSlot();
+
+	return slot && slot->harvesting;
+}
+
+/*
+ * ClearProgress
+ * -------------
+ * Empties the progress slot of this backend.
+ */
+static void ClearProgress(void)
+{
+	OAIProgressSlot *slot = GetProgressSlot();
+
+	if (!slot || slot->pid == 0)
+		return;
+
+	SpinLockAcquire(&slot->mutex);
+
+	slot->pid = 0;
+	slot->relid = InvalidOid;
+	slot->targetid = InvalidOid;
+	slot->harvesting = false;
+	slot->pages = 0;
+	slot->records = 0;
+	slot->bytes = 0;
+	slot->completeListSize = 0;
+	slot->windowsDone = 0;
+	slot->windowsTotal = 0;
+
+	SpinLockRelease(&slot->mutex);
+}
+
+/*
+ * ProgressXactCallback
+ * --------------------
+ * Scans and harvests interrupted by an error do not reach their end, so
+ * their progress is cleared when the transaction is aborted. Harvests
+ * committing each window (OAI_HarvestTable) outlive their transactions.
+ */
+static void ProgressXactCallback(XactEvent event, void *arg)
+{
+	if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+		ClearProgress();
+}
+
+/*
+ * ProgressExit
+ * ------------
+ * Frees the progress slot of a backend that exits.
+ */
+static void ProgressExit(int code, Datum arg)
+{
+	ClearProgress();
+}
+
+/*
+ * ReadOAIDocument
+ * ---------------
+ * Parses an OAI response into an XML document, timed for EXPLAIN ANALYZE.
+ *
+ * state  : the OAI request state
+ * buffer : the response
+ * size   : size of the response
+ *
+ * returns the document, or NULL if the response is not well-formed
+ */
+static xmlDocPtr ReadOAIDocument(OAIFdwState *state, const char *buffer, size_t size)
+{
+	instr_time start;
+	instr_time duration;
+	xmlDocPtr doc;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	doc = xmlReadMemory(buffer, size, NULL, NULL, XML_PARSE_NOBLANKS);
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	state->parseTime += INSTR_TIME_GET_MILLISEC(duration);
+
+	return doc;
+}
+
+/*
+ * IsTransientFailure
+ * ------------------
+ * Decides whether a failed request is worth retrying: network failures
+ * and timeouts, as well as HTTP responses telling the client to come back
+ * later (408, 429, 500, 502, 503 and 504). Errors that would occur again
+ * on every attempt - malformed or unsupported URLs, rejected credentials,
+ * certificate problems, client errors - are not retried.
+ *
+ * curl          : cURL handle of the request
+ * res           : result of curl_easy_perform
+ * response_code : HTTP status code of the response (0 if none)
+ *
+ * returns true if the request should be retried
+ */
+static bool IsTransientFailure(CURL *curl, CURLcode res, long response_code)
+{
+	long connect_code = 0;
+
+	if (res == CURLE_OK)
+		return response_code == 408 ||
+			   response_code == 429 ||
+			   response_code == 500 ||
+			   response_code == 502 ||
+			   response_code == 503 ||
+			   response_code == 504;
+
+	switch (res)
+	{
+	case CURLE_UNSUPPORTED_PROTOCOL:
+	case CURLE_URL_MALFORMAT:
+	case CURLE_NOT_BUILT_IN:
+	case CURLE_TOO_MANY_REDIRECTS:
+	case CURLE_LOGIN_DENIED:
+	case CURLE_REMOTE_ACCESS_DENIED:
+	case CURLE_PEER_FAILED_VERIFICATION:
+	case CURLE_SSL_CERTPROBLEM:
+	case CURLE_SSL_CACERT_BADFILE:
+	case CURLE_ABORTED_BY_CALLBACK:
+		return false;
+	default:
+		break;
+	}
+
+	/* the proxy refused to open a tunnel, e.g. due to wrong credentials */
+	curl_easy_getinfo(curl, CURLINFO_HTTP_CONNECTCODE, &connect_code);
+
+	if (connect_code >= 400 && connect_code < 500 && connect_code != 408 && connect_code != 429)
+		return false;
+
+	return true;
+}
+
+/*
+ * GetRetryDelay
+ * -------------
+ * Time to wait before retrying a failed request. A Retry-After header sent
+ * with the response (delay in seconds or HTTP date) is honoured up to
+ * OAI_RETRY_AFTER_MAX_DELAY. Otherwise the delay is drawn at random
+ * between zero and an exponentially growing ceiling (full jitter), so that
+ * backends that failed at the same time do not retry in lockstep.
+ *
+ * headers : response headers of the failed attempt
+ * attempt : number of the upcoming retry, starting at 1
+ *
+ * returns the delay in milliseconds
+ */
+static long GetRetryDelay(const char *headers, long attempt)
+{
+	char *retry_after = GetResponseHeader(headers, "Retry-After");
+	long ceiling;
+	double fraction;
+
+	if (retry_after)
+	{
+		char *endptr;
+		long delay = -1;
+		long seconds = strtol(retry_after, &endptr, 10);
+
+		if (endptr != retry_after && *endptr == '\0' && seconds >= 0)
+			delay = Min(seconds, OAI_RETRY_AFTER_MAX_DELAY / 1000) * 1000;
+		else
+		{
+			time_t date = curl_getdate(retry_after, NULL);
+
+			if (date > 0)
+				delay = Min(Max((long)(date - time(NULL)), 0), OAI_RETRY_AFTER_MAX_DELAY / 1000) * 1000;
+		}
+
+		elog(DEBUG2, "  %s: Retry-After: %s", __func__, retry_after);
+		pfree(retry_after);
+
+		if (delay >= 0)
+			return delay;
+	}
+
+	ceiling = Min((long)OAI_RETRY_MAX_DELAY, (long)OAI_RETRY_BASE_DELAY << Min(attempt - 1, 16));
+
+#if PG_VERSION_NUM >= 150000
+	fraction = pg_prng_double(&pg_global_prng_state);
+#else
+	fraction = (double)random() / ((double)MAX_RANDOM_VALUE + 1);
+#endif
+
+	return (long)(fraction * ceiling);
+}
+
+/*
+ * WaitForRetry
+ * ------------
+ * Sleeps on the backend's latch before a retry, so that the wait can be
+ * cancelled and does not survive a postmaster crash.
+ *
+ * delay : time to wait in milliseconds
+ */
+static void WaitForRetry(long delay)
+{
+	TimestampTz end = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), delay);
+
+	for (;;)
+	{
+		long remaining = (long)((end - GetCurrentTimestamp()) / 1000);
+
+		if (remaining <= 0)
+			break;
+
+		(void)WaitLatch(MyLatch, OAI_WAIT_EVENTS, remaining, GetOAIWaitEvent(OAI_WAIT_EVENT_BACKOFF));
+		ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * SetOAIRequestOptions
+ * --------------------
+ * Sets the options of a cURL handle for a request to the repository of
+ * `state`: URL, protocols, timeouts, proxy, redirects, credentials and
+ * the callbacks collecting the response. Shared by ExecuteOAIRequest and
+ * the concurrent transfers of FetchOAIRecords.
+ *
+ * state        : the OAI request state
+ * curl         : cURL handle
+ * postfields   : request parameters, must outlive the transfer
+ * chunk        : buffer of the response body
+ * chunk_header : buffer of the response headers
+ * errbuf       : buffer of CURL_ERROR_SIZE bytes for error messages
+ * headers      : list of request headers, the Accept header is appended
+ *                and must be freed by the caller after the transfer
+ */
+static void SetOAIRequestOptions(OAIFdwState *state, CURL *curl, const char *postfields,
+								 struct MemoryStruct *chunk, struct MemoryStruct *chunk_header,
+								 char *errbuf, struct curl_slist **headers)
+{
+	long connectTimeout = state->connectTimeout ? state->connectTimeout : OAI_DEFAULT_CONNECT_TIMEOUT;
+	long request_timeout = state->request_timeout ? state->request_timeout : OAI_DEFAULT_REQUEST_TIMEOUT;
+	StringInfoData user_agent;
+
+	curl_easy_setopt(curl, CURLOPT_URL, state->url);
+
+#if ((LIBCURL_VERSION_MAJOR == 7 && LIBCURL_VERSION_MINOR < 85) || LIBCURL_VERSION_MAJOR < 7)
+	curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
+#else
+	curl_easy_setopt(curl, CURLOPT_PROTOCOLS_STR, "http,https");
+#endif
+
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, request_timeout);
+
+	elog(DEBUG2, "  %s (%s): timeout > %ld", __func__, state->requestVerb, connectTimeout);
+
+	/* Proxy support: added in version 1.1.0 */
+	if (state->proxy)
+	{
+
+		elog(DEBUG2, "%s (%s): proxy URL > '%s'", __func__, state->requestVerb, state->proxy);
+
+		curl_easy_setopt(curl, CURLOPT_PROXY, state->proxy);
+
+		if (strcmp(state->proxyType, OAI_SERVER_OPTION_HTTP_PROXY) == 0)
+		{
+			elog(DEBUG2, "%s (%s): proxy protocol > 'HTTP'", __func__, state->requestVerb);
+			curl_easy_setopt(curl, CURLOPT_PROXYTYPE, CURLPROXY_HTTP);
+		}
+		if (state->proxyUser)
+		{
+			elog(DEBUG2, "%s (%s): entering proxy user ('%s').", __func__, state->requestVerb, state->proxyUser);
+			curl_easy_setopt(curl, CURLOPT_PROXYUSERNAME, state->proxyUser);
+		}
+		if (state->proxyPassword)
+		{
+			elog(DEBUG2, "%s (%s): entering proxy user's password.", __func__, state->requestVerb);
+			curl_easy_setopt(curl, CURLOPT_PROXYPASSWORD, state->proxyPassword);
+		}
+	}
+
+	if (state->requestRedirect == true)
+	{
+
+		elog(DEBUG2, "  %s (%s): setting request redirect: %d", __func__, state->requestVerb, state->requestRedirect);
+		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+
+		if (state->requestMaxRedirect)
+		{
+			elog(DEBUG2, "  %s (%s): setting maxredirs: %ld", __func__, state->requestVerb, state->requestMaxRedirect);
+			curl_easy_setopt(curl, CURLOPT_MAXREDIRS, state->requestMaxRedirect);
+		}
+	}
+
+	/*
+	 * Enable libcurl verbose output, but route it exclusively through
+	 * CURLDebugCallback instead of stderr. The callback emits at DEBUG3
+	 * (gated by log_min_messages) and redacts Authorization headers so
+	 * credentials are never written to server logs.
+	 */
+	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+	curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, CURLDebugCallback);
+	curl_easy_setopt(curl, CURLOPT_DEBUGDATA, NULL);
+
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postfields);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallbackFunction);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)chunk_header);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
+
+	if (state->user && state->password)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+		curl_easy_setopt(curl, CURLOPT_USERNAME, state->user);
+		curl_easy_setopt(curl, CURLOPT_PASSWORD, state->password);
+	}
+	else if (state->user && !state->password)
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+		curl_easy_setopt(curl, CURLOPT_USERNAME, state->user);
+	}
+
+	initStringInfo(&user_agent);
+	appendStringInfo(&user_agent, "PostgreSQL/%s oai_fdw/%s libxml2/%s %s", PG_VERSION, OAI_FDW_VERSION, LIBXML_DOTTED_VERSION, curl_version());
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.data);
+
+	pfree(user_agent.data);
+
+	*headers = curl_slist_append(*headers, "Accept: application/xml");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *headers);
+}
+
+/**
+ * Executes the HTTP request to the OAI repository using the
+ * libcurl library.
+ */
+static int ExecuteOAIRequest(OAIFdwState *state)
+{
+
+	CURL *curl;
+	CURLcode res;
+	StringInfoData url_buffer;
+	char errbuf[CURL_ERROR_SIZE];
+	struct MemoryStruct chunk;
+	struct MemoryStruct chunk_header;
+	long maxretries = OAI_DEFAULT_MAX_RETRY;
+	long response_code = 0;
+	long attempts = 1;
+	double parse_ms;
+
+	struct curl_slist *headers = NULL;
+
+	if (state->maxretries)
+		maxretries = state->maxretries;
+
+	chunk.memory = palloc(1);
+	chunk.size = 0; /* no data at this point */
+	chunk_header.memory = palloc(1);
+	chunk_header.size = 0; /* no data at this point */
+
+	initStringInfo(&url_buffer);
+
+	elog(DEBUG2, "%s called: base url > '%s' ", __func__, state->url);
+
+	curl = curl_easy_init();
+
+	if (!curl)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("%s: failed to initialize curl", __func__)));
+
+	if (!BuildOAIRequest(state, curl, &url_buffer))
+	{
+		curl_easy_cleanup(curl);
+		return OAI_UNKNOWN_REQUEST;
+	}
+
+	if (OAIMetadataCacheTtl > 0 && IsMetadataRequest(state->requestVerb))
+	{
+		OAIMetadataCacheEntry *entry = GetMetadataCacheEntry(state, url_buffer.data, false);
+
+		if (entry && entry->body &&
+			!TimestampDifferenceExceeds(entry->fetched, GetCurrentTimestamp(), OAIMetadataCacheTtl * 1000))
+		{
+			elog(DEBUG1, "GET \"%s?%s\" (cached)", state->url, url_buffer.data);
+
+			state->xmldoc = ReadOAIDocument(state, entry->body, entry->size);
+
+			elog(DEBUG1, "cached response, %ld bytes", entry->size);
+
+			pfree(chunk.memory);
+			pfree(chunk_header.memory);
+			curl_easy_cleanup(curl);
+
+			return OAI_SUCCESS;
+		}
+
+		/* expired: ask the repository whether our copy is still valid */
+		if (entry && entry->etag)
+		{
+			char *header = psprintf("If-None-Match: %s", entry->etag);
+
+			headers = curl_slist_append(headers, header);
+			pfree(header);
+		}
+
+		if (entry && entry->lastModified)
+		{
+			char *header = psprintf("If-Modified-Since: %s", entry->lastModified);
+
+			headers = curl_slist_append(headers, header);
+			pfree(header);
+		}
+	}
+
+	if (state->cacheTtl > 0)
+	{
+		size_t cached_size;
+		char *cached = ReadCachedResponse(state, url_buffer.data, &cached_size);
+
+		if (cached)
+		{
+			elog(DEBUG1, "GET \"%s?%s\" (cached)", state->url, url_buffer.data);
+
+			state->xmldoc = ReadOAIDocument(state, cached, cached_size);
+
+			elog(DEBUG1, "cached response, %ld bytes", cached_size);
+
+			pfree(cached);
+			pfree(chunk.memory);
+			pfree(chunk_header.memory);
+			curl_slist_free_all(headers);
+			curl_easy_cleanup(curl);
+
+			return OAI_SUCCESS;
+		}
+	}
+
+	elog(DEBUG1, "GET \"%s?%s\"", state->url, url_buffer.data);
+
+	if (curl)
+	{
+		errbuf[0] = 0;
+
+		elog(DEBUG2, "  %s (%s): max retry > %ld", __func__, state->requestVerb, maxretries);
+
+		SetOAIRequestOptions(state, curl, url_buffer.data, &chunk, &chunk_header, errbuf, &headers);
+
+		elog(DEBUG2, "  %s (%s): performing cURL request ... ", __func__, state->requestVerb);
+
+		res = PerformOAIRequest(state, curl);
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+		CountOAITransfer(state, curl, res, chunk.size);
+
+		for (long i = 1; IsTransientFailure(curl, res, response_code) && i <= maxretries; i++)
+		{
+			long delay = GetRetryDelay(chunk_header.memory, i);
+
+			elog(WARNING, "request to '%s' failed (%ld/%ld)",
+				 state->foreign_server->servername, i, maxretries);
+
+			elog(DEBUG2, "  %s (%s): %s, HTTP %ld: retrying in %ld ms", __func__, state->requestVerb,
+				 res != CURLE_OK ? curl_easy_strerror(res) : "request failed", response_code, delay);
+
+			WaitForRetry(delay);
+
+			CountOAIRetry(state, delay);
+
+			/* discard any partial data from the failed attempt */
+			chunk.size = 0;
+			chunk.memory[0] = '\0';
+			chunk_header.size = 0;
+			chunk_header.memory[0] = '\0';
+
+			res = PerformOAIRequest(state, curl);
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+			CountOAITransfer(state, curl, res, chunk.size);
+			attempts++;
+		}
+
+		if (res != CURLE_OK || response_code >= 400)
+		{
+			bool has_body = (chunk.size > 0 && chunk.memory);
+			StringInfoData display_body;
+
+			initStringInfo(&display_body);
+
+			if (has_body)
+			{
+				/*
+				 * Truncate the error body before logging or including in
+				 * error messages.  Endpoints may return large HTML pages on
+				 * errors (e.g. from misconfigured proxies), which would
+				 * flood server logs.
+				 */
+				if (chunk.size > OAI_FDW_MAX_ERROR_BODY)
+				{
+					appendBinaryStringInfo(&display_body, chunk.memory, OAI_FDW_MAX_ERROR_BODY);
+					appendStringInfoString(&display_body, "... (truncated)");
+				}
+				else
+				{
+					appendStringInfoString(&display_body, chunk.memory);
+				}
+				elog(DEBUG1, "%s: error response body: %s", __func__, display_body.data);
+			}
+			else
+			{
+				elog(DEBUG1, "%s: no response body available for HTTP error %ld", __func__, response_code);
+			}
+
+			LogOAIRequest(state, curl, url_buffer.data, NULL, attempts, 0);
+
+			if (chunk.memory)
+				pfree(chunk.memory);
+			if (chunk_header.memory)
+				pfree(chunk_header.memory);
+			curl_slist_free_all(headers);
+			curl_easy_cleanup(curl);
+
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					 errmsg("OAI request failed: HTTP %ld", response_code),
+					 errhint("Check your request parameters and try again."),
+					 errdetail("URL: \"%s\"", url_buffer.data)));
+		}
+		else
+		{
+			OAIMetadataCacheEntry *entry = NULL;
+
+			if (response_code == 304 && OAIMetadataCacheTtl > 0 && IsMetadataRequest(state->requestVerb))
+				entry = GetMetadataCacheEntry(state, url_buffer.data, false);
+
+			parse_ms = state->parseTime;
+
+			if (entry && entry->body)
+			{
+				/* not modified: the cached response is valid for another cycle */
+				state->xmldoc = ReadOAIDocument(state, entry->body, entry->size);
+				entry->fetched = GetCurrentTimestamp();
+			}
+			else
+				state->xmldoc = ReadOAIDocument(state, chunk.memory, chunk.size);
+
+			LogOAIRequest(state, curl, url_buffer.data, state->xmldoc, attempts, state->parseTime - parse_ms);
+
+			elog(DEBUG1, "HTTP %ld, %ld bytes", response_code, chunk.size);
+
+			if (state->cacheTtl > 0 && !entry && IsCacheableResponse(state->xmldoc))
+				WriteCachedResponse(state, url_buffer.data, chunk.memory, chunk.size);
+
+			if (OAIMetadataCacheTtl > 0 && IsMetadataRequest(state->requestVerb) &&
+				!entry && IsCacheableResponse(state->xmldoc))
+				StoreMetadataCacheEntry(state, url_buffer.data, chunk.memory, chunk.size, chunk_header.memory);
+
+			elog(DEBUG2, "  %s (%s): http response code = %ld", __func__, state->requestVerb, response_code);
+			elog(DEBUG2, "  %s (%s): http response size = %ld", __func__, state->requestVerb, chunk.size);
+			elog(DEBUG2, "  %s (%s): http response header = \n%s", __func__, state->requestVerb, chunk_header.memory);
+		}
+	}
+
+	if (chunk.memory)
+		pfree(chunk.memory);
+	if (chunk_header.memory)
+		pfree(chunk_header.memory);
+	curl_slist_free_all(headers);
+	curl_easy_cleanup(curl);
+
+	return OAI_SUCCESS;
+}
+
+/*
+ * BuildOAIRequest
+ * ---------------
+ * Appends the parameters of the OAI request of `state` (verb, arguments
+ * or resumptionToken) to a buffer, URL-encoded as expected in a query
+ * string or in POST fields.
+ *
+ * state  : the OAI request state
+ * curl   : cURL handle, used to encode the arguments
+ * buffer : buffer the parameters are appended to
+ *
+ * returns false if the verb of the request is unknown
+ */
+static bool BuildOAIRequest(OAIFdwState *state, CURL *curl, StringInfo buffer)
+{
+	appendStringInfo(buffer, "verb=%s", state->requestVerb);
+
+	if (strcmp(state->requestVerb, OAI_REQUEST_LISTRECORDS) == 0 ||
+		strcmp(state->requestVerb, OAI_REQUEST_LISTIDENTIFIERS) == 0)
+	{
+		if (state->resumptionToken)
+		{
+			/* URL-encode the resumption token to handle special characters like & */
+			char *encoded_token = curl_easy_escape(curl, state->resumptionToken, 0);
+
+			elog(DEBUG2, "  %s (%s): appending 'resumptionToken' > %s", __func__, state->requestVerb, state->resumptionToken);
+
+			if (encoded_token)
+			{
+				elog(DEBUG2, "  %s (%s): encoded resumptionToken > %s", __func__, state->requestVerb, encoded_token);
+				appendStringInfo(buffer, "&resumptionToken=%s", encoded_token);
+				curl_free(encoded_token);
+			}
+			else
+			{
+				/* Fallback to unencoded if encoding fails */
+				elog(DEBUG2, "  %s (%s): encoding failed, using raw token", __func__, state->requestVerb);
+				appendStringInfo(buffer, "&resumptionToken=%s", state->resumptionToken);
+			}
+
+			/* the token replaces all other arguments */
+			return true;
+		}
+
+		if (state->set)
+		{
+			char *encoded_set = curl_easy_escape(curl, state->set, 0);
+			elog(DEBUG2, "  %s (%s): appending 'set' > %s", __func__, state->requestVerb, state->set);
+			appendStringInfo(buffer, "&set=%s", encoded_set);
+			curl_free(encoded_set);
+		}
+
+		if (state->from)
+		{
+			char *encoded_from = curl_easy_escape(curl, state->from, 0);
+			elog(DEBUG2, "  %s (%s): appending 'from' > %s", __func__, state->requestVerb, state->from);
+			appendStringInfo(buffer, "&from=%s", encoded_from);
+			curl_free(encoded_from);
+		}
+
+		if (state->until)
+		{
+			char *encoded_until = curl_easy_escape(curl, state->until, 0);
+			elog(DEBUG2, "  %s (%s): appending 'until' > %s", __func__, state->requestVerb, state->until);
+			appendStringInfo(buffer, "&until=%s", encoded_until);
+			curl_free(encoded_until);
+		}
+
+		if (state->metadataPrefix)
+		{
+			char *encoded_metadataPrefix = curl_easy_escape(curl, state->metadataPrefix, 0);
+			elog(DEBUG2, "  %s (%s): appending 'metadataPrefix' > %s", __func__, state->requestVerb, state->metadataPrefix);
+			appendStringInfo(buffer, "&metadataPrefix=%s", encoded_metadataPrefix);
+			curl_free(encoded_metadataPrefix);
+		}
+	}
+	else if (strcmp(state->requestVerb, OAI_REQUEST_GETRECORD) == 0)
+	{
+		if (state->identifier)
+		{
+			char *encoded_identifier = curl_easy_escape(curl, state->identifier, 0);
+			elog(DEBUG2, "  %s (%s): appending 'identifier' > %s", __func__, state->requestVerb, state->identifier);
+			appendStringInfo(buffer, "&identifier=%s", encoded_identifier);
+			curl_free(encoded_identifier);
+		}
+
+		if (state->metadataPrefix)
+		{
+			elog(DEBUG2, "  %s (%s): appending 'metadataPrefix' > %s", __func__, state->requestVerb, state->metadataPrefix);
+			appendStringInfo(buffer, "&metadataPrefix=%s", state->metadataPrefix);
+		}
+	}
+	else if (strcmp(state->requestVerb, OAI_REQUEST_LISTSETS) == 0)
+	{
+		if (state->resumptionToken)
+		{
+			char *encoded_token = curl_easy_escape(curl, state->resumptionToken, 0);
+
+			elog(DEBUG2, "  %s (%s): appending 'resumptionToken' > %s", __func__, state->requestVerb, state->resumptionToken);
+
+			if (encoded_token)
+			{
+				appendStringInfo(buffer, "&resumptionToken=%s", encoded_token);
+				curl_free(encoded_token);
+			}
+			else
+				appendStringInfo(buffer, "&resumptionToken=%s", state->resumptionToken);
+		}
+	}
+	else if (strcmp(state->requestVerb, OAI_REQUEST_LISTMETADATAFORMATS) != 0 &&
+			 strcmp(state->requestVerb, OAI_REQUEST_IDENTIFY) != 0)
+		return false;
+
+	return true;
+}
+
+/*
+ * FetchOAIRecords
+ * ---------------
+ * Retrieves records with GetRecord requests, up to `concurrency` of them
+ * at a time over the request engine, and stores them in state->records.
+ * Each request takes a token and a concurrency slot of the server-wide
+ * request limits; requests that are not allowed yet wait while the
+ * running ones proceed. Transient failures are retried with the backoff
+ * of ExecuteOAIRequest, other failures raise an error.
+ *
+ * state       : the OAI request state, its verb is overwritten
+ * identifiers : identifiers of the records (char *)
+ * concurrency : maximum number of requests in progress
+ */
+static void FetchOAIRecords(OAIFdwState *state, List *identifiers, int concurrency)
+{
+	OAITransfer *transfers;
+	List *pending = NIL;
+	ListCell *cell;
+	long maxretries = state->maxretries ? state->maxretries : OAI_DEFAULT_MAX_RETRY;
+	int running = 0;
+
+	elog(DEBUG2, "%s called: %d records", __func__, list_length(identifiers));
+
+	state->requestVerb = OAI_REQUEST_GETRECORD;
+	state->records = NIL;
+	state->pagesize = 0;
+	state->pageindex = 0;
+
+	foreach (cell, identifiers)
+	{
+		OAIPendingRecord *record = (OAIPendingRecord *)palloc0(sizeof(OAIPendingRecord));
+
+		record->identifier = (char *)lfirst(cell);
+		pending = lappend(pending, record);
+	}
+
+	transfers = (OAITransfer *)palloc0(concurrency * sizeof(OAITransfer));
+
+	PG_TRY();
+	{
+		while (pending != NIL || running > 0)
+		{
+			long wait_ms = -1;
+
+			CHECK_FOR_INTERRUPTS();
+
+			/* start requests on free transfers, as far as the server limits allow */
+			for (int i = 0; i < concurrency && pending != NIL; i++)
+			{
+				OAITransfer *transfer = &transfers[i];
+				OAIPendingRecord *record = (OAIPendingRecord *)linitial(pending);
+				TimestampTz now = GetCurrentTimestamp();
+				char *encoded;
+				long slot_wait;
+				int held = OAIHeldSlots;
+
+				if (transfer->curl)
+					continue;
+
+				if (record->notBefore > now)
+				{
+					wait_ms = (long)((record->notBefore - now) / 1000) + 1;
+					break;
+				}
+
+				if (!TryAcquireRequestSlot(state, &slot_wait))
+				{
+					wait_ms = Max(slot_wait, 1);
+					break;
+				}
+
+				pending = list_delete_first(pending);
+
+				transfer->holdsSlot = OAIHeldSlots > held;
+				transfer->serverid = state->foreign_server->serverid;
+				transfer->record = record;
+				transfer->curl = curl_easy_init();
+
+				if (!transfer->curl)
+					ereport(ERROR,
+							(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+							 errmsg("%s: failed to initialize curl", __func__)));
+
+				encoded = curl_easy_escape(transfer->curl, record->identifier, 0);
+				transfer->request = psprintf("verb=%s&identifier=%s&metadataPrefix=%s",
+											 OAI_REQUEST_GETRECORD, encoded, state->metadataPrefix);
+				curl_free(encoded);
+
+				transfer->body.memory = palloc(1);
+				transfer->body.size = 0;
+				transfer->header.memory = palloc(1);
+				transfer->header.size = 0;
+				transfer->errbuf[0] = '\0';
+
+				SetOAIRequestOptions(state, transfer->curl, transfer->request,
+									 &transfer->body, &transfer->header,
+									 transfer->errbuf, &transfer->headers);
+
+				elog(DEBUG1, "GET \"%s?%s\"", state->url, transfer->request);
+
+				AddEngineTransfer(transfer->curl, SetTransferResult, &transfer->result);
+				running++;
+			}
+
+			/*
+			 * Waits for the transfers in progress, or with nothing in progress
+			 * for the server limits or a backoff.
+			 */
+			RunRequestEngine(wait_ms, GetOAIWaitEvent(running > 0 ? OAI_WAIT_EVENT_RESPONSE : OAI_WAIT_EVENT_RATE_LIMIT));
+
+			for (int i = 0; i < concurrency; i++)
+			{
+				OAITransfer *transfer = &transfers[i];
+				CURLcode res = transfer->result.code;
+				long response_code = 0;
+
+				if (!transfer->curl || !transfer->result.finished)
+					continue;
+
+				curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &response_code);
+				CountOAITransfer(state, transfer->curl, res, transfer->body.size);
+
+				if (IsTransientFailure(transfer->curl, res, response_code) &&
+					transfer->record->attempt < maxretries)
+				{
+					OAIPendingRecord *record = transfer->record;
+					long delay = GetRetryDelay(transfer->header.memory, ++record->attempt);
+
+					elog(WARNING, "request to '%s' failed (%ld/%ld)",
+						 state->foreign_server->servername, record->attempt, maxretries);
+
+					record->notBefore = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), delay);
+					pending = lappend(pending, record);
+
+					CountOAIRetry(state, delay);
+				}
+				else if (res != CURLE_OK || response_code >= 400)
+				{
+					char *request = pstrdup(transfer->request);
+
+					char *reason = res != CURLE_OK ? pstrdup(transfer->errbuf[0] ? transfer->errbuf : curl_easy_strerror(res)) : NULL;
+
+					LogOAIRequest(state, transfer->curl, request, NULL, transfer->record->attempt + 1, 0);
+					EndTransfer(transfer);
+
+					/* transport failures have no HTTP status, cURL tells what went wrong */
+					if (reason)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+								 errmsg("OAI request failed: %s", reason),
+								 errhint("Check your request parameters and try again."),
+								 errdetail("URL: \"%s\"", request)));
+
+					ereport(ERROR,
+							(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+							 errmsg("OAI request failed: HTTP %ld", response_code),
+							 errhint("Check your request parameters and try again."),
+							 errdetail("URL: \"%s\"", request)));
+				}
+				else
+				{
+					double parse_ms = state->parseTime;
+
+					elog(DEBUG1, "HTTP %ld, %ld bytes", response_code, transfer->body.size);
+
+					state->xmldoc = ReadOAIDocument(state, transfer->body.memory, transfer->body.size);
+					LogOAIRequest(state, transfer->curl, transfer->request, state->xmldoc,
+								  transfer->record->attempt + 1, state->parseTime - parse_ms);
+					ParseOAIRecords(&state);
+
+					if (state->xmldoc)
+						xmlFreeDoc(state->xmldoc);
+					state->xmldoc = NULL;
+				}
+
+				EndTransfer(transfer);
+				running--;
+			}
+		}
+	}
+	PG_CATCH();
+	{
+		for (int i = 0; i < concurrency; i++)
+			EndTransfer(&transfers[i]);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pfree(transfers);
+}
+
+/*
+ * EndTransfer
+ * -----------
+ * Removes a transfer of FetchOAIRecords or of a federated scan from the
+ * request engine, gives back its concurrency slot and frees it for the
+ * next request. Does nothing if the transfer is not in use.
+ *
+ * transfer : the transfer
+ */
+static void EndTransfer(OAITransfer *transfer)
+{
+	if (transfer->curl)
+	{
+		RemoveEngineTransfer(transfer->curl);
+		curl_easy_cleanup(transfer->curl);
+	}
+
+	curl_slist_free_all(transfer->headers);
+
+	if (transfer->holdsSlot)
+		ReleaseRequestSlot(transfer->serverid);
+
+	if (transfer->body.memory)
+		pfree(transfer->body.memory);
+	if (transfer->header.memory)
+		pfree(transfer->header.memory);
+	if (transfer->request)
+		pfree(transfer->request);
+
+	memset(transfer, 0, sizeof(OAITransfer));
+}
+
+/*
+ * HashText
+ * --------
+ * 64-bit hash of a string, used to keep the state of large tables in
+ * memory without their values.
+ */
+static uint64 HashText(const char *value)
+{
+	return DatumGetUInt64(hash_any_extended((const unsigned char *)value, strlen(value), 0));
+}
+
+/*
+ * LoadLocalRecords
+ * ----------------
+ * Reads the identifier and datestamp of all rows of the target table of
+ * OAI_Sync into a hash table. Both are converted to the type of their
+ * column in the foreign table, so that they compare equal to the values
+ * harvested from the repository. Must be called within an SPI connection.
+ *
+ * target_name    : qualified name of the target table
+ * identifier     : quoted name of the identifier column
+ * datestamp      : quoted name of the datestamp column
+ * identifierattr : identifier column of the foreign table
+ * datestampattr  : datestamp column of the foreign table
+ *
+ * returns a hash table of OAILocalRecord
+ */
+static HTAB *LoadLocalRecords(const char *target_name, const char *identifier, const char *datestamp, Form_pg_attribute identifierattr, Form_pg_attribute datestampattr)
+{
+	HASHCTL ctl;
+	HTAB *local;
+	Portal portal;
+	MemoryContext batchcxt;
+	MemoryContext oldcxt;
+	char *sql;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(uint64);
+	ctl.entrysize = sizeof(OAILocalRecord);
+	ctl.hcxt = CurrentMemoryContext;
+
+	local = hash_create("oai_fdw local records", 1024, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	sql = psprintf("SELECT t.%s::%s::pg_catalog.text, t.%s::%s::pg_catalog.text FROM %s t",
+				   identifier, format_type_with_typemod(identifierattr->atttypid, identifierattr->atttypmod),
+				   datestamp, format_type_with_typemod(datestampattr->atttypid, datestampattr->atttypmod),
+				   target_name);
+
+	elog(DEBUG2, "%s: %s", __func__, sql);
+
+	portal = SPI_cursor_open_with_args(NULL, sql, 0, NULL, NULL, NULL, true, 0);
+
+	batchcxt = AllocSetContextCreate(CurrentMemoryContext,
+									 "oai_fdw_local_records",
+									 ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, OAI_DELTA_BATCH_SIZE);
+
+		if (SPI_processed == 0)
+			break;
+
+		oldcxt = MemoryContextSwitchTo(batchcxt);
+
+		for (uint64 i = 0; i < SPI_processed; i++)
+		{
+			char *id = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+			char *ds = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2);
+			uint64 key;
+			OAILocalRecord *entry;
+
+			if (!id)
+				continue;
+
+			key = HashText(id);
+			entry = (OAILocalRecord *)hash_search(local, &key, HASH_ENTER, NULL);
+			entry->datestamp = ds ? HashText(ds) : 0;
+		}
+
+		MemoryContextSwitchTo(oldcxt);
+		MemoryContextReset(batchcxt);
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	MemoryContextDelete(batchcxt);
+
+	return local;
+}
+
+/*
+ * CheckOAIColumns
+ * ---------------
+ * Validates the data types of the columns mapped to OAI nodes and counts
+ * them in state->numfdwcols.
+ *
+ * state : the OAI request state
+ * rel   : the FOREIGN TABLE
+ *
+ * returns true if a column is mapped to the record content, i.e. if the
+ * records have to be retrieved with ListRecords instead of ListIdentifiers
+ */
+static bool CheckOAIColumns(OAIFdwState *state, Relation rel)
+{
+	TupleDesc tupdesc = rel->rd_att;
+	char *relname = NameStr(rel->rd_rel->relname);
+	bool hasContent = false;
+
+	for (int i = 0; i < rel->rd_att->natts; i++)
+	{
+		List *options = GetForeignColumnOptions(state->foreign_table->relid, i + 1);
+		ListCell *lc;
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+		foreach (lc, options)
+		{
+			DefElem *def = (DefElem *)lfirst(lc);
+
+			if (strcmp(def->defname, OAI_NODE_COLUMN_OPTION) == 0)
+			{
+				char *option_value = defGetString(def);
+				char *attname = NameStr(attr->attname);
+				state->numfdwcols++;
+
+				if (strcmp(option_value, OAI_NODE_STATUS) == 0)
+				{
+					if (attr->atttypid != BOOLOID)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								 errmsg("invalid data type for '%s.%s': %d",
+										relname, attname, attr->atttypid),
+								 errhint("OAI %s must be of type 'boolean'.",
+										 OAI_NODE_STATUS)));
+				}
+				else if (strcmp(option_value, OAI_NODE_IDENTIFIER) == 0 ||
+						 strcmp(option_value, OAI_NODE_METADATAPREFIX) == 0 ||
+						 strcmp(option_value, OAI_NODE_SERVER) == 0)
+				{
+					if (attr->atttypid != TEXTOID &&
+						attr->atttypid != VARCHAROID)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								 errmsg("invalid data type for '%s.%s': %d",
+										relname, attname, attr->atttypid),
+								 errhint("OAI %s must be of type 'text' or 'varchar'.",
+										 option_value)));
+				}
+				else if (strcmp(option_value, OAI_NODE_CONTENT) == 0)
+				{
+					hasContent = true;
+
+					if (attr->atttypid != TEXTOID &&
+						attr->atttypid != VARCHAROID &&
+						attr->atttypid != XMLOID)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								 errmsg("invalid data type for '%s.%s': %d",
+										relname, attname, attr->atttypid),
+								 errhint("OAI %s expects one of the following types: 'xml', 'text' or 'varchar'.",
+										 OAI_NODE_CONTENT)));
+				}
+				else if (strcmp(option_value, OAI_NODE_SETSPEC) == 0)
+				{
+					if (attr->atttypid != TEXTARRAYOID &&
+						attr->atttypid != VARCHARARRAYOID)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								 errmsg("invalid data type for '%s.%s': %d",
+										relname, attname, attr->atttypid),
+								 errhint("OAI %s expects one of the following types: 'text[]', 'varchar[]'.",
+										 OAI_NODE_SETSPEC)));
+				}
+				else if (strcmp(option_value, OAI_NODE_DATESTAMP) == 0)
+				{
+					if (attr->atttypid != TIMESTAMPOID)
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								 errmsg("invalid data type for '%s.%s': %d",
+										relname, attname, attr->atttypid),
+								 errhint("OAI %s expects a 'timestamp'.",
+										 OAI_NODE_DATESTAMP)));
+				}
+			}
+		}
+	}
+
+	return hasContent;
+}
+
+/**
+ * This function validates the oai_nodes in the OPTION clause of each column
+ * and its data types. Additionally it chooses which OAI Request will be
+ * executed bases on the oai_nodes set in the foreign table (ListRecords or
+ * ListIdentifiers).
+ *
+ * ListRecords:     https://www.openarchives.org/OAI/openarchivesprotocol.html#ListRecords
+ * ListIdentifiers: https://www.openarchives.org/OAI/openarchivesprotocol.html#ListIdentifiers
+ */
+static void OAIRequestPlanner(OAIFdwState *state, RelOptInfo *baserel)
+{
+	List *conditions = baserel->baserestrictinfo;
+	bool hasContentForeignColumn = false;
+
+#if PG_VERSION_NUM < 130000
+	Relation rel = heap_open(state->foreign_table->relid, NoLock);
+#else
+	Relation rel = table_open(state->foreign_table->relid, NoLock);
+#endif
+
+	char *relname = NameStr(rel->rd_rel->relname);
+	elog(DEBUG2, "%s called.", __func__);
+
+	/* The default request type is OAI_REQUEST_LISTRECORDS.
+	 * This can be altered depending on the columns used
+	 * in the WHERE and SELECT clauses */
+	state->requestVerb = OAI_REQUEST_LISTRECORDS;
+	state->numcols = rel->rd_att->natts;
+	state->foreigntableid = state->foreign_table->relid;
+
+	hasContentForeignColumn = CheckOAIColumns(state, rel);
+
+	/* the "server" column of a single-server table holds its own server */
+	if (!state->federated)
+		state->servers = list_make1(state->foreign_server->servername);
+
+	/* If the foreign table has no "oai_attribute = 'content'" there is no need
+	 * to retrieve the document itself. The ListIdentifiers request lists the
+	 * whole OAI header */
+	if (!hasContentForeignColumn)
+	{
+		state->requestVerb = OAI_REQUEST_LISTIDENTIFIERS;
+		elog(DEBUG2, "  %s: the foreign table '%s' has no 'content' OAI node. Request type set to '%s'",
+			 __func__, relname, OAI_REQUEST_LISTIDENTIFIERS);
+	}
+
+	if (state->numfdwcols != 0)
+		deparseSelectColumns(state, baserel->reltarget->exprs);
+
+	deparseWhereClause(state, conditions);
+
+	state->pruned = state->servers == NIL;
+
+	if (state->pruned)
+		elog(DEBUG2, "  %s: the WHERE clause excludes all servers of '%s'", __func__, relname);
+
+#if PG_VERSION_NUM < 130000
+	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif
+
+	elog(DEBUG2, "%s => finished.", __func__);
+}
+
+static TupleTableSlot *OAIFdwExecForeignUpdate(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
+{
+	ereport(
+		ERROR, (
+				   errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				   errmsg("Operation not supported."),
+				   errhint("The OAI Foreign Data Wrapper does not support UPDATE queries.")));
+	return NULL;
+}
+
+static TupleTableSlot *OAIFdwExecForeignInsert(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
+{
+	ereport(
+		ERROR, (
+				   errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				   errmsg("Operation not supported."),
+				   errhint("The OAI Foreign Data Wrapper does not support INSERT queries.")));
+
+	return NULL;
+}
+
+static TupleTableSlot *OAIFdwExecForeignDelete(EState *estate, ResultRelInfo *rinfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
+{
+	ereport(
+		ERROR, (
+				   errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				   errmsg("Operation not supported."),
+				   errhint("The OAI Foreign Data Wrapper does not support DELETE queries.")));
+
+	return NULL;
+}
+
+static char *GetOAINodeFromColumn(Oid foreigntableid, int16 attnum)
+{
+
+	List *options;
+	TupleDesc tupdesc;
+	char *optionValue = NULL;
+
+#if PG_VERSION_NUM < 130000
+	Relation rel = heap_open(foreigntableid, NoLock);
+#else
+	Relation rel = table_open(foreigntableid, NoLock);
+#endif
+
+	elog(DEBUG2, "  %s called", __func__);
+	tupdesc = rel->rd_att;
+
+	for (int i = 0; i < rel->rd_att->natts; i++)
+	{
+		ListCell *lc;
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		options = GetForeignColumnOptions(foreigntableid, i + 1);
+
+		if (attr->attnum == attnum)
+		{
+			foreach (lc, options)
+			{
+				DefElem *def = (DefElem *)lfirst(lc);
+
+				if (strcmp(def->defname, OAI_NODE_COLUMN_OPTION) == 0)
+				{
+					optionValue = defGetString(def);
+					break;
+				}
+			}
+		}
+	}
+
+#if PG_VERSION_NUM < 130000
+	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif
+
+	return optionValue;
+}
+
+static char *datumToString(Datum datum, Oid type)
+{
+
+	regproc typoutput;
+	HeapTuple tuple;
+	char *result;
+
+	tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(type));
+
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "%s: cache lookup failed for type %u", __func__, type);
+
+	typoutput = ((Form_pg_type)GETSTRUCT(tuple))->typoutput;
+
+	ReleaseSysCache(tuple);
+
+	elog(DEBUG2, "%s: type > %u", __func__, type);
+
+	switch (type)
+	{
+
+	case TEXTOID:
+	case VARCHAROID:
+		result = DatumGetCString(OidFunctionCall1(typoutput, datum));
+		break;
+	default:
+		return NULL;
+	}
+
+	return result;
+}
+
+static void deparseExpr(Expr *expr, OAIFdwState *state)
+{
+	OpExpr *oper;
+	ScalarArrayOpExpr *arrayoper;
+	Var *var;
+	HeapTuple tuple;
+	char *operName;
+	char *oaiNode;
+	Node *left;
+	Node *right;
+
+	elog(DEBUG2, "%s called for expr->type %u", __func__, expr->type);
+
+	switch (expr->type)
+	{
+
+	case T_OpExpr:
+
+		elog(DEBUG2, "  %s: case T_OpExpr", __func__);
+		oper = (OpExpr *)expr;
+
+		tuple = SearchSysCache1(OPEROID, ObjectIdGetDatum(oper->opno));
+
+		if (!HeapTupleIsValid(tuple))
+			elog(ERROR, "%s: cache lookup failed for operator %u", __func__, oper->opno);
+
+		operName = pstrdup(((Form_pg_operator)GETSTRUCT(tuple))->oprname.data);
+
+		ReleaseSysCache(tuple);
+
+		elog(DEBUG2, "  %s: opername > %s", __func__, operName);
+
+		left = linitial(oper->args);
+		right = lsecond(oper->args);
+
+		if (!IsA(left, Var) || !IsA(right, Const))
+			break; /* let PG evaluate locally */
+
+		var = (Var *)left;
+		oaiNode = GetOAINodeFromColumn(state->foreign_table->relid, var->varattno);
+
+		if (!oaiNode)
+			break;
+
+		if (strcmp(operName, "=") == 0)
+		{
+			if (strcmp(oaiNode, OAI_NODE_IDENTIFIER) == 0 && (var->vartype == TEXTOID || var->vartype == VARCHAROID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				state->requestVerb = OAI_REQUEST_GETRECORD;
+				state->identifier = datumToString(constant->constvalue, constant->consttype);
+
+				elog(DEBUG2, "  %s: request type set to '%s' with identifier '%s'", __func__, OAI_REQUEST_GETRECORD, state->identifier);
+			}
+
+			if (strcmp(oaiNode, OAI_NODE_DATESTAMP) == 0 && (var->vartype == TIMESTAMPOID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				state->from = deparseTimestamp(constant->constvalue);
+				state->until = deparseTimestamp(constant->constvalue);
+			}
+
+			if (strcmp(oaiNode, OAI_NODE_METADATAPREFIX) == 0 && (var->vartype == TEXTOID || var->vartype == VARCHAROID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				state->metadataPrefix = datumToString(constant->constvalue, constant->consttype);
+
+				elog(DEBUG2, "  %s: metadataPrefix set to '%s'", __func__, state->metadataPrefix);
+			}
+
+			if (strcmp(oaiNode, OAI_NODE_SERVER) == 0 && (var->vartype == TEXTOID || var->vartype == VARCHAROID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				char *server = datumToString(constant->constvalue, constant->consttype);
+
+				if (server)
+					PruneOAIServers(state, list_make1(server));
+			}
+		}
+
+		if (strcmp(operName, ">=") == 0 || strcmp(operName, ">") == 0)
+		{
+			if (strcmp(oaiNode, OAI_NODE_DATESTAMP) == 0 && (var->vartype == TIMESTAMPOID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				state->from = deparseTimestamp(constant->constvalue);
+			}
+		}
+
+		if (strcmp(operName, "<=") == 0 || strcmp(operName, "<") == 0)
+		{
+			if (strcmp(oaiNode, OAI_NODE_DATESTAMP) == 0 && (var->vartype == TIMESTAMPOID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				state->until = deparseTimestamp(constant->constvalue);
+			}
+		}
+
+		if (strcmp(operName, "<@") == 0 || strcmp(operName, "@>") == 0 || strcmp(operName, "&&") == 0)
+		{
+			if (strcmp(oaiNode, OAI_NODE_SETSPEC) == 0 && (var->vartype == TEXTARRAYOID || var->vartype == VARCHARARRAYOID))
+			{
+				Const *constant = (Const *)lsecond(oper->args);
+				ArrayType *array = (ArrayType *)constant->constvalue;
+
+				int numitems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+
+				if (numitems > 1)
+				{
+					elog(WARNING, "The OAI standard requests do not support multiple '%s' attributes. This filter will be applied AFTER the OAI request.", OAI_NODE_SETSPEC);
+					elog(DEBUG2, "  %s: clearing '%s' attribute.", __func__, OAI_NODE_SETSPEC);
+					state->set = NULL;
+				}
+				else if (numitems == 1)
+				{
+					bool isnull;
+					Datum value;
+
+					ArrayIterator iterator = array_create_iterator(array, 0, NULL);
+
+					while (array_iterate(iterator, &value, &isnull))
+					{
+						elog(DEBUG2, "  %s: setSpec set to '%s'", __func__, datumToString(value, TEXTOID));
+						state->set = datumToString(value, TEXTOID);
+					}
+
+					array_free_iterator(iterator);
+				}
+			}
+		}
+
+		break;
+
+	case T_ScalarArrayOpExpr:
+
+		elog(DEBUG2, "  %s: case T_ScalarArrayOpExpr", __func__);
+		arrayoper = (ScalarArrayOpExpr *)expr;
+
+		left = linitial(arrayoper->args);
+		right = lsecond(arrayoper->args);
+
+		/* only "server IN (...)" and "server = ANY (...)" are pushed down */
+		if (!arrayoper->useOr || !IsA(left, Var) || !IsA(right, Const) || ((Const *)right)->constisnull)
+			break;
+
+		var = (Var *)left;
+		oaiNode = GetOAINodeFromColumn(state->foreign_table->relid, var->varattno);
+
+		if (!oaiNode || strcmp(oaiNode, OAI_NODE_SERVER) != 0)
+			break;
+
+		tuple = SearchSysCache1(OPEROID, ObjectIdGetDatum(arrayoper->opno));
+
+		if (!HeapTupleIsValid(tuple))
+			elog(ERROR, "%s: cache lookup failed for operator %u", __func__, arrayoper->opno);
+
+		operName = pstrdup(((Form_pg_operator)GETSTRUCT(tuple))->oprname.data);
+
+		ReleaseSysCache(tuple);
+
+		if (strcmp(operName, "=") == 0)
+		{
+			ArrayType *array = DatumGetArrayTypeP(((Const *)right)->constvalue);
+			ArrayIterator iterator = array_create_iterator(array, 0, NULL);
+			List *servers = NIL;
+			bool isnull;
+			bool valid = true;
+			Datum value;
+
+			while (array_iterate(iterator, &value, &isnull))
+			{
+				char *server;
+
+				if (isnull)
+					continue;
+
+				server = datumToString(value, ARR_ELEMTYPE(array));
+
+				if (!server)
+					valid = false;
+
+				servers = lappend(servers, server);
+			}
+
+			array_free_iterator(iterator);
+
+			if (valid)
+				PruneOAIServers(state, servers);
+		}
+
+		break;
+
+	default:
+
+		break;
+	}
+}
+
+/*
+ * PruneOAIServers
+ * ---------------
+ * Removes the servers a condition on the "server" column excludes from
+ * the servers of the scan. The condition is still checked for every
+ * record, so pruning only saves the requests.
+ *
+ * state   : the OAI request state
+ * servers : names of the servers the condition allows (char *)
+ */
+static void PruneOAIServers(OAIFdwState *state, List *servers)
+{
+	List *result = NIL;
+	ListCell *cell;
+
+	foreach (cell, state->servers)
+	{
+		char *server = (char *)lfirst(cell);
+		ListCell *lc;
+
+		foreach (lc, servers)
+		{
+			if (strcmp(server, (char *)lfirst(lc)) == 0)
+			{
+				result = lappend(result, server);
+				break;
+			}
+		}
+	}
+
+	if (list_length(result) < list_length(state->servers))
+		elog(DEBUG2, "  %s: %d of %d servers left", __func__, list_length(result), list_length(state->servers));
+
+	state->servers = result;
+}
+
+static void deparseSelectColumns(OAIFdwState *state, List *exprs)
+{
+	ListCell *cell;
+
+	elog(DEBUG2, "%s called", __func__);
+
+	foreach (cell, exprs)
+	{
+		Expr *expr = (Expr *)lfirst(cell);
+
+		elog(DEBUG2, "  %s: evaluating expr->type = %u", __func__, expr->type);
+
+		deparseExpr(expr, state);
+	}
+}
+
+static char *deparseTimestamp(Datum datum)
+{
+
+	struct pg_tm datetime_tm;
+	fsec_t datetime_fsec;
+	StringInfoData s;
+
+	(void)timestamp2tm(DatumGetTimestampTz(datum),
+					   NULL,
+					   &datetime_tm,
+					   &datetime_fsec,
+					   NULL,
+					   NULL);
+
+	initStringInfo(&s);
+	appendStringInfo(&s, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+					 datetime_tm.tm_year > 0 ? datetime_tm.tm_year : -datetime_tm.tm_year + 1,
+					 datetime_tm.tm_mon, datetime_tm.tm_mday, datetime_tm.tm_hour,
+					 datetime_tm.tm_min, datetime_tm.tm_sec);
+
+	return s.data;
+}
+
+static void deparseWhereClause(OAIFdwState *state, List *conditions)
+{
+	ListCell *cell;
+
+	foreach (cell, conditions)
+	{
+		Expr *expr = (Expr *)lfirst(cell);
+
+		/* extract WHERE clause from RestrictInfo */
+		if (IsA(expr, RestrictInfo))
+		{
+			RestrictInfo *ri = (RestrictInfo *)expr;
+			expr = ri->clause;
+		}
+
+		deparseExpr(expr, state);
+	}
+}
+
+static void OAIFdwGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+	OAIFdwState *state = (OAIFdwState *)palloc0(sizeof(OAIFdwState));
+	state->foreign_table = GetForeignTable(foreigntableid);
+	state->foreign_server = GetForeignServer(state->foreign_table->serverid);
+	state->startup_cost = 10000.0;
+	/* estimate total cost as startup cost + 10 * (returned rows) */
+	state->total_cost = state->startup_cost + baserel->rows * 10.0;
+
+	baserel->fdw_private = state;
+}
+
+static void OAIFdwGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+
+	struct OAIFdwState *state = (struct OAIFdwState *)baserel->fdw_private;
+	Path *path = (Path *)create_foreignscan_path(root, baserel,
+												 NULL,			/* default pathtarget */
+												 baserel->rows, /* rows */
+#if PG_VERSION_NUM >= 180000
+												 0, /* no parallel pathflags */
+#endif
+												 state->startup_cost, /* startup cost */
+												 state->total_cost,	  /* total cost */
+												 NIL,				  /* no pathkeys */
+												 NULL,				  /* no required outer relids */
+												 NULL,				  /* no fdw_outerpath */
+#if PG_VERSION_NUM >= 170000
+												 NIL,	/* no fdw_restrictinfo */
+#endif													/* PG_VERSION_NUM */
+												 NULL); /* no fdw_private */
+	add_path(baserel, path);
+}
+
+static ForeignScan *OAIFdwGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
+{
+	OAIFdwState *state = baserel->fdw_private;
+	List *fdw_private = NIL;
+
+	InitSession(state, baserel);
+
+	scan_clauses = extract_actual_clauses(scan_clauses, false);
+	fdw_private = SerializePlanData(state);
+
+	return make_foreignscan(tlist,
+							scan_clauses,
+							baserel->relid,
+							NIL,		 /* no expressions we will evaluate */
+							fdw_private, /* pass along our state */
+							NIL,		 /* no custom tlist; our scan tuple looks like tlist */
+							NIL,		 /* no quals we will recheck */
+							outer_plan);
+}
+
+static void OAIFdwBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan *fs = (ForeignScan *)node->ss.ps.plan;
+	struct OAIFdwState *state = DeserializePlanData(fs->fdw_private);
+
+	node->fdw_state = (void *)state;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	state->foreign_table = GetForeignTable(state->foreigntableid);
+	state->foreign_server = GetForeignServer(state->foreign_table->serverid);
+	LoadOAIUserMapping(state); /* restores user/password/proxy creds */
+
+	state->oaicxt = AllocSetContextCreate(CurrentMemoryContext,
+										  "oai_fdw_ctx",
+										  ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * Keep the emitted tuples if this scan is expected to be rescanned, e.g.
+	 * on the inner side of a nested loop (EXEC_FLAG_REWIND) or inside a
+	 * correlated subquery (the plan depends on outer parameters), so that
+	 * rescans do not harvest the whole result set again.
+	 */
+	if ((eflags & EXEC_FLAG_REWIND) || !bms_is_empty(fs->scan.plan.extParam))
+		InitRescanStore(node, state);
+}
+
+/*
+ * InitRescanStore
+ * ---------------
+ * Creates the tuplestore used to replay the tuples of a scan on rescan. It
+ * is kept in memory up to work_mem and spills to disk beyond that.
+ *
+ * node  : the ForeignScanState being executed
+ * state : the scan state that will own the tuplestore
+ */
+static void InitRescanStore(ForeignScanState *node, OAIFdwState *state)
+{
+	MemoryContext oldcxt = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	TupleDesc tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+
+	elog(DEBUG2, "%s called", __func__);
+
+	state->rescanstore = tuplestore_begin_heap(false, false, work_mem);
+#if PG_VERSION_NUM < 120000
+	state->rescanslot = MakeSingleTupleTableSlot(tupdesc);
+#else
+	state->rescanslot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+#endif
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+static OAIRecord *FetchNextOAIRecord(OAIFdwState **state)
+{
+	if ((*state)->pageindex == (*state)->pagesize)
+	{
+		elog(DEBUG3, "%s: EOF > %d/%d", __func__, (*state)->pageindex, (*state)->pagesize);
+		return NULL;
+	}
+	else
+	{
+		OAIRecord *record;
+		ListCell *cell;
+
+		cell = list_nth_cell((*state)->records, (*state)->pageindex);
+		record = (OAIRecord *)lfirst(cell);
+
+		(*state)->rowcount++;
+		(*state)->pageindex++;
+
+		return record;
+	}
+}
+
+static void CreateOAITuple(TupleTableSlot *slot, OAIFdwState *state, OAIRecord *oai)
+{
+	elog(DEBUG2, "%s called", __func__);
+
+	for (int i = 0; i < state->numcols; i++)
+	{
+		Oid pgtype = state->oaiTable->cols[i]->pgtype;
+		char *oai_node = state->oaiTable->cols[i]->oai_node;
+		char *colname = state->oaiTable->cols[i]->name;
+		int pgtypmod = state->oaiTable->cols[i]->pgtypmod;
+
+		if (oai_node)
+		{
+			slot->tts_isnull[i] = false;
+
+			if (strcmp(oai_node, OAI_NODE_STATUS) == 0)
+				slot->tts_values[i] = BoolGetDatum(oai->isDeleted);
+			else if (strcmp(oai_node, OAI_NODE_IDENTIFIER) == 0)
+			{
+				if (oai->identifier)
+					slot->tts_values[i] = CStringGetTextDatum(oai->identifier);
+				else
+					slot->tts_isnull[i] = true;
+			}
+			else if (strcmp(oai_node, OAI_NODE_METADATAPREFIX) == 0)
+			{
+				if (oai->metadataPrefix)
+					slot->tts_values[i] = CStringGetTextDatum(oai->metadataPrefix);
+				else
+					slot->tts_isnull[i] = true;
+			}
+			else if (strcmp(oai_node, OAI_NODE_SERVER) == 0)
+				slot->tts_values[i] = CStringGetTextDatum(oai->server ? oai->server : state->foreign_server->servername);
+			else if (strcmp(oai_node, OAI_NODE_CONTENT) == 0)
+			{
+				if (oai->content)
+					slot->tts_values[i] = CStringGetTextDatum((char *)oai->content);
+				else
+					slot->tts_isnull[i] = true;
+			}
+			else if (strcmp(oai_node, OAI_NODE_SETSPEC) == 0)
+			{
+				if (oai->setsArray)
+					slot->tts_values[i] = PointerGetDatum(oai->setsArray);
+				else
+					slot->tts_isnull[i] = true;
+			}
+			else if (strcmp(oai_node, OAI_NODE_DATESTAMP) == 0)
+			{
+				if (oai->datestamp)
+				{
+					HeapTuple tuple;
+					regproc typinput;
+					Datum datum;
+
+					datum = CStringGetDatum(oai->datestamp);
+					/* find the appropriate conversion function */
+					tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(pgtype));
+
+					if (!HeapTupleIsValid(tuple))
+						ereport(ERROR,
+								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+								 errmsg("cache lookup failed for type %u > column '%s'", pgtype, colname)));
+
+					typinput = ((Form_pg_type)GETSTRUCT(tuple))->typinput;
+					ReleaseSysCache(tuple);
+
+					slot->tts_values[i] = OidFunctionCall3(
+						typinput,
+						datum,
+						ObjectIdGetDatum(InvalidOid),
+						Int32GetDatum(pgtypmod));
+				}
+				else
+					slot->tts_isnull[i] = true;
+			}
+			else
+				slot->tts_isnull[i] = true;
+		}
+		else
+		{
+			slot->tts_isnull[i] = true;
+			slot->tts_values[i] = PointerGetDatum(NULL);
+		}
+	}
 }
 
-static char *datumToString(Datum datum, Oid type)
+static void OAIExplainForeignScan(ForeignScanState *node, ExplainState *es)
 {
+	OAIFdwState *state = (OAIFdwState *)node->fdw_state;
 
-	regproc typoutput;
-	HeapTuple tuple;
-	char *result;
+	if (state)
+	{
+		if (!state->federated && state->foreign_server && strlen(state->foreign_server->servername) > 0)
+			ExplainPropertyText("Foreign Server", state->foreign_server->servername, es);
 
-	tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(type));
+		if (!state->federated && state->url && strlen(state->url) > 0)
+			ExplainPropertyText("Foreign Server URL", state->url, es);
 
-	if (!HeapTupleIsValid(tuple))
-		elog(ERROR, "%s: cache lookup failed for type %u", __func__, type);
+		/* servers left after pruning, if any was pruned or the table has several */
+		if (state->federated || state->pruned)
+		{
+			if (state->servers != NIL)
+				ExplainPropertyList("Foreign Servers", state->servers, es);
+			else
+				ExplainPropertyText("Foreign Servers", "none", es);
+		}
 
-	typoutput = ((Form_pg_type)GETSTRUCT(tuple))->typoutput;
+		if (state->requestVerb && strlen(state->requestVerb) > 0)
+			ExplainPropertyText("requestVerb", state->requestVerb, es);
 
-	ReleaseSysCache(tuple);
+		if (state->set && strlen(state->set) > 0)
+			ExplainPropertyText("setSpec", state->set, es);
 
-	elog(DEBUG2, "%s: type > %u", __func__, type);
+		if (state->metadataPrefix && strlen(state->metadataPrefix) > 0)
+			ExplainPropertyText("metadataPrefix", state->metadataPrefix, es);
 
-	switch (type)
-	{
+		if (state->from && strlen(state->from) > 0)
+			ExplainPropertyText("from", state->from, es);
 
-	case TEXTOID:
-	case VARCHAROID:
-		result = DatumGetCString(OidFunctionCall1(typoutput, datum));
-		break;
-	default:
-		return NULL;
-	}
+		if (state->until && strlen(state->until) > 0)
+			ExplainPropertyText("until", state->until, es);
 
-	return result;
+		if (es->analyze)
+		{
+			ExplainPropertyInteger("HTTP Requests", NULL, state->httpRequests, es);
+			ExplainPropertyInteger("HTTP Retries", NULL, state->httpRetries, es);
+			ExplainPropertyFloat("Backoff Time", "ms", state->backoffTime, 3, es);
+			ExplainPropertyInteger("Bytes Received", "bytes", state->bytesReceived, es);
+			ExplainPropertyInteger("Bytes Decompressed", "bytes", state->bytesDecompressed, es);
+			ExplainPropertyInteger("Peak Page Size", "bytes", state->peakPageSize, es);
+			ExplainPropertyFloat("DNS Time", "ms", state->dnsTime, 3, es);
+			ExplainPropertyFloat("Connect Time", "ms", state->connectTime, 3, es);
+			ExplainPropertyFloat("Time To First Byte", "ms", state->firstByteTime, 3, es);
+			ExplainPropertyFloat("Transfer Time", "ms", state->transferTime, 3, es);
+			ExplainPropertyFloat("XML Parse Time", "ms", state->parseTime, 3, es);
+			ExplainPropertyFloat("Record Extraction Time", "ms", state->extractTime, 3, es);
+			ExplainPropertyInteger("Records Seen", NULL, state->recordsSeen, es);
+			ExplainPropertyInteger("Deleted Records Seen", NULL, state->deletedSeen, es);
+
+			if (state->resumedRows > 0)
+				ExplainPropertyInteger("Records Resumed From Checkpoint", NULL, state->resumedRows, es);
+		}
+	}
 }
 
-static void deparseExpr(Expr *expr, OAIFdwState *state)
+static TupleTableSlot *OAIFdwIterateForeignScan(ForeignScanState *node)
 {
-	OpExpr *oper;
-	Var *var;
-	HeapTuple tuple;
-	char *operName;
-	char *oaiNode;
-	Node *left;
-	Node *right;
-
-	elog(DEBUG2, "%s called for expr->type %u", __func__, expr->type);
-
-	switch (expr->type)
-	{
 
-	case T_OpExpr:
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	struct OAIFdwState *state = (struct OAIFdwState *)node->fdw_state;
+	OAIRecord *record;
+	MemoryContext old_cxt;
 
-		elog(DEBUG2, "  %s: case T_OpExpr", __func__);
-		oper = (OpExpr *)expr;
+	elog(DEBUG2, "%s called.", __func__);
 
-		tuple = SearchSysCache1(OPEROID, ObjectIdGetDatum(oper->opno));
+	ExecClearTuple(slot);
 
-		if (!HeapTupleIsValid(tuple))
-			elog(ERROR, "%s: cache lookup failed for operator %u", __func__, oper->opno);
+	/* Returns an empty tuple in case there is no mapping for OAI nodes and columns */
+	if (state->numfdwcols == 0)
+		return slot;
 
-		operName = pstrdup(((Form_pg_operator)GETSTRUCT(tuple))->oprname.data);
+	/*
+	 * Tuples stored in a previous pass are replayed first. If that pass did
+	 * not read the result set until the end (e.g. LIMIT), the harvest
+	 * continues afterwards from where it stopped.
+	 */
+	if (state->rescanreplay)
+	{
+		if (tuplestore_gettupleslot(state->rescanstore, true, false, state->rescanslot))
+			return ExecCopySlot(slot, state->rescanslot);
 
-		ReleaseSysCache(tuple);
+		state->rescanreplay = false;
 
-		elog(DEBUG2, "  %s: opername > %s", __func__, operName);
+		if (state->eof)
+			return slot;
+	}
 
-		left = linitial(oper->args);
-		right = lsecond(oper->args);
+	old_cxt = MemoryContextSwitchTo(state->oaicxt);
 
-		if (!IsA(left, Var) || !IsA(right, Const))
-			break; /* let PG evaluate locally */
+	/*
+	 * Load OAI records in case that this function is called for the first time
+	 * or a page contains a resumption token and the index reached the end of
+	 * the page. A federated scan loads the records of all its servers as they
+	 * arrive, and a scan whose servers were all pruned loads nothing.
+	 */
+	if (state->pruned)
+		elog(DEBUG2, "  %s: all servers pruned", __func__);
+	else if (state->federated)
+	{
+		if (state->pageindex == state->pagesize)
+			LoadFederatedRecords(state);
+	}
+	else if (state->rowcount == 0 || (state->resumptionToken && state->pageindex == state->pagesize))
+		LoadOAIRecords(&state);
 
-		var = (Var *)left;
-		oaiNode = GetOAINodeFromColumn(state->foreign_table->relid, var->varattno);
+	record = FetchNextOAIRecord(&state);
 
-		if (!oaiNode)
-			break;
+	MemoryContextSwitchTo(old_cxt);
 
-		if (strcmp(operName, "=") == 0)
-		{
-			if (strcmp(oaiNode, OAI_NODE_IDENTIFIER) == 0 && (var->vartype == TEXTOID || var->vartype == VARCHAROID))
-			{
-				Const *constant = (Const *)lsecond(oper->args);
-				state->requestVerb = OAI_REQUEST_GETRECORD;
-				state->identifier = datumToString(constant->constvalue, constant->consttype);
+	if (record != NULL)
+	{
+		MemoryContext per_tuple = node->ss.ps.ps_ExprContext->ecxt_per_tuple_memory;
+		MemoryContext old = MemoryContextSwitchTo(per_tuple);
 
-				elog(DEBUG2, "  %s: request type set to '%s' with identifier '%s'", __func__, OAI_REQUEST_GETRECORD, state->identifier);
-			}
+		elog(DEBUG2, "  %s: creating OAI tuple", __func__);
+		CreateOAITuple(slot, state, record);
+		MemoryContextSwitchTo(old);
 
-			if (strcmp(oaiNode, OAI_NODE_DATESTAMP) == 0 && (var->vartype == TIMESTAMPOID))
-			{
-				Const *constant = (Const *)lsecond(oper->args);
-				state->from = deparseTimestamp(constant->constvalue);
-				state->until = deparseTimestamp(constant->constvalue);
-			}
+		elog(DEBUG2, "  %s: storing virtual tuple", __func__);
+		ExecStoreVirtualTuple(slot);
+		pfree(record);
 
-			if (strcmp(oaiNode, OAI_NODE_METADATAPREFIX) == 0 && (var->vartype == TEXTOID || var->vartype == VARCHAROID))
-			{
-				Const *constant = (Const *)lsecond(oper->args);
-				state->metadataPrefix = datumToString(constant->constvalue, constant->consttype);
+		if (state->rescanstore)
+			tuplestore_puttupleslot(state->rescanstore, slot);
+	}
+	else
+		state->eof = true;
 
-				elog(DEBUG2, "  %s: metadataPrefix set to '%s'", __func__, state->metadataPrefix);
-			}
-		}
+	elog(DEBUG3, "%s => returning tuple (rowcount: %d)", __func__, state->rowcount);
 
-		if (strcmp(operName, ">=") == 0 || strcmp(operName, ">") == 0)
-		{
-			if (strcmp(oaiNode, OAI_NODE_DATESTAMP) == 0 && (var->vartype == TIMESTAMPOID))
-			{
-				Const *constant = (Const *)lsecond(oper->args);
-				state->from = deparseTimestamp(constant->constvalue);
-			}
-		}
+	return slot;
+}
 
-		if (strcmp(operName, "<=") == 0 || strcmp(operName, "<") == 0)
-		{
-			if (strcmp(oaiNode, OAI_NODE_DATESTAMP) == 0 && (var->vartype == TIMESTAMPOID))
-			{
-				Const *constant = (Const *)lsecond(oper->args);
-				state->until = deparseTimestamp(constant->constvalue);
-			}
-		}
+static void RaiseOAIException(xmlNodePtr error)
+{
+	xmlChar *code = xmlGetProp(error, (xmlChar *)"code");
+	xmlChar *cont = xmlNodeGetContent(error);
+	char *ccode;
+	char *ccont;
 
-		if (strcmp(operName, "<@") == 0 || strcmp(operName, "@>") == 0 || strcmp(operName, "&&") == 0)
-		{
-			if (strcmp(oaiNode, OAI_NODE_SETSPEC) == 0 && (var->vartype == TEXTARRAYOID || var->vartype == VARCHARARRAYOID))
-			{
-				Const *constant = (Const *)lsecond(oper->args);
-				ArrayType *array = (ArrayType *)constant->constvalue;
+	/* Guard the RAW pointers before any string op */
+	if (!code)
+	{
+		if (cont)
+			xmlFree(cont);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+				 errmsg("invalid OAI error response: missing 'code' attribute")));
+	}
 
-				int numitems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+	ccode = pstrdup((char *)code);
+	ccont = cont ? pstrdup((char *)cont) : pstrdup("");
 
-				if (numitems > 1)
-				{
-					elog(WARNING, "The OAI standard requests do not support multiple '%s' attributes. This filter will be applied AFTER the OAI request.", OAI_NODE_SETSPEC);
-					elog(DEBUG2, "  %s: clearing '%s' attribute.", __func__, OAI_NODE_SETSPEC);
-					state->set = NULL;
-				}
-				else if (numitems == 1)
-				{
-					bool isnull;
-					Datum value;
+	xmlFree(code);
+	if (cont)
+		xmlFree(cont);
 
-					ArrayIterator iterator = array_create_iterator(array, 0, NULL);
+	if (strcmp(ccode, OAI_ERROR_ID_DOES_NOT_EXIST) == 0 ||
+		strcmp(ccode, OAI_ERROR_NO_RECORD_MATCH) == 0)
+		ereport(WARNING,
+				(errcode(ERRCODE_NO_DATA_FOUND),
+				 errmsg("OAI %s: %s", ccode, ccont)));
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+				 errmsg("OAI %s: %s", ccode, ccont)));
+}
 
-					while (array_iterate(iterator, &value, &isnull))
-					{
-						elog(DEBUG2, "  %s: setSpec set to '%s'", __func__, datumToString(value, TEXTOID));
-						state->set = datumToString(value, TEXTOID);
-					}
+/*
+ * ExtractOAIHeader
+ * ----------------
+ * Copies identifier, datestamp, sets and deleted status of an OAI <header>
+ * element into a record.
+ *
+ * doc    : the OAI response
+ * header : the <header> element
+ * oai    : the record
+ */
+static void ExtractOAIHeader(xmlDocPtr doc, xmlNodePtr header, OAIRecord *oai)
+{
+	xmlNodePtr headerElements;
+	xmlChar *status = xmlGetProp(header, (xmlChar *)OAI_NODE_STATUS);
 
-					array_free_iterator(iterator);
-				}
-			}
-		}
+	if (status)
+	{
+		if (xmlStrcmp(status, (xmlChar *)OAI_RESPONSE_ELEMENT_DELETED) == 0)
+			oai->isDeleted = true;
+		xmlFree(status);
+	}
 
-		break;
+	for (headerElements = header->children; headerElements != NULL; headerElements = headerElements->next)
+	{
+		xmlBufferPtr buffer = xmlBufferCreate();
+		xmlNodeDump(buffer, doc, headerElements->children, 0, 0);
 
-	default:
+		if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_IDENTIFIER) == 0)
+			oai->identifier = pstrdup((char *)buffer->content);
+		else if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETSPEC) == 0)
+			appendTextArray(&oai->setsArray, pstrdup((char *)buffer->content));
+		else if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_DATESTAMP) == 0)
+			oai->datestamp = pstrdup((char *)buffer->content);
 
-		break;
+		xmlBufferFree(buffer);
 	}
 }
 
-static void deparseSelectColumns(OAIFdwState *state, List *exprs)
+/*
+ * ExtractOAIRecord
+ * ----------------
+ * Converts a <record> element of a ListRecords or GetRecord response, or
+ * a <header> element of a ListIdentifiers response, into an OAIRecord.
+ * Does not depend on the state of a scan, so that the extraction can be
+ * measured on its own (see oai_fdw_bench_parse).
+ *
+ * doc            : the OAI response
+ * node           : child element of the verb element of the response
+ * metadataPrefix : metadata format of the request
+ *
+ * returns the palloc'd record, or NULL if the element is no record
+ */
+static OAIRecord *ExtractOAIRecord(xmlDocPtr doc, xmlNodePtr node, const char *metadataPrefix)
 {
-	ListCell *cell;
+	OAIRecord *oai;
+	xmlNodePtr record;
 
-	elog(DEBUG2, "%s called", __func__);
+	if (xmlStrcmp(node->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RECORD) != 0 &&
+		xmlStrcmp(node->name, (xmlChar *)OAI_RESPONSE_ELEMENT_HEADER) != 0)
+		return NULL;
 
-	foreach (cell, exprs)
+	oai = (OAIRecord *)palloc0(sizeof(OAIRecord));
+	oai->metadataPrefix = pstrdup(metadataPrefix);
+	oai->isDeleted = false;
+	oai->setsArray = NULL;
+
+	/* ListIdentifiers */
+	if (xmlStrcmp(node->name, (xmlChar *)OAI_RESPONSE_ELEMENT_HEADER) == 0)
 	{
-		Expr *expr = (Expr *)lfirst(cell);
+		ExtractOAIHeader(doc, node, oai);
+		return oai;
+	}
 
-		elog(DEBUG2, "  %s: evaluating expr->type = %u", __func__, expr->type);
+	for (record = node->children; record != NULL; record = record->next)
+	{
+		if (xmlStrcmp(record->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATA) == 0)
+		{
+			/* Copy necessary to include the namespaces in the buffer output */
+			xmlNodePtr copy = xmlCopyNode(record->children, 1);
 
-		deparseExpr(expr, state);
+			xmlBufferPtr buffer = xmlBufferCreate();
+			xmlNodeDump(buffer, doc, copy, 0, 1);
+
+			elog(DEBUG2, "  %s: XML Buffer size: %d", __func__, buffer->size);
+
+			oai->content = pstrdup((char *)buffer->content);
+
+			xmlFreeNode(copy);
+			xmlBufferFree(buffer);
+		}
+		else if (xmlStrcmp(record->name, (xmlChar *)OAI_RESPONSE_ELEMENT_HEADER) == 0)
+			ExtractOAIHeader(doc, record, oai);
 	}
+
+	return oai;
 }
 
-static char *deparseTimestamp(Datum datum)
+/*
+ * ParseOAIRecords
+ * ---------------
+ * Appends the records (or headers, for ListIdentifiers) of the response
+ * in state->xmldoc to state->records, and picks up its responseDate and
+ * resumptionToken. OAI errors in the response are raised.
+ *
+ * state : the OAI request state, with the parsed response of its verb
+ */
+static void ParseOAIRecords(struct OAIFdwState **state)
 {
+	xmlNodePtr xmlroot;
+	xmlNodePtr oaipmh;
+	xmlNodePtr ListRecordsRequest;
+	instr_time start;
+	instr_time duration;
 
-	struct pg_tm datetime_tm;
-	fsec_t datetime_fsec;
-	StringInfoData s;
-
-	(void)timestamp2tm(DatumGetTimestampTz(datum),
-					   NULL,
-					   &datetime_tm,
-					   &datetime_fsec,
-					   NULL,
-					   NULL);
+	INSTR_TIME_SET_CURRENT(start);
 
-	initStringInfo(&s);
-	appendStringInfo(&s, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-					 datetime_tm.tm_year > 0 ? datetime_tm.tm_year : -datetime_tm.tm_year + 1,
-					 datetime_tm.tm_mon, datetime_tm.tm_mday, datetime_tm.tm_hour,
-					 datetime_tm.tm_min, datetime_tm.tm_sec);
+	/*
+	 * After executing an OAI request the resumption token is no longer
+	 * needed. A new resumption token will be loaded in case there are
+	 * still records left to be retrieved.
+	 */
+	(*state)->resumptionToken = NULL;
 
-	return s.data;
-}
+	if (!(*state)->xmldoc)
+		ereport(ERROR, (errmsg("invalid XML response from '%s'", (*state)->url)));
 
-static void deparseWhereClause(OAIFdwState *state, List *conditions)
-{
-	ListCell *cell;
+	xmlroot = xmlDocGetRootElement((*state)->xmldoc);
 
-	foreach (cell, conditions)
-	{
-		Expr *expr = (Expr *)lfirst(cell);
+	if (!xmlroot)
+		ereport(ERROR, (errmsg("empty XML document from '%s'", (*state)->url)));
 
-		/* extract WHERE clause from RestrictInfo */
-		if (IsA(expr, RestrictInfo))
+	for (oaipmh = xmlroot->children; oaipmh != NULL; oaipmh = oaipmh->next)
+	{
+		if (xmlStrcmp(oaipmh->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESPONSEDATE) == 0)
 		{
-			RestrictInfo *ri = (RestrictInfo *)expr;
-			expr = ri->clause;
-		}
+			xmlChar *responseDate = xmlNodeGetContent(oaipmh);
 
-		deparseExpr(expr, state);
+			(*state)->responseDate = responseDate ? pstrdup((char *)responseDate) : NULL;
+			xmlFree(responseDate);
+			break;
+		}
 	}
-}
 
-static void OAIFdwGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
-{
-	OAIFdwState *state = (OAIFdwState *)palloc0(sizeof(OAIFdwState));
-	state->foreign_table = GetForeignTable(foreigntableid);
-	state->foreign_server = GetForeignServer(state->foreign_table->serverid);
-	state->startup_cost = 10000.0;
-	/* estimate total cost as startup cost + 10 * (returned rows) */
-	state->total_cost = state->startup_cost + baserel->rows * 10.0;
+	if (strcmp((*state)->requestVerb, OAI_REQUEST_LISTIDENTIFIERS) == 0 ||
+		strcmp((*state)->requestVerb, OAI_REQUEST_LISTRECORDS) == 0 ||
+		strcmp((*state)->requestVerb, OAI_REQUEST_GETRECORD) == 0)
+	{
+		for (oaipmh = xmlroot->children; oaipmh != NULL; oaipmh = oaipmh->next)
+		{
+			if (xmlStrcmp(oaipmh->name, (xmlChar *)"error") == 0)
+			{
+				if ((*state)->checkpointPages > 0)
+					DiscardInvalidCheckpoint(*state, oaipmh);
+				RaiseOAIException(oaipmh);
+			}
+			else if (xmlStrcmp(oaipmh->name, (xmlChar *)(*state)->requestVerb) != 0)
+				continue;
 
-	baserel->fdw_private = state;
-}
+			for (ListRecordsRequest = oaipmh->children; ListRecordsRequest != NULL; ListRecordsRequest = ListRecordsRequest->next)
+			{
+				OAIRecord *oai;
 
-static void OAIFdwGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
-{
+				if (xmlStrcmp(ListRecordsRequest->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN) == 0)
+				{
+					xmlChar *tokenContent = xmlNodeGetContent(ListRecordsRequest);
 
-	struct OAIFdwState *state = (struct OAIFdwState *)baserel->fdw_private;
-	Path *path = (Path *)create_foreignscan_path(root, baserel,
-												 NULL,			/* default pathtarget */
-												 baserel->rows, /* rows */
-#if PG_VERSION_NUM >= 180000
-												 0, /* no parallel pathflags */
-#endif
-												 state->startup_cost, /* startup cost */
-												 state->total_cost,	  /* total cost */
-												 NIL,				  /* no pathkeys */
-												 NULL,				  /* no required outer relids */
-												 NULL,				  /* no fdw_outerpath */
-#if PG_VERSION_NUM >= 170000
-												 NIL,	/* no fdw_restrictinfo */
-#endif													/* PG_VERSION_NUM */
-												 NULL); /* no fdw_private */
-	add_path(baserel, path);
-}
+					(*state)->completeListSize = GetCompleteListSize(ListRecordsRequest);
 
-static ForeignScan *OAIFdwGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
-{
-	OAIFdwState *state = baserel->fdw_private;
-	List *fdw_private = NIL;
+					if (tokenContent && strlen((char *)tokenContent) != 0)
+					{
+						(*state)->resumptionToken = pstrdup((char *)tokenContent);
+						(*state)->tokenExpiration = GetTokenExpiration(ListRecordsRequest);
+						elog(DEBUG2, "  %s: (%s): Token detected in current page > %s", __func__, (*state)->requestVerb, (char *)tokenContent);
+					}
+					xmlFree(tokenContent);
+					continue;
+				}
 
-	InitSession(state, baserel);
+				oai = ExtractOAIRecord((*state)->xmldoc, ListRecordsRequest, (*state)->metadataPrefix);
 
-	scan_clauses = extract_actual_clauses(scan_clauses, false);
-	fdw_private = SerializePlanData(state);
+				if (!oai)
+					continue;
 
-	return make_foreignscan(tlist,
-							scan_clauses,
-							baserel->relid,
-							NIL,		 /* no expressions we will evaluate */
-							fdw_private, /* pass along our state */
-							NIL,		 /* no custom tlist; our scan tuple looks like tlist */
-							NIL,		 /* no quals we will recheck */
-							outer_plan);
+				elog(DEBUG2, "  %s (%s): Appending record list -> %s", __func__, (*state)->requestVerb, oai->identifier);
+
+				(*state)->records = lappend((*state)->records, oai);
+				(*state)->pagesize++;
+				(*state)->recordsSeen++;
+
+				if (oai->isDeleted)
+					(*state)->deletedSeen++;
+			}
+		}
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	(*state)->extractTime += INSTR_TIME_GET_MILLISEC(duration);
 }
 
-static void OAIFdwBeginForeignScan(ForeignScanState *node, int eflags)
+static void LoadOAIRecords(struct OAIFdwState **state)
 {
-	ForeignScan *fs = (ForeignScan *)node->ss.ps.plan;
-	struct OAIFdwState *state = DeserializePlanData(fs->fdw_private);
+	bool replayed = false;
+	int result;
 
-	node->fdw_state = (void *)state;
-
-	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-		return;
+	elog(DEBUG2, "%s called.", __func__);
 
-	state->foreign_table = GetForeignTable(state->foreigntableid);
-	state->foreign_server = GetForeignServer(state->foreign_table->serverid);
-	LoadOAIUserMapping(state); /* restores user/password/proxy creds */
+	/* Sets the page size and index to zero.*/
+	(*state)->pagesize = 0;
+	(*state)->pageindex = 0;
+	(*state)->tokenExpiration = 0;
+	/* Removes all retrieved records, if any.*/
+	(*state)->records = NIL;
 
-	state->oaicxt = AllocSetContextCreate(CurrentMemoryContext,
-										  "oai_fdw_ctx",
-										  ALLOCSET_DEFAULT_SIZES);
-}
+	if ((*state)->resumeFromCheckpoint && !(*state)->checkpointKey)
+		OpenCheckpoint(*state);
 
-static OAIRecord *FetchNextOAIRecord(OAIFdwState **state)
-{
-	if ((*state)->pageindex == (*state)->pagesize)
+	/*
+	 * Pages stored in a checkpoint are replayed from disk, the harvest
+	 * continues with the repository afterwards.
+	 */
+	if ((*state)->checkpointPending > 0)
 	{
-		elog(DEBUG3, "%s: EOF > %d/%d", __func__, (*state)->pageindex, (*state)->pagesize);
-		return NULL;
+		result = ReadCheckpointPage(*state);
+		replayed = true;
 	}
 	else
-	{
-		OAIRecord *record;
-		ListCell *cell;
+		result = ExecuteOAIRequest(*state);
 
-		cell = list_nth_cell((*state)->records, (*state)->pageindex);
-		record = (OAIRecord *)lfirst(cell);
+	if (result == OAI_SUCCESS)
+	{
+		ParseOAIRecords(state);
 
-		(*state)->rowcount++;
-		(*state)->pageindex++;
+		/*
+		 * The last page is not stored: once it has been retrieved, there is
+		 * nothing left to resume.
+		 */
+		if (replayed)
+			(*state)->resumedRows += (*state)->pagesize;
+		else if ((*state)->resumeFromCheckpoint && (*state)->resumptionToken)
+			WriteCheckpoint(*state);
 
-		return record;
+		(*state)->pagesLoaded++;
+		ReportScanProgress(*state);
 	}
+
+	if ((*state)->xmldoc)
+		xmlFreeDoc((*state)->xmldoc);
 }
 
-static void CreateOAITuple(TupleTableSlot *slot, OAIFdwState *state, OAIRecord *oai)
+/*
+ * LoadFederatedRecords
+ * --------------------
+ * Loads the next records of a federated scan into state->records. The
+ * servers of the scan are harvested at the same time over the request
+ * engine, up to max_concurrent_servers of them, each one page after the
+ * other. Every server keeps its own options: its request limits, retries
+ * and response cache apply to its requests as in a scan of its own. The
+ * records of the pages that arrived first are returned while the other
+ * requests proceed.
+ *
+ * state : the scan state
+ */
+static void LoadFederatedRecords(OAIFdwState *state)
 {
-	elog(DEBUG2, "%s called", __func__);
+	OAIFederation *federation = state->federation;
 
-	for (int i = 0; i < state->numcols; i++)
+	elog(DEBUG2, "%s called.", __func__);
+
+	state->records = NIL;
+	state->pagesize = 0;
+	state->pageindex = 0;
+
+	if (!federation)
+		federation = state->federation = BeginFederation(state);
+
+	while (state->pagesize == 0 && federation->remaining > 0)
 	{
-		Oid pgtype = state->oaiTable->cols[i]->pgtype;
-		char *oai_node = state->oaiTable->cols[i]->oai_node;
-		char *colname = state->oaiTable->cols[i]->name;
-		int pgtypmod = state->oaiTable->cols[i]->pgtypmod;
+		long wait_ms = -1;
 
-		if (oai_node)
-		{
-			slot->tts_isnull[i] = false;
+		CHECK_FOR_INTERRUPTS();
 
-			if (strcmp(oai_node, OAI_NODE_STATUS) == 0)
-				slot->tts_values[i] = BoolGetDatum(oai->isDeleted);
-			else if (strcmp(oai_node, OAI_NODE_IDENTIFIER) == 0)
-			{
-				if (oai->identifier)
-					slot->tts_values[i] = CStringGetTextDatum(oai->identifier);
-				else
-					slot->tts_isnull[i] = true;
-			}
-			else if (strcmp(oai_node, OAI_NODE_METADATAPREFIX) == 0)
-			{
-				if (oai->metadataPrefix)
-					slot->tts_values[i] = CStringGetTextDatum(oai->metadataPrefix);
-				else
-					slot->tts_isnull[i] = true;
-			}
-			else if (strcmp(oai_node, OAI_NODE_CONTENT) == 0)
-			{
-				if (oai->content)
-					slot->tts_values[i] = CStringGetTextDatum((char *)oai->content);
-				else
-					slot->tts_isnull[i] = true;
-			}
-			else if (strcmp(oai_node, OAI_NODE_SETSPEC) == 0)
-			{
-				if (oai->setsArray)
-					slot->tts_values[i] = PointerGetDatum(oai->setsArray);
-				else
-					slot->tts_isnull[i] = true;
-			}
-			else if (strcmp(oai_node, OAI_NODE_DATESTAMP) == 0)
-			{
-				if (oai->datestamp)
-				{
-					HeapTuple tuple;
-					regproc typinput;
-					Datum datum;
+		/* pages that arrived while the records of the last one were returned */
+		for (int i = 0; i < federation->nendpoints; i++)
+			if (federation->endpoints[i].transfer.result.finished)
+				EndFederatedRequest(state, federation, &federation->endpoints[i]);
 
-					datum = CStringGetDatum(oai->datestamp);
-					/* find the appropriate conversion function */
-					tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(pgtype));
+		if (state->pagesize > 0)
+			break;
 
-					if (!HeapTupleIsValid(tuple))
-						ereport(ERROR,
-								(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
-								 errmsg("cache lookup failed for type %u > column '%s'", pgtype, colname)));
+		StartFederatedRequests(state, federation, &wait_ms);
 
-					typinput = ((Form_pg_type)GETSTRUCT(tuple))->typinput;
-					ReleaseSysCache(tuple);
+		/* pages served from the cache need no waiting */
+		if (state->pagesize > 0)
+			break;
+		else if (federation->running == 0 && wait_ms < 0)
+			continue;
 
-					slot->tts_values[i] = OidFunctionCall3(
-						typinput,
-						datum,
-						ObjectIdGetDatum(InvalidOid),
-						Int32GetDatum(pgtypmod));
-				}
-				else
-					slot->tts_isnull[i] = true;
-			}
-			else
-				slot->tts_isnull[i] = true;
-		}
-		else
-		{
-			slot->tts_isnull[i] = true;
-			slot->tts_values[i] = PointerGetDatum(NULL);
-		}
+		/*
+		 * Waits for the transfers in progress, or with nothing in progress
+		 * for the server limits or a backoff.
+		 */
+		RunRequestEngine(wait_ms, GetOAIWaitEvent(federation->running > 0 ? OAI_WAIT_EVENT_RESPONSE : OAI_WAIT_EVENT_RATE_LIMIT));
+	}
+
+	/*
+	 * Servers whose page arrived are requested again while the records are
+	 * returned; their transfers proceed whenever the request engine runs.
+	 */
+	if (state->pagesize > 0 && federation->remaining > 0)
+	{
+		long wait_ms = -1;
+
+		StartFederatedRequests(state, federation, &wait_ms);
+
+		if (federation->running > 0)
+			RunRequestEngine(0, GetOAIWaitEvent(OAI_WAIT_EVENT_RESPONSE));
 	}
+
+	CollectFederatedCounters(state);
+
+	elog(DEBUG2, "%s => %d records, %d of %d servers left", __func__,
+		 state->pagesize, federation->remaining, federation->nendpoints);
 }
 
-static void OAIExplainForeignScan(ForeignScanState *node, ExplainState *es)
+/*
+ * BeginFederation
+ * ---------------
+ * Prepares the requests of a federated scan in the current memory
+ * context, which must be the one of the scan: each server gets a request
+ * state with the options of its FOREIGN SERVER and USER MAPPING and the
+ * request planned for the table. The transfers are ended when the memory
+ * context is reset or deleted, also on error.
+ *
+ * state : the scan state
+ *
+ * returns the requests of the scan
+ */
+static OAIFederation *BeginFederation(OAIFdwState *state)
 {
-	OAIFdwState *state = (OAIFdwState *)node->fdw_state;
+	OAIFederation *federation = (OAIFederation *)palloc0(sizeof(OAIFederation));
+	MemoryContextCallback *callback;
+	ListCell *cell;
 
-	if (state)
+	federation->endpoints = (OAIEndpoint *)palloc0(list_length(state->servers) * sizeof(OAIEndpoint));
+
+	foreach (cell, state->servers)
 	{
-		if (state->foreign_server && strlen(state->foreign_server->servername) > 0)
-			ExplainPropertyText("Foreign Server", state->foreign_server->servername, es);
+		OAIFdwState *endpoint = (OAIFdwState *)palloc0(sizeof(OAIFdwState));
 
-		if (state->url && strlen(state->url) > 0)
-			ExplainPropertyText("Foreign Server URL", state->url, es);
+		endpoint->foreign_table = state->foreign_table;
+		endpoint->foreign_server = GetForeignServerByName((char *)lfirst(cell), false);
+		endpoint->foreigntableid = state->foreigntableid;
 
-		if (state->requestVerb && strlen(state->requestVerb) > 0)
-			ExplainPropertyText("requestVerb", state->requestVerb, es);
+		LoadOAIServerInfo(endpoint);
+		LoadOAIUserMapping(endpoint);
 
-		if (state->set && strlen(state->set) > 0)
-			ExplainPropertyText("setSpec", state->set, es);
+		/* the request planned for the table overrides the server defaults */
+		endpoint->requestVerb = state->requestVerb;
+		endpoint->metadataPrefix = state->metadataPrefix;
+		endpoint->identifier = state->identifier;
+		endpoint->set = state->set;
+		endpoint->from = state->from;
+		endpoint->until = state->until;
 
-		if (state->metadataPrefix && strlen(state->metadataPrefix) > 0)
-			ExplainPropertyText("metadataPrefix", state->metadataPrefix, es);
+		federation->endpoints[federation->nendpoints++].state = endpoint;
+	}
 
-		if (state->from && strlen(state->from) > 0)
-			ExplainPropertyText("from", state->from, es);
+	federation->remaining = federation->nendpoints;
 
-		if (state->until && strlen(state->until) > 0)
-			ExplainPropertyText("until", state->until, es);
-	}
+	callback = (MemoryContextCallback *)palloc0(sizeof(MemoryContextCallback));
+	callback->func = EndFederation;
+	callback->arg = federation;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	return federation;
+}
+
+/*
+ * EndFederation
+ * -------------
+ * Ends the transfers of a federated scan and gives back their concurrency
+ * slots. Called when the memory context of the scan is reset or deleted.
+ *
+ * arg : the requests of the scan
+ */
+static void EndFederation(void *arg)
+{
+	OAIFederation *federation = (OAIFederation *)arg;
+
+	for (int i = 0; i < federation->nendpoints; i++)
+		EndTransfer(&federation->endpoints[i].transfer);
 }
 
-static TupleTableSlot *OAIFdwIterateForeignScan(ForeignScanState *node)
+/*
+ * StartFederatedRequests
+ * ----------------------
+ * Requests the next page of the servers of a federated scan that have no
+ * request in progress, as far as max_concurrent_servers and the request
+ * limits of each server allow. Pages found in the response cache of a
+ * server are added to the records of the scan at once.
+ *
+ * state      : the scan state
+ * federation : the requests of the scan
+ * wait_ms    : lowered to the time after which a server that had to wait
+ *              may be requested, -1 if none has to wait
+ */
+static void StartFederatedRequests(OAIFdwState *state, OAIFederation *federation, long *wait_ms)
 {
+	int limit = state->maxConcurrentServers > 0 ? state->maxConcurrentServers : federation->nendpoints;
+	int first = federation->next;
 
-	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-	struct OAIFdwState *state = (struct OAIFdwState *)node->fdw_state;
-	OAIRecord *record;
-	MemoryContext old_cxt;
-
-	elog(DEBUG2, "%s called.", __func__);
+	for (int i = 0; i < federation->nendpoints && federation->running < limit; i++)
+	{
+		int index = (first + i) % federation->nendpoints;
+		OAIEndpoint *endpoint = &federation->endpoints[index];
+		OAIFdwState *server = endpoint->state;
+		OAITransfer *transfer = &endpoint->transfer;
+		TimestampTz now = GetCurrentTimestamp();
+		StringInfoData request;
+		long slot_wait;
+		int held = OAIHeldSlots;
+
+		if (endpoint->done || transfer->curl)
+			continue;
+
+		if (endpoint->notBefore > now)
+		{
+			long remaining = (long)((endpoint->notBefore - now) / 1000) + 1;
 
-	ExecClearTuple(slot);
+			*wait_ms = *wait_ms < 0 ? remaining : Min(*wait_ms, remaining);
+			continue;
+		}
 
-	/* Returns an empty tuple in case there is no mapping for OAI nodes and columns */
-	if (state->numfdwcols == 0)
-		return slot;
+		transfer->curl = curl_easy_init();
 
-	old_cxt = MemoryContextSwitchTo(state->oaicxt);
+		if (!transfer->curl)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+					 errmsg("%s: failed to initialize curl", __func__)));
 
-	/*
-	 * Load OAI records in case that this function is called for the first time
-	 * or a page contains a resumption token and the index reached the end of
-	 * the page.
-	 */
-	if (state->rowcount == 0 || (state->resumptionToken && state->pageindex == state->pagesize))
-		LoadOAIRecords(&state);
+		initStringInfo(&request);
+		(void)BuildOAIRequest(server, transfer->curl, &request);
 
-	record = FetchNextOAIRecord(&state);
+		if (server->cacheTtl > 0)
+		{
+			size_t cached_size;
+			char *cached = ReadCachedResponse(server, request.data, &cached_size);
 
-	MemoryContextSwitchTo(old_cxt);
+			if (cached)
+			{
+				elog(DEBUG1, "GET \"%s?%s\" (cached)", server->url, request.data);
 
-	if (record != NULL)
-	{
-		MemoryContext per_tuple = node->ss.ps.ps_ExprContext->ecxt_per_tuple_memory;
-		MemoryContext old = MemoryContextSwitchTo(per_tuple);
+				curl_easy_cleanup(transfer->curl);
+				transfer->curl = NULL;
 
-		elog(DEBUG2, "  %s: creating OAI tuple", __func__);
-		CreateOAITuple(slot, state, record);
-		MemoryContextSwitchTo(old);
+				server->xmldoc = ReadOAIDocument(server, cached, cached_size);
+				pfree(cached);
+				pfree(request.data);
 
-		elog(DEBUG2, "  %s: storing virtual tuple", __func__);
-		ExecStoreVirtualTuple(slot);
-		pfree(record);
-	}
+				AddFederatedPage(state, federation, endpoint);
+				continue;
+			}
+		}
 
-	elog(DEBUG3, "%s => returning tuple (rowcount: %d)", __func__, state->rowcount);
+		if (!TryAcquireRequestSlot(server, &slot_wait))
+		{
+			slot_wait = Max(slot_wait, 1);
+			*wait_ms = *wait_ms < 0 ? slot_wait : Min(*wait_ms, slot_wait);
 
-	return slot;
-}
+			curl_easy_cleanup(transfer->curl);
+			transfer->curl = NULL;
+			pfree(request.data);
+			continue;
+		}
 
-static void RaiseOAIException(xmlNodePtr error)
-{
-	xmlChar *code = xmlGetProp(error, (xmlChar *)"code");
-	xmlChar *cont = xmlNodeGetContent(error);
-	char *ccode;
-	char *ccont;
+		transfer->holdsSlot = OAIHeldSlots > held;
+		transfer->serverid = server->foreign_server->serverid;
+		transfer->request = request.data;
+		transfer->body.memory = palloc(1);
+		transfer->body.size = 0;
+		transfer->header.memory = palloc(1);
+		transfer->header.size = 0;
+		transfer->errbuf[0] = '\0';
 
-	/* Guard the RAW pointers before any string op */
-	if (!code)
-	{
-		if (cont)
-			xmlFree(cont);
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
-				 errmsg("invalid OAI error response: missing 'code' attribute")));
-	}
+		SetOAIRequestOptions(server, transfer->curl, transfer->request,
+							 &transfer->body, &transfer->header,
+							 transfer->errbuf, &transfer->headers);
 
-	ccode = pstrdup((char *)code);
-	ccont = cont ? pstrdup((char *)cont) : pstrdup("");
+		elog(DEBUG1, "GET \"%s?%s\"", server->url, transfer->request);
 
-	xmlFree(code);
-	if (cont)
-		xmlFree(cont);
+		AddEngineTransfer(transfer->curl, SetTransferResult, &transfer->result);
+		federation->running++;
 
-	if (strcmp(ccode, OAI_ERROR_ID_DOES_NOT_EXIST) == 0 ||
-		strcmp(ccode, OAI_ERROR_NO_RECORD_MATCH) == 0)
-		ereport(WARNING,
-				(errcode(ERRCODE_NO_DATA_FOUND),
-				 errmsg("OAI %s: %s", ccode, ccont)));
-	else
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
-				 errmsg("OAI %s: %s", ccode, ccont)));
+		/* the next round starts with the servers after this one */
+		federation->next = (index + 1) % federation->nendpoints;
+	}
 }
 
-static void LoadOAIRecords(struct OAIFdwState **state)
+/*
+ * EndFederatedRequest
+ * -------------------
+ * Handles a finished page request of a federated scan. Transient failures
+ * are retried after a backoff, other failures raise an error; the records
+ * of a page are added to the records of the scan.
+ *
+ * state      : the scan state
+ * federation : the requests of the scan
+ * endpoint   : the server whose request finished
+ */
+static void EndFederatedRequest(OAIFdwState *state, OAIFederation *federation, OAIEndpoint *endpoint)
 {
-	xmlNodePtr xmlroot;
-	xmlNodePtr oaipmh;
-	xmlNodePtr headerElements;
-	xmlNodePtr ListRecordsRequest;
+	OAIFdwState *server = endpoint->state;
+	OAITransfer *transfer = &endpoint->transfer;
+	CURLcode res = transfer->result.code;
+	long maxretries = server->maxretries ? server->maxretries : OAI_DEFAULT_MAX_RETRY;
+	long response_code = 0;
+	double parse_ms;
 
-	elog(DEBUG2, "%s called.", __func__);
+	curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &response_code);
+	CountOAITransfer(server, transfer->curl, res, transfer->body.size);
 
-	/* Sets the page size and index to zero.*/
-	(*state)->pagesize = 0;
-	(*state)->pageindex = 0;
-	/* Removes all retrieved records, if any.*/
-	(*state)->records = NIL;
+	if (IsTransientFailure(transfer->curl, res, response_code) && endpoint->attempt < maxretries)
+	{
+		long delay = GetRetryDelay(transfer->header.memory, ++endpoint->attempt);
+
+		elog(WARNING, "request to '%s' failed (%ld/%ld)",
+			 server->foreign_server->servername, endpoint->attempt, maxretries);
 
-	if (ExecuteOAIRequest(*state) == OAI_SUCCESS)
+		endpoint->notBefore = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), delay);
+		CountOAIRetry(server, delay);
+
+		EndTransfer(transfer);
+		federation->running--;
+		return;
+	}
+
+	if (res != CURLE_OK || response_code >= 400)
 	{
-		/*
-		 * After executing an OAI request the resumption token is no longer
-		 * needed. A new resumption token will be loaded in case there are
-		 * still records left to be retrieved.
-		 */
-		(*state)->resumptionToken = NULL;
+		char *request = pstrdup(transfer->request);
+		char *reason = res != CURLE_OK ? pstrdup(transfer->errbuf[0] ? transfer->errbuf : curl_easy_strerror(res)) : NULL;
 
-		if (!(*state)->xmldoc)
-			ereport(ERROR, (errmsg("invalid XML response from '%s'", (*state)->url)));
+		LogOAIRequest(server, transfer->curl, request, NULL, endpoint->attempt + 1, 0);
+		EndTransfer(transfer);
+		federation->running--;
 
-		xmlroot = xmlDocGetRootElement((*state)->xmldoc);
+		if (reason)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					 errmsg("OAI request to server '%s' failed: %s",
+							server->foreign_server->servername, reason),
+					 errhint("Check your request parameters and try again."),
+					 errdetail("URL: \"%s\"", request)));
 
-		if (!xmlroot)
-			ereport(ERROR, (errmsg("empty XML document from '%s'", (*state)->url)));
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("OAI request to server '%s' failed: HTTP %ld",
+						server->foreign_server->servername, response_code),
+				 errhint("Check your request parameters and try again."),
+				 errdetail("URL: \"%s\"", request)));
+	}
 
-		if (strcmp((*state)->requestVerb, OAI_REQUEST_LISTIDENTIFIERS) == 0)
-		{
-			for (oaipmh = xmlroot->children; oaipmh != NULL; oaipmh = oaipmh->next)
-			{
-				if (xmlStrcmp(oaipmh->name, (xmlChar *)"error") == 0)
-					RaiseOAIException(oaipmh);
-				else if (xmlStrcmp(oaipmh->name, (xmlChar *)(*state)->requestVerb) != 0)
-					continue;
+	elog(DEBUG1, "HTTP %ld, %ld bytes", response_code, transfer->body.size);
 
-				for (ListRecordsRequest = oaipmh->children; ListRecordsRequest != NULL; ListRecordsRequest = ListRecordsRequest->next)
-				{
+	parse_ms = server->parseTime;
+	server->xmldoc = ReadOAIDocument(server, transfer->body.memory, transfer->body.size);
+	LogOAIRequest(server, transfer->curl, transfer->request, server->xmldoc,
+				  endpoint->attempt + 1, server->parseTime - parse_ms);
 
-					if (xmlStrcmp(ListRecordsRequest->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN) == 0)
-					{
-						xmlChar *tokenContent = xmlNodeGetContent(ListRecordsRequest);
-						if (tokenContent && strlen((char *)tokenContent) != 0)
-						{
-							(*state)->resumptionToken = pstrdup((char *)tokenContent);
-							elog(DEBUG2, "  %s: (%s): Token detected in current page > %s", __func__, (*state)->requestVerb, (char *)tokenContent);
-						}
-						xmlFree(tokenContent);
-					}
-					else if (xmlStrcmp(ListRecordsRequest->name, (xmlChar *)OAI_RESPONSE_ELEMENT_HEADER) == 0)
-					{
+	if (server->cacheTtl > 0 && IsCacheableResponse(server->xmldoc))
+		WriteCachedResponse(server, transfer->request, transfer->body.memory, transfer->body.size);
 
-						OAIRecord *oai = (OAIRecord *)palloc0(sizeof(OAIRecord));
-						xmlChar *status;
+	EndTransfer(transfer);
+	federation->running--;
+	endpoint->attempt = 0;
 
-						oai->setsArray = NULL;
-						oai->isDeleted = false;
-						oai->metadataPrefix = pstrdup((*state)->metadataPrefix);
-						status = xmlGetProp(ListRecordsRequest, (xmlChar *)OAI_NODE_STATUS);
+	AddFederatedPage(state, federation, endpoint);
+}
 
-						if (status)
-						{
-							if (xmlStrcmp(status, (xmlChar *)OAI_RESPONSE_ELEMENT_DELETED) == 0)
-								oai->isDeleted = true;
-							xmlFree(status);
-						}
+/*
+ * AddFederatedPage
+ * ----------------
+ * Extracts the records of a page retrieved from a server of a federated
+ * scan, tags them with the name of the server and appends them to the
+ * records of the scan. A page without resumptionToken was the last one of
+ * its server.
+ *
+ * state      : the scan state
+ * federation : the requests of the scan
+ * endpoint   : the server the page was retrieved from, with its document
+ */
+static void AddFederatedPage(OAIFdwState *state, OAIFederation *federation, OAIEndpoint *endpoint)
+{
+	OAIFdwState *server = endpoint->state;
+	ErrorContextCallback errcallback;
+	ListCell *cell;
 
-						for (headerElements = ListRecordsRequest->children; headerElements != NULL; headerElements = headerElements->next)
-						{
+	server->records = NIL;
+	server->pagesize = 0;
 
-							xmlBufferPtr buffer = xmlBufferCreate();
-							xmlNodeDump(buffer, (*state)->xmldoc, headerElements->children, 0, 0);
+	/* OAI errors and warnings name the server they come from */
+	errcallback.callback = FederatedPageErrorCallback;
+	errcallback.arg = server->foreign_server->servername;
+	errcallback.previous = error_context_stack;
+	error_context_stack = &errcallback;
 
-							if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_IDENTIFIER) == 0)
-								oai->identifier = pstrdup((char *)buffer->content);
-							else if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETSPEC) == 0)
-							{
-								char *array_element = pstrdup((char *)buffer->content);
-								appendTextArray(&oai->setsArray, array_element);
-							}
-							else if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_DATESTAMP) == 0)
-								oai->datestamp = pstrdup((char *)buffer->content);
+	ParseOAIRecords(&server);
 
-							xmlBufferFree(buffer);
-						}
+	error_context_stack = errcallback.previous;
 
-						elog(DEBUG2, "  %s (%s): Appending record list -> %s", __func__, (*state)->requestVerb, oai->identifier);
+	if (server->xmldoc)
+		xmlFreeDoc(server->xmldoc);
+	server->xmldoc = NULL;
 
-						(*state)->records = lappend((*state)->records, oai);
-						(*state)->pagesize++;
-					}
-				}
-			}
-		}
-		else if (strcmp((*state)->requestVerb, OAI_REQUEST_LISTRECORDS) == 0 || strcmp((*state)->requestVerb, OAI_REQUEST_GETRECORD) == 0)
-		{
+	foreach (cell, server->records)
+	{
+		OAIRecord *record = (OAIRecord *)lfirst(cell);
 
-			for (oaipmh = xmlroot->children; oaipmh != NULL; oaipmh = oaipmh->next)
-			{
+		record->server = server->foreign_server->servername;
+		state->records = lappend(state->records, record);
+	}
 
-				if (xmlStrcmp(oaipmh->name, (xmlChar *)"error") == 0)
-					RaiseOAIException(oaipmh);
-				else if (xmlStrcmp(oaipmh->name, (xmlChar *)(*state)->requestVerb) != 0)
-					continue;
+	state->pagesize += server->pagesize;
+	list_free(server->records);
+	server->records = NIL;
 
-				for (ListRecordsRequest = oaipmh->children; ListRecordsRequest != NULL; ListRecordsRequest = ListRecordsRequest->next)
-				{
+	if (!server->resumptionToken)
+	{
+		endpoint->done = true;
+		federation->remaining--;
+	}
 
-					if (xmlStrcmp(ListRecordsRequest->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RESUMPTIONTOKEN) == 0)
-					{
-						xmlChar *tokenContent = xmlNodeGetContent(ListRecordsRequest);
-						if (tokenContent && strlen((char *)tokenContent) != 0)
-							(*state)->resumptionToken = pstrdup((char *)tokenContent);
-						xmlFree(tokenContent);
-					}
-					else if (xmlStrcmp(ListRecordsRequest->name, (xmlChar *)OAI_RESPONSE_ELEMENT_RECORD) == 0)
-					{
-						OAIRecord *oai = (OAIRecord *)palloc0(sizeof(OAIRecord));
-						xmlNodePtr record;
+	state->pagesLoaded++;
+	CollectFederatedCounters(state);
+	ReportScanProgress(state);
+}
 
-						oai->metadataPrefix = pstrdup((*state)->metadataPrefix);
-						oai->isDeleted = false;
-						oai->setsArray = NULL;
+/*
+ * FederatedPageErrorCallback
+ * --------------------------
+ * Error context of the pages of a federated scan.
+ *
+ * arg : name of the foreign server
+ */
+static void FederatedPageErrorCallback(void *arg)
+{
+	errcontext("OAI response of server \"%s\"", (char *)arg);
+}
 
-						for (record = ListRecordsRequest->children; record != NULL; record = record->next)
-						{
+/*
+ * CollectFederatedCounters
+ * ------------------------
+ * Moves the counters of the servers of a federated scan, shown by EXPLAIN
+ * ANALYZE and oai_fdw_progress, into the scan state. The completeListSize
+ * of the scan is the sum of the ones the servers announced.
+ *
+ * state : the scan state
+ */
+static void CollectFederatedCounters(OAIFdwState *state)
+{
+	OAIFederation *federation = state->federation;
 
-							if (xmlStrcmp(record->name, (xmlChar *)OAI_RESPONSE_ELEMENT_METADATA) == 0)
-							{
-
-								/* Copy necessary to include the namespaces in the buffer output */
-								xmlNodePtr copy = xmlCopyNode(record->children, 1);
-
-								xmlBufferPtr buffer = xmlBufferCreate();
-								xmlNodeDump(buffer, (*state)->xmldoc, copy, 0, 1);
-
-								elog(DEBUG2, "  %s (%s): XML Buffer size: %d", __func__, (*state)->requestVerb, buffer->size);
-
-								oai->content = pstrdup((char *)buffer->content);
-
-								elog(DEBUG2, "  %s (%s): freeing node copy.", __func__, (*state)->requestVerb);
-								xmlFreeNode(copy);
-								elog(DEBUG2, "  %s (%s): freeing xml content buffer.", __func__, (*state)->requestVerb);
-								xmlBufferFree(buffer);
-							}
-
-							if (xmlStrcmp(record->name, (xmlChar *)OAI_RESPONSE_ELEMENT_HEADER) == 0)
-							{
-
-								xmlChar *status = xmlGetProp(record, (xmlChar *)OAI_NODE_STATUS);
-								if (status)
-								{
-									if (xmlStrcmp(status, (xmlChar *)OAI_RESPONSE_ELEMENT_DELETED) == 0)
-										oai->isDeleted = true;
-									xmlFree(status);
-								}
-
-								for (headerElements = record->children; headerElements != NULL; headerElements = headerElements->next)
-								{
-
-									xmlBufferPtr buffer = xmlBufferCreate();
-									xmlNodeDump(buffer, (*state)->xmldoc, headerElements->children, 0, 0);
-
-									if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_IDENTIFIER) == 0)
-									{
-										oai->identifier = pstrdup((char *)buffer->content);
-										elog(DEBUG2, "  %s (%s): setting identifier to OAI object > '%s'", __func__, (*state)->requestVerb, oai->identifier);
-									}
-									else if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_SETSPEC) == 0)
-									{
-										char *array_element = pstrdup((char *)buffer->content);
-										elog(DEBUG2, "  %s (%s): setting setspec to OAI object > '%s'", __func__, (*state)->requestVerb, array_element);
-
-										appendTextArray(&oai->setsArray, array_element);
-									}
-									else if (xmlStrcmp(headerElements->name, (xmlChar *)OAI_RESPONSE_ELEMENT_DATESTAMP) == 0)
-									{
-										oai->datestamp = pstrdup((char *)buffer->content);
-										elog(DEBUG2, "  %s (%s): setting datestamp to OAI object > '%s'", __func__, (*state)->requestVerb, oai->datestamp);
-									}
-
-									elog(DEBUG3, "  %s (%s): freeing header buffer.", __func__, (*state)->requestVerb);
-									xmlBufferFree(buffer);
-								}
-							}
-						}
+	state->completeListSize = 0;
 
-						(*state)->records = lappend((*state)->records, oai);
-						(*state)->pagesize++;
-					}
-				}
-			}
-		}
+	for (int i = 0; i < federation->nendpoints; i++)
+	{
+		OAIFdwState *server = federation->endpoints[i].state;
+
+		state->httpRequests += server->httpRequests;
+		state->httpRetries += server->httpRetries;
+		state->backoffTime += server->backoffTime;
+		state->bytesReceived += server->bytesReceived;
+		state->bytesDecompressed += server->bytesDecompressed;
+		state->peakPageSize = Max(state->peakPageSize, server->peakPageSize);
+		state->dnsTime += server->dnsTime;
+		state->connectTime += server->connectTime;
+		state->firstByteTime += server->firstByteTime;
+		state->transferTime += server->transferTime;
+		state->parseTime += server->parseTime;
+		state->extractTime += server->extractTime;
+		state->recordsSeen += server->recordsSeen;
+		state->deletedSeen += server->deletedSeen;
+		state->completeListSize += server->completeListSize;
+
+		server->httpRequests = 0;
+		server->httpRetries = 0;
+		server->backoffTime = 0;
+		server->bytesReceived = 0;
+		server->bytesDecompressed = 0;
+		server->dnsTime = 0;
+		server->connectTime = 0;
+		server->firstByteTime = 0;
+		server->transferTime = 0;
+		server->parseTime = 0;
+		server->extractTime = 0;
+		server->recordsSeen = 0;
+		server->deletedSeen = 0;
 	}
-
-	if ((*state)->xmldoc)
-		xmlFreeDoc((*state)->xmldoc);
 }
 
 static void appendTextArray(ArrayType **array, char *text_element)
@@ -2680,15 +10165,51 @@ static void OAIFdwReScanForeignScan(ForeignScanState *node)
 	if (!state)
 		return;
 
+	/*
+	 * The OAI request is entirely built at planning time from constants,
+	 * and no fdw_exprs are ever passed to the executor (see
+	 * OAIFdwGetForeignPlan). Changed parameters therefore only affect the
+	 * quals, which are evaluated locally for each tuple, and never
+	 * invalidate the stored tuples of the previous pass.
+	 */
+	if (state->rescanstore)
+	{
+		elog(DEBUG2, "%s: replaying %d stored tuples", __func__, state->rowcount);
+		tuplestore_rescan(state->rescanstore);
+		state->rescanreplay = true;
+		return;
+	}
+
+	/* also ends the transfers of a federated scan, see EndFederation */
 	if (state->oaicxt)
 		MemoryContextReset(state->oaicxt);
 
+	state->federation = NULL;
 	state->rowcount = 0;
 	state->pageindex = 0;
 	state->pagesize = 0;
 	state->records = NIL;
 	state->resumptionToken = NULL;
 	state->xmldoc = NULL;
+	state->eof = false;
+	state->rescanreplay = false;
+
+	/* the next pass may issue a different request */
+	if (state->checkpointKey)
+	{
+		RemoveCheckpoint(state);
+		state->checkpointKey = NULL;
+	}
+
+	/*
+	 * This scan was not expected to be rescanned. Store the tuples of the
+	 * next pass, so that further rescans can be served without network
+	 * traffic.
+	 */
+	if (state->rescanstore)
+		tuplestore_clear(state->rescanstore);
+	else
+		InitRescanStore(node, state);
 }
 
 static void OAIFdwEndForeignScan(ForeignScanState *node)
@@ -2697,12 +10218,26 @@ static void OAIFdwEndForeignScan(ForeignScanState *node)
 	if (!state)
 		return;
 
+	/* the scan succeeded, its checkpoint is no longer needed */
+	if (state->checkpointKey)
+		RemoveCheckpoint(state);
+
+	EndScanProgress(state);
+
 	if (state->oaicxt)
 	{
 		MemoryContextDelete(state->oaicxt);
 		state->oaicxt = NULL;
 	}
 
+	if (state->rescanstore)
+	{
+		tuplestore_end(state->rescanstore);
+		ExecDropSingleTupleTableSlot(state->rescanslot);
+		state->rescanstore = NULL;
+		state->rescanslot = NULL;
+	}
+
 	elog(DEBUG2, "%s exit oai_fdw: so long .. \n", __func__);
 }
 
@@ -2715,12 +10250,12 @@ static List *OAIFdwImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid server
 	bool format_set = false;
 	OAIFdwState *state;
 	ForeignServer *server = GetForeignServer(serverOid);
+	List *formats = NIL;
+	bool formats_loaded = false;
 
 	elog(DEBUG2, "%s called: '%s'", __func__, server->servername);
 	state = GetServerInfo(server->servername);
 
-	all_sets = GetSets(state);
-
 	elog(DEBUG2, "  %s: parsing statements", __func__);
 
 	foreach (cell, stmt->options)
@@ -2729,9 +10264,13 @@ static List *OAIFdwImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid server
 		if (strcmp(def->defname, OAI_NODE_METADATAPREFIX) == 0)
 		{
 			ListCell *cell_formats;
-			List *formats = NIL;
 			bool found = false;
-			formats = GetMetadataFormats(state);
+
+			if (!formats_loaded)
+			{
+				formats = GetMetadataFormats(state);
+				formats_loaded = true;
+			}
 
 			foreach (cell_formats, formats)
 			{
@@ -2767,6 +10306,10 @@ static List *OAIFdwImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid server
 	{
 		List *tables = NIL;
 
+		/* LIMIT TO names the sets explicitly, no need to ask the repository */
+		if (stmt->list_type != FDW_IMPORT_SCHEMA_LIMIT_TO)
+			all_sets = GetSets(state);
+
 		if (stmt->list_type == FDW_IMPORT_SCHEMA_LIMIT_TO)
 		{
 			ListCell *cell_limit_to;
@@ -3056,7 +10599,96 @@ static void LoadOAITableInfo(OAIFdwState *state)
 			state->until = defGetString(def);
 		else if (strcmp(OAI_NODE_SETSPEC, def->defname) == 0)
 			state->set = defGetString(def);
+		else if (strcmp(OAI_TABLE_OPTION_RESUME_FROM_CHECKPOINT, def->defname) == 0)
+			state->resumeFromCheckpoint = defGetBoolean(def);
+		else if (strcmp(OAI_TABLE_OPTION_SERVERS, def->defname) == 0)
+			state->servers = GetFederatedServers(state, defGetString(def));
+		else if (strcmp(OAI_TABLE_OPTION_MAX_CONCURRENT_SERVERS, def->defname) == 0)
+		{
+			char *tailpt;
+			char *concurrency_str = defGetString(def);
+			state->maxConcurrentServers = (int)strtol(concurrency_str, &tailpt, 0);
+		}
+	}
+
+	state->federated = state->servers != NIL;
+}
+
+/*
+ * GetFederatedServers
+ * -------------------
+ * Resolves the foreign servers of the table option "servers", which must
+ * all belong to the foreign-data wrapper of the table. The owner of the
+ * table must still have USAGE on each of them, as if the table had been
+ * created on that server: privileges may have been revoked since the
+ * option was set.
+ *
+ * state   : the OAI request state, with the server of the table loaded
+ * servers : comma-separated list of server names
+ *
+ * returns the names of the servers (char *)
+ */
+static List *GetFederatedServers(OAIFdwState *state, const char *servers)
+{
+	List *names;
+	List *result = NIL;
+	ListCell *cell;
+	HeapTuple tp;
+	Oid owner;
+
+	if (!SplitIdentifierString(pstrdup(servers), ',', &names))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+				 errmsg("invalid %s: %s", OAI_TABLE_OPTION_SERVERS, servers)));
+
+	tp = SearchSysCache1(RELOID, ObjectIdGetDatum(state->foreign_table->relid));
+
+	if (!HeapTupleIsValid(tp))
+		elog(ERROR, "cache lookup failed for relation %u", state->foreign_table->relid);
+
+	owner = ((Form_pg_class)GETSTRUCT(tp))->relowner;
+	ReleaseSysCache(tp);
+
+	foreach (cell, names)
+	{
+		ForeignServer *server = GetForeignServerByName((char *)lfirst(cell), false);
+
+		if (server->fdwid != state->foreign_server->fdwid)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+					 errmsg("server \"%s\" in option '%s' is not an %s server",
+							server->servername, OAI_TABLE_OPTION_SERVERS, OAI_FDW_NAME)));
+
+		CheckFederatedServerUsage(server, owner);
+
+		result = lappend(result, server->servername);
 	}
+
+	return result;
+}
+
+/*
+ * CheckFederatedServerUsage
+ * -------------------------
+ * Raises an error unless a role has USAGE on a server listed in the table
+ * option "servers", like CREATE FOREIGN TABLE requires for the server of
+ * the table.
+ *
+ * server : the listed server
+ * roleid : the role setting the option, or the owner of the table
+ */
+static void CheckFederatedServerUsage(ForeignServer *server, Oid roleid)
+{
+	AclResult aclresult;
+
+#if PG_VERSION_NUM >= 160000
+	aclresult = object_aclcheck(ForeignServerRelationId, server->serverid, roleid, ACL_USAGE);
+#else
+	aclresult = pg_foreign_server_aclcheck(server->serverid, roleid, ACL_USAGE);
+#endif
+
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, OBJECT_FOREIGN_SERVER, server->servername);
 }
 
 static void LoadOAIServerInfo(OAIFdwState *state)
@@ -3096,6 +10728,24 @@ static void LoadOAIServerInfo(OAIFdwState *state)
 				char *timeout_str = defGetString(def);
 				state->request_timeout = strtol(timeout_str, &tailpt, 0);
 			}
+			else if (strcmp(OAI_SERVER_OPTION_CACHE_TTL, def->defname) == 0)
+			{
+				char *tailpt;
+				char *ttl_str = defGetString(def);
+				state->cacheTtl = strtol(ttl_str, &tailpt, 0);
+			}
+			else if (strcmp(OAI_SERVER_OPTION_MAX_REQUESTS_PER_SECOND, def->defname) == 0)
+			{
+				char *tailpt;
+				char *rate_str = defGetString(def);
+				state->maxRequestsPerSecond = strtod(rate_str, &tailpt);
+			}
+			else if (strcmp(OAI_SERVER_OPTION_MAX_CONCURRENT_REQUESTS, def->defname) == 0)
+			{
+				char *tailpt;
+				char *concurrency_str = defGetString(def);
+				state->maxConcurrentRequests = (int)strtol(concurrency_str, &tailpt, 0);
+			}
 			else if (strcmp(OAI_SERVER_OPTION_CONNECTRETRY, def->defname) == 0)
 			{
 				char *tailpt;
@@ -3152,6 +10802,7 @@ static void InitSession(OAIFdwState *state, RelOptInfo *baserel)
 static List *SerializePlanData(OAIFdwState *state)
 {
 	List *result = NIL;
+	ListCell *cell;
 
 	elog(DEBUG2, "%s called", __func__);
 
@@ -3163,6 +10814,10 @@ static List *SerializePlanData(OAIFdwState *state)
 	result = lappend(result, IntToConst((int)state->maxretries));
 	result = lappend(result, IntToConst((int)state->connectTimeout));
 	result = lappend(result, IntToConst((int)state->request_timeout));
+	result = lappend(result, IntToConst((int)state->cacheTtl));
+	result = lappend(result, Float8ToConst(state->maxRequestsPerSecond));
+	result = lappend(result, IntToConst(state->maxConcurrentRequests));
+	result = lappend(result, IntToConst((int)state->resumeFromCheckpoint));
 	result = lappend(result, CStringToConst(state->identifier));
 	result = lappend(result, CStringToConst(state->set));
 	result = lappend(result, CStringToConst(state->url));
@@ -3174,6 +10829,15 @@ static List *SerializePlanData(OAIFdwState *state)
 	result = lappend(result, CStringToConst(state->resumptionToken));
 	result = lappend(result, CStringToConst(state->requestVerb));
 	result = lappend(result, OidToConst(state->foreigntableid));
+	result = lappend(result, IntToConst((int)state->federated));
+	result = lappend(result, IntToConst((int)state->pruned));
+	result = lappend(result, IntToConst(state->maxConcurrentServers));
+
+	elog(DEBUG2, "%s: serializing %d servers", __func__, list_length(state->servers));
+	result = lappend(result, IntToConst(list_length(state->servers)));
+
+	foreach (cell, state->servers)
+		result = lappend(result, CStringToConst((char *)lfirst(cell)));
 
 	elog(DEBUG2, "%s: serializing table with %d columns", __func__, state->numcols);
 	for (int i = 0; i < state->numcols; ++i)
@@ -3221,6 +10885,7 @@ static struct OAIFdwState *DeserializePlanData(List *list)
 {
 	struct OAIFdwState *state = (struct OAIFdwState *)palloc0(sizeof(OAIFdwState));
 	ListCell *cell = list_head(list);
+	int nservers;
 
 	elog(DEBUG2, "%s called", __func__);
 
@@ -3249,6 +10914,18 @@ static struct OAIFdwState *DeserializePlanData(List *list)
 	state->request_timeout = (int)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
 	cell = list_next(list, cell);
 
+	state->cacheTtl = (int)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	state->maxRequestsPerSecond = DatumGetFloat8(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	state->maxConcurrentRequests = (int)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	state->resumeFromCheckpoint = (bool)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
 	state->identifier = ConstToCString(lfirst(cell));
 	cell = list_next(list, cell);
 
@@ -3282,6 +10959,25 @@ static struct OAIFdwState *DeserializePlanData(List *list)
 	state->foreigntableid = DatumGetObjectId(((Const *)lfirst(cell))->constvalue);
 	cell = list_next(list, cell);
 
+	state->federated = (bool)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	state->pruned = (bool)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	state->maxConcurrentServers = (int)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	nservers = (int)DatumGetInt32(((Const *)lfirst(cell))->constvalue);
+	cell = list_next(list, cell);
+
+	elog(DEBUG2, "  %s: deserializing %d servers", __func__, nservers);
+	for (int i = 0; i < nservers; ++i)
+	{
+		state->servers = lappend(state->servers, ConstToCString(lfirst(cell)));
+		cell = list_next(list, cell);
+	}
+
 	elog(DEBUG2, "  %s: deserializing table with %d columns", __func__, state->numcols);
 	state->oaiTable = (struct OAIfdwTable *)palloc0(sizeof(struct OAIfdwTable));
 	state->oaiTable->cols = (struct OAIfdwColumn **)palloc0(sizeof(struct OAIfdwColumn *) * state->numcols);
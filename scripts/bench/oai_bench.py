@@ -0,0 +1,361 @@
+#!/usr/bin/env python3
+#
+# End-to-end benchmarks of oai_fdw against the local mock repository of
+# scripts/mock-oai. Run with `make bench` against an installed oai_fdw; the
+# connection is taken from the usual PG* environment variables and the
+# user must be allowed to create databases and read server files (e.g. a
+# superuser).
+#
+# Each combination of page size, record size and sets per record is
+# served by a mock repository of its own, and harvested with:
+#
+#   list_records     : SELECT over all records (ListRecords)
+#   list_identifiers : SELECT over all headers (ListIdentifiers)
+#   get_record       : OAI_Sync with the ListIdentifiers strategy, fetching
+#                      the stale records with concurrent GetRecord requests
+#   harvest_table    : OAI_HarvestTable into a new table
+#
+# The scenario parse measures the record extraction alone: the responses
+# in scripts/bench/fixtures (oai_dc, MARCXML and METS) are parsed by
+# oai_fdw_bench_parse inside the backend, which therefore has to run on
+# this machine, and reported in ns and allocations per record.
+#
+# Every run uses a new backend. Its wall time, records/s, MB/s, peak RSS
+# (VmHWM, Linux only) and - for scans - the per-stage timings of EXPLAIN
+# ANALYZE are written as JSON to --output, so that results of different
+# releases can be compared.
+
+import argparse
+import datetime
+import itertools
+import json
+import os
+import platform
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import time
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+MOCK_SERVER = os.path.join(ROOT, "scripts", "mock-oai", "mock_oai_server.py")
+FIXTURES = os.path.join(ROOT, "scripts", "bench", "fixtures")
+
+# EXPLAIN ANALYZE properties of a Foreign Scan reported per run
+STAGES = {
+    "HTTP Requests": "http_requests",
+    "Bytes Received": "bytes_received",
+    "Bytes Decompressed": "bytes_decompressed",
+    "Peak Page Size": "peak_page_size",
+    "DNS Time": "dns_ms",
+    "Connect Time": "connect_ms",
+    "Time To First Byte": "first_byte_ms",
+    "Transfer Time": "transfer_ms",
+    "XML Parse Time": "parse_ms",
+    "Record Extraction Time": "extract_ms",
+    "Records Seen": "records_seen",
+}
+
+SCENARIOS = ("list_records", "list_identifiers", "get_record", "harvest_table", "parse")
+
+
+class Bench:
+
+    def __init__(self, args):
+        self.args = args
+        self.psql = args.psql or os.path.join(
+            subprocess.check_output([args.pg_config, "--bindir"], text=True).strip(), "psql")
+
+    def run_sql(self, sql, dbname=None, check=True):
+        """Runs a script in a new session, returning its output and the time
+        of the statements between \\timing on and off."""
+        result = subprocess.run([self.psql, "-X", "-q", "-A", "-t", "-v", "ON_ERROR_STOP=1",
+                                 "-d", dbname or self.args.dbname],
+                                input=sql, capture_output=True, text=True)
+
+        if check and result.returncode != 0:
+            raise RuntimeError("psql failed: %s\n%s" % (result.stderr.strip(), sql))
+
+        timings = [float(t) for t in re.findall(r"^Time: ([0-9.]+) ms", result.stdout, re.M)]
+        output = re.sub(r"^Time: .*\n?", "", result.stdout, flags=re.M)
+
+        return output.strip(), sum(timings)
+
+    def setup_database(self):
+        exists, _ = self.run_sql("SELECT 1 FROM pg_database WHERE datname = %s" % quote(self.args.dbname),
+                                 dbname="postgres")
+        if not exists:
+            self.run_sql("CREATE DATABASE %s" % ident(self.args.dbname), dbname="postgres")
+
+        self.run_sql("DROP EXTENSION IF EXISTS oai_fdw CASCADE; CREATE EXTENSION oai_fdw;")
+
+        result = subprocess.run([self.psql, "-X", "-q", "-A", "-t", "-d", self.args.dbname,
+                                 "-c", "SELECT length(pg_read_file('/proc/self/status')) > 0"],
+                                capture_output=True, text=True)
+        self.rss_readable = result.returncode == 0 and result.stdout.strip() == "t"
+
+        if not self.rss_readable:
+            print("peak RSS not available: /proc/self/status cannot be read by the database user", file=sys.stderr)
+
+    def environment(self):
+        version, _ = self.run_sql("SELECT extversion FROM pg_extension WHERE extname = 'oai_fdw'")
+        server, _ = self.run_sql("SHOW server_version")
+
+        try:
+            commit = subprocess.check_output(["git", "-C", ROOT, "describe", "--always", "--dirty"],
+                                             text=True, stderr=subprocess.DEVNULL).strip()
+        except (OSError, subprocess.CalledProcessError):
+            commit = None
+
+        return {
+            "started": datetime.datetime.now(datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ"),
+            "oai_fdw": version,
+            "commit": commit,
+            "postgresql": server,
+            "machine": platform.machine(),
+            "system": platform.platform(),
+            "cpus": os.cpu_count(),
+        }
+
+    def start_mock(self, page_size, record_size, sets):
+        port = free_port()
+        command = [sys.executable, MOCK_SERVER, "serve", "--port", str(port),
+                   "--records", str(self.args.records), "--page-size", str(page_size),
+                   "--record-size", str(record_size), "--sets", str(max(sets, 20)),
+                   "--sets-per-record", str(sets), "--compression", self.args.compression,
+                   "--latency", str(self.args.latency)]
+        process = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+        for _ in range(100):
+            try:
+                socket.create_connection(("127.0.0.1", port), timeout=0.1).close()
+                return process, port
+            except OSError:
+                time.sleep(0.1)
+
+        process.kill()
+        raise RuntimeError("mock repository did not start")
+
+    def create_tables(self, port):
+        self.run_sql("""
+DROP SERVER IF EXISTS oai_bench_server CASCADE;
+CREATE SERVER oai_bench_server FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'http://127.0.0.1:%d/oai', request_timeout '0');
+
+CREATE FOREIGN TABLE oai_bench_records (
+  id text              OPTIONS (oai_node 'identifier'),
+  xmldoc xml           OPTIONS (oai_node 'content'),
+  sets text[]          OPTIONS (oai_node 'setspec'),
+  updatedate timestamp OPTIONS (oai_node 'datestamp'),
+  status boolean       OPTIONS (oai_node 'status')
+) SERVER oai_bench_server OPTIONS (metadataprefix 'oai_dc');
+
+CREATE FOREIGN TABLE oai_bench_identifiers (
+  id text              OPTIONS (oai_node 'identifier'),
+  sets text[]          OPTIONS (oai_node 'setspec'),
+  updatedate timestamp OPTIONS (oai_node 'datestamp'),
+  status boolean       OPTIONS (oai_node 'status')
+) SERVER oai_bench_server OPTIONS (metadataprefix 'oai_dc');
+""" % port)
+
+    def peak_rss(self):
+        # /proc/self is the backend running the query
+        if self.rss_readable:
+            return "SELECT 'peak_rss:' || coalesce(substring(pg_read_file('/proc/self/status') from 'VmHWM:\\s*(\\d+)'), '');\n"
+
+        return "SELECT 'peak_rss:';\n"
+
+    def split_rss(self, output):
+        """Splits the output of a script ending with peak_rss() into the
+        output of the other statements and the peak RSS in kB."""
+        rest, _, rss = output.rpartition("peak_rss:")
+        return rest.strip(), int(rss) if rss.strip().isdigit() else None
+
+    def scan(self, table):
+        sql = "\\timing on\nEXPLAIN (ANALYZE, FORMAT JSON) SELECT * FROM %s;\n\\timing off\n%s" % (
+            table, self.peak_rss())
+        output, ms = self.run_sql(sql)
+        plan_json, rss = self.split_rss(output)
+        node = json.loads(plan_json)[0]["Plan"]
+        stages = {STAGES[k]: v for k, v in node.items() if k in STAGES}
+
+        return {"ms": ms, "records": node.get("Actual Rows"), "bytes": stages.get("bytes_received"),
+                "peak_rss_kb": rss, "stages": stages}
+
+    def get_record(self):
+        stale = min(self.args.getrecord_records, self.args.records)
+        self.run_sql("""
+DROP TABLE IF EXISTS oai_bench_sync;
+CREATE TABLE oai_bench_sync (id text PRIMARY KEY, xmldoc xml, sets text[], updatedate timestamp, status boolean);
+INSERT INTO oai_bench_sync (id, sets, updatedate, status)
+SELECT id, sets, CASE WHEN row_number() OVER (ORDER BY id) <= %d THEN '1900-01-01' ELSE updatedate END, status
+FROM oai_bench_identifiers;
+""" % stale)
+        output, ms = self.run_sql("\\timing on\nSELECT OAI_Sync('oai_bench_records', 'oai_bench_sync', "
+                                  "'ListIdentifiers', %d);\n\\timing off\n%s" % (self.args.concurrency, self.peak_rss()))
+        _, rss = self.split_rss(output)
+        size, _ = self.run_sql("SELECT coalesce(sum(octet_length(xmldoc::text)), 0) FROM oai_bench_sync "
+                               "WHERE updatedate > '1900-01-01' AND id IN (SELECT id FROM oai_bench_sync ORDER BY id LIMIT %d)"
+                               % stale)
+
+        return {"ms": ms, "records": stale, "bytes": int(size),
+                "peak_rss_kb": rss, "stages": {}}
+
+    def harvest_table(self):
+        self.run_sql("DROP TABLE IF EXISTS oai_bench_harvest;")
+        windows = self.args.windows
+        # the mock repository has one record per hour since 2020-01-01
+        hours = (self.args.records + windows - 1) // windows
+        output, ms = self.run_sql("\\timing on\nCALL OAI_HarvestTable('oai_bench_records', 'oai_bench_harvest', "
+                                  "interval '%d hours', '2020-01-01 00:00:00', timestamp '2020-01-01 00:00:00' + interval '%d hours');\n"
+                                  "\\timing off\n%s" % (hours, hours * windows, self.peak_rss()))
+        _, rss = self.split_rss(output)
+        counts, _ = self.run_sql("SELECT count(*) || ',' || coalesce(sum(octet_length(xmldoc::text)), 0) FROM oai_bench_harvest")
+        records, size = counts.split(",")
+
+        return {"ms": ms, "records": int(records), "bytes": int(size),
+                "peak_rss_kb": rss, "stages": {}}
+
+    def parse(self):
+        runs = []
+
+        for fixture in sorted(f for f in os.listdir(FIXTURES) if f.endswith(".xml")):
+            output, _ = self.run_sql("SELECT row_to_json(b) FROM oai_fdw_bench_parse(%s, %d) b;"
+                                     % (quote(os.path.join(FIXTURES, fixture)), self.args.parse_iterations))
+            run = json.loads(output)
+            run.update({"fixture": fixture[:-4], "iterations": self.args.parse_iterations})
+            runs.append(run)
+
+            print("%-10s %7d records %9.0f ns/record (parse %.0f, extract %.0f) %7.1f xml allocations/record %9s palloc bytes/record"
+                  % (run["fixture"], run["records"], run["ns_per_record"], run["parse_ns_per_record"],
+                     run["extract_ns_per_record"], run["xml_allocations_per_record"],
+                     "%.0f" % run["palloc_bytes_per_record"] if run["palloc_bytes_per_record"] is not None else "-"),
+                  flush=True)
+
+        return runs
+
+    def run(self):
+        self.setup_database()
+        results = {"environment": self.environment(), "parameters": vars(self.args), "runs": []}
+        scenarios = [s for s in self.args.scenarios if s != "parse"]
+        matrix = list(itertools.product(self.args.page_sizes, self.args.record_sizes, self.args.sets)) if scenarios else []
+
+        if "parse" in self.args.scenarios:
+            results["parse"] = self.parse()
+
+        for page_size, record_size, sets in matrix:
+            process, port = self.start_mock(page_size, record_size, sets)
+
+            try:
+                self.create_tables(port)
+                # the first harvest renders the pages of the mock repository
+                self.scan("oai_bench_records")
+                self.scan("oai_bench_identifiers")
+
+                for scenario in scenarios:
+                    for repetition in range(self.args.repetitions):
+                        if scenario == "list_records":
+                            run = self.scan("oai_bench_records")
+                        elif scenario == "list_identifiers":
+                            run = self.scan("oai_bench_identifiers")
+                        elif scenario == "get_record":
+                            run = self.get_record()
+                        else:
+                            run = self.harvest_table()
+
+                        seconds = run.pop("ms") / 1000.0
+                        run.update({
+                            "scenario": scenario,
+                            "page_size": page_size,
+                            "record_size": record_size,
+                            "sets_per_record": sets,
+                            "repetition": repetition + 1,
+                            "seconds": round(seconds, 4),
+                            "records_per_second": round(run["records"] / seconds, 1) if seconds > 0 and run["records"] else None,
+                            "mb_per_second": round(run["bytes"] / seconds / 1048576, 3) if seconds > 0 and run["bytes"] else None,
+                        })
+                        results["runs"].append(run)
+                        report(run)
+            finally:
+                process.terminate()
+                process.wait()
+
+        self.run_sql("DROP SERVER IF EXISTS oai_bench_server CASCADE; DROP TABLE IF EXISTS oai_bench_sync, oai_bench_harvest;")
+
+        with open(self.args.output, "w", encoding="utf-8") as f:
+            json.dump(results, f, indent=2)
+            f.write("\n")
+
+        print("\nresults written to %s" % self.args.output)
+
+
+def report(run):
+    if report.header:
+        print("%-17s %6s %7s %5s %10s %10s %9s %11s" % ("scenario", "page", "record", "sets", "seconds",
+                                                         "records/s", "MB/s", "peak RSS kB"))
+        report.header = False
+
+    print("%-17s %6d %7d %5d %10.3f %10s %9s %11s" % (
+        run["scenario"], run["page_size"], run["record_size"], run["sets_per_record"], run["seconds"],
+        run["records_per_second"] or "-", run["mb_per_second"] or "-", run["peak_rss_kb"] or "-"), flush=True)
+
+
+report.header = True
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def quote(value):
+    return "'" + value.replace("'", "''") + "'"
+
+
+def ident(value):
+    return '"' + value.replace('"', '""') + '"'
+
+
+def int_list(value):
+    return [int(v) for v in value.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmarks oai_fdw against a local mock OAI-PMH repository.")
+    parser.add_argument("--dbname", default="oai_fdw_bench", help="database to run in, created if missing (default: %(default)s)")
+    parser.add_argument("--pg-config", default="pg_config", help="pg_config of the installation (default: %(default)s)")
+    parser.add_argument("--psql", help="psql executable (default: the one of --pg-config)")
+    parser.add_argument("--output", default="bench_results.json", help="JSON result file (default: %(default)s)")
+    parser.add_argument("--records", type=int, default=5000, help="records of the repository (default: %(default)s)")
+    parser.add_argument("--page-sizes", type=int_list, default=[100, 1000], help="comma separated (default: 100,1000)")
+    parser.add_argument("--record-sizes", type=int_list, default=[512, 8192], help="comma separated, bytes (default: 512,8192)")
+    parser.add_argument("--sets", type=int_list, default=[1, 10], help="comma separated sets per record (default: 1,10)")
+    parser.add_argument("--scenarios", default=",".join(SCENARIOS), help="comma separated (default: all)")
+    parser.add_argument("--repetitions", type=int, default=3, help="runs of each scenario (default: %(default)s)")
+    parser.add_argument("--getrecord-records", type=int, default=1000,
+                        help="stale records fetched with GetRecord (default: %(default)s)")
+    parser.add_argument("--concurrency", type=int, default=4, help="concurrent GetRecord requests (default: %(default)s)")
+    parser.add_argument("--parse-iterations", type=int, default=200,
+                        help="iterations of oai_fdw_bench_parse per fixture (default: %(default)s)")
+    parser.add_argument("--windows", type=int, default=4, help="time windows of OAI_HarvestTable (default: %(default)s)")
+    parser.add_argument("--compression", choices=("none", "gzip", "deflate"), default="none",
+                        help="content encoding of the mock repository (default: %(default)s)")
+    parser.add_argument("--latency", type=int, default=0, help="ms per response of the mock repository (default: %(default)s)")
+    args = parser.parse_args()
+
+    args.scenarios = [s.strip() for s in args.scenarios.split(",") if s.strip()]
+
+    for scenario in args.scenarios:
+        if scenario not in SCENARIOS:
+            parser.error("unknown scenario '%s', supported are %s" % (scenario, ", ".join(SCENARIOS)))
+
+    if not shutil.which(args.pg_config) and not args.psql:
+        parser.error("pg_config not found, set --pg-config or --psql")
+
+    Bench(args).run()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,528 @@
+#!/usr/bin/env python3
+#
+# Local OAI-PMH 2.0 repository serving a generated corpus, so that oai_fdw
+# can be tested and benchmarked without network access. Only the Python
+# standard library is required.
+#
+#   serve    : answers OAI-PMH requests (default)
+#   generate : writes the corpus to a JSON fixture file, which can be
+#              served later with --corpus
+#
+# The corpus is derived from its parameters and --seed alone, so the same
+# parameters always produce the same records. Network conditions (latency,
+# bandwidth, compression, transient errors and expiring resumptionTokens)
+# are simulated per request. With --granularity day the repository only
+# accepts and reports datestamps of the form YYYY-MM-DD.
+#
+# Example:
+#
+#   $ ./mock_oai_server.py serve --port 8008 --records 5000 --page-size 100
+#   $ curl 'http://localhost:8008/oai?verb=ListRecords&metadataPrefix=oai_dc'
+
+import argparse
+import base64
+import datetime
+import gzip
+import json
+import random
+import sys
+import threading
+import time
+import urllib.parse
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from xml.sax.saxutils import escape
+
+OAI_NAMESPACE = "http://www.openarchives.org/OAI/2.0/"
+OAI_SCHEMA = "http://www.openarchives.org/OAI/2.0/OAI-PMH.xsd"
+OAI_DC_NAMESPACE = "http://www.openarchives.org/OAI/2.0/oai_dc/"
+OAI_DC_SCHEMA = "http://www.openarchives.org/OAI/2.0/oai_dc.xsd"
+DC_NAMESPACE = "http://purl.org/dc/elements/1.1/"
+DATE_FORMAT = "%Y-%m-%dT%H:%M:%SZ"
+CHUNK_SIZE = 16384
+
+WORDS = ("archive", "catalogue", "collection", "digital", "edition", "harvest",
+         "index", "journal", "library", "manuscript", "metadata", "monograph",
+         "periodical", "protocol", "record", "repository", "series", "volume")
+
+
+def format_date(value):
+    return value.strftime(DATE_FORMAT)
+
+
+def parse_date(value, until=False):
+    """Parses an OAI-PMH date with day or seconds granularity. A day given
+    as until covers the whole day."""
+    try:
+        if len(value) == 10:
+            day = datetime.datetime.strptime(value, "%Y-%m-%d")
+            return day + datetime.timedelta(days=1, seconds=-1) if until else day
+        return datetime.datetime.strptime(value, DATE_FORMAT)
+    except ValueError:
+        return None
+
+
+class Corpus:
+    """Records of the repository, ordered by datestamp."""
+
+    def __init__(self, records, sets, earliest):
+        self.records = records
+        self.sets = sets
+        self.earliest = earliest
+        self.by_identifier = {r["identifier"]: r for r in records}
+
+    @classmethod
+    def generate(cls, args):
+        rng = random.Random(args.seed)
+        start = parse_date(args.start_date)
+        sets = [{"spec": "set%d" % i, "name": "Mock set %d" % i} for i in range(args.sets)]
+        records = []
+
+        for i in range(args.records):
+            record_sets = [sets[(i + k) % len(sets)]["spec"]
+                           for k in range(min(args.sets_per_record, len(sets)))]
+            deleted = args.deleted_every > 0 and (i + 1) % args.deleted_every == 0
+            description = []
+            size = 0
+
+            while size < args.record_size:
+                word = rng.choice(WORDS)
+                description.append(word)
+                size += len(word) + 1
+
+            records.append({
+                "identifier": "oai:mock:%08d" % (i + 1),
+                "datestamp": format_date(start + datetime.timedelta(seconds=i * args.interval)),
+                "sets": record_sets,
+                "deleted": deleted,
+                "title": "Mock record %d" % (i + 1),
+                "creator": "Creator %d" % rng.randint(1, 100),
+                "description": " ".join(description),
+            })
+
+        return cls(records, sets, format_date(start))
+
+    @classmethod
+    def load(cls, path):
+        with open(path, encoding="utf-8") as f:
+            data = json.load(f)
+
+        records = sorted(data["records"], key=lambda r: r["datestamp"])
+        earliest = records[0]["datestamp"] if records else data.get("earliest", "2000-01-01T00:00:00Z")
+
+        return cls(records, data["sets"], earliest)
+
+    def save(self, path):
+        with open(path, "w", encoding="utf-8") as f:
+            json.dump({"earliest": self.earliest, "sets": self.sets, "records": self.records}, f, indent=1)
+            f.write("\n")
+
+    def select(self, from_date, until_date, set_spec):
+        result = []
+
+        for record in self.records:
+            datestamp = parse_date(record["datestamp"])
+
+            if from_date and datestamp < from_date:
+                continue
+            if until_date and datestamp > until_date:
+                continue
+            if set_spec and not any(s == set_spec or s.startswith(set_spec + ":") for s in record["sets"]):
+                continue
+
+            result.append(record)
+
+        return result
+
+
+class OAIError(Exception):
+
+    def __init__(self, code, message):
+        super().__init__(message)
+        self.code = code
+        self.message = message
+
+
+class MockOAIServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, corpus, args):
+        super().__init__(address, MockOAIHandler)
+        self.corpus = corpus
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.lock = threading.Lock()
+        self.requests = 0
+        # the corpus does not change, so selections and rendered pages are
+        # kept, sparing their cost in benchmarks once a list was harvested
+        self.selections = {}
+        self.pages = {}
+
+    def should_fail(self):
+        """Decides whether the next request gets a 503 response."""
+        with self.lock:
+            self.requests += 1
+
+            if self.args.error_every > 0 and self.requests % self.args.error_every == 0:
+                return True
+
+            return self.args.error_rate > 0 and self.rng.random() < self.args.error_rate
+
+
+class MockOAIHandler(BaseHTTPRequestHandler):
+    server_version = "MockOAI/1.0"
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        if self.server.args.verbose:
+            sys.stderr.write("%s - %s\n" % (self.address_string(), format % args))
+
+    def do_GET(self):
+        url = urllib.parse.urlsplit(self.path)
+        self.handle_oai(url.path, urllib.parse.parse_qs(url.query, keep_blank_values=True))
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length") or 0)
+        body = self.rfile.read(length).decode("utf-8")
+        self.handle_oai(urllib.parse.urlsplit(self.path).path,
+                        urllib.parse.parse_qs(body, keep_blank_values=True))
+
+    def handle_oai(self, path, params):
+        args = self.server.args
+
+        if path.rstrip("/") != args.path.rstrip("/"):
+            self.send_body(404, b"not found", "text/plain")
+            return
+
+        if args.latency > 0:
+            time.sleep(args.latency / 1000.0)
+
+        if self.server.should_fail():
+            self.send_body(503, b"service temporarily unavailable", "text/plain",
+                           {"Retry-After": str(args.retry_after)})
+            return
+
+        self.send_body(200, self.oai_response(params).encode("utf-8"), "text/xml; charset=utf-8")
+
+    def send_body(self, status, body, content_type, headers=None):
+        encoding = self.choose_encoding()
+
+        if encoding == "gzip":
+            body = gzip.compress(body)
+        elif encoding == "deflate":
+            body = zlib.compress(body)
+
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+
+        if encoding:
+            self.send_header("Content-Encoding", encoding)
+
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+
+        self.end_headers()
+
+        bandwidth = self.server.args.bandwidth
+
+        for offset in range(0, len(body), CHUNK_SIZE):
+            chunk = body[offset:offset + CHUNK_SIZE]
+            self.wfile.write(chunk)
+
+            if bandwidth > 0:
+                time.sleep(len(chunk) / bandwidth)
+
+    def choose_encoding(self):
+        compression = self.server.args.compression
+        accepted = [e.split(";")[0].strip() for e in self.headers.get("Accept-Encoding", "").split(",")]
+
+        if compression == "none":
+            return None
+        if compression == "auto":
+            return next((e for e in ("gzip", "deflate") if e in accepted), None)
+
+        return compression if compression in accepted else None
+
+    def oai_response(self, params):
+        """Builds the OAI-PMH document answering a request."""
+        request = {k: v[0] for k, v in params.items()}
+        verb = request.get("verb", "")
+        attributes = "".join(' %s="%s"' % (k, escape(v, {'"': "&quot;"}))
+                             for k, v in sorted(request.items()))
+
+        try:
+            if any(len(v) > 1 for v in params.values()):
+                raise OAIError("badArgument", "repeated arguments")
+
+            handler = getattr(self, "verb_" + verb, None)
+
+            if not handler:
+                raise OAIError("badVerb", "illegal OAI verb '%s'" % verb)
+
+            content = handler(request)
+        except OAIError as e:
+            if e.code == "badVerb":
+                attributes = ""
+            content = '<error code="%s">%s</error>' % (e.code, escape(e.message))
+
+        return ('<?xml version="1.0" encoding="UTF-8"?>\n'
+                '<OAI-PMH xmlns="%s" xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance" '
+                'xsi:schemaLocation="%s %s">'
+                '<responseDate>%s</responseDate>'
+                '<request%s>%s</request>%s</OAI-PMH>\n') % (
+                    OAI_NAMESPACE, OAI_NAMESPACE, OAI_SCHEMA,
+                    format_date(datetime.datetime.now(datetime.timezone.utc)),
+                    attributes, escape(self.base_url()), content)
+
+    def base_url(self):
+        return "http://%s%s" % (self.headers.get("Host", "localhost"), self.server.args.path)
+
+    def check_arguments(self, request, required=(), optional=()):
+        allowed = set(required) | set(optional) | {"verb"}
+
+        for name in request:
+            if name not in allowed:
+                raise OAIError("badArgument", "illegal argument '%s'" % name)
+
+        for name in required:
+            if not request.get(name):
+                raise OAIError("badArgument", "missing argument '%s'" % name)
+
+    def check_format(self, prefix):
+        if prefix != "oai_dc":
+            raise OAIError("cannotDisseminateFormat", "metadata format '%s' is not supported" % prefix)
+
+    def verb_Identify(self, request):
+        self.check_arguments(request)
+
+        return ('<Identify><repositoryName>oai_fdw mock repository</repositoryName>'
+                '<baseURL>%s</baseURL><protocolVersion>2.0</protocolVersion>'
+                '<adminEmail>mock@localhost</adminEmail>'
+                '<earliestDatestamp>%s</earliestDatestamp>'
+                '<deletedRecord>persistent</deletedRecord>'
+                '<granularity>%s</granularity>'
+                '<compression>gzip</compression><compression>deflate</compression>'
+                '</Identify>') % (escape(self.base_url()), self.datestamp(self.server.corpus.earliest),
+                                  "YYYY-MM-DD" if self.server.args.granularity == "day" else "YYYY-MM-DDThh:mm:ssZ")
+
+    def verb_ListMetadataFormats(self, request):
+        self.check_arguments(request, optional=("identifier",))
+
+        if "identifier" in request and request["identifier"] not in self.server.corpus.by_identifier:
+            raise OAIError("idDoesNotExist", "unknown identifier '%s'" % request["identifier"])
+
+        return ('<ListMetadataFormats><metadataFormat><metadataPrefix>oai_dc</metadataPrefix>'
+                '<schema>%s</schema><metadataNamespace>%s</metadataNamespace>'
+                '</metadataFormat></ListMetadataFormats>') % (OAI_DC_SCHEMA, OAI_DC_NAMESPACE)
+
+    def verb_ListSets(self, request):
+        self.check_arguments(request, optional=("resumptionToken",))
+
+        if "resumptionToken" in request:
+            raise OAIError("badResumptionToken", "the sets are not split into pages")
+
+        sets = self.server.corpus.sets
+
+        if not sets:
+            raise OAIError("noSetHierarchy", "the repository does not support sets")
+
+        return "<ListSets>%s</ListSets>" % "".join(
+            "<set><setSpec>%s</setSpec><setName>%s</setName></set>" % (escape(s["spec"]), escape(s["name"]))
+            for s in sets)
+
+    def verb_GetRecord(self, request):
+        self.check_arguments(request, required=("identifier", "metadataPrefix"))
+        self.check_format(request["metadataPrefix"])
+
+        record = self.server.corpus.by_identifier.get(request["identifier"])
+
+        if not record:
+            raise OAIError("idDoesNotExist", "unknown identifier '%s'" % request["identifier"])
+
+        return "<GetRecord>%s</GetRecord>" % self.record(record)
+
+    def verb_ListIdentifiers(self, request):
+        return self.list_request(request, "ListIdentifiers", self.header)
+
+    def verb_ListRecords(self, request):
+        return self.list_request(request, "ListRecords", self.record)
+
+    def list_request(self, request, verb, render):
+        args = self.server.args
+
+        if "resumptionToken" in request:
+            self.check_arguments(request, required=("resumptionToken",))
+            query = self.decode_token(request["resumptionToken"])
+        else:
+            self.check_arguments(request, required=("metadataPrefix",), optional=("from", "until", "set"))
+            query = {"metadataPrefix": request["metadataPrefix"], "from": request.get("from"),
+                     "until": request.get("until"), "set": request.get("set"), "cursor": 0}
+
+        self.check_format(query["metadataPrefix"])
+
+        from_date = parse_date(query["from"]) if query["from"] else None
+        until_date = parse_date(query["until"], until=True) if query["until"] else None
+
+        if (query["from"] and not from_date) or (query["until"] and not until_date):
+            raise OAIError("badArgument", "invalid date")
+
+        if args.granularity == "day" and any(d and len(d) != 10 for d in (query["from"], query["until"])):
+            raise OAIError("badArgument", "the repository only supports dates with day granularity")
+
+        if query["set"] and not self.server.corpus.sets:
+            raise OAIError("noSetHierarchy", "the repository does not support sets")
+
+        selection = (query["from"], query["until"], query["set"])
+        records = self.server.selections.get(selection)
+
+        if records is None:
+            records = self.server.corpus.select(from_date, until_date, query["set"])
+            self.server.selections[selection] = records
+
+        if not records:
+            raise OAIError("noRecordsMatch", "no records match the request")
+
+        cursor = query["cursor"]
+        page = (verb, query["metadataPrefix"]) + selection + (cursor,)
+        content = self.server.pages.get(page)
+
+        if content is None:
+            content = "".join(render(r) for r in records[cursor:cursor + args.page_size])
+            self.server.pages[page] = content
+
+        if cursor + args.page_size < len(records):
+            query["cursor"] = cursor + args.page_size
+            expiration = ""
+
+            if args.token_ttl > 0:
+                expires = datetime.datetime.now(datetime.timezone.utc) + datetime.timedelta(seconds=args.token_ttl)
+                expiration = ' expirationDate="%s"' % format_date(expires)
+
+            content += '<resumptionToken completeListSize="%d" cursor="%d"%s>%s</resumptionToken>' % (
+                len(records), cursor, expiration, self.encode_token(query))
+        elif cursor > 0:
+            content += '<resumptionToken completeListSize="%d" cursor="%d"/>' % (len(records), cursor)
+
+        return "<%s>%s</%s>" % (verb, content, verb)
+
+    def encode_token(self, query):
+        token = dict(query, issued=time.time())
+        return base64.urlsafe_b64encode(json.dumps(token).encode("utf-8")).decode("ascii")
+
+    def decode_token(self, token):
+        try:
+            query = json.loads(base64.urlsafe_b64decode(token.encode("ascii")))
+        except ValueError:
+            raise OAIError("badResumptionToken", "invalid resumptionToken")
+
+        ttl = self.server.args.token_ttl
+
+        if ttl > 0 and time.time() - query.get("issued", 0) > ttl:
+            raise OAIError("badResumptionToken", "the resumptionToken has expired")
+
+        return query
+
+    def datestamp(self, value):
+        return value[:10] if self.server.args.granularity == "day" else value
+
+    def header(self, record):
+        status = ' status="deleted"' if record["deleted"] else ""
+        sets = "".join("<setSpec>%s</setSpec>" % escape(s) for s in record["sets"])
+
+        return "<header%s><identifier>%s</identifier><datestamp>%s</datestamp>%s</header>" % (
+            status, escape(record["identifier"]), self.datestamp(record["datestamp"]), sets)
+
+    def record(self, record):
+        if record["deleted"]:
+            return "<record>%s</record>" % self.header(record)
+
+        return ('<record>%s<metadata>'
+                '<oai_dc:dc xmlns:oai_dc="%s" xmlns:dc="%s">'
+                '<dc:identifier>%s</dc:identifier><dc:title>%s</dc:title>'
+                '<dc:creator>%s</dc:creator><dc:description>%s</dc:description>'
+                '</oai_dc:dc></metadata></record>') % (
+                    self.header(record), OAI_DC_NAMESPACE, DC_NAMESPACE,
+                    escape(record["identifier"]), escape(record["title"]),
+                    escape(record["creator"]), escape(record["description"]))
+
+
+def corpus_arguments(parser):
+    parser.add_argument("--corpus", help="serve the records of a fixture file written by 'generate'")
+    parser.add_argument("--records", type=int, default=1000, help="number of records (default: %(default)s)")
+    parser.add_argument("--record-size", type=int, default=512,
+                        help="approximate size of the description of each record in bytes (default: %(default)s)")
+    parser.add_argument("--sets", type=int, default=10, help="number of sets (default: %(default)s)")
+    parser.add_argument("--sets-per-record", type=int, default=2,
+                        help="sets each record belongs to (default: %(default)s)")
+    parser.add_argument("--deleted-every", type=int, default=0,
+                        help="every n-th record is deleted, 0 for none (default: %(default)s)")
+    parser.add_argument("--start-date", default="2020-01-01T00:00:00Z",
+                        help="datestamp of the first record (default: %(default)s)")
+    parser.add_argument("--interval", type=int, default=3600,
+                        help="seconds between the datestamps of two records (default: %(default)s)")
+    parser.add_argument("--seed", type=int, default=42, help="seed of the generated content (default: %(default)s)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Local OAI-PMH repository for oai_fdw tests and benchmarks.")
+    commands = parser.add_subparsers(dest="command")
+
+    serve = commands.add_parser("serve", help="answer OAI-PMH requests (default)")
+    corpus_arguments(serve)
+    serve.add_argument("--host", default="127.0.0.1", help="address to listen on (default: %(default)s)")
+    serve.add_argument("--port", type=int, default=8008, help="port to listen on (default: %(default)s)")
+    serve.add_argument("--path", default="/oai", help="path of the OAI-PMH endpoint (default: %(default)s)")
+    serve.add_argument("--page-size", type=int, default=100,
+                       help="records per ListRecords/ListIdentifiers page (default: %(default)s)")
+    serve.add_argument("--latency", type=int, default=0, help="ms to wait before each response (default: %(default)s)")
+    serve.add_argument("--bandwidth", type=int, default=0,
+                       help="bytes per second each response is sent with, 0 for unlimited (default: %(default)s)")
+    serve.add_argument("--compression", choices=("auto", "none", "gzip", "deflate"), default="auto",
+                       help="content encoding, if accepted by the client (default: %(default)s)")
+    serve.add_argument("--error-every", type=int, default=0,
+                       help="every n-th request fails with 503, 0 for none (default: %(default)s)")
+    serve.add_argument("--error-rate", type=float, default=0,
+                       help="fraction of requests failing with 503 (default: %(default)s)")
+    serve.add_argument("--retry-after", type=int, default=1,
+                       help="Retry-After of the 503 responses in seconds (default: %(default)s)")
+    serve.add_argument("--token-ttl", type=int, default=0,
+                       help="seconds a resumptionToken is valid, 0 for no expiration (default: %(default)s)")
+    serve.add_argument("--granularity", choices=("seconds", "day"), default="seconds",
+                       help="datestamp granularity of the repository (default: %(default)s)")
+    serve.add_argument("--verbose", action="store_true", help="log each request to stderr")
+
+    generate = commands.add_parser("generate", help="write the corpus to a fixture file")
+    corpus_arguments(generate)
+    generate.add_argument("--output", required=True, help="fixture file to write")
+
+    argv = sys.argv[1:]
+
+    if not argv or argv[0] not in ("serve", "generate", "-h", "--help"):
+        argv = ["serve"] + argv
+
+    args = parser.parse_args(argv)
+
+    if args.command == "serve" and args.page_size < 1:
+        parser.error("--page-size must be positive")
+
+    corpus = Corpus.load(args.corpus) if args.corpus else Corpus.generate(args)
+
+    if args.command == "generate":
+        corpus.save(args.output)
+        print("%d records written to %s" % (len(corpus.records), args.output))
+        return
+
+    server = MockOAIServer((args.host, args.port), corpus, args)
+    print("serving %d records on http://%s:%d%s" % (len(corpus.records), args.host, args.port, args.path), flush=True)
+
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+
+
+if __name__ == "__main__":
+    main()
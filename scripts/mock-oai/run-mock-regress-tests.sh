@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Runs regression tests against the local mock OAI-PMH repository, so that
+# they do not depend on the network. The corpus must match the one the
+# expected output of sql/mock_server.sql was written for. A second
+# instance serving the same corpus with day granularity listens on
+# MOCK_DAY_PORT.
+#
+# REGRESS : tests to run (default: create-extension mock_server)
+# PGUSER  : user running the tests (default: postgres)
+
+CODEPATH="$(cd "$(dirname "$0")/../.." && pwd)"
+MOCK_PORT=${MOCK_PORT:-8008}
+MOCK_DAY_PORT=${MOCK_DAY_PORT:-8009}
+REGRESS=${REGRESS:-"create-extension mock_server"}
+
+echo -e "\n== Starting mock OAI-PMH repositories on ports $MOCK_PORT and $MOCK_DAY_PORT ==\n"
+
+MOCK_ARGS="--records 250 --page-size 50 --sets 5 --sets-per-record 2 --deleted-every 10 --record-size 256"
+
+python3 "$CODEPATH/scripts/mock-oai/mock_oai_server.py" serve --port $MOCK_PORT $MOCK_ARGS &
+MOCK_PID=$!
+python3 "$CODEPATH/scripts/mock-oai/mock_oai_server.py" serve --port $MOCK_DAY_PORT $MOCK_ARGS --granularity day &
+MOCK_DAY_PID=$!
+trap "kill $MOCK_PID $MOCK_DAY_PID 2>/dev/null" EXIT
+
+for port in $MOCK_PORT $MOCK_DAY_PORT; do
+  for i in $(seq 1 50); do
+    curl -s -o /dev/null "http://localhost:$port/oai?verb=Identify" && break
+    sleep 0.1
+  done
+done
+
+make -C "$CODEPATH" PGUSER=${PGUSER:-postgres} installcheck REGRESS="$REGRESS"
@@ -160,6 +160,33 @@ OPTIONS (url 'https://services.dnb.de/oai/repository',
          metadataprefix 'oai_dc',
          request_timeout 'foo');         
 
+-- Negative cache_ttl
+CREATE SERVER oai_server_err25 FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'https://services.dnb.de/oai/repository',
+         metadataprefix 'oai_dc',
+         cache_ttl '-1');
+
+-- Invalid cache_ttl
+CREATE SERVER oai_server_err26 FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'https://services.dnb.de/oai/repository',
+         metadataprefix 'oai_dc',
+         cache_ttl '1h');
+
+-- Clearing the cache of a non-existing server
+SELECT oai_fdw_clear_cache('oai_server_err26');
+
+-- Invalid max_requests_per_second
+CREATE SERVER oai_server_err27 FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'https://services.dnb.de/oai/repository',
+         metadataprefix 'oai_dc',
+         max_requests_per_second '0');
+
+-- Invalid max_concurrent_requests
+CREATE SERVER oai_server_err28 FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'https://services.dnb.de/oai/repository',
+         metadataprefix 'oai_dc',
+         max_concurrent_requests '2.5');
+
 
 SELECT * FROM OAI_Identify('oai_server_err21');
 
@@ -273,6 +300,15 @@ SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc');
 
 SELECT * FROM oai_table_err10 LIMIT 1;
 
+-- Invalid resume_from_checkpoint
+CREATE FOREIGN TABLE oai_table_err11 (
+  id text             OPTIONS (oai_node 'identifier')
+) 
+SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc', resume_from_checkpoint 'foo');
+
+-- Clearing the checkpoints of a table that has none
+SELECT oai_fdw_clear_checkpoints('oai_table_err10');
+
 -- OAI_ListMetadataFormats: Wrong FOREIGN SERVER
 SELECT * FROM OAI_ListMetadataFormats('foo');
 
@@ -313,6 +349,75 @@ INSERT INTO ulb_ulbmsuo_oai_dc (status) VALUES (false);
 -- DELETE query
 DELETE FROM ulb_ulbmsuo_oai_dc;
 
+-- OAI_Sync from a table that is not a foreign table
+SELECT OAI_Sync('pg_class', 'pg_class');
+
+-- OAI_Sync into a foreign table
+SELECT OAI_Sync('ulb_ulbmsuo_oai_dc', 'ulb_ulbmsuo_oai_dc');
+
+-- OAI_Sync with an unknown strategy
+SELECT OAI_Sync('ulb_ulbmsuo_oai_dc', 'ulb_ulbmsuo_oai_dc', 'GetRecord');
+
+-- OAI_Sync without concurrent requests
+SELECT OAI_Sync('ulb_ulbmsuo_oai_dc', 'ulb_ulbmsuo_oai_dc', 'ListIdentifiers', 0);
+
+-- OAI_Sync with an unknown deleted_mode
+SELECT OAI_Sync('ulb_ulbmsuo_oai_dc', 'ulb_ulbmsuo_oai_dc', deleted_mode => 'purge');
+
+-- Invalid list of servers
+CREATE FOREIGN TABLE oai_table_err17 (
+  id text             OPTIONS (oai_node 'identifier')
+) 
+SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc', servers 'oai_server_ulb,,oai_server_dnb');
+
+-- Server listed twice
+CREATE FOREIGN TABLE oai_table_err17 (
+  id text             OPTIONS (oai_node 'identifier')
+) 
+SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc', servers 'oai_server_ulb, oai_server_ulb');
+
+-- Invalid max_concurrent_servers
+CREATE FOREIGN TABLE oai_table_err17 (
+  id text             OPTIONS (oai_node 'identifier')
+) 
+SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc', servers 'oai_server_ulb,oai_server_dnb', max_concurrent_servers '0');
+
+-- Checkpoints of a federated scan
+CREATE FOREIGN TABLE oai_table_err17 (
+  id text             OPTIONS (oai_node 'identifier')
+) 
+SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc', servers 'oai_server_ulb,oai_server_dnb', resume_from_checkpoint 'true');
+
+-- Federated scan of a server that does not exist
+CREATE FOREIGN TABLE oai_table_err17 (
+  id text             OPTIONS (oai_node 'identifier'),
+  src text            OPTIONS (oai_node 'server')
+) 
+SERVER oai_server_ulb OPTIONS (metadataPrefix 'oai_dc', servers 'oai_server_ulb,oai_server_foo');
+
+SELECT * FROM oai_table_err17 LIMIT 1;
+
+-- OAI_Sync harvests a single server
+ALTER FOREIGN TABLE oai_table_err17 OPTIONS (SET servers 'oai_server_ulb,oai_server_dnb');
+SELECT OAI_Sync('oai_table_err17', 'ulb_ulbmsuo_oai_dc');
+
+DROP FOREIGN TABLE oai_table_err17;
+
+-- server statistics without shared_preload_libraries
+SELECT server_name, requests FROM oai_fdw_stat_servers;
+
+-- progress is kept in shared memory as well
+SELECT pid, foreign_table FROM oai_fdw_progress;
+
+-- windows_done is mandatory
+SELECT oai_fdw_progress_update(NULL, NULL);
+
+-- benchmark of a response file that does not exist
+SELECT * FROM oai_fdw_bench_parse('/nonexistent/oai_dc.xml');
+
+-- benchmark without iterations
+SELECT * FROM oai_fdw_bench_parse('/nonexistent/oai_dc.xml', 0);
+
 -- empty user name
 CREATE USER MAPPING FOR postgres SERVER oai_server_ulb OPTIONS (user '', password 'foo');
 
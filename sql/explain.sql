@@ -22,4 +22,28 @@ WHERE
   datestamp BETWEEN '2022-03-01' AND '2022-03-02' AND
   setspec <@ ARRAY['dnb:reiheC'];
 
+CREATE SERVER oai_server_dnb2 FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'https://services.dnb.de/oai/repository');
+
+CREATE FOREIGN TABLE dnb_federated (
+  id text             OPTIONS (oai_node 'identifier'),
+  src text            OPTIONS (oai_node 'server')
+ ) SERVER oai_server_dnb OPTIONS (metadataprefix 'oai_dc',
+                                  servers 'oai_server_dnb, oai_server_dnb2');
+
+EXPLAIN
+SELECT * FROM dnb_federated;
+
+EXPLAIN
+SELECT * FROM dnb_federated WHERE src = 'oai_server_dnb2';
+
+EXPLAIN
+SELECT * FROM dnb_federated WHERE src IN ('oai_server_dnb', 'oai_server_foo');
+
+EXPLAIN
+SELECT * FROM dnb_federated WHERE src = 'oai_server_foo';
+
+DROP FOREIGN TABLE dnb_federated;
+DROP SERVER oai_server_dnb2;
+
 DROP SERVER oai_server_dnb CASCADE;
\ No newline at end of file
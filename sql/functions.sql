@@ -23,6 +23,7 @@ WHERE setname IS NOT NULL AND setspec IS NOT NULL
 ORDER BY setname  COLLATE "C"
 FETCH FIRST ROW ONLY;
 
+-- ListSets response is reused from the metadata cache
 SELECT count(*) > 0 
 FROM OAI_ListSets('oai_server_dnb') 
 WHERE setname IS NOT NULL AND setspec IS NOT NULL;
@@ -19,6 +19,15 @@ SELECT count(*) FROM clone_dnb_oai_dc;
 CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true);
 SELECT count(*) FROM clone_dnb_oai_dc;
 
+-- Existing table upserted by two background workers
+CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true,2);
+SELECT count(*) FROM clone_dnb_oai_dc;
+
+-- Only records whose content hash changed are updated
+UPDATE clone_dnb_oai_dc SET oai_content_hash = NULL WHERE updatedate < '2020-01-02 00:00:00';
+CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true);
+SELECT count(*) FROM clone_dnb_oai_dc WHERE oai_content_hash IS NULL;
+
 CREATE SCHEMA oai_schema;
 /* Target table with specific schema */
 CALL OAI_HarvestTable('dnb_oai_dc','oai_schema.clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true);
@@ -56,6 +65,18 @@ CALL OAI_HarvestTable('foo','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00
 /* EXCEPTION: end date smaller than start date */
 CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2019-12-31 00:00:00',true,true);
 
+/* EXCEPTION: negative number of parallel workers */
+CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true,-1);
+
+/* EXCEPTION: adaptive pages without records */
+CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true,0,0);
+
+/* EXCEPTION: unknown deleted_mode */
+CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true,0,NULL,interval '1 hour',interval '1 year','purge');
+
+/* EXCEPTION: deleted_mode without status column */
+CALL OAI_HarvestTable('dnb_oai_dc','clone_dnb_oai_dc', interval '1 day', '2020-01-01 00:00:00', '2020-01-03 00:00:00',true,true,0,NULL,interval '1 hour',interval '1 year','delete');
+
 /* EXCEPTION: Foreign table without datestamp */
 CREATE FOREIGN TABLE IF NOT EXISTS table_without_datestamp (
   id text                OPTIONS (oai_node 'identifier'), 
@@ -0,0 +1,320 @@
+-- Offline tests against the mock repository of scripts/mock-oai, started
+-- with the corpus below by scripts/mock-oai/run-mock-regress-tests.sh:
+-- 250 records, one per hour since 2020-01-01, in pages of 50 records,
+-- each record in 2 of 5 sets and every 10th record deleted.
+CREATE SERVER oai_server_mock FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'http://localhost:8008/oai');
+
+CREATE FOREIGN TABLE mock_oai_dc (
+  id text                OPTIONS (oai_node 'identifier'),
+  xmldoc xml             OPTIONS (oai_node 'content'),
+  sets text[]            OPTIONS (oai_node 'setspec'),
+  updatedate timestamp   OPTIONS (oai_node 'datestamp'),
+  format text            OPTIONS (oai_node 'metadataprefix'),
+  status boolean         OPTIONS (oai_node 'status')
+ ) SERVER oai_server_mock OPTIONS (metadataprefix 'oai_dc');
+
+SELECT * FROM OAI_ListSets('oai_server_mock') ORDER BY setspec;
+
+-- all pages of the result set
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_oai_dc;
+
+-- time window (from and until)
+SELECT count(*) FROM mock_oai_dc
+WHERE updatedate >= '2020-01-02 00:00:00' AND updatedate < '2020-01-03 00:00:00';
+
+-- set membership
+SELECT count(*) FROM mock_oai_dc WHERE 'set3' = ANY (sets);
+
+-- single record (GetRecord)
+SELECT id, sets, format, status,
+       (xpath('//dc:title/text()', xmldoc, ARRAY[ARRAY['dc','http://purl.org/dc/elements/1.1/']]))[1]::text AS title
+FROM mock_oai_dc WHERE id = 'oai:mock:00000042';
+
+-- harvest in windows of 5 days, each split into 3 pages
+CALL OAI_HarvestTable('mock_oai_dc','mock_clone', interval '5 days', '2020-01-01 00:00:00', '2020-01-11 00:00:00');
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_clone;
+
+-- nothing changed in the repository
+CALL OAI_HarvestTable('mock_oai_dc','mock_clone', interval '5 days', '2020-01-01 00:00:00', '2020-01-11 00:00:00');
+
+DROP TABLE mock_clone;
+
+-- parallel harvest by a role without LOGIN, switched to with SET ROLE
+CREATE ROLE regress_oai_nologin NOLOGIN;
+GRANT SELECT ON mock_oai_dc TO regress_oai_nologin;
+GRANT CREATE ON SCHEMA public TO regress_oai_nologin;
+
+SET ROLE regress_oai_nologin;
+CALL OAI_HarvestTable('mock_oai_dc','mock_parallel', interval '1 day', '2020-01-01 00:00:00', '2020-01-11 00:00:00',
+                      parallel_workers => 2);
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_parallel;
+
+CALL OAI_HarvestTable('mock_oai_dc','mock_parallel', interval '1 day', '2020-01-01 00:00:00', '2020-01-11 00:00:00',
+                      parallel_workers => 2);
+RESET ROLE;
+
+DROP TABLE mock_parallel;
+DROP OWNED BY regress_oai_nologin;
+DROP ROLE regress_oai_nologin;
+
+-- adaptive pages: the probe shrinks a page announced with 24 records ...
+CALL OAI_HarvestTable('mock_oai_dc','mock_adaptive', interval '1 day', '2020-01-09 06:30:00', '2020-01-10 06:30:00',
+                      exec_verbose => true, target_records => 12);
+
+-- ... and pages with fewer records than the target grow, at most fourfold
+CALL OAI_HarvestTable('mock_oai_dc','mock_adaptive', interval '2 hours', '2020-01-10 06:30:00', '2020-01-11 06:30:00',
+                      exec_verbose => true, target_records => 12);
+SELECT count(*) FROM mock_adaptive;
+DROP TABLE mock_adaptive;
+
+-- deleted records: 2 of the 24 records of the first day
+CALL OAI_HarvestTable('mock_oai_dc','mock_deleted', interval '1 day', '2020-01-01 00:00:00', '2020-01-02 00:00:00',
+                      exec_verbose => true);
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_deleted;
+
+-- as if these records were deleted after the last harvest
+UPDATE mock_deleted SET status = false WHERE status;
+CALL OAI_HarvestTable('mock_oai_dc','mock_deleted', interval '1 day', '2020-01-01 00:00:00', '2020-01-02 00:00:00',
+                      exec_verbose => true, deleted_mode => 'mark');
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_deleted;
+
+CALL OAI_HarvestTable('mock_oai_dc','mock_deleted', interval '1 day', '2020-01-01 00:00:00', '2020-01-02 00:00:00',
+                      exec_verbose => true, deleted_mode => 'delete');
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_deleted;
+DROP TABLE mock_deleted;
+
+-- checkpoints: a scan failing on the third page ...
+CREATE FOREIGN TABLE mock_checkpoint (
+  id text                OPTIONS (oai_node 'identifier'),
+  status boolean         OPTIONS (oai_node 'status')
+ ) SERVER oai_server_mock OPTIONS (metadataprefix 'oai_dc', resume_from_checkpoint 'true');
+
+SELECT count(*) FROM mock_checkpoint WHERE 1 / (right(id, 8)::int - 120) IS NOT NULL;
+
+-- ... is resumed from the pages retrieved so far
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_checkpoint;
+
+-- the checkpoint of a completed scan is removed
+SELECT oai_fdw_clear_checkpoints('mock_checkpoint');
+
+-- checkpoints are kept per role: the one of another role is not resumed
+CREATE ROLE regress_oai_checkpoint;
+GRANT SELECT ON mock_checkpoint TO regress_oai_checkpoint;
+SET ROLE regress_oai_checkpoint;
+SELECT count(*) FROM mock_checkpoint WHERE 1 / (right(id, 8)::int - 120) IS NOT NULL;
+RESET ROLE;
+
+-- a second scan of the same request in a query runs without checkpoint
+SELECT count(*) FROM mock_checkpoint a JOIN mock_checkpoint b USING (id);
+SELECT oai_fdw_clear_checkpoints('mock_checkpoint');
+
+DROP FOREIGN TABLE mock_checkpoint;
+DROP ROLE regress_oai_checkpoint;
+
+-- EXPLAIN ANALYZE counters of a scan of 5 pages; timings vary and are
+-- only checked for presence
+CREATE FUNCTION mock_explain(query text) RETURNS jsonb LANGUAGE plpgsql AS $$
+DECLARE
+  plan json;
+BEGIN
+  EXECUTE 'EXPLAIN (ANALYZE, FORMAT JSON) ' || query INTO plan;
+  RETURN (plan -> 0 -> 'Plan')::jsonb;
+END; $$;
+
+WITH p AS (SELECT mock_explain('SELECT * FROM mock_oai_dc') AS plan)
+SELECT plan ->> 'requestVerb' AS verb,
+       (plan ->> 'HTTP Requests')::int AS requests,
+       (plan ->> 'HTTP Retries')::int AS retries,
+       (plan ->> 'Records Seen')::int AS records,
+       (plan ->> 'Deleted Records Seen')::int AS deleted,
+       (plan ->> 'Bytes Received')::bigint > 0 AS received
+FROM p;
+
+WITH p AS (SELECT mock_explain('SELECT * FROM mock_oai_dc') AS plan)
+SELECT k AS missing
+FROM p, unnest(ARRAY['Backoff Time', 'Bytes Decompressed', 'Peak Page Size', 'DNS Time',
+                     'Connect Time', 'Time To First Byte', 'Transfer Time', 'XML Parse Time',
+                     'Record Extraction Time']) AS k
+WHERE jsonb_typeof(plan -> k) IS DISTINCT FROM 'number';
+
+DROP FUNCTION mock_explain(text);
+
+-- the response cache is not shared by roles mapping the same remote user
+-- with different passwords: 5 pages cached for each of them
+CREATE SERVER oai_server_mock_cache FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'http://localhost:8008/oai', cache_ttl '600');
+
+CREATE FOREIGN TABLE mock_cached (
+  id text                OPTIONS (oai_node 'identifier')
+ ) SERVER oai_server_mock_cache OPTIONS (metadataprefix 'oai_dc');
+
+CREATE ROLE regress_oai_cache_a;
+CREATE ROLE regress_oai_cache_b;
+GRANT SELECT ON mock_cached TO regress_oai_cache_a, regress_oai_cache_b;
+CREATE USER MAPPING FOR regress_oai_cache_a SERVER oai_server_mock_cache
+OPTIONS (user 'harvester', password 'secret');
+CREATE USER MAPPING FOR regress_oai_cache_b SERVER oai_server_mock_cache
+OPTIONS (user 'harvester', password 'guessed');
+
+SET ROLE regress_oai_cache_a;
+SELECT count(*) FROM mock_cached;
+SET ROLE regress_oai_cache_b;
+SELECT count(*) FROM mock_cached;
+-- served from the cache
+SET ROLE regress_oai_cache_a;
+SELECT count(*) FROM mock_cached;
+RESET ROLE;
+
+SELECT oai_fdw_clear_cache('oai_server_mock_cache');
+
+DROP FOREIGN TABLE mock_cached;
+DROP USER MAPPING FOR regress_oai_cache_a SERVER oai_server_mock_cache;
+DROP USER MAPPING FOR regress_oai_cache_b SERVER oai_server_mock_cache;
+DROP SERVER oai_server_mock_cache;
+DROP ROLE regress_oai_cache_a;
+DROP ROLE regress_oai_cache_b;
+
+-- federated scan of two servers, both on the mock repository
+CREATE SERVER oai_server_mock2 FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'http://localhost:8008/oai');
+
+CREATE FOREIGN TABLE mock_federated (
+  id text                OPTIONS (oai_node 'identifier'),
+  src text               OPTIONS (oai_node 'server'),
+  status boolean         OPTIONS (oai_node 'status')
+ ) SERVER oai_server_mock OPTIONS (metadataprefix 'oai_dc',
+                                   servers 'oai_server_mock,oai_server_mock2');
+
+SELECT src, count(*), count(*) FILTER (WHERE status) AS deleted
+FROM mock_federated GROUP BY src ORDER BY src;
+
+-- one server at a time
+ALTER FOREIGN TABLE mock_federated OPTIONS (ADD max_concurrent_servers '1');
+SELECT count(*), count(DISTINCT id) FROM mock_federated;
+
+-- only the second server is requested
+SELECT src, count(*) FROM mock_federated WHERE src = 'oai_server_mock2' GROUP BY src;
+
+-- the owner of a federated table needs USAGE on every listed server ...
+CREATE ROLE regress_oai_federator;
+GRANT USAGE ON FOREIGN SERVER oai_server_mock TO regress_oai_federator;
+GRANT CREATE ON SCHEMA public TO regress_oai_federator;
+SET ROLE regress_oai_federator;
+CREATE FOREIGN TABLE mock_federated_owned (
+  id text                OPTIONS (oai_node 'identifier')
+ ) SERVER oai_server_mock OPTIONS (metadataprefix 'oai_dc',
+                                   servers 'oai_server_mock,oai_server_mock2');
+RESET ROLE;
+
+-- ... also when the table is scanned
+GRANT USAGE ON FOREIGN SERVER oai_server_mock2 TO regress_oai_federator;
+SET ROLE regress_oai_federator;
+CREATE FOREIGN TABLE mock_federated_owned (
+  id text                OPTIONS (oai_node 'identifier')
+ ) SERVER oai_server_mock OPTIONS (metadataprefix 'oai_dc',
+                                   servers 'oai_server_mock,oai_server_mock2');
+RESET ROLE;
+REVOKE USAGE ON FOREIGN SERVER oai_server_mock2 FROM regress_oai_federator;
+SELECT count(*) FROM mock_federated_owned;
+DROP OWNED BY regress_oai_federator;
+DROP ROLE regress_oai_federator;
+
+DROP FOREIGN TABLE mock_federated;
+DROP SERVER oai_server_mock2;
+
+-- OAI_Sync by a role that does not own the extension
+CREATE TABLE mock_sync (id text PRIMARY KEY, xmldoc xml, updatedate timestamp, status boolean);
+CREATE ROLE regress_oai_harvester;
+GRANT SELECT ON mock_oai_dc TO regress_oai_harvester;
+GRANT SELECT, INSERT, UPDATE ON mock_sync TO regress_oai_harvester;
+
+SET ROLE regress_oai_harvester;
+SELECT OAI_Sync('mock_oai_dc', 'mock_sync');
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_sync;
+
+-- nothing changed since the watermark
+SELECT OAI_Sync('mock_oai_dc', 'mock_sync');
+
+-- the bookkeeping table stays inaccessible
+SELECT * FROM oai_fdw_sync_state;
+RESET ROLE;
+
+SELECT target_table, foreign_table, records FROM oai_fdw_sync_state;
+
+-- scheduled harvests (the scheduler itself is not loaded in the tests)
+\set VERBOSITY terse
+INSERT INTO oai_fdw_harvest_jobs (foreign_table, target_table, run_interval, job_owner)
+VALUES ('mock_oai_dc', 'mock_sync', interval '1 day', 'regress_oai_harvester');
+INSERT INTO oai_fdw_harvest_jobs (foreign_table, target_table, run_interval)
+VALUES ('mock_oai_dc', 'mock_sync', interval '1 hour');
+INSERT INTO oai_fdw_harvest_jobs (foreign_table, target_table, run_interval)
+VALUES ('mock_oai_dc', 'mock_oai_dc', interval '0');
+INSERT INTO oai_fdw_harvest_jobs (foreign_table, target_table, run_interval, strategy)
+VALUES ('mock_oai_dc', 'mock_oai_dc', interval '1 hour', 'GetRecord');
+INSERT INTO oai_fdw_harvest_jobs (foreign_table, target_table, run_interval, deleted_mode)
+VALUES ('mock_oai_dc', 'mock_oai_dc', interval '1 hour', 'purge');
+\set VERBOSITY default
+
+SELECT foreign_table, target_table, run_interval, strategy, enabled, job_owner, failures,
+       next_run <= now() AS due
+FROM oai_fdw_harvest_jobs;
+
+INSERT INTO oai_fdw_harvest_runs (job_id, started, finished, duration, records)
+SELECT job_id, '2020-01-01 00:00:00+00', '2020-01-01 00:00:05+00', interval '5 seconds', 250
+FROM oai_fdw_harvest_jobs;
+
+SET ROLE regress_oai_harvester;
+SELECT count(*) FROM oai_fdw_harvest_runs;
+RESET ROLE;
+
+-- the history goes with the job
+DELETE FROM oai_fdw_harvest_jobs;
+SELECT count(*) FROM oai_fdw_harvest_runs;
+
+-- retries of failed jobs double from one minute up to run_interval
+SELECT failures, oai_fdw_harvest_backoff(failures, interval '1 day') AS backoff
+FROM unnest(ARRAY[1, 2, 3, 8, 11, 12]) AS failures;
+
+-- ... and are capped at 2^16 minutes
+SELECT oai_fdw_harvest_backoff(100, interval '1 year');
+
+
+-- strategy ListIdentifiers: only the records missing in the target or
+-- with another datestamp are retrieved, with GetRecord
+DELETE FROM mock_sync WHERE id IN ('oai:mock:00000001', 'oai:mock:00000002');
+UPDATE mock_sync SET updatedate = '2000-01-01 00:00:00' WHERE id = 'oai:mock:00000003';
+SELECT OAI_Sync('mock_oai_dc', 'mock_sync', 'ListIdentifiers', concurrency => 2);
+SELECT id, updatedate, xmldoc IS NOT NULL AS content FROM mock_sync
+WHERE id IN ('oai:mock:00000001', 'oai:mock:00000002', 'oai:mock:00000003') ORDER BY id;
+
+-- deleted_mode: a sync from scratch, as if the deleted records had been
+-- deleted after the last one, flags their rows ...
+DELETE FROM oai_fdw_sync_state WHERE target_table = 'mock_sync'::regclass;
+UPDATE mock_sync SET status = false WHERE status;
+SELECT OAI_Sync('mock_oai_dc', 'mock_sync', deleted_mode => 'mark');
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_sync;
+
+-- ... or removes them, also with ListIdentifiers
+SELECT OAI_Sync('mock_oai_dc', 'mock_sync', 'ListIdentifiers', deleted_mode => 'delete');
+SELECT count(*), count(*) FILTER (WHERE status) AS deleted FROM mock_sync;
+
+DROP TABLE mock_sync;
+DROP OWNED BY regress_oai_harvester;
+DROP ROLE regress_oai_harvester;
+
+-- repositories with day granularity: the probed window is widened to
+-- whole days, 2020-01-02 to 2020-01-05
+CREATE SERVER oai_server_mock_day FOREIGN DATA WRAPPER oai_fdw
+OPTIONS (url 'http://localhost:8009/oai');
+
+CREATE FOREIGN TABLE mock_day_oai_dc (
+  id text                OPTIONS (oai_node 'identifier'),
+  updatedate timestamp   OPTIONS (oai_node 'datestamp')
+ ) SERVER oai_server_mock_day OPTIONS (metadataprefix 'oai_dc');
+
+SELECT oai_fdw_complete_list_size('mock_day_oai_dc', '2020-01-02 12:00:00', '2020-01-05 12:00:00');
+
+DROP SERVER oai_server_mock_day CASCADE;
+
+DROP SERVER oai_server_mock CASCADE;
@@ -69,6 +69,8 @@ SET enable_hashjoin = off;
 SET enable_mergejoin = off;
 SET enable_material = off;
 
+-- Correlated subquery: rescans replay the records of the first pass
+-- instead of issuing the same OAI request again.
 SELECT v.s,
        (SELECT count(*)
         FROM dnb_zdb_oai_dc_nocontent o